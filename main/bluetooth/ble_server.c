@@ -7,6 +7,7 @@
 #include "esp_bt_main.h"
 #include "esp_gatt_common_api.h"
 #include "device_config.h"
+#include "power_mgmt.h"
 #include <string.h>
 
 static const char *TAG = "BLE_SERVER";
@@ -164,6 +165,7 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
             
             conn_id = param->connect.conn_id;
             is_connected = true;
+            power_mgmt_activity_notify();
             
             esp_ble_conn_update_params_t conn_params = {0};
             memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
@@ -1,5 +1,6 @@
 #include "gatt_srv.h"
 #include "device_config.h"
+#include "power_mgmt.h"
 #include "esp_log.h"
 #include "esp_gatt_common_api.h"
 #include <string.h>
@@ -142,6 +143,9 @@ void gatt_server_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_i
             
         case ESP_GATTS_WRITE_EVT:
             if (!param->write.is_prep) {
+                // The phone using us keeps the device out of sleep
+                power_mgmt_activity_notify();
+                
                 ESP_LOGI(TAG, "GATT_WRITE_EVT, handle = %d, value len = %d, value :", 
                          param->write.handle, param->write.len);
                 
@@ -15,6 +15,10 @@
 #define LORA_PREAMBLE_LENGTH    8          // symbols
 #define LORA_SYNC_WORD          0x12       // Private network
 
+// Duty cycle (enforced only inside regulated sub-bands, e.g. EU868)
+#define DUTY_CYCLE_WINDOW_MS    3600000    // Averaging window (1 hour)
+#define DUTY_CYCLE_LOW_PRIO_RESERVE_PCT 25 // Budget kept back from forwards/beacons
+
 // LoRa Pin Configuration (ESP32-S3)
 #define LORA_SCK_PIN            18
 #define LORA_MISO_PIN           19
@@ -23,13 +27,93 @@
 #define LORA_RST_PIN            14
 #define LORA_DIO0_PIN           27
 #define LORA_DIO1_PIN           26
+#define LORA_SPI_CLOCK_HZ       10000000   // SX127x rated SPI clock (10 MHz)
+#define LORA_SPI_QUEUE_SIZE     8          // In-flight transactions for batched writes
+#define LORA_RX_RING_DEPTH      8          // Received frames buffered for the mesh layer
+
+// Listen before talk (CAD + binary exponential backoff)
+#define LORA_LBT_ENABLED        1
+#define LORA_LBT_CW_MIN         4          // Initial contention window (slots)
+#define LORA_LBT_CW_MAX         64
+#define LORA_LBT_MAX_ATTEMPTS   6
 
 // Mesh Network Configuration
 #define MAX_HOP_COUNT           10
-#define MESH_BEACON_INTERVAL    30000      // ms
+#define BEACON_IMIN_MS          2000       // Trickle interval right after a topology change
+#define BEACON_IMAX_DOUBLINGS   5          // Up to 64 s between beacons while nothing changes
+#define BEACON_IMAX_MS          (BEACON_IMIN_MS << BEACON_IMAX_DOUBLINGS)
+#define BEACON_REDUNDANCY       2          // Matching beacons heard that make ours redundant
+#define BEACON_MAX_ROUTES       8          // Route summaries piggybacked per beacon
 #define MESSAGE_TIMEOUT         300000     // 5 minutes
-#define MAX_ROUTES              50
-#define MAX_MESSAGES            100
+#define MAX_ROUTES              512        // Hash table slots, power of two
+#define DEDUP_GENERATION_SLOTS  1024       // Seen-set slots per generation, power of two
+#define DEDUP_WINDOW_MS         MESSAGE_TIMEOUT  // Max age of a generation
+#define MAX_NEIGHBORS           32
+#define LINK_TIMEOUT_MS         (3 * BEACON_IMAX_MS)
+#define ADR_SNR_MARGIN_DB       10.0f      // Headroom above the demodulation floor
+#define ADR_BASE_LISTEN_PERIOD_MS 20000    // A node listening faster than base drops back...
+#define ADR_BASE_LISTEN_MS      5000       // ...for this long, so newcomers can be heard
+
+// On-demand routing (AODV)
+#define AODV_PENDING_MAX        8          // Locally originated messages awaiting a route
+#define AODV_DISCOVERY_TIMEOUT_MS 5000     // First RREQ wait, doubled per retry
+#define AODV_RREQ_RETRIES       2
+
+// Managed flooding of broadcasts
+#define FLOOD_PENDING_MAX       16         // Relays waiting for their backoff to expire
+#define FLOOD_DELAY_MIN_MS      100
+#define FLOOD_DELAY_MAX_MS      2000       // Backoff for the strongest (closest) links
+#define FLOOD_SNR_LOW_DB        (-15.0f)   // SNR mapped to the shortest backoff
+#define FLOOD_SNR_HIGH_DB       10.0f      // SNR mapped to the longest backoff
+#define FLOOD_SUPPRESS_COUNT    2          // Overheard relays that cancel ours
+
+// End-to-end delivery (ACK tracking and retransmission)
+#define DELIVERY_MAX_PENDING    8          // Unacknowledged unicast messages tracked
+#define DELIVERY_MAX_RETRIES    4
+#define DELIVERY_HOP_TIMEOUT_MS 3000       // ACK wait per hop of the route
+#define DELIVERY_BACKOFF_MAX_MS 120000
+
+// Transmit scheduler: frames held per priority class
+#define TX_DEPTH_CONTROL        8          // ACKs and route control
+#define TX_DEPTH_EMERGENCY      4
+#define TX_DEPTH_LOCAL          6          // Text originated here
+#define TX_DEPTH_RELAY          8          // Forwarded and flooded traffic
+#define TX_DEPTH_BEACON         1          // A newer beacon replaces a queued one
+#define TX_AGING_MS             10000      // Head-of-queue wait that promotes a class one level
+
+// Frame aggregation: small messages for the same next hop share one packet
+#define AGG_ENABLED             1
+#define AGG_WINDOW_MS           150        // Max wait for companions before sending alone
+#define AGG_MAX_RECORDS         8
+
+// Compress text payloads on air (receivers always accept both forms)
+#define WIRE_COMPRESS_TEXT      1
+
+// Fragmentation of payloads larger than one frame
+#define FRAG_MAX_PAYLOAD        16384      // Largest payload accepted for sending or reassembly
+#define FRAG_TX_SLOTS           2          // Outgoing transfers in progress
+#define FRAG_RX_SLOTS           2          // Reassemblies in progress
+#define FRAG_NACK_INTERVAL_MS   5000       // Receiver silence before re-requesting missing fragments
+#define FRAG_MAX_NACKS          5
+#define FRAG_TIMEOUT_MS         60000      // Transfer abandoned after this long without progress
+
+// Message history: append-only log on its own flash partition (partitions.csv)
+#define MSG_LOG_PARTITION_LABEL "msglog"
+#define MSG_LOG_TAIL_INDEX      64         // Newest records located without scanning flash
+#define MSG_LOG_CONVERSATIONS   16         // Peers (and broadcast) with indexed history
+#define MSG_LOG_RETAIN_PER_PEER 1000       // Newest messages kept as history per conversation
+#define MSG_LOG_RETAIN_AGE_S    (30 * 24 * 3600)  // Powered-on time history is kept, 0 for no limit
+#define MSG_LOG_QUOTA_KB        0          // Space history may take, 0 for the whole partition
+#define MSG_LOG_PINNED_MAX      16         // Emergency messages kept past every limit
+#define MSG_LOG_FREE_SECTORS    4          // Kept erased ahead so appends never wait for an erase
+#define MSG_LOG_COMPACT_SLICE_US 2000      // Compaction per slice; one step (an erase) may overrun it
+#define MSG_LOG_COMPACT_PAUSE_MS 20        // Between slices while compaction is due
+#define MSG_LOG_RETENTION_CHECK_MS 60000   // Between checks whether the oldest sector has expired
+#define PERSIST_BATCH_MAX       8          // Pending messages that trigger a group commit
+#define PERSIST_FLUSH_MS        2000       // Longest a received message waits in RAM (loss window)
+
+// Shared message buffers (radio RX, TX scheduler, relays, retransmissions)
+#define MSG_POOL_SIZE           40         // At most 255
 
 // Bluetooth Configuration
 #define BLE_DEVICE_NAME         "MeshChat"
@@ -40,6 +124,8 @@
 // Power Management
 #define BATTERY_LOW_VOLTAGE     3200       // mV
 #define SLEEP_TIMEOUT           300000     // 5 minutes of inactivity
+#define POWER_MIN_SLEEP_MS      20         // Shorter gaps to the next timer stay awake
+#define POWER_MAX_SLEEP_MS      30000
 #define DEEP_SLEEP_TIME         3600       // 1 hour deep sleep
 
 // Message Types
@@ -50,7 +136,10 @@ typedef enum {
     MSG_TYPE_ROUTE_REPLY = 0x04,
     MSG_TYPE_ROUTE_ERROR = 0x05,
     MSG_TYPE_BEACON = 0x06,
-    MSG_TYPE_BROADCAST = 0x07
+    MSG_TYPE_BROADCAST = 0x07,
+    MSG_TYPE_EMERGENCY = 0x08,             // Text sent ahead of all other traffic
+    MSG_TYPE_FRAGMENT = 0x09,              // Piece of a payload larger than one frame
+    MSG_TYPE_FRAGMENT_NACK = 0x0A          // Receiver's bitmap of fragments it holds
 } message_type_t;
 
 // Message Structure
@@ -63,7 +152,7 @@ typedef struct {
     uint8_t hop_count;             // TTL for mesh routing
     uint8_t payload_length;        // Actual payload length
     uint8_t payload[256];          // Message content
-    uint16_t checksum;             // CRC16 error detection
+    uint16_t checksum;             // CRC-16/CCITT of header and used payload, hop_count excluded
 } __attribute__((packed)) mesh_message_t;
 
 // Route Table Entry
@@ -71,6 +160,7 @@ typedef struct {
     uint8_t destination[8];        // Destination device ID
     uint8_t next_hop[8];          // Next hop device ID
     uint8_t hop_count;            // Number of hops to destination
+    uint32_t seq_num;             // Destination sequence number (0 = unknown)
     uint64_t timestamp;           // Last updated
     bool active;                  // Route is active
 } route_entry_t;
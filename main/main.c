@@ -20,9 +20,38 @@
 #include "ble_server.h"
 #include "power_mgmt.h"
 #include "nvs_storage.h"
+#include "persist.h"
+#include "timer_wheel.h"
+#include "text_codec.h"
 
 static const char *TAG = "MESHCHAT_MAIN";
 
+// Report the outcome of our unicast messages to the connected phone
+static void on_delivery_status(uint32_t message_id, mesh_delivery_state_t state,
+                               uint8_t attempts, uint32_t latency_ms)
+{
+    char json[128];
+    snprintf(json, sizeof(json),
+             "{\"type\":\"%s\",\"message_id\":%lu,\"attempts\":%u,\"latency_ms\":%lu}",
+             state == MESH_DELIVERY_ACKED ? "ack" : "delivery_failed",
+             message_id, attempts, latency_ms);
+    ble_server_send_message(json);
+}
+
+// Keep received text; the flash write happens later in the persist task
+static void on_mesh_message(const mesh_message_t *message)
+{
+    if (message->message_type == MSG_TYPE_TEXT || message->message_type == MSG_TYPE_EMERGENCY) {
+        persist_message(message);
+    }
+}
+
+// Nothing buffered may be lost to sleep or a dying battery
+static void on_power_sleep(void)
+{
+    persist_flush();
+}
+
 void app_main(void)
 {
     esp_err_t ret;
@@ -37,11 +66,19 @@ void app_main(void)
 
     ESP_LOGI(TAG, "MeshChat Device Starting...");
 
+    // Shared timers for the mesh, power management and BLE
+    timer_wheel_init();
+
+    // Text compression tables, shared by the radio and the message log
+    text_codec_init();
+
     // Initialize power management
     power_mgmt_init();
 
-    // Initialize NVS storage for messages
+    // Initialize NVS storage and the message log, with write-behind for received messages
     nvs_storage_init();
+    persist_init();
+    power_mgmt_set_sleep_hook(on_power_sleep);
 
     // Initialize LoRa radio
     if (lora_init() != ESP_OK) {
@@ -51,6 +88,8 @@ void app_main(void)
 
     // Initialize mesh networking
     mesh_init();
+    mesh_set_delivery_callback(on_delivery_status);
+    mesh_set_message_callback(on_mesh_message);
 
     // Initialize Bluetooth LE
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
@@ -7,18 +7,26 @@
 #include "esp_adc_cal.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include <sys/time.h>
+#include "timer_wheel.h"
+#include "lora.h"
 
 static const char *TAG = "POWER_MGMT";
 
 static esp_adc_cal_characteristics_t *adc_chars;
-static uint64_t last_activity_time = 0;
+static wheel_timer_t idle_timer;        // Runs out after SLEEP_TIMEOUT without activity
+static volatile bool idle = false;
+static power_mgmt_hook_t sleep_hook = NULL;
 static bool power_mgmt_initialized = false;
 
 // ADC configuration for battery monitoring
 #define DEFAULT_VREF    1100        // Use adc2_vref_to_gpio() to obtain a better estimate
 #define NO_OF_SAMPLES   64          // Multisampling
 
+static void power_mgmt_idle(void *arg)
+{
+    idle = true;
+}
+
 esp_err_t power_mgmt_init(void)
 {
     esp_err_t ret;
@@ -52,10 +60,9 @@ esp_err_t power_mgmt_init(void)
         ESP_LOGI(TAG, "Using Default Vref for ADC calibration");
     }
     
-    // Set initial activity time
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    last_activity_time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    // Start the inactivity timer
+    timer_wheel_setup(&idle_timer, power_mgmt_idle, NULL);
+    power_mgmt_activity_notify();
     
     power_mgmt_initialized = true;
     ESP_LOGI(TAG, "Power management initialized");
@@ -69,19 +76,24 @@ esp_err_t power_mgmt_update(void)
         return ESP_ERR_INVALID_STATE;
     }
     
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    uint64_t current_time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
-    
-    // Check if we should enter sleep mode due to inactivity
-    if ((current_time - last_activity_time) > (SLEEP_TIMEOUT * 1000)) {
-        ESP_LOGI(TAG, "Entering light sleep due to inactivity");
-        power_mgmt_sleep(30000);  // Sleep for 30 seconds
+    // Once idle, sleep until the next timer anyone registered is due
+    if (idle) {
+        uint32_t sleep_ms = timer_wheel_next_ms();
+        if (sleep_ms > POWER_MAX_SLEEP_MS) {
+            sleep_ms = POWER_MAX_SLEEP_MS;
+        }
+        if (sleep_ms >= POWER_MIN_SLEEP_MS) {
+            power_mgmt_sleep(sleep_ms);
+        }
     }
     
     // Check battery level
     if (power_mgmt_is_battery_low()) {
         ESP_LOGW(TAG, "Battery low! Consider deep sleep or charging");
+        // Buffered data goes out while there is still power to write it
+        if (sleep_hook) {
+            sleep_hook();
+        }
         // Could implement automatic deep sleep here
     }
     
@@ -90,17 +102,24 @@ esp_err_t power_mgmt_update(void)
 
 esp_err_t power_mgmt_sleep(uint32_t duration_ms)
 {
-    ESP_LOGI(TAG, "Entering light sleep for %lu ms", duration_ms);
+    ESP_LOGD(TAG, "Entering light sleep for %lu ms", duration_ms);
     
-    // Configure wake-up sources
+    if (sleep_hook) {
+        sleep_hook();
+    }
+    
+    // Configure wake-up sources; the radio keeps listening and wakes us per frame
     esp_sleep_enable_timer_wakeup(duration_ms * 1000);  // Convert to microseconds
+    lora_arm_wakeup();
     
     // Enter light sleep
     esp_err_t ret = esp_light_sleep_start();
+    lora_disarm_wakeup();
     
     if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "Woke up from light sleep");
-        power_mgmt_activity_notify();  // Reset activity timer
+        // A wake-up is not activity by itself; received frames count as
+        // activity once the mesh handles them
+        ESP_LOGD(TAG, "Woke up from light sleep");
     } else {
         ESP_LOGE(TAG, "Light sleep failed: %s", esp_err_to_name(ret));
     }
@@ -112,6 +131,10 @@ esp_err_t power_mgmt_deep_sleep(uint32_t duration_ms)
 {
     ESP_LOGI(TAG, "Entering deep sleep for %lu ms", duration_ms);
     
+    if (sleep_hook) {
+        sleep_hook();
+    }
+    
     // Configure wake-up sources
     esp_sleep_enable_timer_wakeup(duration_ms * 1000);  // Convert to microseconds
     
@@ -167,7 +190,11 @@ bool power_mgmt_is_battery_low(void)
 
 void power_mgmt_activity_notify(void)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    last_activity_time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    idle = false;
+    timer_wheel_start(&idle_timer, SLEEP_TIMEOUT);
+}
+
+void power_mgmt_set_sleep_hook(power_mgmt_hook_t hook)
+{
+    sleep_hook = hook;
 }
@@ -13,4 +13,9 @@ uint8_t power_mgmt_get_battery_percentage(void);
 bool power_mgmt_is_battery_low(void);
 void power_mgmt_activity_notify(void);
 
+// Runs before every sleep and while the battery is low, so buffered data
+// can be written out first
+typedef void (*power_mgmt_hook_t)(void);
+void power_mgmt_set_sleep_hook(power_mgmt_hook_t hook);
+
 #endif // POWER_MGMT_H
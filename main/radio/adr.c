@@ -0,0 +1,137 @@
+#include "adr.h"
+#include "link_quality.h"
+#include "device_config.h"
+#include <math.h>
+
+// Candidate profiles, fastest first, with the demodulation SNR floor each
+// needs (SX127x datasheet, 125 kHz reference bandwidth)
+typedef struct {
+    uint8_t spreading_factor;
+    uint32_t bandwidth_hz;
+    float min_snr;
+} adr_profile_t;
+
+static const adr_profile_t profiles[] = {
+    { 7,  250000, -7.5f },
+    { 7,  125000, -7.5f },
+    { 8,  125000, -10.0f },
+    { 9,  125000, -12.5f },
+    { 10, 125000, -15.0f },
+    { 11, 125000, -17.5f },
+    { 12, 125000, -20.0f },
+};
+
+#define NUM_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+static lora_modem_params_t profile_params[NUM_PROFILES];
+static uint8_t base_profile;
+
+void adr_init(void)
+{
+    base_profile = NUM_PROFILES - 1;
+    for (uint8_t i = 0; i < NUM_PROFILES; i++) {
+        profile_params[i].spreading_factor = profiles[i].spreading_factor;
+        profile_params[i].bandwidth_hz = profiles[i].bandwidth_hz;
+        profile_params[i].coding_rate = LORA_CODING_RATE;
+        profile_params[i].preamble_length = LORA_PREAMBLE_LENGTH;
+        if (profiles[i].spreading_factor == LORA_SPREADING_FACTOR &&
+            profiles[i].bandwidth_hz == LORA_BANDWIDTH) {
+            base_profile = i;
+        }
+    }
+}
+
+// Network-wide default: beacons from unknown nodes and fallback traffic
+uint8_t adr_base_profile(void)
+{
+    return base_profile;
+}
+
+const lora_modem_params_t *adr_profile_params(uint8_t profile)
+{
+    if (profile >= NUM_PROFILES) {
+        profile = base_profile;
+    }
+    return &profile_params[profile];
+}
+
+// SNR measured in a wider channel carries proportionally more noise
+float adr_normalize_snr(float snr, uint32_t bandwidth_hz)
+{
+    return snr + 10.0f * log10f((float)bandwidth_hz / 125000.0f);
+}
+
+// Fastest profile the link sustains with ADR_SNR_MARGIN_DB to spare, never
+// slower than the base profile
+uint8_t adr_link_profile(float snr)
+{
+    for (uint8_t i = 0; i < base_profile; i++) {
+        float floor = profiles[i].min_snr + 10.0f * log10f((float)profiles[i].bandwidth_hz / 125000.0f);
+        if (snr >= floor + ADR_SNR_MARGIN_DB) {
+            return i;
+        }
+    }
+    return base_profile;
+}
+
+// Listen on the fastest profile every current neighbor can still reach us on
+uint8_t adr_select_rx_profile(void)
+{
+    size_t count;
+    const link_entry_t *links = link_quality_entries(&count);
+    uint8_t selected = 0;
+    bool any = false;
+
+    for (size_t i = 0; i < count; i++) {
+        if (links[i].active) {
+            uint8_t profile = adr_link_profile(links[i].snr);
+            if (profile > selected) {
+                selected = profile;
+            }
+            any = true;
+        }
+    }
+    return any ? selected : base_profile;
+}
+
+// What a neighbor listens on right now: the profile it announced, except
+// during the base-listen window that opens each period it announced
+static uint8_t adr_listen_profile(const link_entry_t *link, uint32_t now_ms)
+{
+    if (link->rx_profile >= NUM_PROFILES) {
+        return base_profile;
+    }
+    if (link->base_listens && (now_ms - link->base_period_ms) % ADR_BASE_LISTEN_PERIOD_MS < ADR_BASE_LISTEN_MS) {
+        return base_profile;
+    }
+    return link->rx_profile;
+}
+
+uint8_t adr_tx_profile(const uint8_t *recipient_id, uint32_t now_ms)
+{
+    const link_entry_t *link = link_quality_find(recipient_id);
+    if (link && link->rx_profile < NUM_PROFILES) {
+        return adr_listen_profile(link, now_ms);
+    }
+    return adr_broadcast_profile(now_ms);
+}
+
+// Slowest profile any neighbor listens on, so a broadcast reaches all of them
+uint8_t adr_broadcast_profile(uint32_t now_ms)
+{
+    size_t count;
+    const link_entry_t *links = link_quality_entries(&count);
+    uint8_t selected = 0;
+    bool any = false;
+
+    for (size_t i = 0; i < count; i++) {
+        if (links[i].active) {
+            uint8_t profile = adr_listen_profile(&links[i], now_ms);
+            if (profile > selected) {
+                selected = profile;
+            }
+            any = true;
+        }
+    }
+    return any ? selected : base_profile;
+}
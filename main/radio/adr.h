@@ -0,0 +1,17 @@
+#ifndef ADR_H
+#define ADR_H
+
+#include <stdint.h>
+#include "airtime.h"
+
+// Adaptive data rate: profiles are indexed fastest (0) to slowest
+void adr_init(void);
+uint8_t adr_base_profile(void);
+const lora_modem_params_t *adr_profile_params(uint8_t profile);
+float adr_normalize_snr(float snr, uint32_t bandwidth_hz);
+uint8_t adr_link_profile(float snr);
+uint8_t adr_select_rx_profile(void);
+uint8_t adr_tx_profile(const uint8_t *recipient_id, uint32_t now_ms);
+uint8_t adr_broadcast_profile(uint32_t now_ms);
+
+#endif // ADR_H
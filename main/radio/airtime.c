@@ -0,0 +1,29 @@
+#include "airtime.h"
+
+uint32_t airtime_symbol_us(const lora_modem_params_t *params)
+{
+    return (uint32_t)(((uint64_t)1000000 << params->spreading_factor) / params->bandwidth_hz);
+}
+
+// Semtech SX127x datasheet, section 4.1.1.7 (explicit header, CRC on)
+uint32_t airtime_us(const lora_modem_params_t *params, size_t payload_length)
+{
+    const int32_t sf = params->spreading_factor;
+    const int32_t cr = params->coding_rate - 4;
+    const uint32_t t_sym = airtime_symbol_us(params);
+
+    // Low data rate optimization is mandated above 16 ms symbols
+    const int32_t de = (t_sym > 16000) ? 1 : 0;
+
+    // Preamble lasts (n_preamble + 4.25) symbols
+    uint32_t t_preamble = (params->preamble_length + 4) * t_sym + t_sym / 4;
+
+    int32_t num = 8 * (int32_t)payload_length - 4 * sf + 28 + 16;
+    int32_t den = 4 * (sf - 2 * de);
+    int32_t payload_symbols = 8;
+    if (num > 0) {
+        payload_symbols += ((num + den - 1) / den) * (cr + 4);
+    }
+
+    return t_preamble + (uint32_t)payload_symbols * t_sym;
+}
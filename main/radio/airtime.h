@@ -0,0 +1,19 @@
+#ifndef AIRTIME_H
+#define AIRTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Modem settings that determine how long a packet occupies the channel
+typedef struct {
+    uint8_t spreading_factor;       // 6-12
+    uint32_t bandwidth_hz;          // e.g. 125000
+    uint8_t coding_rate;            // Denominator of 4/x, 5-8
+    uint16_t preamble_length;       // Symbols
+} lora_modem_params_t;
+
+// Time on air in microseconds for an explicit-header packet with CRC
+uint32_t airtime_us(const lora_modem_params_t *params, size_t payload_length);
+uint32_t airtime_symbol_us(const lora_modem_params_t *params);
+
+#endif // AIRTIME_H
@@ -0,0 +1,382 @@
+#include "aodv.h"
+#include "mesh.h"
+#include "link_quality.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "AODV";
+
+// Control payloads, little endian on air
+typedef struct {
+    uint8_t destination[8];
+    uint32_t dest_seq;              // Last known, 0 if unknown
+    uint32_t orig_seq;
+    uint8_t hops;                   // Hops travelled so far
+} __attribute__((packed)) aodv_rreq_t;
+
+typedef struct {
+    uint8_t destination[8];         // Node the route leads to
+    uint32_t dest_seq;
+    uint8_t hops;                   // Hops from the replier to destination, plus hops travelled
+} __attribute__((packed)) aodv_rrep_t;
+
+typedef struct {
+    uint8_t destination[8];
+    uint32_t dest_seq;
+} __attribute__((packed)) aodv_rerr_entry_t;
+
+#define AODV_RERR_MAX_ENTRIES ((sizeof(((mesh_message_t *)0)->payload) - 1) / sizeof(aodv_rerr_entry_t))
+
+// Discovery in progress for one destination
+typedef struct {
+    uint8_t destination[8];
+    uint32_t deadline_ms;
+    uint8_t retries;
+    bool active;
+} aodv_discovery_t;
+
+static uint8_t self_id[8];
+static uint32_t own_seq = 0;
+static msg_handle_t pending[AODV_PENDING_MAX];   // MSG_HANDLE_NONE when free
+static aodv_discovery_t discoveries[AODV_PENDING_MAX];
+
+static uint32_t aodv_now_ms(void)
+{
+    return pdTICKS_TO_MS(xTaskGetTickCount());
+}
+
+static void aodv_queue(mesh_message_t *message)
+{
+    message->checksum = mesh_calculate_checksum(message);
+    if (mesh_queue_message(message) != ESP_OK) {
+        ESP_LOGW(TAG, "TX queue full, control message dropped");
+    }
+}
+
+// Pass a control message on with its updated payload, copying it only once
+static void aodv_forward(const mesh_message_t *message, const void *payload, size_t length)
+{
+    msg_handle_t handle = msg_pool_store(message);
+    if (handle == MSG_HANDLE_NONE) {
+        return;
+    }
+
+    mesh_message_t *forward = msg_pool_get(handle);
+    forward->hop_count--;
+    memcpy(forward->payload, payload, length);
+    forward->checksum = mesh_calculate_checksum(forward);
+    if (mesh_queue_handle(handle) != ESP_OK) {
+        ESP_LOGW(TAG, "TX queue full, control message dropped");
+    }
+}
+
+// Install or refresh a route if it is fresher, or as fresh and shorter
+static void aodv_update_route(const uint8_t *destination, const uint8_t *next_hop, uint8_t hops, uint32_t seq)
+{
+    route_entry_t *route = mesh_find_route(destination);
+    if (route && seq != 0 && route->seq_num != 0) {
+        int32_t age = (int32_t)(seq - route->seq_num);
+        if (age < 0 || (age == 0 && route->hop_count <= hops)) {
+            return;
+        }
+    }
+
+    mesh_add_route(destination, next_hop, hops);
+    route = mesh_find_route(destination);
+    if (route && seq != 0) {
+        route->seq_num = seq;
+    }
+}
+
+static void aodv_send_rreq(const uint8_t *destination)
+{
+    mesh_message_t rreq;
+    uint8_t broadcast_id[8];
+    memset(broadcast_id, 0xFF, 8);
+    mesh_prepare_message(&rreq, MSG_TYPE_ROUTE_REQUEST, broadcast_id, MAX_HOP_COUNT);
+
+    aodv_rreq_t req = {0};
+    memcpy(req.destination, destination, 8);
+    route_entry_t *stale = mesh_find_route(destination);
+    req.dest_seq = stale ? stale->seq_num : 0;
+    req.orig_seq = ++own_seq;
+    req.hops = 0;
+
+    memcpy(rreq.payload, &req, sizeof(req));
+    rreq.payload_length = sizeof(req);
+    aodv_queue(&rreq);
+    ESP_LOGD(TAG, "Route request sent");
+}
+
+static void aodv_send_rerr(const aodv_rerr_entry_t *entries, uint8_t count, uint8_t hop_count)
+{
+    mesh_message_t rerr;
+    uint8_t broadcast_id[8];
+    memset(broadcast_id, 0xFF, 8);
+    mesh_prepare_message(&rerr, MSG_TYPE_ROUTE_ERROR, broadcast_id, hop_count);
+
+    rerr.payload[0] = count;
+    memcpy(&rerr.payload[1], entries, count * sizeof(aodv_rerr_entry_t));
+    rerr.payload_length = 1 + count * sizeof(aodv_rerr_entry_t);
+    aodv_queue(&rerr);
+    ESP_LOGD(TAG, "Route error sent for %d destinations", count);
+}
+
+// Drop a broken route and tell upstream nodes that use us to reach it
+static void aodv_route_broken(const uint8_t *destination)
+{
+    aodv_rerr_entry_t entry;
+    memcpy(entry.destination, destination, 8);
+
+    route_entry_t *route = mesh_find_route(destination);
+    entry.dest_seq = route ? route->seq_num + 1 : 0;
+    mesh_remove_route(destination);
+
+    aodv_send_rerr(&entry, 1, MAX_HOP_COUNT);
+}
+
+static aodv_discovery_t *aodv_find_discovery(const uint8_t *destination)
+{
+    for (int i = 0; i < AODV_PENDING_MAX; i++) {
+        if (discoveries[i].active && memcmp(discoveries[i].destination, destination, 8) == 0) {
+            return &discoveries[i];
+        }
+    }
+    return NULL;
+}
+
+static void aodv_start_discovery(const uint8_t *destination)
+{
+    if (aodv_find_discovery(destination)) {
+        return;  // Already searching
+    }
+
+    for (int i = 0; i < AODV_PENDING_MAX; i++) {
+        if (!discoveries[i].active) {
+            memcpy(discoveries[i].destination, destination, 8);
+            discoveries[i].retries = 0;
+            discoveries[i].deadline_ms = aodv_now_ms() + AODV_DISCOVERY_TIMEOUT_MS;
+            discoveries[i].active = true;
+            aodv_send_rreq(destination);
+            return;
+        }
+    }
+}
+
+// Requeue or drop everything buffered for a destination
+static void aodv_release_pending(const uint8_t *destination, bool route_found)
+{
+    for (int i = 0; i < AODV_PENDING_MAX; i++) {
+        if (pending[i] == MSG_HANDLE_NONE) {
+            continue;
+        }
+        const mesh_message_t *message = msg_pool_get(pending[i]);
+        if (memcmp(message->recipient_id, destination, 8) == 0) {
+            if (route_found) {
+                mesh_queue_handle(pending[i]);
+            } else {
+                ESP_LOGW(TAG, "No route found, message %lu dropped", message->id);
+                msg_pool_release(pending[i]);
+            }
+            pending[i] = MSG_HANDLE_NONE;
+        }
+    }
+
+    aodv_discovery_t *discovery = aodv_find_discovery(destination);
+    if (discovery) {
+        discovery->active = false;
+    }
+}
+
+void aodv_init(void)
+{
+    mesh_get_device_id(self_id);
+    own_seq = 0;
+    memset(pending, 0, sizeof(pending));
+    memset(discoveries, 0, sizeof(discoveries));
+}
+
+aodv_route_status_t aodv_resolve(msg_handle_t handle, uint8_t *next_hop)
+{
+    const mesh_message_t *message = msg_pool_get(handle);
+    route_entry_t *route = mesh_find_route(message->recipient_id);
+
+    // A next hop we no longer hear from means the link broke
+    if (route && link_quality_find(route->next_hop) == NULL) {
+        ESP_LOGD(TAG, "Next hop lost, invalidating route");
+        aodv_route_broken(message->recipient_id);
+        route = NULL;
+    }
+
+    if (route) {
+        memcpy(next_hop, route->next_hop, 8);
+        return AODV_ROUTE_FOUND;
+    }
+
+    // Relays cannot buffer on behalf of others; the source rediscovers
+    if (memcmp(message->sender_id, self_id, 8) != 0) {
+        aodv_rerr_entry_t entry = {0};
+        memcpy(entry.destination, message->recipient_id, 8);
+        aodv_send_rerr(&entry, 1, MAX_HOP_COUNT);
+        return AODV_ROUTE_UNREACHABLE;
+    }
+
+    for (int i = 0; i < AODV_PENDING_MAX; i++) {
+        if (pending[i] == MSG_HANDLE_NONE) {
+            msg_pool_ref(handle);
+            pending[i] = handle;
+            aodv_start_discovery(message->recipient_id);
+            return AODV_ROUTE_PENDING;
+        }
+    }
+
+    ESP_LOGW(TAG, "Discovery buffer full, message %lu dropped", message->id);
+    return AODV_ROUTE_UNREACHABLE;
+}
+
+static void aodv_handle_rreq(const mesh_message_t *message, const uint8_t *transmitter_id)
+{
+    if (message->payload_length < sizeof(aodv_rreq_t) || memcmp(message->sender_id, self_id, 8) == 0) {
+        return;
+    }
+
+    aodv_rreq_t req;
+    memcpy(&req, message->payload, sizeof(req));
+    req.hops++;
+
+    // Reverse path towards the originator
+    aodv_update_route(message->sender_id, transmitter_id, req.hops, req.orig_seq);
+
+    mesh_message_t rrep;
+    aodv_rrep_t rep;
+    if (memcmp(req.destination, self_id, 8) == 0) {
+        // We are the destination: answer with a fresh sequence number
+        if ((int32_t)(req.dest_seq - own_seq) > 0) {
+            own_seq = req.dest_seq;
+        }
+        own_seq++;
+        memcpy(rep.destination, self_id, 8);
+        rep.dest_seq = own_seq;
+        rep.hops = 0;
+    } else {
+        route_entry_t *route = mesh_find_route(req.destination);
+        if (route && route->seq_num != 0 && (int32_t)(route->seq_num - req.dest_seq) >= 0 &&
+            link_quality_find(route->next_hop) != NULL) {
+            // Intermediate reply from a fresh enough route
+            memcpy(rep.destination, req.destination, 8);
+            rep.dest_seq = route->seq_num;
+            rep.hops = route->hop_count;
+        } else {
+            if (message->hop_count > 1) {
+                aodv_forward(message, &req, sizeof(req));
+            }
+            return;
+        }
+    }
+
+    mesh_prepare_message(&rrep, MSG_TYPE_ROUTE_REPLY, message->sender_id, MAX_HOP_COUNT);
+    memcpy(rrep.payload, &rep, sizeof(rep));
+    rrep.payload_length = sizeof(rep);
+    aodv_queue(&rrep);
+    ESP_LOGD(TAG, "Route reply sent");
+}
+
+static void aodv_handle_rrep(const mesh_message_t *message, const uint8_t *transmitter_id)
+{
+    if (message->payload_length < sizeof(aodv_rrep_t)) {
+        return;
+    }
+
+    aodv_rrep_t rep;
+    memcpy(&rep, message->payload, sizeof(rep));
+    rep.hops++;
+
+    // Forward path towards the destination
+    aodv_update_route(rep.destination, transmitter_id, rep.hops, rep.dest_seq);
+
+    if (memcmp(message->recipient_id, self_id, 8) == 0) {
+        ESP_LOGI(TAG, "Route discovered (%d hops)", rep.hops);
+        aodv_release_pending(rep.destination, true);
+    } else if (message->hop_count > 1) {
+        // Continue along the reverse path set up by the request
+        aodv_forward(message, &rep, sizeof(rep));
+    }
+}
+
+static void aodv_handle_rerr(const mesh_message_t *message, const uint8_t *transmitter_id)
+{
+    if (message->payload_length < 1) {
+        return;
+    }
+
+    uint8_t count = message->payload[0];
+    if (count > AODV_RERR_MAX_ENTRIES || message->payload_length < 1 + count * sizeof(aodv_rerr_entry_t)) {
+        return;
+    }
+
+    // Invalidate only routes that went through the node reporting the error
+    aodv_rerr_entry_t affected[AODV_RERR_MAX_ENTRIES];
+    uint8_t affected_count = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        aodv_rerr_entry_t entry;
+        memcpy(&entry, &message->payload[1 + i * sizeof(entry)], sizeof(entry));
+
+        route_entry_t *route = mesh_find_route(entry.destination);
+        if (route && memcmp(route->next_hop, transmitter_id, 8) == 0) {
+            mesh_remove_route(entry.destination);
+            affected[affected_count++] = entry;
+        }
+    }
+
+    if (affected_count > 0 && message->hop_count > 1) {
+        aodv_send_rerr(affected, affected_count, message->hop_count - 1);
+    }
+}
+
+void aodv_handle_message(const mesh_message_t *message, const uint8_t *transmitter_id)
+{
+    switch (message->message_type) {
+        case MSG_TYPE_ROUTE_REQUEST:
+            aodv_handle_rreq(message, transmitter_id);
+            break;
+        case MSG_TYPE_ROUTE_REPLY:
+            aodv_handle_rrep(message, transmitter_id);
+            break;
+        case MSG_TYPE_ROUTE_ERROR:
+            aodv_handle_rerr(message, transmitter_id);
+            break;
+        default:
+            break;
+    }
+}
+
+// Retry or abandon discoveries whose reply is overdue
+// Returns the time until the next discovery deadline, UINT32_MAX if none
+uint32_t aodv_process(uint32_t now_ms)
+{
+    for (int i = 0; i < AODV_PENDING_MAX; i++) {
+        aodv_discovery_t *discovery = &discoveries[i];
+        if (!discovery->active || (int32_t)(now_ms - discovery->deadline_ms) < 0) {
+            continue;
+        }
+
+        if (discovery->retries >= AODV_RREQ_RETRIES) {
+            aodv_release_pending(discovery->destination, false);
+            continue;
+        }
+
+        discovery->retries++;
+        discovery->deadline_ms = now_ms + (AODV_DISCOVERY_TIMEOUT_MS << discovery->retries);
+        aodv_send_rreq(discovery->destination);
+    }
+
+    uint32_t wait_ms = UINT32_MAX;
+    for (int i = 0; i < AODV_PENDING_MAX; i++) {
+        if (discoveries[i].active && discoveries[i].deadline_ms - now_ms < wait_ms) {
+            wait_ms = discoveries[i].deadline_ms - now_ms;
+        }
+    }
+    return wait_ms;
+}
@@ -0,0 +1,20 @@
+#ifndef AODV_H
+#define AODV_H
+
+#include "esp_err.h"
+#include "device_config.h"
+#include "msg_pool.h"
+
+// On-demand route discovery (AODV-style) over ROUTE_REQUEST/REPLY/ERROR
+typedef enum {
+    AODV_ROUTE_FOUND = 0,       // next_hop filled in
+    AODV_ROUTE_PENDING,         // Message buffered until discovery completes
+    AODV_ROUTE_UNREACHABLE,     // Message dropped, ROUTE_ERROR sent
+} aodv_route_status_t;
+
+void aodv_init(void);
+aodv_route_status_t aodv_resolve(msg_handle_t handle, uint8_t *next_hop);
+void aodv_handle_message(const mesh_message_t *message, const uint8_t *transmitter_id);
+uint32_t aodv_process(uint32_t now_ms);
+
+#endif // AODV_H
@@ -0,0 +1,113 @@
+#include "beacon.h"
+#include "mesh.h"
+#include "route_table.h"
+#include "trickle.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "BEACON";
+
+#define BEACON_SUMMARY_HEADER   5
+#define BEACON_ROUTE_SIZE       9
+
+// A node may stay silent for up to two and a half intervals (fire late,
+// suppress once, fire early-late again); its routes must outlive that
+_Static_assert(BEACON_IMAX_MS * 5 / 2 < MESSAGE_TIMEOUT, "routes would expire between beacons");
+
+static trickle_t trickle;
+static uint32_t known_digest;           // Node set the timer last saw
+static size_t summary_cursor;           // Routes are announced in rotation
+static uint8_t self_id[8];
+
+void beacon_init(uint32_t now_ms)
+{
+    mesh_get_device_id(self_id);
+    known_digest = route_table_digest(self_id);
+    summary_cursor = 0;
+    trickle_init(&trickle, BEACON_IMIN_MS, BEACON_IMAX_DOUBLINGS, BEACON_REDUNDANCY, now_ms);
+}
+
+bool beacon_due(uint32_t now_ms)
+{
+    // Nodes appearing or expiring anywhere in range is the inconsistency
+    // that makes the whole neighborhood beacon fast again
+    uint32_t digest = route_table_digest(self_id);
+    if (digest != known_digest) {
+        known_digest = digest;
+        trickle_inconsistent(&trickle, now_ms);
+    }
+    return trickle_poll(&trickle, now_ms);
+}
+
+uint32_t beacon_wait_ms(uint32_t now_ms)
+{
+    return trickle_wait_ms(&trickle, now_ms);
+}
+
+void beacon_inconsistent(uint32_t now_ms)
+{
+    trickle_inconsistent(&trickle, now_ms);
+}
+
+size_t beacon_write_summary(uint8_t *out, size_t size)
+{
+    if (size < BEACON_SUMMARY_HEADER) {
+        return 0;
+    }
+
+    uint32_t digest = route_table_digest(self_id);
+    memcpy(out, &digest, sizeof(digest));
+    uint8_t count = 0;
+    uint8_t *p = out + BEACON_SUMMARY_HEADER;
+
+    size_t total = route_table_count();
+    for (size_t visited = 0; visited < total && count < BEACON_MAX_ROUTES &&
+                             (size_t)(out + size - p) >= BEACON_ROUTE_SIZE; visited++) {
+        route_entry_t *route = route_table_next(&summary_cursor);
+        if (route == NULL) {
+            summary_cursor = 0;
+            route = route_table_next(&summary_cursor);
+        }
+        if (route->hop_count >= MAX_HOP_COUNT) {
+            continue;  // Nobody could use it
+        }
+        memcpy(p, route->destination, 8);
+        p[8] = route->hop_count;
+        p += BEACON_ROUTE_SIZE;
+        count++;
+    }
+
+    out[4] = count;
+    return p - out;
+}
+
+void beacon_handle_summary(const uint8_t *sender_id, const uint8_t *summary, size_t length, uint32_t now_ms)
+{
+    if (length < BEACON_SUMMARY_HEADER || length < BEACON_SUMMARY_HEADER + (size_t)summary[4] * BEACON_ROUTE_SIZE) {
+        ESP_LOGW(TAG, "Truncated beacon summary");
+        return;
+    }
+
+    uint32_t digest;
+    memcpy(&digest, summary, sizeof(digest));
+    uint8_t count = summary[4];
+    const uint8_t *p = summary + BEACON_SUMMARY_HEADER;
+
+    // Distance vector: take shorter routes, and follow whatever the current
+    // next hop reports about its own route
+    for (uint8_t i = 0; i < count; i++, p += BEACON_ROUTE_SIZE) {
+        if (memcmp(p, self_id, 8) == 0 || p[8] >= MAX_HOP_COUNT) {
+            continue;
+        }
+        uint8_t hop_count = p[8] + 1;
+        route_entry_t *route = mesh_find_route(p);
+        if (route == NULL || hop_count < route->hop_count || memcmp(route->next_hop, sender_id, 8) == 0) {
+            mesh_add_route(p, sender_id, hop_count);
+        }
+    }
+
+    if (digest == route_table_digest(self_id)) {
+        trickle_consistent(&trickle);
+    }
+    ESP_LOGD(TAG, "Beacon summary with %d routes", count);
+}
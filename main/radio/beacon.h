@@ -0,0 +1,32 @@
+#ifndef BEACON_H
+#define BEACON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "device_config.h"
+
+// Beacon payload:
+//
+//   rx_profile    1 byte   (ADR profile the sender listens on)
+//   base_phase    2 bytes  (ms into the sender's base-listen period, little endian;
+//                           LINK_NO_BASE_LISTEN when it listens on base throughout)
+//
+// followed by the route summary:
+//
+//   digest        4 bytes  (route_table_digest() of the sender, including itself)
+//   count         1 byte
+//   routes        count * (destination 8 bytes, hop_count 1 byte)
+//
+// Beacons are timed by a Trickle timer that speeds up whenever the set of
+// known nodes changes and backs off while neighbors announce the same set.
+#define BEACON_HEADER_SIZE  3
+
+void beacon_init(uint32_t now_ms);
+bool beacon_due(uint32_t now_ms);
+uint32_t beacon_wait_ms(uint32_t now_ms);
+void beacon_inconsistent(uint32_t now_ms);
+size_t beacon_write_summary(uint8_t *out, size_t size);
+void beacon_handle_summary(const uint8_t *sender_id, const uint8_t *summary, size_t length, uint32_t now_ms);
+
+#endif // BEACON_H
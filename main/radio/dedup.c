@@ -0,0 +1,105 @@
+#include "dedup.h"
+#include "device_config.h"
+#include <string.h>
+
+#if (DEDUP_GENERATION_SLOTS & (DEDUP_GENERATION_SLOTS - 1)) != 0
+#error "DEDUP_GENERATION_SLOTS must be a power of two"
+#endif
+
+#define DEDUP_MASK      (DEDUP_GENERATION_SLOTS - 1)
+#define DEDUP_MAX_LOAD  (DEDUP_GENERATION_SLOTS / 2)
+
+// Two generations of 32-bit fingerprints. New entries go into the current
+// generation; when it fills up or ages out, the previous one is dropped and
+// the current one takes its place. Every entry therefore survives at least
+// one full generation.
+typedef struct {
+    uint32_t fingerprints[DEDUP_GENERATION_SLOTS];  // 0 = empty
+    uint32_t count;
+    uint32_t started_ms;
+} dedup_generation_t;
+
+static dedup_generation_t generations[2];
+static uint8_t current = 0;
+
+static uint64_t dedup_hash(const uint8_t *sender_id, uint32_t msg_id)
+{
+    // FNV-1a over sender and message id
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ sender_id[i]) * 0x100000001b3ULL;
+    }
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ ((msg_id >> (8 * i)) & 0xFF)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool generation_contains(const dedup_generation_t *gen, uint32_t index, uint32_t fingerprint)
+{
+    for (uint32_t probe = 0; probe < DEDUP_GENERATION_SLOTS; probe++) {
+        uint32_t slot = gen->fingerprints[index];
+        if (slot == 0) {
+            return false;
+        }
+        if (slot == fingerprint) {
+            return true;
+        }
+        index = (index + 1) & DEDUP_MASK;
+    }
+    return false;
+}
+
+static void generation_insert(dedup_generation_t *gen, uint32_t index, uint32_t fingerprint)
+{
+    while (gen->fingerprints[index] != 0) {
+        index = (index + 1) & DEDUP_MASK;
+    }
+    gen->fingerprints[index] = fingerprint;
+    gen->count++;
+}
+
+static void dedup_rotate(uint32_t now_ms)
+{
+    current ^= 1;
+    memset(&generations[current], 0, sizeof(generations[current]));
+    generations[current].started_ms = now_ms;
+}
+
+void dedup_init(uint32_t now_ms)
+{
+    memset(generations, 0, sizeof(generations));
+    current = 0;
+    generations[0].started_ms = now_ms;
+    generations[1].started_ms = now_ms;
+}
+
+bool dedup_contains(const uint8_t *sender_id, uint32_t msg_id)
+{
+    uint64_t hash = dedup_hash(sender_id, msg_id);
+    uint32_t index = (uint32_t)(hash >> 32) & DEDUP_MASK;
+    uint32_t fingerprint = (uint32_t)hash | 1;
+
+    return generation_contains(&generations[current], index, fingerprint) ||
+           generation_contains(&generations[current ^ 1], index, fingerprint);
+}
+
+bool dedup_check_and_insert(const uint8_t *sender_id, uint32_t msg_id, uint32_t now_ms)
+{
+    uint64_t hash = dedup_hash(sender_id, msg_id);
+    uint32_t index = (uint32_t)(hash >> 32) & DEDUP_MASK;
+    uint32_t fingerprint = (uint32_t)hash | 1;
+
+    if (generation_contains(&generations[current], index, fingerprint) ||
+        generation_contains(&generations[current ^ 1], index, fingerprint)) {
+        return true;
+    }
+
+    dedup_generation_t *gen = &generations[current];
+    if (gen->count >= DEDUP_MAX_LOAD || now_ms - gen->started_ms >= DEDUP_WINDOW_MS) {
+        dedup_rotate(now_ms);
+        gen = &generations[current];
+    }
+    generation_insert(gen, index, fingerprint);
+    return false;
+}
@@ -0,0 +1,12 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Seen-set of (sender, message id) pairs with time-bucketed expiry
+void dedup_init(uint32_t now_ms);
+bool dedup_check_and_insert(const uint8_t *sender_id, uint32_t msg_id, uint32_t now_ms);
+bool dedup_contains(const uint8_t *sender_id, uint32_t msg_id);
+
+#endif // DEDUP_H
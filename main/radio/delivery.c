@@ -0,0 +1,210 @@
+#include "delivery.h"
+#include "timer_wheel.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <string.h>
+
+static const char *TAG = "DELIVERY";
+
+typedef struct {
+    msg_handle_t handle;            // Retransmitted verbatim (same id)
+    uint32_t message_id;
+    uint32_t first_sent_ms;
+    wheel_timer_t retry_timer;      // Next retransmission or failure check
+    uint8_t attempts;               // Transmissions so far
+    bool active;
+} delivery_entry_t;
+
+static delivery_entry_t entries[DELIVERY_MAX_PENDING];
+static mesh_delivery_callback_t delivery_callback = NULL;
+static SemaphoreHandle_t delivery_mutex;    // Sending tasks track, mesh_task acknowledges and retries
+
+static void delivery_retry(void *arg);
+
+static uint32_t delivery_now_ms(void)
+{
+    return pdTICKS_TO_MS(xTaskGetTickCount());
+}
+
+esp_err_t delivery_init(void)
+{
+    if (delivery_mutex == NULL) {
+        delivery_mutex = xSemaphoreCreateMutex();
+        if (delivery_mutex == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    memset(entries, 0, sizeof(entries));
+    for (int i = 0; i < DELIVERY_MAX_PENDING; i++) {
+        timer_wheel_setup(&entries[i].retry_timer, delivery_retry, &entries[i]);
+    }
+    return ESP_OK;
+}
+
+void delivery_set_callback(mesh_delivery_callback_t callback)
+{
+    delivery_callback = callback;
+}
+
+// ACK wait for the given attempt: one round trip per hop, doubled per retry, plus jitter
+static uint32_t delivery_timeout_ms(const uint8_t *recipient_id, uint8_t attempts)
+{
+    // Also called from the sending task, which must not touch the route table directly
+    route_entry_t route;
+    uint8_t hops = mesh_get_route(recipient_id, &route) ? route.hop_count : MAX_HOP_COUNT;
+    if (hops == 0) {
+        hops = 1;
+    }
+
+    uint32_t timeout = DELIVERY_HOP_TIMEOUT_MS * hops;
+    for (uint8_t i = 1; i < attempts && timeout < DELIVERY_BACKOFF_MAX_MS; i++) {
+        timeout *= 2;
+    }
+    if (timeout > DELIVERY_BACKOFF_MAX_MS) {
+        timeout = DELIVERY_BACKOFF_MAX_MS;
+    }
+
+    // Keep retransmissions of nodes that lost the same ACK from lining up
+    return timeout + esp_random() % (timeout / 4 + 1);
+}
+
+// Caller holds delivery_mutex
+static delivery_entry_t *delivery_find(uint32_t message_id)
+{
+    for (int i = 0; i < DELIVERY_MAX_PENDING; i++) {
+        if (entries[i].active && entries[i].message_id == message_id) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Frees the entry under delivery_mutex; the message reference it held is
+// released and the outcome reported by the caller once the lock is dropped
+static void delivery_close(delivery_entry_t *entry)
+{
+    entry->active = false;
+    timer_wheel_cancel(&entry->retry_timer);
+}
+
+static void delivery_report(msg_handle_t handle, uint32_t message_id, mesh_delivery_state_t state,
+                            uint8_t attempts, uint32_t latency_ms)
+{
+    msg_pool_release(handle);
+    if (delivery_callback) {
+        delivery_callback(message_id, state, attempts, latency_ms);
+    }
+}
+
+// Takes over the caller's reference to the message. Called before the
+// message is queued, so that its ACK cannot arrive untracked.
+esp_err_t delivery_track(msg_handle_t handle, uint32_t now_ms)
+{
+    const mesh_message_t *message = msg_pool_get(handle);
+    xSemaphoreTake(delivery_mutex, portMAX_DELAY);
+    for (int i = 0; i < DELIVERY_MAX_PENDING; i++) {
+        if (!entries[i].active) {
+            entries[i].handle = handle;
+            entries[i].message_id = message->id;
+            entries[i].first_sent_ms = now_ms;
+            entries[i].attempts = 1;
+            entries[i].active = true;
+            timer_wheel_start(&entries[i].retry_timer, delivery_timeout_ms(message->recipient_id, 1));
+            xSemaphoreGive(delivery_mutex);
+            return ESP_OK;
+        }
+    }
+    xSemaphoreGive(delivery_mutex);
+
+    ESP_LOGW(TAG, "Too many unacknowledged messages");
+    msg_pool_release(handle);
+    return ESP_ERR_NO_MEM;
+}
+
+// A tracked message that could not be queued after all; no outcome is reported
+void delivery_cancel(uint32_t message_id)
+{
+    xSemaphoreTake(delivery_mutex, portMAX_DELAY);
+    delivery_entry_t *entry = delivery_find(message_id);
+    msg_handle_t handle = entry ? entry->handle : MSG_HANDLE_NONE;
+    if (entry) {
+        delivery_close(entry);
+    }
+    xSemaphoreGive(delivery_mutex);
+
+    if (handle != MSG_HANDLE_NONE) {
+        msg_pool_release(handle);
+    }
+}
+
+void delivery_ack(uint32_t message_id, uint32_t now_ms)
+{
+    xSemaphoreTake(delivery_mutex, portMAX_DELAY);
+    delivery_entry_t *entry = delivery_find(message_id);
+    if (entry == NULL) {
+        xSemaphoreGive(delivery_mutex);
+
+        // Every retransmission that got through is acknowledged separately
+        ESP_LOGD(TAG, "Duplicate ACK for message %lu", message_id);
+        return;
+    }
+
+    msg_handle_t handle = entry->handle;
+    uint8_t attempts = entry->attempts;
+    uint32_t latency_ms = now_ms - entry->first_sent_ms;
+    delivery_close(entry);
+    xSemaphoreGive(delivery_mutex);
+
+    ESP_LOGI(TAG, "Message %lu delivered after %d attempts", message_id, attempts);
+    delivery_report(handle, message_id, MESH_DELIVERY_ACKED, attempts, latency_ms);
+}
+
+static void delivery_retry(void *arg)
+{
+    delivery_entry_t *entry = arg;
+    xSemaphoreTake(delivery_mutex, portMAX_DELAY);
+
+    // Finished, or finished and tracking another message, since the timer fired
+    if (!entry->active || timer_wheel_pending(&entry->retry_timer)) {
+        xSemaphoreGive(delivery_mutex);
+        return;
+    }
+
+    msg_handle_t handle = entry->handle;
+    uint32_t message_id = entry->message_id;
+    if (entry->attempts > DELIVERY_MAX_RETRIES) {
+        uint8_t attempts = entry->attempts;
+        uint32_t now_ms = delivery_now_ms();
+        uint32_t latency_ms = now_ms - entry->first_sent_ms;
+        delivery_close(entry);
+        xSemaphoreGive(delivery_mutex);
+
+        ESP_LOGW(TAG, "Message %lu not acknowledged, giving up", message_id);
+        delivery_report(handle, message_id, MESH_DELIVERY_FAILED, attempts, latency_ms);
+        return;
+    }
+
+    // Still queued or waiting for a route: queueing it again would send it
+    // twice, so only wait another round for the copy already in flight
+    if (msg_pool_shared(handle)) {
+        timer_wheel_start(&entry->retry_timer,
+                          delivery_timeout_ms(msg_pool_get(handle)->recipient_id, entry->attempts));
+        xSemaphoreGive(delivery_mutex);
+        return;
+    }
+
+    // A full queue just costs this attempt; the timer still advances
+    entry->attempts++;
+    uint8_t attempts = entry->attempts;
+    timer_wheel_start(&entry->retry_timer, delivery_timeout_ms(msg_pool_get(handle)->recipient_id, attempts));
+    msg_pool_ref(handle);
+    xSemaphoreGive(delivery_mutex);
+
+    if (mesh_queue_handle(handle) == ESP_OK) {
+        ESP_LOGD(TAG, "Retransmitting message %lu (attempt %d)", message_id, attempts);
+    }
+}
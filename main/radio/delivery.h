@@ -0,0 +1,17 @@
+#ifndef DELIVERY_H
+#define DELIVERY_H
+
+#include "esp_err.h"
+#include "mesh.h"
+#include "msg_pool.h"
+
+// Sender-side reliable delivery: each tracked unicast message stays pending
+// until its ACK arrives or the retransmissions run out. Messages are tracked
+// from the sending task; ACKs and retries are handled on mesh_task.
+esp_err_t delivery_init(void);
+void delivery_set_callback(mesh_delivery_callback_t callback);
+esp_err_t delivery_track(msg_handle_t handle, uint32_t now_ms);
+void delivery_cancel(uint32_t message_id);
+void delivery_ack(uint32_t message_id, uint32_t now_ms);
+
+#endif // DELIVERY_H
@@ -0,0 +1,110 @@
+#include "duty_cycle.h"
+#include "device_config.h"
+
+// Regulatory sub-bands (ETSI EN 300 220 for EU868). Frequencies outside
+// every entry are treated as unrestricted.
+typedef struct {
+    uint32_t low_hz;
+    uint32_t high_hz;
+    uint16_t permille;          // Allowed transmit time per 1000
+} duty_band_t;
+
+static const duty_band_t bands[] = {
+    { 863000000, 868000000, 10 },   // h1.4
+    { 868000000, 868600000, 10 },   // h1.4 (g1)
+    { 868700000, 869200000, 1 },    // h1.5 (g2)
+    { 869400000, 869650000, 100 },  // h1.6 (g3)
+    { 869700000, 870000000, 10 },   // h1.7 (g4)
+};
+
+#define NUM_BANDS (sizeof(bands) / sizeof(bands[0]))
+
+// Token bucket per band, in microseconds of airtime
+typedef struct {
+    uint64_t tokens_us;
+    uint32_t last_refill_ms;
+} duty_bucket_t;
+
+static duty_bucket_t buckets[NUM_BANDS];
+
+static uint64_t bucket_capacity_us(const duty_band_t *band)
+{
+    return (uint64_t)DUTY_CYCLE_WINDOW_MS * band->permille;  // ms * permille = us
+}
+
+static int find_band(uint32_t frequency_hz)
+{
+    for (int i = 0; i < (int)NUM_BANDS; i++) {
+        if (frequency_hz >= bands[i].low_hz && frequency_hz < bands[i].high_hz) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void refill(int band, uint32_t now_ms)
+{
+    duty_bucket_t *bucket = &buckets[band];
+    uint32_t elapsed_ms = now_ms - bucket->last_refill_ms;
+    uint64_t capacity = bucket_capacity_us(&bands[band]);
+
+    bucket->tokens_us += (uint64_t)elapsed_ms * bands[band].permille;
+    if (bucket->tokens_us > capacity) {
+        bucket->tokens_us = capacity;
+    }
+    bucket->last_refill_ms = now_ms;
+}
+
+void duty_cycle_init(uint32_t now_ms)
+{
+    for (int i = 0; i < (int)NUM_BANDS; i++) {
+        buckets[i].tokens_us = bucket_capacity_us(&bands[i]);
+        buckets[i].last_refill_ms = now_ms;
+    }
+}
+
+uint32_t duty_cycle_wait_ms(uint32_t frequency_hz, uint32_t airtime_us, duty_priority_t priority, uint32_t now_ms)
+{
+    int band = find_band(frequency_hz);
+    if (band < 0) {
+        return 0;
+    }
+    refill(band, now_ms);
+
+    uint64_t needed = airtime_us;
+    if (priority == DUTY_PRIORITY_LOW) {
+        needed += bucket_capacity_us(&bands[band]) * DUTY_CYCLE_LOW_PRIO_RESERVE_PCT / 100;
+    }
+    if (buckets[band].tokens_us >= needed) {
+        return 0;
+    }
+
+    // Tokens accrue at `permille` microseconds per millisecond
+    uint64_t deficit = needed - buckets[band].tokens_us;
+    return (uint32_t)((deficit + bands[band].permille - 1) / bands[band].permille);
+}
+
+void duty_cycle_consume(uint32_t frequency_hz, uint32_t airtime_us, uint32_t now_ms)
+{
+    int band = find_band(frequency_hz);
+    if (band < 0) {
+        return;
+    }
+    refill(band, now_ms);
+
+    if (buckets[band].tokens_us > airtime_us) {
+        buckets[band].tokens_us -= airtime_us;
+    } else {
+        buckets[band].tokens_us = 0;
+    }
+}
+
+uint32_t duty_cycle_remaining_us(uint32_t frequency_hz, uint32_t now_ms)
+{
+    int band = find_band(frequency_hz);
+    if (band < 0) {
+        return UINT32_MAX;
+    }
+    refill(band, now_ms);
+    return (uint32_t)buckets[band].tokens_us;
+}
@@ -0,0 +1,19 @@
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Low priority traffic may not dig into the reserved part of the budget
+typedef enum {
+    DUTY_PRIORITY_HIGH = 0,     // Locally originated traffic and ACKs
+    DUTY_PRIORITY_LOW,          // Forwards and beacons
+} duty_priority_t;
+
+// Callers pass a monotonic millisecond clock so the scheduler runs on any host
+void duty_cycle_init(uint32_t now_ms);
+uint32_t duty_cycle_wait_ms(uint32_t frequency_hz, uint32_t airtime_us, duty_priority_t priority, uint32_t now_ms);
+void duty_cycle_consume(uint32_t frequency_hz, uint32_t airtime_us, uint32_t now_ms);
+uint32_t duty_cycle_remaining_us(uint32_t frequency_hz, uint32_t now_ms);
+
+#endif // DUTY_CYCLE_H
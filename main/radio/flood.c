@@ -0,0 +1,112 @@
+#include "flood.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include <string.h>
+
+static const char *TAG = "FLOOD";
+
+typedef struct {
+    msg_handle_t handle;            // Message as received; hop_count is decremented on relay
+    uint32_t due_ms;
+    uint8_t overheard;              // Relays of the same message heard meanwhile
+    bool active;
+} flood_relay_t;
+
+static flood_relay_t relays[FLOOD_PENDING_MAX];
+
+void flood_init(void)
+{
+    memset(relays, 0, sizeof(relays));
+}
+
+// Weak links wait least: a distant receiver covers the most new ground, and
+// nodes close to the previous hop mostly overhear the same neighbors
+static uint32_t flood_delay_ms(float snr)
+{
+    float position = (snr - FLOOD_SNR_LOW_DB) / (FLOOD_SNR_HIGH_DB - FLOOD_SNR_LOW_DB);
+    if (position < 0.0f) {
+        position = 0.0f;
+    } else if (position > 1.0f) {
+        position = 1.0f;
+    }
+
+    uint32_t span = FLOOD_DELAY_MAX_MS - FLOOD_DELAY_MIN_MS;
+    uint32_t delay = FLOOD_DELAY_MIN_MS + (uint32_t)(position * span);
+
+    // Jitter separates neighbors that heard the frame at the same SNR
+    return delay + esp_random() % (span / 8 + 1);
+}
+
+void flood_schedule(msg_handle_t handle, float snr, uint32_t now_ms)
+{
+    const mesh_message_t *message = msg_pool_get(handle);
+    if (message->hop_count <= 1) {
+        return;  // Hop limit reached
+    }
+
+    flood_relay_t *slot = NULL;
+    for (int i = 0; i < FLOOD_PENDING_MAX; i++) {
+        if (!relays[i].active) {
+            slot = &relays[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        ESP_LOGW(TAG, "Relay table full, broadcast %lu not relayed", message->id);
+        return;
+    }
+
+    msg_pool_ref(handle);
+    slot->handle = handle;
+    slot->due_ms = now_ms + flood_delay_ms(snr);
+    slot->overheard = 0;
+    slot->active = true;
+}
+
+void flood_overheard(const uint8_t *sender_id, uint32_t msg_id)
+{
+    for (int i = 0; i < FLOOD_PENDING_MAX; i++) {
+        flood_relay_t *relay = &relays[i];
+        if (!relay->active) {
+            continue;
+        }
+        const mesh_message_t *message = msg_pool_get(relay->handle);
+        if (message->id == msg_id && memcmp(message->sender_id, sender_id, 8) == 0) {
+            if (++relay->overheard >= FLOOD_SUPPRESS_COUNT) {
+                relay->active = false;
+                msg_pool_release(relay->handle);
+                ESP_LOGD(TAG, "Relay of broadcast %lu suppressed", msg_id);
+            }
+            return;
+        }
+    }
+}
+
+// Hand out one relay whose backoff has expired, with its reference
+msg_handle_t flood_take_due(uint32_t now_ms)
+{
+    for (int i = 0; i < FLOOD_PENDING_MAX; i++) {
+        flood_relay_t *relay = &relays[i];
+        if (relay->active && (int32_t)(now_ms - relay->due_ms) >= 0) {
+            relay->active = false;
+            return relay->handle;
+        }
+    }
+    return MSG_HANDLE_NONE;
+}
+
+// Time until the next relay is due, UINT32_MAX if none
+uint32_t flood_wait_ms(uint32_t now_ms)
+{
+    uint32_t wait_ms = UINT32_MAX;
+    for (int i = 0; i < FLOOD_PENDING_MAX; i++) {
+        if (relays[i].active) {
+            int32_t remaining = (int32_t)(relays[i].due_ms - now_ms);
+            uint32_t relay_wait = remaining > 0 ? (uint32_t)remaining : 0;
+            if (relay_wait < wait_ms) {
+                wait_ms = relay_wait;
+            }
+        }
+    }
+    return wait_ms;
+}
@@ -0,0 +1,17 @@
+#ifndef FLOOD_H
+#define FLOOD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "device_config.h"
+#include "msg_pool.h"
+
+// Managed flooding: broadcasts are relayed after an SNR-dependent backoff
+// and the relay is dropped when enough neighbors are heard relaying first
+void flood_init(void);
+void flood_schedule(msg_handle_t handle, float snr, uint32_t now_ms);
+void flood_overheard(const uint8_t *sender_id, uint32_t msg_id);
+msg_handle_t flood_take_due(uint32_t now_ms);
+uint32_t flood_wait_ms(uint32_t now_ms);
+
+#endif // FLOOD_H
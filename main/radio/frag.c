@@ -0,0 +1,456 @@
+#include "frag.h"
+#include "tx_sched.h"
+#include "wire.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "FRAG";
+
+// Fragment payload: header, then up to FRAG_DATA_SIZE bytes of data
+typedef struct {
+    uint32_t transfer_id;
+    uint16_t total_length;
+    uint8_t index;
+    uint8_t count;
+    uint8_t type;                   // Message type of the reassembled payload
+} __attribute__((packed)) frag_header_t;
+
+// NACK payload: transfer id, then a bitmap of fragments held (bit set = have)
+typedef struct {
+    uint32_t transfer_id;
+    uint8_t count;
+} __attribute__((packed)) frag_nack_header_t;
+
+#define FRAG_DATA_SIZE      (WIRE_MAX_PAYLOAD - sizeof(frag_header_t))
+#define FRAG_MAX_COUNT      ((FRAG_MAX_PAYLOAD + FRAG_DATA_SIZE - 1) / FRAG_DATA_SIZE)
+#define FRAG_BITMAP_BYTES   ((FRAG_MAX_COUNT + 7) / 8)
+
+_Static_assert(FRAG_MAX_COUNT <= UINT8_MAX, "fragment index does not fit in a byte");
+_Static_assert(sizeof(frag_nack_header_t) + FRAG_BITMAP_BYTES <= WIRE_MAX_PAYLOAD, "NACK bitmap too large");
+
+typedef struct {
+    uint8_t recipient_id[8];
+    uint32_t transfer_id;
+    uint8_t type;
+    uint8_t *data;
+    size_t length;
+    uint8_t count;
+    uint8_t pending[FRAG_BITMAP_BYTES];     // Fragments still to be (re)sent
+    uint32_t last_activity_ms;
+    uint8_t probes;                 // Unanswered resends of the last fragment
+    bool active;
+} frag_tx_t;
+
+typedef struct {
+    uint8_t sender_id[8];
+    uint8_t recipient_id[8];
+    uint32_t transfer_id;
+    uint8_t type;
+    uint8_t *data;
+    size_t length;
+    uint8_t count;
+    uint8_t received_count;
+    uint8_t received[FRAG_BITMAP_BYTES];
+    uint32_t last_activity_ms;
+    uint8_t nacks_sent;             // Since the last fragment arrived
+    bool is_broadcast;              // Nobody to re-request from
+    bool complete;                  // Delivered; kept to answer late resends
+    bool active;
+} frag_rx_t;
+
+static frag_tx_t tx_transfers[FRAG_TX_SLOTS];
+static frag_rx_t rx_transfers[FRAG_RX_SLOTS];
+static frag_callback_t payload_callback = NULL;
+static SemaphoreHandle_t frag_mutex;
+
+static bool bit_test(const uint8_t *bitmap, uint8_t index)
+{
+    return (bitmap[index / 8] >> (index % 8)) & 1;
+}
+
+static void bit_set(uint8_t *bitmap, uint8_t index)
+{
+    bitmap[index / 8] |= 1 << (index % 8);
+}
+
+static void bit_clear(uint8_t *bitmap, uint8_t index)
+{
+    bitmap[index / 8] &= ~(1 << (index % 8));
+}
+
+static bool frag_is_broadcast(const uint8_t *id)
+{
+    static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    return memcmp(id, broadcast_id, 8) == 0;
+}
+
+static uint32_t frag_now_ms(void)
+{
+    return pdTICKS_TO_MS(xTaskGetTickCount());
+}
+
+void frag_init(void)
+{
+    frag_mutex = xSemaphoreCreateMutex();
+    memset(tx_transfers, 0, sizeof(tx_transfers));
+    memset(rx_transfers, 0, sizeof(rx_transfers));
+}
+
+void frag_set_callback(frag_callback_t callback)
+{
+    payload_callback = callback;
+}
+
+esp_err_t frag_send(const uint8_t *recipient_id, uint8_t type, const uint8_t *data, size_t length)
+{
+    if (length == 0 || length > FRAG_MAX_PAYLOAD) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t *copy = malloc(length);
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, data, length);
+
+    xSemaphoreTake(frag_mutex, portMAX_DELAY);
+    for (int i = 0; i < FRAG_TX_SLOTS; i++) {
+        frag_tx_t *tx = &tx_transfers[i];
+        if (tx->active) {
+            continue;
+        }
+
+        memcpy(tx->recipient_id, recipient_id, 8);
+        // Message ids restart at every boot; a random id cannot match a
+        // transfer the receiver still remembers from before a reboot
+        tx->transfer_id = esp_random();
+        tx->type = type;
+        tx->data = copy;
+        tx->length = length;
+        tx->count = (length + FRAG_DATA_SIZE - 1) / FRAG_DATA_SIZE;
+        memset(tx->pending, 0, sizeof(tx->pending));
+        for (uint8_t f = 0; f < tx->count; f++) {
+            bit_set(tx->pending, f);
+        }
+        tx->last_activity_ms = frag_now_ms();
+        tx->probes = 0;
+        tx->active = true;
+        xSemaphoreGive(frag_mutex);
+
+        ESP_LOGI(TAG, "Sending %d bytes in %d fragments", (int)length, tx->count);
+        return ESP_OK;
+    }
+    xSemaphoreGive(frag_mutex);
+
+    free(copy);
+    return ESP_ERR_NO_MEM;
+}
+
+static void frag_tx_finish(frag_tx_t *tx)
+{
+    free(tx->data);
+    tx->data = NULL;
+    tx->active = false;
+}
+
+// Queue one fragment; returns false when the scheduler has no room
+static bool frag_queue_fragment(frag_tx_t *tx, uint8_t index)
+{
+    msg_handle_t handle = msg_pool_alloc();
+    if (handle == MSG_HANDLE_NONE) {
+        return false;
+    }
+
+    mesh_message_t *message = msg_pool_get(handle);
+    mesh_prepare_message(message, MSG_TYPE_FRAGMENT, tx->recipient_id, MAX_HOP_COUNT);
+
+    size_t offset = (size_t)index * FRAG_DATA_SIZE;
+    size_t chunk = tx->length - offset < FRAG_DATA_SIZE ? tx->length - offset : FRAG_DATA_SIZE;
+    frag_header_t header = {
+        .transfer_id = tx->transfer_id,
+        .total_length = (uint16_t)tx->length,
+        .index = index,
+        .count = tx->count,
+        .type = tx->type,
+    };
+    memcpy(message->payload, &header, sizeof(header));
+    memcpy(message->payload + sizeof(header), tx->data + offset, chunk);
+    message->payload_length = sizeof(header) + chunk;
+    message->checksum = mesh_calculate_checksum(message);
+
+    return mesh_queue_handle(handle) == ESP_OK;
+}
+
+static void frag_send_nack(frag_rx_t *rx)
+{
+    mesh_message_t nack;
+    mesh_prepare_message(&nack, MSG_TYPE_FRAGMENT_NACK, rx->sender_id, MAX_HOP_COUNT);
+
+    frag_nack_header_t header = { .transfer_id = rx->transfer_id, .count = rx->count };
+    size_t bitmap_len = (rx->count + 7) / 8;
+    memcpy(nack.payload, &header, sizeof(header));
+    memcpy(nack.payload + sizeof(header), rx->received, bitmap_len);
+    nack.payload_length = sizeof(header) + bitmap_len;
+    nack.checksum = mesh_calculate_checksum(&nack);
+
+    mesh_queue_message(&nack);
+}
+
+static void frag_rx_release(frag_rx_t *rx)
+{
+    free(rx->data);
+    rx->data = NULL;
+}
+
+static void frag_rx_finish(frag_rx_t *rx)
+{
+    frag_rx_release(rx);
+    rx->active = false;
+}
+
+static void frag_handle_fragment(const mesh_message_t *message)
+{
+    frag_header_t header;
+    if (message->payload_length <= sizeof(header)) {
+        return;
+    }
+    memcpy(&header, message->payload, sizeof(header));
+
+    // Every fragment but the last is full, so the pieces tile the payload exactly
+    size_t chunk = message->payload_length - sizeof(header);
+    size_t offset = (size_t)header.index * FRAG_DATA_SIZE;
+    if (header.total_length == 0 || header.total_length > FRAG_MAX_PAYLOAD || header.index >= header.count ||
+        header.count != (header.total_length + FRAG_DATA_SIZE - 1) / FRAG_DATA_SIZE ||
+        chunk != (header.index + 1 < header.count ? FRAG_DATA_SIZE : header.total_length - offset)) {
+        ESP_LOGW(TAG, "Inconsistent fragment header");
+        return;
+    }
+
+    uint32_t now_ms = frag_now_ms();
+    frag_rx_t *rx = NULL;
+    frag_rx_t *free_slot = NULL;
+    for (int i = 0; i < FRAG_RX_SLOTS; i++) {
+        frag_rx_t *slot = &rx_transfers[i];
+        if (slot->active && slot->transfer_id == header.transfer_id &&
+            memcmp(slot->sender_id, message->sender_id, 8) == 0) {
+            rx = slot;
+            break;
+        }
+        // Prefer an unused slot, else recycle one that only remembers a finished transfer
+        if (!slot->active && (free_slot == NULL || free_slot->active)) {
+            free_slot = slot;
+        } else if (slot->active && slot->complete && free_slot == NULL) {
+            free_slot = slot;
+        }
+    }
+
+    // The buffer was sized from the first fragment; one that disagrees
+    // with it belongs to some other transfer
+    if (rx != NULL && (rx->length != header.total_length || rx->count != header.count ||
+                       rx->type != header.type)) {
+        ESP_LOGW(TAG, "Fragment does not match transfer %lu", rx->transfer_id);
+        return;
+    }
+
+    // The sender missed our final bitmap and is probing
+    if (rx != NULL && rx->complete) {
+        rx->last_activity_ms = now_ms;
+        if (!rx->is_broadcast) {
+            frag_send_nack(rx);
+        }
+        return;
+    }
+
+    if (rx == NULL) {
+        if (free_slot == NULL) {
+            ESP_LOGW(TAG, "No reassembly slot free, fragment dropped");
+            return;
+        }
+        // Memory is bounded by FRAG_RX_SLOTS * FRAG_MAX_PAYLOAD
+        uint8_t *data = malloc(header.total_length);
+        if (data == NULL) {
+            return;
+        }
+        rx = free_slot;
+        memset(rx, 0, sizeof(*rx));
+        memcpy(rx->sender_id, message->sender_id, 8);
+        memcpy(rx->recipient_id, message->recipient_id, 8);
+        rx->transfer_id = header.transfer_id;
+        rx->type = header.type;
+        rx->data = data;
+        rx->length = header.total_length;
+        rx->count = header.count;
+        rx->is_broadcast = frag_is_broadcast(message->recipient_id);
+        rx->active = true;
+    }
+
+    rx->last_activity_ms = now_ms;
+    rx->nacks_sent = 0;
+    if (bit_test(rx->received, header.index)) {
+        return;  // Resent copy of a fragment we already hold
+    }
+    memcpy(rx->data + offset, message->payload + sizeof(header), chunk);
+    bit_set(rx->received, header.index);
+    rx->received_count++;
+
+    if (rx->received_count < rx->count) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Reassembled %d bytes from %d fragments", (int)rx->length, rx->count);
+
+    // A complete bitmap tells a unicast sender it can stop
+    if (!rx->is_broadcast) {
+        frag_send_nack(rx);
+    }
+
+    if (payload_callback) {
+        payload_callback(rx->sender_id, rx->recipient_id, rx->transfer_id, rx->type, rx->data, rx->length);
+    }
+    frag_rx_release(rx);
+    rx->complete = true;
+}
+
+static void frag_handle_nack(const mesh_message_t *message)
+{
+    frag_nack_header_t header;
+    if (message->payload_length < sizeof(header)) {
+        return;
+    }
+    memcpy(&header, message->payload, sizeof(header));
+    const uint8_t *held = message->payload + sizeof(header);
+    if (message->payload_length < sizeof(header) + (header.count + 7) / 8) {
+        return;
+    }
+
+    xSemaphoreTake(frag_mutex, portMAX_DELAY);
+    for (int i = 0; i < FRAG_TX_SLOTS; i++) {
+        frag_tx_t *tx = &tx_transfers[i];
+        if (!tx->active || tx->transfer_id != header.transfer_id ||
+            memcmp(tx->recipient_id, message->sender_id, 8) != 0 || tx->count != header.count) {
+            continue;
+        }
+
+        // Resend exactly what the receiver is missing
+        uint8_t missing = 0;
+        for (uint8_t f = 0; f < tx->count; f++) {
+            if (bit_test(held, f)) {
+                bit_clear(tx->pending, f);
+            } else {
+                bit_set(tx->pending, f);
+                missing++;
+            }
+        }
+        tx->last_activity_ms = frag_now_ms();
+        tx->probes = 0;
+
+        if (missing == 0) {
+            ESP_LOGI(TAG, "Transfer %lu delivered", tx->transfer_id);
+            frag_tx_finish(tx);
+        } else {
+            ESP_LOGD(TAG, "Transfer %lu: resending %d fragments", tx->transfer_id, missing);
+        }
+        break;
+    }
+    xSemaphoreGive(frag_mutex);
+}
+
+void frag_handle_message(const mesh_message_t *message)
+{
+    if (message->message_type == MSG_TYPE_FRAGMENT) {
+        frag_handle_fragment(message);
+    } else if (message->message_type == MSG_TYPE_FRAGMENT_NACK) {
+        frag_handle_nack(message);
+    }
+}
+
+// Lower *wait_ms to the time left until deadline_ms
+static void frag_deadline(uint32_t *wait_ms, uint32_t deadline_ms, uint32_t now_ms)
+{
+    int32_t remaining = (int32_t)(deadline_ms - now_ms);
+    uint32_t wait = remaining > 0 ? (uint32_t)remaining : 0;
+    if (wait < *wait_ms) {
+        *wait_ms = wait;
+    }
+}
+
+// Returns the time until a transfer next needs attention, UINT32_MAX if none.
+// Fragments waiting for scheduler room go out as mesh_task sends frames.
+uint32_t frag_process(uint32_t now_ms)
+{
+    uint32_t wait_ms = UINT32_MAX;
+
+    xSemaphoreTake(frag_mutex, portMAX_DELAY);
+    for (int i = 0; i < FRAG_TX_SLOTS; i++) {
+        frag_tx_t *tx = &tx_transfers[i];
+        if (!tx->active) {
+            continue;
+        }
+
+        // Feed fragments as the scheduler drains, leaving room for chat
+        for (uint8_t f = 0; f < tx->count && tx_sched_free(TX_CLASS_LOCAL) > 1; f++) {
+            if (bit_test(tx->pending, f)) {
+                if (!frag_queue_fragment(tx, f)) {
+                    break;
+                }
+                bit_clear(tx->pending, f);
+                tx->last_activity_ms = now_ms;
+            }
+        }
+
+        // Unicast transfers wait for the receiver's bitmap; broadcasts are done once sent
+        bool all_sent = true;
+        for (uint8_t f = 0; f < tx->count && all_sent; f++) {
+            all_sent = !bit_test(tx->pending, f);
+        }
+        uint32_t idle_ms = now_ms - tx->last_activity_ms;
+        if ((all_sent && frag_is_broadcast(tx->recipient_id)) || idle_ms > FRAG_TIMEOUT_MS ||
+            tx->probes > FRAG_MAX_NACKS) {
+            frag_tx_finish(tx);
+        } else if (all_sent && idle_ms > 2 * FRAG_NACK_INTERVAL_MS) {
+            // Silence can mean the receiver heard nothing at all; the last
+            // fragment makes it answer with what it is missing
+            bit_set(tx->pending, tx->count - 1);
+            tx->probes++;
+            wait_ms = 0;
+        } else {
+            uint32_t check_after_ms = all_sent ? 2 * FRAG_NACK_INTERVAL_MS : FRAG_TIMEOUT_MS;
+            frag_deadline(&wait_ms, tx->last_activity_ms + check_after_ms + 1, now_ms);
+        }
+    }
+    xSemaphoreGive(frag_mutex);
+
+    for (int i = 0; i < FRAG_RX_SLOTS; i++) {
+        frag_rx_t *rx = &rx_transfers[i];
+        if (!rx->active) {
+            continue;
+        }
+
+        // Each NACK restarts the idle timer; the sender answers with the missing fragments
+        uint32_t idle_ms = now_ms - rx->last_activity_ms;
+        if (rx->complete) {
+            if (idle_ms > FRAG_TIMEOUT_MS) {
+                rx->active = false;
+            } else {
+                frag_deadline(&wait_ms, rx->last_activity_ms + FRAG_TIMEOUT_MS + 1, now_ms);
+            }
+        } else if (idle_ms > FRAG_TIMEOUT_MS || (rx->nacks_sent >= FRAG_MAX_NACKS && idle_ms > FRAG_NACK_INTERVAL_MS)) {
+            ESP_LOGW(TAG, "Reassembly of transfer %lu abandoned (%d/%d)",
+                     rx->transfer_id, rx->received_count, rx->count);
+            frag_rx_finish(rx);
+        } else if (!rx->is_broadcast && idle_ms > FRAG_NACK_INTERVAL_MS) {
+            frag_send_nack(rx);
+            rx->nacks_sent++;
+            rx->last_activity_ms = now_ms;
+        }
+        if (rx->active && !rx->complete) {
+            frag_deadline(&wait_ms, rx->last_activity_ms + FRAG_NACK_INTERVAL_MS + 1, now_ms);
+        }
+    }
+    return wait_ms;
+}
@@ -0,0 +1,19 @@
+#ifndef FRAG_H
+#define FRAG_H
+
+#include "esp_err.h"
+#include "mesh.h"
+
+// Splits payloads larger than one frame into MSG_TYPE_FRAGMENT messages and
+// reassembles them; receivers re-request missing pieces with a bitmap NACK
+void frag_init(void);
+esp_err_t frag_send(const uint8_t *recipient_id, uint8_t type, const uint8_t *data, size_t length);
+void frag_handle_message(const mesh_message_t *message);
+uint32_t frag_process(uint32_t now_ms);
+
+// Reassembled payload; recipient_id is ours or broadcast
+typedef void (*frag_callback_t)(const uint8_t *sender_id, const uint8_t *recipient_id, uint32_t transfer_id,
+                                uint8_t type, const uint8_t *data, size_t length);
+void frag_set_callback(frag_callback_t callback);
+
+#endif // FRAG_H
@@ -0,0 +1,98 @@
+#include "link_quality.h"
+#include "device_config.h"
+#include "timer_wheel.h"
+#include <string.h>
+
+// Weight of the newest sample in the moving averages
+#define LINK_EWMA_ALPHA 0.25f
+
+static link_entry_t links[MAX_NEIGHBORS];
+static wheel_timer_t link_timers[MAX_NEIGHBORS];   // Silence timeout per neighbor
+
+static void link_quality_timeout(void *arg)
+{
+    links[(uintptr_t)arg].active = false;
+}
+
+void link_quality_init(void)
+{
+    memset(links, 0, sizeof(links));
+    for (int i = 0; i < MAX_NEIGHBORS; i++) {
+        timer_wheel_setup(&link_timers[i], link_quality_timeout, (void *)(uintptr_t)i);
+    }
+}
+
+static link_entry_t *link_quality_lookup(const uint8_t *id, uint32_t now_ms)
+{
+    link_entry_t *free_slot = NULL;
+    link_entry_t *oldest = &links[0];
+
+    for (int i = 0; i < MAX_NEIGHBORS; i++) {
+        if (!links[i].active) {
+            if (free_slot == NULL) {
+                free_slot = &links[i];
+            }
+        } else if (memcmp(links[i].id, id, 8) == 0) {
+            return &links[i];
+        } else if (now_ms - links[i].last_heard_ms > now_ms - oldest->last_heard_ms) {
+            oldest = &links[i];
+        }
+    }
+
+    // Replace the neighbor we have not heard from for longest
+    link_entry_t *entry = free_slot ? free_slot : oldest;
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->id, id, 8);
+    entry->rx_profile = LINK_PROFILE_UNKNOWN;
+    return entry;
+}
+
+void link_quality_update(const uint8_t *id, int rssi, float snr, uint32_t now_ms)
+{
+    link_entry_t *entry = link_quality_lookup(id, now_ms);
+
+    if (!entry->active) {
+        entry->snr = snr;
+        entry->rssi = rssi;
+        entry->active = true;
+    } else {
+        entry->snr += LINK_EWMA_ALPHA * (snr - entry->snr);
+        entry->rssi += LINK_EWMA_ALPHA * (rssi - entry->rssi);
+    }
+    entry->last_heard_ms = now_ms;
+    timer_wheel_start(&link_timers[entry - links], LINK_TIMEOUT_MS);
+}
+
+static link_entry_t *link_quality_match(const uint8_t *id)
+{
+    for (int i = 0; i < MAX_NEIGHBORS; i++) {
+        if (links[i].active && memcmp(links[i].id, id, 8) == 0) {
+            return &links[i];
+        }
+    }
+    return NULL;
+}
+
+// Only for a neighbor already heard; an unknown one must not evict a live entry.
+// base_phase_ms is how far into its base-listen period the neighbor was when it sent.
+void link_quality_set_rx_profile(const uint8_t *id, uint8_t profile, uint16_t base_phase_ms, uint32_t now_ms)
+{
+    link_entry_t *entry = link_quality_match(id);
+    if (entry == NULL) {
+        return;
+    }
+    entry->rx_profile = profile;
+    entry->base_listens = base_phase_ms != LINK_NO_BASE_LISTEN;
+    entry->base_period_ms = now_ms - base_phase_ms;
+}
+
+const link_entry_t *link_quality_find(const uint8_t *id)
+{
+    return link_quality_match(id);
+}
+
+const link_entry_t *link_quality_entries(size_t *count)
+{
+    *count = MAX_NEIGHBORS;
+    return links;
+}
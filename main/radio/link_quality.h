@@ -0,0 +1,29 @@
+#ifndef LINK_QUALITY_H
+#define LINK_QUALITY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LINK_PROFILE_UNKNOWN 0xFF
+#define LINK_NO_BASE_LISTEN  0xFFFF     // Base phase of a neighbor that listens on base throughout
+
+// Per-neighbor link history, fed from every frame we hear directly
+typedef struct {
+    uint8_t id[8];
+    float snr;                      // Smoothed SNR, normalized to 125 kHz (dB)
+    float rssi;                     // Smoothed RSSI (dBm)
+    uint32_t last_heard_ms;
+    uint8_t rx_profile;             // Receive profile the neighbor announced
+    bool base_listens;              // Drops back to the base profile every period...
+    uint32_t base_period_ms;        // ...the current one of which started here
+    bool active;
+} link_entry_t;
+
+void link_quality_init(void);
+void link_quality_update(const uint8_t *id, int rssi, float snr, uint32_t now_ms);
+void link_quality_set_rx_profile(const uint8_t *id, uint8_t profile, uint16_t base_phase_ms, uint32_t now_ms);
+const link_entry_t *link_quality_find(const uint8_t *id);
+const link_entry_t *link_quality_entries(size_t *count);
+
+#endif // LINK_QUALITY_H
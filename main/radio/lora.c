@@ -4,6 +4,11 @@
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_random.h"
+#include "esp_sleep.h"
 #include <string.h>
 
 static const char *TAG = "LORA";
@@ -44,44 +49,310 @@ static const char *TAG = "LORA";
 #define MODE_TX                  0x03
 #define MODE_RX_CONTINUOUS       0x05
 #define MODE_RX_SINGLE           0x06
+#define MODE_CAD                 0x07
 
 // IRQ flags
+#define IRQ_CAD_DETECTED_MASK    0x01
+#define IRQ_CAD_DONE_MASK        0x04
 #define IRQ_TX_DONE_MASK         0x08
 #define IRQ_PAYLOAD_CRC_ERROR_MASK 0x20
 #define IRQ_RX_DONE_MASK         0x40
 
+// DIO0 mapping (REG_DIO_MAPPING_1 bits 7-6)
+#define DIO0_MAP_RX_DONE         0x00
+#define DIO0_MAP_TX_DONE         0x40
+#define DIO0_MAP_CAD_DONE        0x80
+
+// FIFO size of the SX127x
+#define LORA_FIFO_SIZE           256
+
+// Slack added to the computed airtime before a transmission is declared lost
+#define LORA_TX_TIMEOUT_MARGIN_MS 100
+
+// Register write queued as part of a batch
+typedef struct {
+    uint8_t reg;
+    uint8_t value;
+} lora_reg_write_t;
+
 static spi_device_handle_t spi_handle;
 static bool lora_initialized = false;
 
+// Profile the radio listens on, and the one currently programmed
+static lora_modem_params_t rx_params = {
+    .spreading_factor = LORA_SPREADING_FACTOR,
+    .bandwidth_hz = LORA_BANDWIDTH,
+    .coding_rate = LORA_CODING_RATE,
+    .preamble_length = LORA_PREAMBLE_LENGTH,
+};
+static lora_modem_params_t active_params;
+
+// Radio engine state
+static TaskHandle_t radio_task_handle = NULL;
+static SemaphoreHandle_t radio_mutex;       // Serializes register sequences
+static SemaphoreHandle_t tx_done_sem;       // Given by the radio task on TxDone
+static SemaphoreHandle_t cad_done_sem;      // Given by the radio task on CadDone
+static bool cad_detected = false;
+static QueueHandle_t rx_ring;               // Received frames waiting for the mesh layer
+static TaskHandle_t rx_notify_task = NULL;
+static uint32_t rx_notify_bits = 0;
+static bool radio_sleeping = false;
+static lora_mac_stats_t mac_stats;
+static int last_rssi = 0;
+static float last_snr = 0;
+
+// DMA-capable bounce buffer for burst FIFO transfers
+WORD_ALIGNED_ATTR DRAM_ATTR static uint8_t fifo_dma_buf[LORA_FIFO_SIZE];
+
 // SPI communication functions
 static esp_err_t lora_write_register(uint8_t reg, uint8_t value)
 {
     spi_transaction_t trans = {
-        .flags = 0,
+        .flags = SPI_TRANS_USE_TXDATA,
         .cmd = 0,
         .addr = reg | 0x80,  // Write bit
         .length = 8,
         .rxlength = 0,
-        .tx_buffer = &value,
-        .rx_buffer = NULL
+        .tx_data = {value},
     };
-    return spi_device_transmit(spi_handle, &trans);
+    // Single-byte accesses are too short to be worth an interrupt round-trip
+    return spi_device_polling_transmit(spi_handle, &trans);
 }
 
 static esp_err_t lora_read_register(uint8_t reg, uint8_t *value)
 {
     spi_transaction_t trans = {
-        .flags = 0,
+        .flags = SPI_TRANS_USE_RXDATA,
         .cmd = 0,
         .addr = reg & 0x7F,  // Clear write bit
         .length = 8,
         .rxlength = 8,
         .tx_buffer = NULL,
-        .rx_buffer = value
+    };
+    esp_err_t ret = spi_device_polling_transmit(spi_handle, &trans);
+    *value = trans.rx_data[0];
+    return ret;
+}
+
+// Queue a list of register writes back-to-back and collect the results once,
+// so configuration sequences cost one bus acquisition instead of one per register
+static esp_err_t lora_write_registers(const lora_reg_write_t *writes, size_t count)
+{
+    spi_transaction_t trans[LORA_SPI_QUEUE_SIZE];
+    spi_transaction_t *done;
+    esp_err_t ret = spi_device_acquire_bus(spi_handle, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    for (size_t base = 0; base < count && ret == ESP_OK; base += LORA_SPI_QUEUE_SIZE) {
+        size_t batch = count - base;
+        if (batch > LORA_SPI_QUEUE_SIZE) {
+            batch = LORA_SPI_QUEUE_SIZE;
+        }
+
+        size_t queued = 0;
+        for (; queued < batch; queued++) {
+            trans[queued] = (spi_transaction_t) {
+                .flags = SPI_TRANS_USE_TXDATA,
+                .addr = writes[base + queued].reg | 0x80,
+                .length = 8,
+                .tx_data = {writes[base + queued].value},
+            };
+            ret = spi_device_queue_trans(spi_handle, &trans[queued], portMAX_DELAY);
+            if (ret != ESP_OK) {
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < queued; i++) {
+            esp_err_t res = spi_device_get_trans_result(spi_handle, &done, portMAX_DELAY);
+            if (ret == ESP_OK) {
+                ret = res;
+            }
+        }
+    }
+
+    spi_device_release_bus(spi_handle);
+    return ret;
+}
+
+// Burst-write the FIFO in a single DMA transaction
+static esp_err_t lora_write_fifo(const uint8_t *data, size_t len)
+{
+    if (len == 0 || len > LORA_FIFO_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(fifo_dma_buf, data, len);
+    spi_transaction_t trans = {
+        .flags = 0,
+        .cmd = 0,
+        .addr = REG_FIFO | 0x80,
+        .length = len * 8,
+        .rxlength = 0,
+        .tx_buffer = fifo_dma_buf,
+        .rx_buffer = NULL
     };
     return spi_device_transmit(spi_handle, &trans);
 }
 
+// Burst-read the FIFO in a single DMA transaction
+static esp_err_t lora_read_fifo(uint8_t *data, size_t len)
+{
+    if (len == 0 || len > LORA_FIFO_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    spi_transaction_t trans = {
+        .flags = 0,
+        .cmd = 0,
+        .addr = REG_FIFO & 0x7F,
+        .length = len * 8,
+        .rxlength = len * 8,
+        .tx_buffer = NULL,
+        .rx_buffer = fifo_dma_buf
+    };
+    esp_err_t ret = spi_device_transmit(spi_handle, &trans);
+    if (ret == ESP_OK) {
+        memcpy(data, fifo_dma_buf, len);
+    }
+    return ret;
+}
+
+// REG_MODEM_CONFIG_1 bandwidth field (bits 7-4)
+static uint8_t lora_bandwidth_bits(uint32_t bandwidth_hz)
+{
+    static const uint32_t bandwidths[] = {
+        7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000
+    };
+    for (uint8_t i = 0; i < sizeof(bandwidths) / sizeof(bandwidths[0]); i++) {
+        if (bandwidth_hz <= bandwidths[i]) {
+            return i << 4;
+        }
+    }
+    return 9 << 4;
+}
+
+// Program SF/BW/CR/preamble if they differ from the active profile.
+// The radio must be in sleep or standby.
+static esp_err_t lora_apply_modem_params(const lora_modem_params_t *params)
+{
+    if (params->spreading_factor == active_params.spreading_factor &&
+        params->bandwidth_hz == active_params.bandwidth_hz &&
+        params->coding_rate == active_params.coding_rate &&
+        params->preamble_length == active_params.preamble_length) {
+        return ESP_OK;
+    }
+
+    bool low_data_rate = airtime_symbol_us(params) > 16000;
+    const lora_reg_write_t modem_config[] = {
+        { REG_MODEM_CONFIG_1, lora_bandwidth_bits(params->bandwidth_hz) |
+                              ((params->coding_rate - 4) << 1) },
+        { REG_MODEM_CONFIG_2, (params->spreading_factor << 4) | 0x04 },  // CRC on
+        { REG_MODEM_CONFIG_3, (low_data_rate ? 0x08 : 0x00) | 0x04 },    // AGC auto
+        { REG_PREAMBLE_MSB, (params->preamble_length >> 8) & 0xFF },
+        { REG_PREAMBLE_LSB, params->preamble_length & 0xFF },
+    };
+    esp_err_t ret = lora_write_registers(modem_config, sizeof(modem_config) / sizeof(modem_config[0]));
+    if (ret == ESP_OK) {
+        active_params = *params;
+    }
+    return ret;
+}
+
+static void IRAM_ATTR lora_dio0_isr(void *arg)
+{
+    BaseType_t higher_prio_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(radio_task_handle, &higher_prio_woken);
+    portYIELD_FROM_ISR(higher_prio_woken);
+}
+
+// Enter continuous RX with DIO0 signalling RxDone. Caller holds radio_mutex.
+static void lora_start_rx(void)
+{
+    lora_apply_modem_params(&rx_params);
+
+    const lora_reg_write_t rx_config[] = {
+        { REG_DIO_MAPPING_1, DIO0_MAP_RX_DONE },
+        { REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS },
+    };
+    lora_write_registers(rx_config, sizeof(rx_config) / sizeof(rx_config[0]));
+}
+
+// Move one received frame from the FIFO into the RX ring. Caller holds radio_mutex.
+static void lora_drain_rx_frame(void)
+{
+    lora_frame_t frame;
+    uint8_t rx_addr, rssi, snr;
+
+    lora_read_register(REG_RX_NB_BYTES, &frame.length);
+    lora_read_register(REG_FIFO_RX_CURRENT_ADDR, &rx_addr);
+    lora_read_register(REG_PKT_RSSI_VALUE, &rssi);
+    lora_read_register(REG_PKT_SNR_VALUE, &snr);
+    frame.rssi = -164 + rssi;  // Adjust for frequency > 525 MHz
+    frame.snr = ((int8_t)snr) * 0.25f;
+
+    lora_write_register(REG_FIFO_ADDR_PTR, rx_addr);
+    if (lora_read_fifo(frame.data, frame.length) != ESP_OK) {
+        ESP_LOGW(TAG, "FIFO read failed");
+        return;
+    }
+
+    if (xQueueSend(rx_ring, &frame, 0) != pdPASS) {
+        mac_stats.rx_dropped++;
+        ESP_LOGW(TAG, "RX ring full, frame dropped (%lu total)", mac_stats.rx_dropped);
+        return;
+    }
+    mac_stats.rx_frames++;
+
+    if (rx_notify_task) {
+        xTaskNotify(rx_notify_task, rx_notify_bits, eSetBits);
+    }
+}
+
+// Services DIO0 interrupts: drains received frames and completes transmissions
+static void lora_radio_task(void *parameters)
+{
+    uint8_t irq_flags;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        xSemaphoreTake(radio_mutex, portMAX_DELAY);
+        lora_read_register(REG_IRQ_FLAGS, &irq_flags);
+        lora_write_register(REG_IRQ_FLAGS, irq_flags);
+
+        if (irq_flags & IRQ_RX_DONE_MASK) {
+            if (irq_flags & IRQ_PAYLOAD_CRC_ERROR_MASK) {
+                // Most CRC failures are overlapping transmissions
+                mac_stats.rx_crc_errors++;
+                ESP_LOGW(TAG, "CRC error in received message");
+            } else {
+                lora_drain_rx_frame();
+            }
+        }
+
+        if (irq_flags & IRQ_TX_DONE_MASK) {
+            // Radio drops to standby after TX; go straight back to listening
+            if (!radio_sleeping) {
+                lora_start_rx();
+            }
+            xSemaphoreGive(tx_done_sem);
+        }
+
+        if (irq_flags & IRQ_CAD_DONE_MASK) {
+            // Keep listening while the sender decides whether to back off
+            cad_detected = (irq_flags & IRQ_CAD_DETECTED_MASK) != 0;
+            if (!radio_sleeping) {
+                lora_start_rx();
+            }
+            xSemaphoreGive(cad_done_sem);
+        }
+        xSemaphoreGive(radio_mutex);
+    }
+}
+
 esp_err_t lora_init(void)
 {
     esp_err_t ret;
@@ -98,7 +369,12 @@ esp_err_t lora_init(void)
 
     // Configure DIO pins as input
     io_conf.mode = GPIO_MODE_INPUT;
-    io_conf.pin_bit_mask = (1ULL << LORA_DIO0_PIN) | (1ULL << LORA_DIO1_PIN);
+    io_conf.pin_bit_mask = (1ULL << LORA_DIO1_PIN);
+    gpio_config(&io_conf);
+
+    // DIO0 raises RxDone/TxDone and drives the radio task
+    io_conf.intr_type = GPIO_INTR_POSEDGE;
+    io_conf.pin_bit_mask = (1ULL << LORA_DIO0_PIN);
     gpio_config(&io_conf);
 
     // Configure SPI
@@ -108,14 +384,14 @@ esp_err_t lora_init(void)
         .sclk_io_num = LORA_SCK_PIN,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
-        .max_transfer_sz = 256,
+        .max_transfer_sz = LORA_FIFO_SIZE,
     };
 
     spi_device_interface_config_t devcfg = {
-        .clock_speed_hz = 1000000,  // 1 MHz
+        .clock_speed_hz = LORA_SPI_CLOCK_HZ,
         .mode = 0,
         .spics_io_num = LORA_CS_PIN,
-        .queue_size = 7,
+        .queue_size = LORA_SPI_QUEUE_SIZE,
         .address_bits = 8,
     };
 
@@ -145,39 +421,60 @@ esp_err_t lora_init(void)
         return ESP_ERR_NOT_FOUND;
     }
 
-    // Put in sleep mode
+    // Put in sleep mode (LoRa mode can only be selected while sleeping)
     lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_SLEEP);
 
-    // Set frequency
     uint64_t frf = ((uint64_t)LORA_FREQUENCY << 19) / 32000000;
-    lora_write_register(REG_FRF_MSB, (uint8_t)(frf >> 16));
-    lora_write_register(REG_FRF_MID, (uint8_t)(frf >> 8));
-    lora_write_register(REG_FRF_LSB, (uint8_t)(frf >> 0));
+    const lora_reg_write_t config[] = {
+        // Set frequency
+        { REG_FRF_MSB, (uint8_t)(frf >> 16) },
+        { REG_FRF_MID, (uint8_t)(frf >> 8) },
+        { REG_FRF_LSB, (uint8_t)(frf >> 0) },
+        // Set sync word
+        { 0x39, LORA_SYNC_WORD },
+        // Set FIFO base addresses
+        { REG_FIFO_TX_BASE_ADDR, 0 },
+        { REG_FIFO_RX_BASE_ADDR, 0 },
+    };
+    ret = lora_write_registers(config, sizeof(config) / sizeof(config[0]));
+    if (ret == ESP_OK) {
+        // Set spreading factor, bandwidth, coding rate and preamble
+        ret = lora_apply_modem_params(&rx_params);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Modem configuration failed");
+        return ret;
+    }
 
     // Set TX power
     lora_set_power(LORA_TX_POWER);
 
-    // Set spreading factor, bandwidth, and coding rate
-    lora_write_register(REG_MODEM_CONFIG_1, 
-        ((LORA_BANDWIDTH == 125000) ? 0x70 : 0x80) | 
-        ((LORA_CODING_RATE - 4) << 1));
-    
-    lora_write_register(REG_MODEM_CONFIG_2, 
-        (LORA_SPREADING_FACTOR << 4) | 0x04);
-
-    // Set preamble length
-    lora_write_register(REG_PREAMBLE_MSB, (LORA_PREAMBLE_LENGTH >> 8) & 0xFF);
-    lora_write_register(REG_PREAMBLE_LSB, LORA_PREAMBLE_LENGTH & 0xFF);
+    // Create radio engine
+    radio_mutex = xSemaphoreCreateMutex();
+    tx_done_sem = xSemaphoreCreateBinary();
+    cad_done_sem = xSemaphoreCreateBinary();
+    rx_ring = xQueueCreate(LORA_RX_RING_DEPTH, sizeof(lora_frame_t));
+    if (radio_mutex == NULL || tx_done_sem == NULL || cad_done_sem == NULL || rx_ring == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate radio engine");
+        return ESP_ERR_NO_MEM;
+    }
 
-    // Set sync word
-    lora_write_register(0x39, LORA_SYNC_WORD);
+    if (xTaskCreate(lora_radio_task, "lora_radio", 3072, NULL, 6, &radio_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create radio task");
+        return ESP_ERR_NO_MEM;
+    }
 
-    // Set FIFO base addresses
-    lora_write_register(REG_FIFO_TX_BASE_ADDR, 0);
-    lora_write_register(REG_FIFO_RX_BASE_ADDR, 0);
+    ret = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {  // Already installed is fine
+        ESP_LOGE(TAG, "GPIO ISR service install failed");
+        return ret;
+    }
+    gpio_isr_handler_add(LORA_DIO0_PIN, lora_dio0_isr, NULL);
 
-    // Put in standby mode
-    lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+    // Listen by default
+    xSemaphoreTake(radio_mutex, portMAX_DELAY);
+    lora_start_rx();
+    xSemaphoreGive(radio_mutex);
 
     lora_initialized = true;
     ESP_LOGI(TAG, "LoRa initialized successfully (version: 0x%02X)", version);
@@ -185,121 +482,182 @@ esp_err_t lora_init(void)
     return ESP_OK;
 }
 
-esp_err_t lora_send_message(const mesh_message_t *message)
+// Run Channel Activity Detection on the given profile; sets *busy when a
+// LoRa preamble was detected
+static esp_err_t lora_channel_activity(const lora_modem_params_t *params, bool *busy)
 {
-    if (!lora_initialized) {
-        return ESP_ERR_INVALID_STATE;
-    }
+    xSemaphoreTake(radio_mutex, portMAX_DELAY);
+    xSemaphoreTake(cad_done_sem, 0);  // Discard a stale completion
 
-    // Calculate total message size
-    size_t msg_size = sizeof(mesh_message_t);
-    
-    // Put in standby mode
     lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
-
-    // Set FIFO address pointer
-    lora_write_register(REG_FIFO_ADDR_PTR, 0);
-
-    // Write message to FIFO
-    const uint8_t *data = (const uint8_t *)message;
-    for (size_t i = 0; i < msg_size; i++) {
-        lora_write_register(REG_FIFO, data[i]);
+    lora_apply_modem_params(params);
+    const lora_reg_write_t cad_start[] = {
+        { REG_DIO_MAPPING_1, DIO0_MAP_CAD_DONE },
+        { REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_CAD },
+    };
+    lora_write_registers(cad_start, sizeof(cad_start) / sizeof(cad_start[0]));
+    xSemaphoreGive(radio_mutex);
+
+    mac_stats.cad_runs++;
+
+    // CAD takes roughly two symbols
+    uint32_t timeout_ms = 2 * airtime_symbol_us(params) / 1000 + LORA_TX_TIMEOUT_MARGIN_MS;
+    if (xSemaphoreTake(cad_done_sem, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        xSemaphoreTake(radio_mutex, portMAX_DELAY);
+        if (!radio_sleeping) {
+            lora_start_rx();
+        }
+        xSemaphoreGive(radio_mutex);
+        return ESP_ERR_TIMEOUT;
     }
 
-    // Set payload length
-    lora_write_register(REG_PAYLOAD_LENGTH, msg_size);
-
-    // Start transmission
-    lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_TX);
-
-    // Wait for TX done (with timeout)
-    uint8_t irq_flags;
-    int timeout = 10000;  // 10 seconds
-    do {
-        lora_read_register(REG_IRQ_FLAGS, &irq_flags);
-        vTaskDelay(pdMS_TO_TICKS(1));
-        timeout--;
-    } while (!(irq_flags & IRQ_TX_DONE_MASK) && timeout > 0);
+    *busy = cad_detected;
+    return ESP_OK;
+}
 
-    // Clear IRQ flags
-    lora_write_register(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
+static esp_err_t lora_transmit(const uint8_t *data, size_t length, const lora_modem_params_t *params)
+{
+    xSemaphoreTake(radio_mutex, portMAX_DELAY);
+    xSemaphoreTake(tx_done_sem, 0);  // Discard a stale completion
+
+    // Put in standby mode and route TxDone to DIO0
+    const lora_reg_write_t tx_setup[] = {
+        { REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY },
+        { REG_DIO_MAPPING_1, DIO0_MAP_TX_DONE },
+        { REG_FIFO_ADDR_PTR, 0 },
+    };
+    lora_write_registers(tx_setup, sizeof(tx_setup) / sizeof(tx_setup[0]));
+    lora_apply_modem_params(params);
 
-    // Put back in standby
-    lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+    // Write message to FIFO
+    esp_err_t ret = lora_write_fifo(data, length);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "FIFO write failed (%d bytes)", length);
+        if (!radio_sleeping) {
+            lora_start_rx();
+        }
+        xSemaphoreGive(radio_mutex);
+        return ret;
+    }
 
-    if (timeout <= 0) {
+    // Set payload length and start transmission
+    const lora_reg_write_t tx_start[] = {
+        { REG_PAYLOAD_LENGTH, (uint8_t)length },
+        { REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_TX },
+    };
+    lora_write_registers(tx_start, sizeof(tx_start) / sizeof(tx_start[0]));
+    xSemaphoreGive(radio_mutex);
+
+    // Radio task signals completion from the DIO0 interrupt
+    uint32_t timeout_ms = airtime_us(params, length) / 1000 + LORA_TX_TIMEOUT_MARGIN_MS;
+    if (xSemaphoreTake(tx_done_sem, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        xSemaphoreTake(radio_mutex, portMAX_DELAY);
+        lora_write_register(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
+        if (!radio_sleeping) {
+            lora_start_rx();
+        }
+        xSemaphoreGive(radio_mutex);
+        mac_stats.tx_timeouts++;
         ESP_LOGE(TAG, "TX timeout");
         return ESP_ERR_TIMEOUT;
     }
 
-    ESP_LOGD(TAG, "Message sent successfully");
+    mac_stats.tx_frames++;
+    ESP_LOGD(TAG, "Frame sent successfully (%d bytes)", length);
     return ESP_OK;
 }
 
-esp_err_t lora_receive_message(mesh_message_t *message, uint32_t timeout_ms)
+// One busy CAD for a frame: a random number of slots from a contention window
+// that doubles per busy attempt, or 0 once the frame has had LORA_LBT_MAX_ATTEMPTS
+uint32_t lora_lbt_backoff_ms(lora_lbt_t *lbt, const lora_modem_params_t *params)
 {
-    if (!lora_initialized) {
-        return ESP_ERR_INVALID_STATE;
+    mac_stats.cad_busy++;
+    if (++lbt->attempts >= LORA_LBT_MAX_ATTEMPTS) {
+        mac_stats.tx_dropped_busy++;
+        ESP_LOGW(TAG, "Channel busy, frame dropped after %d attempts", lbt->attempts);
+        *lbt = (lora_lbt_t) {0};
+        return 0;
+    }
+    if (lbt->window == 0) {
+        lbt->window = LORA_LBT_CW_MIN;
     }
 
-    // Put in continuous RX mode
-    lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
-
-    uint8_t irq_flags;
-    uint32_t start_time = xTaskGetTickCount();
-    
-    // Wait for RX done or timeout
-    do {
-        lora_read_register(REG_IRQ_FLAGS, &irq_flags);
-        vTaskDelay(pdMS_TO_TICKS(10));
-    } while (!(irq_flags & IRQ_RX_DONE_MASK) && 
-             (xTaskGetTickCount() - start_time) < pdMS_TO_TICKS(timeout_ms));
+    // A slot covers a preamble plus header, long enough for an ongoing frame to be detectable
+    uint32_t slot_ms = airtime_symbol_us(params) * (params->preamble_length + 12) / 1000 + 1;
+    uint32_t slots = 1 + esp_random() % lbt->window;
+    mac_stats.backoff_slots += slots;
 
-    if (!(irq_flags & IRQ_RX_DONE_MASK)) {
-        lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
-        return ESP_ERR_TIMEOUT;
+    if (lbt->window < LORA_LBT_CW_MAX) {
+        lbt->window *= 2;
     }
+    return slots * slot_ms;
+}
 
-    // Check for CRC error
-    if (irq_flags & IRQ_PAYLOAD_CRC_ERROR_MASK) {
-        lora_write_register(REG_IRQ_FLAGS, IRQ_RX_DONE_MASK | IRQ_PAYLOAD_CRC_ERROR_MASK);
-        lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
-        ESP_LOGW(TAG, "CRC error in received message");
-        return ESP_ERR_INVALID_CRC;
+// Listen before talk: transmit once CAD finds the channel clear. A busy
+// channel returns ESP_ERR_NOT_FINISHED with *backoff_ms set by
+// lora_lbt_backoff_ms(); the caller retries the same frame, with the same
+// lbt, after that, so the driver never sleeps through the backoff. A NULL
+// lbt gives the frame a single attempt.
+esp_err_t lora_send_frame(const uint8_t *data, size_t length, const lora_modem_params_t *params,
+                          lora_lbt_t *lbt, uint32_t *backoff_ms)
+{
+    *backoff_ms = 0;
+    if (!lora_initialized) {
+        return ESP_ERR_INVALID_STATE;
     }
-
-    // Get received bytes count
-    uint8_t rx_bytes;
-    lora_read_register(REG_RX_NB_BYTES, &rx_bytes);
-
-    if (rx_bytes != sizeof(mesh_message_t)) {
-        lora_write_register(REG_IRQ_FLAGS, IRQ_RX_DONE_MASK);
-        lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
-        ESP_LOGW(TAG, "Received message size mismatch: %d", rx_bytes);
+    if (length == 0 || length > LORA_MAX_PAYLOAD) {
         return ESP_ERR_INVALID_SIZE;
     }
+    if (params == NULL) {
+        params = &rx_params;
+    }
 
-    // Set FIFO pointer to received message
-    uint8_t rx_addr;
-    lora_read_register(REG_FIFO_RX_CURRENT_ADDR, &rx_addr);
-    lora_write_register(REG_FIFO_ADDR_PTR, rx_addr);
-
-    // Read message from FIFO
-    uint8_t *data = (uint8_t *)message;
-    for (int i = 0; i < rx_bytes; i++) {
-        lora_read_register(REG_FIFO, &data[i]);
+#if LORA_LBT_ENABLED
+    bool busy = false;
+    if (lora_channel_activity(params, &busy) != ESP_OK) {
+        ESP_LOGW(TAG, "CAD timeout, transmitting anyway");
+    } else if (busy) {
+        if (lbt == NULL) {
+            mac_stats.cad_busy++;
+            return ESP_ERR_TIMEOUT;
+        }
+        *backoff_ms = lora_lbt_backoff_ms(lbt, params);
+        return *backoff_ms > 0 ? ESP_ERR_NOT_FINISHED : ESP_ERR_TIMEOUT;
+    }
+    if (lbt != NULL) {
+        *lbt = (lora_lbt_t) {0};
     }
+#endif
 
-    // Clear IRQ flags
-    lora_write_register(REG_IRQ_FLAGS, IRQ_RX_DONE_MASK);
+    return lora_transmit(data, length, params);
+}
 
-    // Put back in standby
-    lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+void lora_get_mac_stats(lora_mac_stats_t *stats)
+{
+    *stats = mac_stats;
+}
 
-    ESP_LOGD(TAG, "Message received successfully (%d bytes)", rx_bytes);
+esp_err_t lora_receive_frame(lora_frame_t *frame, uint32_t timeout_ms)
+{
+    if (!lora_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (xQueueReceive(rx_ring, frame, pdMS_TO_TICKS(timeout_ms)) != pdPASS) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    last_rssi = frame->rssi;
+    last_snr = frame->snr;
     return ESP_OK;
 }
 
+void lora_set_rx_notify(TaskHandle_t task, uint32_t notify_bits)
+{
+    rx_notify_task = task;
+    rx_notify_bits = notify_bits;
+}
+
 esp_err_t lora_set_power(int8_t power)
 {
     if (power < 2) power = 2;
@@ -311,24 +669,79 @@ esp_err_t lora_set_power(int8_t power)
 
 esp_err_t lora_sleep(void)
 {
-    return lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_SLEEP);
+    xSemaphoreTake(radio_mutex, portMAX_DELAY);
+    radio_sleeping = true;
+    esp_err_t ret = lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_SLEEP);
+    xSemaphoreGive(radio_mutex);
+    return ret;
 }
 
 esp_err_t lora_wake(void)
 {
-    return lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+    xSemaphoreTake(radio_mutex, portMAX_DELAY);
+    radio_sleeping = false;
+    lora_start_rx();
+    xSemaphoreGive(radio_mutex);
+    return ESP_OK;
+}
+
+// Light sleep: a frame arriving raises DIO0, which must wake the CPU. Wakeup
+// needs a level trigger, so the edge interrupt is held off meanwhile.
+void lora_arm_wakeup(void)
+{
+    if (!lora_initialized) {
+        return;
+    }
+    gpio_intr_disable(LORA_DIO0_PIN);
+    gpio_wakeup_enable(LORA_DIO0_PIN, GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+}
+
+void lora_disarm_wakeup(void)
+{
+    if (!lora_initialized) {
+        return;
+    }
+    gpio_wakeup_disable(LORA_DIO0_PIN);
+    gpio_set_intr_type(LORA_DIO0_PIN, GPIO_INTR_POSEDGE);
+    gpio_intr_enable(LORA_DIO0_PIN);
+
+    // The edge passed while we slept; hand it to the radio task now
+    if (gpio_get_level(LORA_DIO0_PIN) && radio_task_handle != NULL) {
+        xTaskNotifyGive(radio_task_handle);
+    }
 }
 
+esp_err_t lora_set_rx_params(const lora_modem_params_t *params)
+{
+    if (!lora_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(radio_mutex, portMAX_DELAY);
+    rx_params = *params;
+    if (!radio_sleeping) {
+        lora_write_register(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_STDBY);
+        lora_start_rx();
+    }
+    xSemaphoreGive(radio_mutex);
+
+    ESP_LOGI(TAG, "Listening on SF%d / %lu Hz", params->spreading_factor, params->bandwidth_hz);
+    return ESP_OK;
+}
+
+const lora_modem_params_t *lora_get_modem_params(void)
+{
+    return &rx_params;
+}
+
+// Signal quality of the most recently received frame
 int lora_get_rssi(void)
 {
-    uint8_t rssi;
-    lora_read_register(REG_PKT_RSSI_VALUE, &rssi);
-    return -164 + rssi;  // Adjust for frequency > 525 MHz
+    return last_rssi;
 }
 
 float lora_get_snr(void)
 {
-    uint8_t snr;
-    lora_read_register(REG_PKT_SNR_VALUE, &snr);
-    return ((int8_t)snr) * 0.25;
+    return last_snr;
 }
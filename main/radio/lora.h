@@ -2,15 +2,57 @@
 #define LORA_H
 
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "device_config.h"
+#include "airtime.h"
+
+// Largest payload the SX127x can carry in one packet
+#define LORA_MAX_PAYLOAD 255
+
+// Frame drained from the radio by the DIO0 handler
+typedef struct {
+    uint8_t length;
+    int16_t rssi;                   // Packet RSSI (dBm)
+    float snr;                      // Packet SNR (dB)
+    uint8_t data[LORA_MAX_PAYLOAD];
+} lora_frame_t;
+
+// Channel access and reception counters
+typedef struct {
+    uint32_t tx_frames;
+    uint32_t tx_timeouts;
+    uint32_t tx_dropped_busy;       // Gave up after LORA_LBT_MAX_ATTEMPTS busy CADs
+    uint32_t cad_runs;
+    uint32_t cad_busy;              // CAD detected another transmission
+    uint32_t backoff_slots;
+    uint32_t rx_frames;
+    uint32_t rx_crc_errors;         // Mostly collisions
+    uint32_t rx_dropped;            // RX ring overflow
+} lora_mac_stats_t;
+
+// Listen-before-talk progress of one frame, kept with it across retries;
+// zeroed for a new frame
+typedef struct {
+    uint8_t attempts;               // Busy CADs so far
+    uint8_t window;                 // Contention window for the next busy CAD (slots), 0 for the first
+} lora_lbt_t;
 
 // Function prototypes
 esp_err_t lora_init(void);
-esp_err_t lora_send_message(const mesh_message_t *message);
-esp_err_t lora_receive_message(mesh_message_t *message, uint32_t timeout_ms);
+esp_err_t lora_send_frame(const uint8_t *data, size_t length, const lora_modem_params_t *params,
+                          lora_lbt_t *lbt, uint32_t *backoff_ms);
+uint32_t lora_lbt_backoff_ms(lora_lbt_t *lbt, const lora_modem_params_t *params);
+esp_err_t lora_receive_frame(lora_frame_t *frame, uint32_t timeout_ms);
+void lora_set_rx_notify(TaskHandle_t task, uint32_t notify_bits);
 esp_err_t lora_set_power(int8_t power);
 esp_err_t lora_sleep(void);
 esp_err_t lora_wake(void);
+void lora_arm_wakeup(void);
+void lora_disarm_wakeup(void);
+esp_err_t lora_set_rx_params(const lora_modem_params_t *params);
+const lora_modem_params_t *lora_get_modem_params(void);
+void lora_get_mac_stats(lora_mac_stats_t *stats);
 int lora_get_rssi(void);
 float lora_get_snr(void);
 
@@ -1,30 +1,71 @@
 #include "mesh.h"
 #include "lora.h"
+#include "wire.h"
+#include "airtime.h"
+#include "duty_cycle.h"
+#include "link_quality.h"
+#include "adr.h"
+#include "route_table.h"
+#include "dedup.h"
+#include "aodv.h"
+#include "flood.h"
+#include "delivery.h"
+#include "tx_sched.h"
+#include "frag.h"
+#include "beacon.h"
+#include "timer_wheel.h"
+#include "crc.h"
+#include "power_mgmt.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
 
 static const char *TAG = "MESH";
 
+// mesh_task notification bits
+#define MESH_NOTIFY_RX          (1 << 0)    // Radio task queued a received frame
+#define MESH_NOTIFY_TX          (1 << 1)    // A message was queued for transmission
+#define MESH_NOTIFY_ALL         (MESH_NOTIFY_RX | MESH_NOTIFY_TX)
+
 // Global variables
-static route_entry_t route_table[MAX_ROUTES];
-static mesh_message_t message_queue[MAX_MESSAGES];
 static uint8_t device_id[8];
 static uint32_t message_counter = 0;
 static mesh_message_callback_t message_callback = NULL;
+static mesh_payload_callback_t payload_callback = NULL;
 static TaskHandle_t mesh_task_handle = NULL;
-static QueueHandle_t tx_queue;
+static uint8_t rx_profile;              // ADR profile we are listening on
+static uint8_t announced_rx_profile;    // Profile our latest beacon announced
+static bool base_listening;             // In a base-profile listen window
+static uint32_t base_listen_toggle_ms;  // When that window next opens or closes
+static mesh_tx_stats_t tx_stats;
 
 // Forward declarations
 static void mesh_task(void *parameters);
-static void mesh_handle_received_message(const mesh_message_t *message);
+static void mesh_handle_received_message(msg_handle_t handle, const wire_link_t *link, float snr);
 static void mesh_send_beacon(void);
-static bool mesh_is_message_duplicate(uint32_t msg_id, const uint8_t *sender_id);
+static uint32_t mesh_try_transmit(msg_handle_t handle, tx_sched_ticket_t *ticket);
+static void mesh_forward(msg_handle_t handle);
+static void mesh_handle_payload(const uint8_t *sender_id, const uint8_t *recipient_id, uint32_t transfer_id,
+                                uint8_t type, const uint8_t *data, size_t length);
+
+static uint32_t mesh_now_ms(void)
+{
+    return pdTICKS_TO_MS(xTaskGetTickCount());
+}
+
+static bool mesh_is_broadcast(const uint8_t *recipient_id)
+{
+    for (int i = 0; i < 8; i++) {
+        if (recipient_id[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
 
 esp_err_t mesh_init(void)
 {
@@ -32,15 +73,46 @@ esp_err_t mesh_init(void)
     esp_wifi_get_mac(WIFI_IF_STA, device_id);
     
     // Initialize route table
-    memset(route_table, 0, sizeof(route_table));
+    if (route_table_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create route table");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    // Beacon fast until the neighborhood agrees on who is out there
+    beacon_init(mesh_now_ms());
+    
+    // Initialize duplicate suppression
+    dedup_init(mesh_now_ms());
+    
+    // Start with a full airtime budget
+    duty_cycle_init(mesh_now_ms());
+    
+    // Routes beyond direct neighbors are discovered on demand
+    aodv_init();
     
-    // Initialize message queue
-    memset(message_queue, 0, sizeof(message_queue));
+    // Broadcasts reach beyond one hop through managed flooding
+    flood_init();
     
-    // Create TX queue for outgoing messages
-    tx_queue = xQueueCreate(10, sizeof(mesh_message_t));
-    if (tx_queue == NULL) {
-        ESP_LOGE(TAG, "Failed to create TX queue");
+    // Unicast text is retransmitted until acknowledged
+    if (delivery_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create delivery tracking");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    // Payloads larger than one frame travel as fragments
+    frag_init();
+    frag_set_callback(mesh_handle_payload);
+    
+    // Listen on the network's base profile until neighbors are known
+    link_quality_init();
+    adr_init();
+    rx_profile = adr_base_profile();
+    announced_rx_profile = rx_profile;
+    base_listening = false;
+    
+    // Create the shared message buffers and the priority scheduler for outgoing messages
+    if (msg_pool_init() != ESP_OK || tx_sched_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create TX scheduler");
         return ESP_ERR_NO_MEM;
     }
     
@@ -50,6 +122,9 @@ esp_err_t mesh_init(void)
         return ESP_ERR_NO_MEM;
     }
     
+    // Radio task wakes us when frames land in its RX ring
+    lora_set_rx_notify(mesh_task_handle, MESH_NOTIFY_RX);
+    
     ESP_LOGI(TAG, "Mesh network initialized");
     ESP_LOGI(TAG, "Device ID: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X",
              device_id[0], device_id[1], device_id[2], device_id[3],
@@ -58,130 +133,537 @@ esp_err_t mesh_init(void)
     return ESP_OK;
 }
 
+// Handle everything the radio task has received
+static void mesh_receive_frames(void)
+{
+    lora_frame_t frame;
+    wire_link_t link;
+    
+    while (lora_receive_frame(&frame, 0) == ESP_OK) {
+        // Radio traffic keeps us awake for the replies and relays it causes
+        power_mgmt_activity_notify();
+        
+        float snr = adr_normalize_snr(frame.snr, lora_get_modem_params()->bandwidth_hz);
+        bool link_updated = false;
+        size_t offset = 0;
+        
+        // An aggregate frame yields one message per record
+        while (offset < frame.length) {
+            // Decode straight into a pool buffer so relaying needs no further copy
+            msg_handle_t handle = msg_pool_alloc();
+            if (handle == MSG_HANDLE_NONE) {
+                break;
+            }
+            esp_err_t ret = wire_decode_next(frame.data, frame.length, &offset, msg_pool_get(handle), &link);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "Malformed frame (%d bytes): %s", frame.length, esp_err_to_name(ret));
+                msg_pool_release(handle);
+                continue;
+            }
+            
+            // Every frame heard directly tells us about the link to its transmitter
+            if (!link_updated) {
+                link_quality_update(link.transmitter_id, frame.rssi, snr, mesh_now_ms());
+                link_updated = true;
+            }
+            
+            mesh_handle_received_message(handle, &link, snr);
+            msg_pool_release(handle);
+        }
+    }
+}
+
+static uint32_t mesh_min_wait(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+// Newcomers only know the base profile, so a node listening faster than that
+// drops back to it for a window every period; returns the time to the next toggle
+static uint32_t mesh_base_listen(uint32_t now_ms)
+{
+    if (rx_profile == adr_base_profile()) {
+        return UINT32_MAX;
+    }
+    
+    if ((int32_t)(now_ms - base_listen_toggle_ms) >= 0) {
+        base_listening = !base_listening;
+        base_listen_toggle_ms = now_ms + (base_listening ? ADR_BASE_LISTEN_MS
+                                                         : ADR_BASE_LISTEN_PERIOD_MS - ADR_BASE_LISTEN_MS);
+        lora_set_rx_params(adr_profile_params(base_listening ? adr_base_profile() : rx_profile));
+    }
+    return base_listen_toggle_ms - now_ms;
+}
+
+// Run every protocol timer that is due; returns the time until the next one
+static uint32_t mesh_run_timers(uint32_t now_ms)
+{
+    msg_handle_t handle;
+    
+    // Route and neighbor expiry, retransmissions and anything else on the shared wheel
+    uint32_t wait_ms = timer_wheel_run();
+    
+    // Beacon on the Trickle schedule; a receive profile change must be announced promptly
+    if (adr_select_rx_profile() != announced_rx_profile) {
+        beacon_inconsistent(now_ms);
+    }
+    if (beacon_due(now_ms)) {
+        mesh_send_beacon();
+    }
+    wait_ms = mesh_min_wait(wait_ms, beacon_wait_ms(now_ms));
+    wait_ms = mesh_min_wait(wait_ms, mesh_base_listen(now_ms));
+    
+    // Relay broadcasts whose backoff expired without enough neighbors relaying first
+    while ((handle = flood_take_due(now_ms)) != MSG_HANDLE_NONE) {
+        mesh_forward(handle);
+        msg_pool_release(handle);
+    }
+    wait_ms = mesh_min_wait(wait_ms, flood_wait_ms(now_ms));
+    
+    // Retry or give up on route discoveries
+    wait_ms = mesh_min_wait(wait_ms, aodv_process(now_ms));
+    
+    // Feed outgoing fragments and re-request missing incoming ones
+    return mesh_min_wait(wait_ms, frag_process(now_ms));
+}
+
+// Send the most urgent message; a class held back by the duty cycle
+// keeps its place while the classes behind it go ahead
+static bool mesh_transmit_next(void)
+{
+    msg_handle_t handle;
+    tx_sched_ticket_t ticket;
+    
+    while ((handle = tx_sched_peek(&ticket, mesh_now_ms())) != MSG_HANDLE_NONE) {
+        uint32_t wait_ms = mesh_try_transmit(handle, &ticket);
+        msg_pool_release(handle);
+        if (wait_ms > 0) {
+            tx_sched_defer(&ticket, mesh_now_ms() + wait_ms);
+        } else {
+            tx_sched_complete(&ticket, mesh_now_ms());
+            return true;
+        }
+    }
+    return false;
+}
+
+// Event loop: drain received frames, fire due timers, send one frame, and
+// block only when nothing is ready, until the next event or deadline
 static void mesh_task(void *parameters)
 {
-    mesh_message_t message;
-    TickType_t last_beacon_time = 0;
-    const TickType_t beacon_interval = pdMS_TO_TICKS(MESH_BEACON_INTERVAL);
+    wheel_timer_t wake_timer;
+    timer_wheel_setup(&wake_timer, NULL, NULL);
     
     while (1) {
-        // Send beacon periodically
-        if (xTaskGetTickCount() - last_beacon_time >= beacon_interval) {
-            mesh_send_beacon();
-            last_beacon_time = xTaskGetTickCount();
-        }
+        mesh_receive_frames();
+        uint32_t wait_ms = mesh_run_timers(mesh_now_ms());
         
-        // Process outgoing messages
-        if (xQueueReceive(tx_queue, &message, pdMS_TO_TICKS(100)) == pdPASS) {
-            lora_send_message(&message);
-            ESP_LOGD(TAG, "Sent message ID: %lu", message.id);
+        // Whatever was just sent, received or timed out may have made more work ready
+        if (mesh_transmit_next()) {
+            continue;
         }
         
-        // Listen for incoming messages
-        if (lora_receive_message(&message, 100) == ESP_OK) {
-            mesh_handle_received_message(&message);
+        wait_ms = mesh_min_wait(wait_ms, tx_sched_wait_ms(mesh_now_ms()));
+        if (wait_ms == UINT32_MAX) {
+            timer_wheel_cancel(&wake_timer);
+            xTaskNotifyWait(0, MESH_NOTIFY_ALL, NULL, portMAX_DELAY);
+        } else if (wait_ms > 0) {
+            // Our own deadlines go on the wheel too, so power management
+            // never sleeps through them
+            timer_wheel_start(&wake_timer, wait_ms);
+            
+            // Round up so a deadline is never woken for early and spun on
+            xTaskNotifyWait(0, MESH_NOTIFY_ALL, NULL, pdMS_TO_TICKS(wait_ms + portTICK_PERIOD_MS - 1));
+        }
+    }
+}
+
+// Which queued messages may share a frame with the one being sent
+typedef struct {
+    bool is_broadcast;
+    uint8_t next_hop[8];
+    size_t budget;                  // Frame bytes still free
+} mesh_aggregate_ctx_t;
+
+static bool mesh_aggregate_match(const mesh_message_t *message, void *ctx)
+{
+    mesh_aggregate_ctx_t *agg = ctx;
+    
+    // Unicast joins only when its route already leads through the same neighbor
+    if (agg->is_broadcast != mesh_is_broadcast(message->recipient_id)) {
+        return false;
+    }
+    if (!agg->is_broadcast) {
+        route_entry_t *route = mesh_find_route(message->recipient_id);
+        if (route == NULL || memcmp(route->next_hop, agg->next_hop, 8) != 0) {
+            return false;
+        }
+    }
+    
+    size_t record_size = wire_aggregate_record_size(message);
+    if (record_size > agg->budget) {
+        return false;
+    }
+    agg->budget -= record_size;
+    return true;
+}
+
+// Where a beacon's announced profile puts us in the base-listen cycle, so
+// neighbors know when we are back on the base profile
+static void mesh_stamp_beacon(mesh_message_t *beacon, uint32_t now_ms)
+{
+    uint16_t phase_ms = LINK_NO_BASE_LISTEN;
+    if (beacon->payload[0] != adr_base_profile()) {
+        if (beacon->payload[0] != rx_profile) {
+            // Switching once this beacon is out starts a period just past its window
+            phase_ms = ADR_BASE_LISTEN_MS;
+        } else {
+            int32_t to_toggle_ms = (int32_t)(base_listen_toggle_ms - now_ms);
+            if (to_toggle_ms < 0) {
+                to_toggle_ms = 0;
+            }
+            phase_ms = (base_listening ? ADR_BASE_LISTEN_MS : ADR_BASE_LISTEN_PERIOD_MS) - to_toggle_ms;
+        }
+    }
+    beacon->payload[1] = phase_ms & 0xFF;
+    beacon->payload[2] = phase_ms >> 8;
+    beacon->checksum = mesh_calculate_checksum(beacon);
+}
+
+// When every neighbor listens faster than the base profile, a newcomer would
+// never hear our beacons; repeat the beacon alone on the base profile for it
+static void mesh_send_base_beacon(mesh_message_t *beacon, uint8_t sent_profile, uint32_t now_ms)
+{
+    if (sent_profile == adr_base_profile()) {
+        return;
+    }
+    
+    mesh_stamp_beacon(beacon, now_ms);
+    wire_link_t link = {0};
+    memcpy(link.transmitter_id, device_id, 8);
+    uint8_t frame[LORA_MAX_PAYLOAD];
+    size_t frame_len;
+    if (wire_encode(beacon, &link, frame, sizeof(frame), &frame_len) != ESP_OK) {
+        return;
+    }
+    
+    // Best effort: the next beacon gets another chance if the budget is short
+    const lora_modem_params_t *params = adr_profile_params(adr_base_profile());
+    uint32_t air_us = airtime_us(params, frame_len);
+    if (duty_cycle_wait_ms(LORA_FREQUENCY, air_us, DUTY_PRIORITY_LOW, now_ms) > 0) {
+        return;
+    }
+    uint32_t backoff_ms;
+    if (lora_send_frame(frame, frame_len, params, NULL, &backoff_ms) == ESP_OK) {
+        duty_cycle_consume(LORA_FREQUENCY, air_us, now_ms);
+        tx_stats.frames++;
+    }
+}
+
+// Send now if the duty-cycle budget and the channel allow, otherwise return how long to wait.
+// Queued messages for the same next hop go out in the same frame when possible.
+static uint32_t mesh_try_transmit(msg_handle_t handle, tx_sched_ticket_t *ticket)
+{
+    const mesh_message_t *message = msg_pool_get(handle);
+    uint32_t now_ms = mesh_now_ms();
+    wire_link_t link = {0};
+    memcpy(link.transmitter_id, device_id, 8);
+    
+    bool is_broadcast = mesh_is_broadcast(message->recipient_id);
+    
+    // Unicast is handed to one neighbor on the route, discovering it first if needed
+    if (!is_broadcast) {
+        aodv_route_status_t status = aodv_resolve(handle, link.next_hop_id);
+        if (status != AODV_ROUTE_FOUND) {
+            ESP_LOGD(TAG, "No route yet for message ID %lu", message->id);
+            return 0;
         }
+        link.has_next_hop = true;
+    }
+    
+    // Unicast goes at the rate the next hop listens on, broadcast at the slowest neighbor's
+    uint8_t profile = is_broadcast ? adr_broadcast_profile(now_ms) : adr_tx_profile(link.next_hop_id, now_ms);
+    const lora_modem_params_t *params = adr_profile_params(profile);
+    
+    // Look for companions; only an aggregate can fit them
+    msg_handle_t companions[AGG_MAX_RECORDS - 1];
+    tx_sched_ticket_t companion_tickets[AGG_MAX_RECORDS - 1];
+    size_t companion_count = 0;
+    size_t head_record = wire_aggregate_record_size(message);
+    if (AGG_ENABLED && wire_aggregate_header_size(&link) + head_record <= LORA_MAX_PAYLOAD) {
+        mesh_aggregate_ctx_t agg = {
+            .is_broadcast = is_broadcast,
+            .budget = LORA_MAX_PAYLOAD - wire_aggregate_header_size(&link) - head_record,
+        };
+        memcpy(agg.next_hop, link.next_hop_id, 8);
+        companion_count = tx_sched_collect(ticket, mesh_aggregate_match, &agg,
+                                           companions, companion_tickets, AGG_MAX_RECORDS - 1);
         
-        // Cleanup old routes
-        mesh_cleanup_old_routes();
+        // A lone message waits briefly for others to share its preamble with
+        if (companion_count == 0 && message->message_type != MSG_TYPE_EMERGENCY &&
+            now_ms - ticket->enqueued_ms < AGG_WINDOW_MS) {
+            return AGG_WINDOW_MS - (now_ms - ticket->enqueued_ms);
+        }
+    }
+    
+    // A beacon's base-listen phase is stamped as it goes out, not when it was queued
+    mesh_message_t *beacon = message->message_type == MSG_TYPE_BEACON ? msg_pool_get(handle) : NULL;
+    for (size_t i = 0; i < companion_count; i++) {
+        if (msg_pool_get(companions[i])->message_type == MSG_TYPE_BEACON) {
+            beacon = msg_pool_get(companions[i]);
+        }
+    }
+    if (beacon != NULL) {
+        mesh_stamp_beacon(beacon, now_ms);
+    }
+    
+    uint8_t frame[LORA_MAX_PAYLOAD];
+    size_t frame_len;
+    uint32_t separate_air_us = 0;
+    if (companion_count == 0) {
+        if (wire_encode(message, &link, frame, sizeof(frame), &frame_len) != ESP_OK) {
+            ESP_LOGE(TAG, "Message ID %lu does not fit in a frame", message->id);
+            return 0;
+        }
+    } else {
+        const mesh_message_t *records[AGG_MAX_RECORDS];
+        records[0] = message;
+        separate_air_us = airtime_us(params, wire_encoded_size(message, &link));
+        for (size_t i = 0; i < companion_count; i++) {
+            records[i + 1] = msg_pool_get(companions[i]);
+            separate_air_us += airtime_us(params, wire_encoded_size(records[i + 1], &link));
+        }
+        wire_encode_aggregate(records, companion_count + 1, &link, frame, sizeof(frame), &frame_len);
+    }
+    uint32_t air_us = airtime_us(params, frame_len);
+    
+    // Relayed traffic and beacons yield to our own messages when the budget is tight
+    duty_priority_t priority = DUTY_PRIORITY_HIGH;
+    if (message->message_type == MSG_TYPE_BEACON ||
+        (message->message_type != MSG_TYPE_EMERGENCY && memcmp(message->sender_id, device_id, 8) != 0)) {
+        priority = DUTY_PRIORITY_LOW;
+    }
+    
+    uint32_t wait_ms = duty_cycle_wait_ms(LORA_FREQUENCY, air_us, priority, now_ms);
+    esp_err_t ret = ESP_FAIL;
+    if (wait_ms == 0) {
+        // Only a frame that went out is charged to the duty cycle
+        uint32_t backoff_ms;
+        ret = lora_send_frame(frame, frame_len, params, &ticket->lbt, &backoff_ms);
+        if (ret == ESP_OK) {
+            duty_cycle_consume(LORA_FREQUENCY, air_us, now_ms);
+            ESP_LOGD(TAG, "Sent message ID: %lu +%d (SF%d, %lu us on air)",
+                     message->id, (int)companion_count, params->spreading_factor, air_us);
+            
+            tx_stats.frames++;
+            tx_stats.messages += 1 + companion_count;
+            if (companion_count > 0) {
+                tx_stats.aggregates++;
+                tx_stats.airtime_saved_us += separate_air_us - air_us;
+            }
+            
+            if (beacon != NULL) {
+                mesh_send_base_beacon(beacon, profile, mesh_now_ms());
+            }
+        } else if (ret == ESP_ERR_NOT_FINISHED) {
+            // Busy channel: the frame keeps its place until the backoff ends
+            wait_ms = backoff_ms;
+            ESP_LOGD(TAG, "Channel busy, message ID %lu backs off %lu ms", message->id, wait_ms);
+        } else {
+            // Given up; unicast text is retried by delivery tracking
+            ESP_LOGW(TAG, "Message ID %lu not sent: %s", message->id, esp_err_to_name(ret));
+        }
+    } else {
+        ESP_LOGD(TAG, "Duty cycle defers message ID %lu by %lu ms", message->id, wait_ms);
+    }
+    
+    // Companions stay queued unless they went out with this frame
+    for (size_t i = 0; i < companion_count; i++) {
+        if (ret == ESP_OK) {
+            tx_sched_complete(&companion_tickets[i], now_ms);
+        }
+        msg_pool_release(companions[i]);
+    }
+    if (wait_ms > 0) {
+        return wait_ms;
+    }
+    
+    // Switch receive profile only once neighbors have been told about it
+    if (ret == ESP_OK && beacon != NULL && announced_rx_profile != rx_profile) {
+        rx_profile = announced_rx_profile;
         
-        vTaskDelay(pdMS_TO_TICKS(50));
+        // The switch ends any listen window; the next one is a full period away
+        base_listening = false;
+        base_listen_toggle_ms = now_ms + ADR_BASE_LISTEN_PERIOD_MS - ADR_BASE_LISTEN_MS;
+        lora_set_rx_params(adr_profile_params(rx_profile));
     }
+    return 0;
 }
 
-esp_err_t mesh_send_text_message(const uint8_t *recipient_id, const char *text)
+void mesh_get_tx_stats(mesh_tx_stats_t *stats)
 {
-    if (strlen(text) > 255) {
-        return ESP_ERR_INVALID_ARG;
+    *stats = tx_stats;
+}
+
+uint32_t mesh_get_airtime_budget_us(void)
+{
+    return duty_cycle_remaining_us(LORA_FREQUENCY, mesh_now_ms());
+}
+
+static esp_err_t mesh_send_text(uint8_t type, const uint8_t *recipient_id, const char *text)
+{
+    // Longer text is fragmented and reassembled into a message at the receiver
+    size_t length = strlen(text);
+    if (length >= sizeof(((mesh_message_t *)0)->payload)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (length > WIRE_MAX_PAYLOAD) {
+        return frag_send(recipient_id, type, (const uint8_t*)text, length);
     }
     
-    mesh_message_t message = {0};
-    message.id = mesh_generate_message_id();
+    msg_handle_t handle = msg_pool_alloc();
+    if (handle == MSG_HANDLE_NONE) {
+        return ESP_ERR_NO_MEM;
+    }
     
-    // Get current timestamp
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    message.timestamp = tv.tv_sec;
+    mesh_message_t *message = msg_pool_get(handle);
+    mesh_prepare_message(message, type, recipient_id, MAX_HOP_COUNT);
+    message->payload_length = length;
+    strcpy((char*)message->payload, text);
+    message->checksum = mesh_calculate_checksum(message);
     
-    memcpy(message.sender_id, device_id, 8);
-    memcpy(message.recipient_id, recipient_id, 8);
-    message.message_type = MSG_TYPE_TEXT;
-    message.hop_count = MAX_HOP_COUNT;
-    message.payload_length = strlen(text);
-    strcpy((char*)message.payload, text);
-    message.checksum = mesh_calculate_checksum(&message);
+    // Unicast stays pending until the recipient acknowledges it. Tracking
+    // starts before the message is queued, so its ACK cannot arrive first.
+    uint32_t message_id = message->id;
+    bool track = !mesh_is_broadcast(recipient_id);
+    if (track) {
+        msg_pool_ref(handle);
+        delivery_track(handle, mesh_now_ms());
+    }
     
     // Add to TX queue
-    if (xQueueSend(tx_queue, &message, pdMS_TO_TICKS(1000)) != pdPASS) {
+    if (mesh_queue_handle(handle) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to queue message");
-        return ESP_ERR_TIMEOUT;
+        if (track) {
+            delivery_cancel(message_id);
+        }
+        return ESP_ERR_NO_MEM;
     }
     
     ESP_LOGI(TAG, "Queued text message: %s", text);
     return ESP_OK;
 }
 
+esp_err_t mesh_send_text_message(const uint8_t *recipient_id, const char *text)
+{
+    return mesh_send_text(MSG_TYPE_TEXT, recipient_id, text);
+}
+
+esp_err_t mesh_send_emergency_message(const uint8_t *recipient_id, const char *text)
+{
+    return mesh_send_text(MSG_TYPE_EMERGENCY, recipient_id, text);
+}
+
 esp_err_t mesh_send_broadcast(const char *text)
 {
     uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
     return mesh_send_text_message(broadcast_id, text);
 }
 
-static void mesh_handle_received_message(const mesh_message_t *message)
+static void mesh_send_ack(const mesh_message_t *message)
+{
+    msg_handle_t handle = msg_pool_alloc();
+    if (handle == MSG_HANDLE_NONE) {
+        return;
+    }
+    
+    mesh_message_t *ack = msg_pool_get(handle);
+    mesh_prepare_message(ack, MSG_TYPE_ACK, message->sender_id, MAX_HOP_COUNT);
+    memcpy(ack->payload, &message->id, sizeof(uint32_t));
+    ack->payload_length = sizeof(uint32_t);
+    ack->checksum = mesh_calculate_checksum(ack);
+    
+    mesh_queue_handle(handle);
+}
+
+// Pass a frame one hop further. The buffer is updated in place, so the
+// caller must hold the only reference to it.
+static void mesh_forward(msg_handle_t handle)
+{
+    mesh_message_t *message = msg_pool_get(handle);
+    if (message->hop_count <= 1) {
+        ESP_LOGD(TAG, "Hop limit reached, message ID %lu dropped", message->id);
+        return;
+    }
+    
+    message->hop_count--;  // Outside the checksum, so it stays valid
+    msg_pool_ref(handle);
+    if (mesh_queue_handle(handle) == ESP_OK) {
+        ESP_LOGD(TAG, "Forwarded message");
+    }
+}
+
+static void mesh_handle_received_message(msg_handle_t handle, const wire_link_t *link, float snr)
 {
+    const mesh_message_t *message = msg_pool_get(handle);
+    
+    // Unicast frames name the one neighbor that should act on them
+    if (link->has_next_hop && memcmp(link->next_hop_id, device_id, 8) != 0) {
+        return;
+    }
+    
     // Verify checksum
     if (!mesh_verify_checksum(message)) {
         ESP_LOGW(TAG, "Message checksum verification failed");
         return;
     }
     
-    // Check if it's a duplicate
-    if (mesh_is_message_duplicate(message->id, message->sender_id)) {
-        ESP_LOGD(TAG, "Duplicate message ignored");
+    // Our own messages come back once neighbors relay them
+    if (memcmp(message->sender_id, device_id, 8) == 0) {
         return;
     }
     
     // Check if message is for us or broadcast
     bool is_for_us = (memcmp(message->recipient_id, device_id, 8) == 0);
-    bool is_broadcast = true;
-    for (int i = 0; i < 8; i++) {
-        if (message->recipient_id[i] != 0xFF) {
-            is_broadcast = false;
-            break;
+    bool is_broadcast = mesh_is_broadcast(message->recipient_id);
+    
+    // Routed unicast in transit is bounded by hop_count alone, so that
+    // end-to-end retransmissions (same id) get past relays that saw the original
+    bool in_transit = link->has_next_hop && !is_for_us;
+    
+    // Check if it's a duplicate; a repeated broadcast is a neighbor relaying it
+    if (!in_transit && dedup_check_and_insert(message->sender_id, message->id, mesh_now_ms())) {
+        if (is_broadcast) {
+            flood_overheard(message->sender_id, message->id);
+        } else if (is_for_us && (message->message_type == MSG_TYPE_TEXT ||
+                                 message->message_type == MSG_TYPE_EMERGENCY)) {
+            // Sender retransmitted because our ACK was lost
+            mesh_send_ack(message);
         }
+        ESP_LOGD(TAG, "Duplicate message ignored");
+        return;
     }
     
     switch (message->message_type) {
         case MSG_TYPE_TEXT:
+        case MSG_TYPE_EMERGENCY:
             if (is_for_us || is_broadcast) {
                 ESP_LOGI(TAG, "Received message: %s", (char*)message->payload);
                 if (message_callback) {
                     message_callback(message);
                 }
                 
+                // Broadcasts travel on through the managed flood
+                if (is_broadcast) {
+                    flood_schedule(handle, snr, mesh_now_ms());
+                }
+                
                 // Send ACK if not broadcast
                 if (!is_broadcast) {
-                    mesh_message_t ack = {0};
-                    ack.id = mesh_generate_message_id();
-                    struct timeval tv;
-                    gettimeofday(&tv, NULL);
-                    ack.timestamp = tv.tv_sec;
-                    memcpy(ack.sender_id, device_id, 8);
-                    memcpy(ack.recipient_id, message->sender_id, 8);
-                    ack.message_type = MSG_TYPE_ACK;
-                    ack.hop_count = MAX_HOP_COUNT;
-                    memcpy(ack.payload, &message->id, sizeof(uint32_t));
-                    ack.payload_length = sizeof(uint32_t);
-                    ack.checksum = mesh_calculate_checksum(&ack);
-                    
-                    xQueueSend(tx_queue, &ack, 0);
+                    mesh_send_ack(message);
                 }
-            } else if (message->hop_count > 0) {
-                // Forward message
-                mesh_message_t forward_msg = *message;
-                forward_msg.hop_count--;
-                xQueueSend(tx_queue, &forward_msg, 0);
-                ESP_LOGD(TAG, "Forwarded message");
+            } else {
+                mesh_forward(handle);
             }
             break;
             
@@ -190,15 +672,50 @@ static void mesh_handle_received_message(const mesh_message_t *message)
                 uint32_t ack_msg_id;
                 memcpy(&ack_msg_id, message->payload, sizeof(uint32_t));
                 ESP_LOGI(TAG, "Received ACK for message %lu", ack_msg_id);
+                delivery_ack(ack_msg_id, mesh_now_ms());
                 if (message_callback) {
                     message_callback(message);
                 }
+            } else if (!is_broadcast) {
+                mesh_forward(handle);
             }
             break;
             
+        case MSG_TYPE_FRAGMENT:
+        case MSG_TYPE_FRAGMENT_NACK:
+            if (is_for_us || is_broadcast) {
+                frag_handle_message(message);
+                
+                // Broadcast fragments are flooded like any other broadcast
+                if (is_broadcast) {
+                    flood_schedule(handle, snr, mesh_now_ms());
+                }
+            } else {
+                mesh_forward(handle);
+            }
+            break;
+            
+        case MSG_TYPE_ROUTE_REQUEST:
+        case MSG_TYPE_ROUTE_REPLY:
+        case MSG_TYPE_ROUTE_ERROR:
+            aodv_handle_message(message, link->transmitter_id);
+            break;
+            
         case MSG_TYPE_BEACON:
             // Update route to sender
             mesh_add_route(message->sender_id, message->sender_id, 1);
+            
+            // Beacons announce the profile the sender listens on and its base-listen schedule...
+            if (message->payload_length >= BEACON_HEADER_SIZE) {
+                uint16_t base_phase_ms = message->payload[1] | (message->payload[2] << 8);
+                link_quality_set_rx_profile(message->sender_id, message->payload[0], base_phase_ms, mesh_now_ms());
+            }
+            
+            // ...followed by a summary of the sender's routes
+            if (message->payload_length > BEACON_HEADER_SIZE) {
+                beacon_handle_summary(message->sender_id, message->payload + BEACON_HEADER_SIZE,
+                                      message->payload_length - BEACON_HEADER_SIZE, mesh_now_ms());
+            }
             ESP_LOGD(TAG, "Updated route from beacon");
             break;
             
@@ -210,43 +727,27 @@ static void mesh_handle_received_message(const mesh_message_t *message)
 
 static void mesh_send_beacon(void)
 {
-    mesh_message_t beacon = {0};
-    beacon.id = mesh_generate_message_id();
+    uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    msg_handle_t handle = msg_pool_alloc();
+    if (handle == MSG_HANDLE_NONE) {
+        return;
+    }
     
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    beacon.timestamp = tv.tv_sec;
+    mesh_message_t *beacon = msg_pool_get(handle);
+    mesh_prepare_message(beacon, MSG_TYPE_BEACON, broadcast_id, 1);  // Only direct neighbors
     
-    memcpy(beacon.sender_id, device_id, 8);
-    memset(beacon.recipient_id, 0xFF, 8);  // Broadcast
-    beacon.message_type = MSG_TYPE_BEACON;
-    beacon.hop_count = 1;  // Only direct neighbors
-    beacon.payload_length = 0;
-    beacon.checksum = mesh_calculate_checksum(&beacon);
+    // Announce the receive profile current link conditions allow; the
+    // schedule is stamped at transmission
+    announced_rx_profile = adr_select_rx_profile();
+    beacon->payload[0] = announced_rx_profile;
+    beacon->payload_length = BEACON_HEADER_SIZE + beacon_write_summary(beacon->payload + BEACON_HEADER_SIZE,
+                                                                       WIRE_MAX_PAYLOAD - BEACON_HEADER_SIZE);
+    mesh_stamp_beacon(beacon, mesh_now_ms());
     
-    xQueueSend(tx_queue, &beacon, 0);
+    mesh_queue_handle(handle);
     ESP_LOGD(TAG, "Sent beacon");
 }
 
-static bool mesh_is_message_duplicate(uint32_t msg_id, const uint8_t *sender_id)
-{
-    // Simple duplicate detection - check last few messages
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        if (message_queue[i].id == msg_id && 
-            memcmp(message_queue[i].sender_id, sender_id, 8) == 0) {
-            return true;
-        }
-    }
-    
-    // Add to message history (circular buffer)
-    static int msg_index = 0;
-    message_queue[msg_index].id = msg_id;
-    memcpy(message_queue[msg_index].sender_id, sender_id, 8);
-    msg_index = (msg_index + 1) % MAX_MESSAGES;
-    
-    return false;
-}
-
 esp_err_t mesh_process(void)
 {
     // This function is called from main loop
@@ -256,31 +757,11 @@ esp_err_t mesh_process(void)
 
 esp_err_t mesh_add_route(const uint8_t *destination, const uint8_t *next_hop, uint8_t hop_count)
 {
-    // Find existing route or empty slot
-    route_entry_t *route = NULL;
-    for (int i = 0; i < MAX_ROUTES; i++) {
-        if (!route_table[i].active) {
-            route = &route_table[i];
-            break;
-        } else if (memcmp(route_table[i].destination, destination, 8) == 0) {
-            route = &route_table[i];
-            break;
-        }
-    }
-    
-    if (route == NULL) {
-        ESP_LOGW(TAG, "Route table full");
-        return ESP_ERR_NO_MEM;
-    }
-    
-    memcpy(route->destination, destination, 8);
-    memcpy(route->next_hop, next_hop, 8);
-    route->hop_count = hop_count;
+    // Full table evicts the least recently used route rather than refusing
+    route_entry_t *route = route_table_insert(destination, next_hop, hop_count, mesh_now_ms());
     
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    route->timestamp = tv.tv_sec;
-    route->active = true;
+    // Every update restarts the route's lifetime
+    route_table_refresh(route, MESSAGE_TIMEOUT);
     
     ESP_LOGD(TAG, "Added/updated route to device");
     return ESP_OK;
@@ -288,41 +769,21 @@ esp_err_t mesh_add_route(const uint8_t *destination, const uint8_t *next_hop, ui
 
 esp_err_t mesh_remove_route(const uint8_t *destination)
 {
-    for (int i = 0; i < MAX_ROUTES; i++) {
-        if (route_table[i].active && 
-            memcmp(route_table[i].destination, destination, 8) == 0) {
-            route_table[i].active = false;
-            ESP_LOGD(TAG, "Removed route");
-            return ESP_OK;
-        }
+    esp_err_t ret = route_table_remove(destination);
+    if (ret == ESP_OK) {
+        ESP_LOGD(TAG, "Removed route");
     }
-    return ESP_ERR_NOT_FOUND;
+    return ret;
 }
 
 route_entry_t* mesh_find_route(const uint8_t *destination)
 {
-    for (int i = 0; i < MAX_ROUTES; i++) {
-        if (route_table[i].active && 
-            memcmp(route_table[i].destination, destination, 8) == 0) {
-            return &route_table[i];
-        }
-    }
-    return NULL;
+    return route_table_find(destination, mesh_now_ms());
 }
 
-void mesh_cleanup_old_routes(void)
+bool mesh_get_route(const uint8_t *destination, route_entry_t *route)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    uint64_t current_time = tv.tv_sec;
-    
-    for (int i = 0; i < MAX_ROUTES; i++) {
-        if (route_table[i].active && 
-            (current_time - route_table[i].timestamp) > MESSAGE_TIMEOUT / 1000) {
-            route_table[i].active = false;
-            ESP_LOGD(TAG, "Cleaned up old route");
-        }
-    }
+    return route_table_get(destination, route);
 }
 
 uint32_t mesh_generate_message_id(void)
@@ -330,25 +791,54 @@ uint32_t mesh_generate_message_id(void)
     return ++message_counter;
 }
 
-uint16_t mesh_calculate_checksum(const mesh_message_t *message)
+void mesh_prepare_message(mesh_message_t *message, uint8_t type, const uint8_t *recipient_id, uint8_t hop_count)
 {
-    uint16_t checksum = 0;
-    const uint8_t *data = (const uint8_t *)message;
-    size_t len = sizeof(mesh_message_t) - sizeof(uint16_t);  // Exclude checksum field
+    memset(message, 0, sizeof(*message));
+    message->id = mesh_generate_message_id();
+    
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    message->timestamp = tv.tv_sec;
     
-    for (size_t i = 0; i < len; i++) {
-        checksum += data[i];
+    memcpy(message->sender_id, device_id, 8);
+    memcpy(message->recipient_id, recipient_id, 8);
+    message->message_type = type;
+    message->hop_count = hop_count;
+}
+
+// Copies the message into the pool; prefer mesh_queue_handle for pool buffers
+esp_err_t mesh_queue_message(const mesh_message_t *message)
+{
+    msg_handle_t handle = msg_pool_store(message);
+    if (handle == MSG_HANDLE_NONE) {
+        return ESP_ERR_NO_MEM;
     }
+    return mesh_queue_handle(handle);
+}
+
+// Takes over the caller's reference to the message
+esp_err_t mesh_queue_handle(msg_handle_t handle)
+{
+    esp_err_t ret = tx_sched_enqueue(handle, tx_sched_classify(msg_pool_get(handle), device_id), mesh_now_ms());
     
-    return checksum;
+    // Wake mesh_task so the message goes out without waiting for a timer
+    if (ret == ESP_OK && mesh_task_handle != NULL) {
+        xTaskNotify(mesh_task_handle, MESH_NOTIFY_TX, eSetBits);
+    }
+    return ret;
+}
+
+// CRC over the header and the used payload bytes only. hop_count is left
+// out so relays can decrement it without recomputing.
+uint16_t mesh_calculate_checksum(const mesh_message_t *message)
+{
+    uint16_t crc = crc16_ccitt(CRC16_CCITT_INIT, message, offsetof(mesh_message_t, hop_count));
+    return crc16_ccitt(crc, &message->payload_length, 1 + message->payload_length);
 }
 
 bool mesh_verify_checksum(const mesh_message_t *message)
 {
-    mesh_message_t temp = *message;
-    temp.checksum = 0;
-    uint16_t calculated = mesh_calculate_checksum(&temp);
-    return calculated == message->checksum;
+    return mesh_calculate_checksum(message) == message->checksum;
 }
 
 void mesh_get_device_id(uint8_t *device_id_out)
@@ -360,3 +850,49 @@ void mesh_set_message_callback(mesh_message_callback_t callback)
 {
     message_callback = callback;
 }
+
+void mesh_set_delivery_callback(mesh_delivery_callback_t callback)
+{
+    delivery_set_callback(callback);
+}
+
+esp_err_t mesh_send_payload(const uint8_t *recipient_id, uint8_t type, const uint8_t *data, size_t length)
+{
+    return frag_send(recipient_id, type, data, length);
+}
+
+void mesh_set_payload_callback(mesh_payload_callback_t callback)
+{
+    payload_callback = callback;
+}
+
+// Reassembled text reaches the application like text that fit in one frame
+static void mesh_handle_payload(const uint8_t *sender_id, const uint8_t *recipient_id, uint32_t transfer_id,
+                                uint8_t type, const uint8_t *data, size_t length)
+{
+    if ((type == MSG_TYPE_TEXT || type == MSG_TYPE_EMERGENCY) && length < sizeof(((mesh_message_t *)0)->payload)) {
+        mesh_message_t message = {0};
+        message.id = transfer_id;
+        
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        message.timestamp = tv.tv_sec;
+        
+        memcpy(message.sender_id, sender_id, 8);
+        memcpy(message.recipient_id, recipient_id, 8);
+        message.message_type = type;
+        message.payload_length = length;
+        memcpy(message.payload, data, length);  // Zeroed tail terminates the text
+        message.checksum = mesh_calculate_checksum(&message);
+        
+        ESP_LOGI(TAG, "Received message: %s", (char*)message.payload);
+        if (message_callback) {
+            message_callback(&message);
+        }
+        return;
+    }
+    
+    if (payload_callback) {
+        payload_callback(sender_id, type, data, length);
+    }
+}
@@ -3,23 +3,56 @@
 
 #include "esp_err.h"
 #include "device_config.h"
+#include "msg_pool.h"
 
 // Mesh network functions
 esp_err_t mesh_init(void);
 esp_err_t mesh_send_text_message(const uint8_t *recipient_id, const char *text);
+esp_err_t mesh_send_emergency_message(const uint8_t *recipient_id, const char *text);
 esp_err_t mesh_send_broadcast(const char *text);
 esp_err_t mesh_process(void);
 esp_err_t mesh_add_route(const uint8_t *destination, const uint8_t *next_hop, uint8_t hop_count);
 esp_err_t mesh_remove_route(const uint8_t *destination);
-route_entry_t* mesh_find_route(const uint8_t *destination);
-void mesh_cleanup_old_routes(void);
+route_entry_t* mesh_find_route(const uint8_t *destination);     // mesh_task only
+bool mesh_get_route(const uint8_t *destination, route_entry_t *route);   // Copy, from any task
 uint32_t mesh_generate_message_id(void);
+void mesh_prepare_message(mesh_message_t *message, uint8_t type, const uint8_t *recipient_id, uint8_t hop_count);
+esp_err_t mesh_queue_message(const mesh_message_t *message);
+esp_err_t mesh_queue_handle(msg_handle_t handle);
 uint16_t mesh_calculate_checksum(const mesh_message_t *message);
 bool mesh_verify_checksum(const mesh_message_t *message);
 void mesh_get_device_id(uint8_t *device_id);
+uint32_t mesh_get_airtime_budget_us(void);
+
+// Transmit counters; messages / frames is the aggregation ratio
+typedef struct {
+    uint32_t frames;
+    uint32_t messages;
+    uint32_t aggregates;            // Frames carrying more than one message
+    uint64_t airtime_saved_us;      // Versus sending each message on its own
+} mesh_tx_stats_t;
+void mesh_get_tx_stats(mesh_tx_stats_t *stats);
 
 // Callback for received messages
 typedef void (*mesh_message_callback_t)(const mesh_message_t *message);
 void mesh_set_message_callback(mesh_message_callback_t callback);
 
+// Final outcome of a unicast message sent with mesh_send_text_message
+typedef enum {
+    MESH_DELIVERY_ACKED = 0,
+    MESH_DELIVERY_FAILED,
+} mesh_delivery_state_t;
+
+typedef void (*mesh_delivery_callback_t)(uint32_t message_id, mesh_delivery_state_t state,
+                                         uint8_t attempts, uint32_t latency_ms);
+void mesh_set_delivery_callback(mesh_delivery_callback_t callback);
+
+// Payloads up to FRAG_MAX_PAYLOAD bytes, fragmented across as many frames as needed
+esp_err_t mesh_send_payload(const uint8_t *recipient_id, uint8_t type, const uint8_t *data, size_t length);
+
+// Callback for reassembled payloads; type is the one given to mesh_send_payload.
+// Reassembled TEXT and EMERGENCY go to the message callback instead.
+typedef void (*mesh_payload_callback_t)(const uint8_t *sender_id, uint8_t type, const uint8_t *data, size_t length);
+void mesh_set_payload_callback(mesh_payload_callback_t callback);
+
 #endif // MESH_H
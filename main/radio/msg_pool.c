@@ -0,0 +1,117 @@
+#include "msg_pool.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+
+static const char *TAG = "MSG_POOL";
+
+static mesh_message_t buffers[MSG_POOL_SIZE];
+static uint8_t refcounts[MSG_POOL_SIZE];
+static uint8_t free_list[MSG_POOL_SIZE];    // Stack of free buffer indices
+static uint32_t free_count;
+static msg_pool_stats_t stats;
+static SemaphoreHandle_t pool_mutex;
+
+esp_err_t msg_pool_init(void)
+{
+    pool_mutex = xSemaphoreCreateMutex();
+    if (pool_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < MSG_POOL_SIZE; i++) {
+        refcounts[i] = 0;
+        free_list[i] = MSG_POOL_SIZE - 1 - i;
+    }
+    free_count = MSG_POOL_SIZE;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.size = MSG_POOL_SIZE;
+    return ESP_OK;
+}
+
+// Handles are index + 1 so that zero never names a buffer
+msg_handle_t msg_pool_alloc(void)
+{
+    msg_handle_t handle = MSG_HANDLE_NONE;
+
+    xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    if (free_count > 0) {
+        uint8_t index = free_list[--free_count];
+        refcounts[index] = 1;
+        handle = index + 1;
+
+        stats.in_use++;
+        if (stats.in_use > stats.peak_in_use) {
+            stats.peak_in_use = stats.in_use;
+        }
+    } else {
+        stats.alloc_failures++;
+    }
+    xSemaphoreGive(pool_mutex);
+
+    if (handle == MSG_HANDLE_NONE) {
+        ESP_LOGW(TAG, "Message pool exhausted");
+    }
+    return handle;
+}
+
+// Copy a message built elsewhere (e.g. on the stack) into a new buffer
+msg_handle_t msg_pool_store(const mesh_message_t *message)
+{
+    msg_handle_t handle = msg_pool_alloc();
+    if (handle != MSG_HANDLE_NONE) {
+        buffers[handle - 1] = *message;
+
+        xSemaphoreTake(pool_mutex, portMAX_DELAY);
+        stats.copies++;
+        xSemaphoreGive(pool_mutex);
+    }
+    return handle;
+}
+
+mesh_message_t *msg_pool_get(msg_handle_t handle)
+{
+    return &buffers[handle - 1];
+}
+
+void msg_pool_ref(msg_handle_t handle)
+{
+    xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    refcounts[handle - 1]++;
+    xSemaphoreGive(pool_mutex);
+}
+
+void msg_pool_release(msg_handle_t handle)
+{
+    if (handle == MSG_HANDLE_NONE) {
+        return;
+    }
+
+    xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    uint8_t index = handle - 1;
+    if (refcounts[index] == 0) {
+        ESP_LOGE(TAG, "Release of free buffer %d", index);
+    } else if (--refcounts[index] == 0) {
+        free_list[free_count++] = index;
+        stats.in_use--;
+    }
+    xSemaphoreGive(pool_mutex);
+}
+
+// Whether anyone besides the caller still holds a reference, e.g. a queue
+bool msg_pool_shared(msg_handle_t handle)
+{
+    xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    bool shared = refcounts[handle - 1] > 1;
+    xSemaphoreGive(pool_mutex);
+    return shared;
+}
+
+void msg_pool_get_stats(msg_pool_stats_t *stats_out)
+{
+    xSemaphoreTake(pool_mutex, portMAX_DELAY);
+    *stats_out = stats;
+    xSemaphoreGive(pool_mutex);
+}
@@ -0,0 +1,31 @@
+#ifndef MSG_POOL_H
+#define MSG_POOL_H
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "device_config.h"
+
+// Statically allocated, reference-counted mesh_message_t buffers.
+// Queues and tables pass handles; the buffer is freed with its last reference.
+typedef uint32_t msg_handle_t;
+
+#define MSG_HANDLE_NONE 0
+
+typedef struct {
+    uint32_t size;
+    uint32_t in_use;
+    uint32_t peak_in_use;
+    uint32_t alloc_failures;
+    uint32_t copies;                // Whole messages copied into the pool
+} msg_pool_stats_t;
+
+esp_err_t msg_pool_init(void);
+msg_handle_t msg_pool_alloc(void);
+msg_handle_t msg_pool_store(const mesh_message_t *message);
+mesh_message_t *msg_pool_get(msg_handle_t handle);
+void msg_pool_ref(msg_handle_t handle);
+void msg_pool_release(msg_handle_t handle);
+bool msg_pool_shared(msg_handle_t handle);
+void msg_pool_get_stats(msg_pool_stats_t *stats);
+
+#endif // MSG_POOL_H
@@ -0,0 +1,273 @@
+#include "route_table.h"
+#include "timer_wheel.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+
+static const char *TAG = "ROUTE_TABLE";
+
+#if (MAX_ROUTES & (MAX_ROUTES - 1)) != 0
+#error "MAX_ROUTES must be a power of two"
+#endif
+
+#define ROUTE_MASK          (MAX_ROUTES - 1)
+#define ROUTE_MAX_LOAD      (MAX_ROUTES * 3 / 4)    // Keep probe sequences short
+#define ROUTE_EVICT_SAMPLES 8                       // Candidates considered for eviction
+#define ROUTE_MAX_DELETED   (MAX_ROUTES / 8)        // Tombstones tolerated before the index is rebuilt
+
+// Index slots hold an entry number or one of these
+#define SLOT_EMPTY          0xFFFF
+#define SLOT_DELETED        0xFFFE
+
+// Routes stay where they were stored, so pointers to them stay valid; only
+// the hash index over them is rebuilt
+static route_entry_t routes[ROUTE_MAX_LOAD];
+static uint32_t last_used_ms[ROUTE_MAX_LOAD];
+static wheel_timer_t expiry_timers[ROUTE_MAX_LOAD];
+static uint16_t free_entries[ROUTE_MAX_LOAD];
+static size_t free_count = 0;
+static uint16_t slots[MAX_ROUTES];
+static size_t used_count = 0;
+static size_t deleted_count = 0;
+static uint32_t digest = 0;                 // XOR of the hashes of all destinations
+static size_t evict_cursor = 0;
+static SemaphoreHandle_t table_mutex;       // Held by mesh_task while changing slots, by readers elsewhere
+
+static uint32_t route_hash(const uint8_t *id)
+{
+    uint64_t key;
+    memcpy(&key, id, sizeof(key));
+
+    // MurmurHash3 finalizer: node IDs differ mostly in a few MAC bytes
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+// Index slot holding the destination, or -1
+static int route_lookup(const uint8_t *destination)
+{
+    size_t index = route_hash(destination) & ROUTE_MASK;
+
+    for (size_t probe = 0; probe < MAX_ROUTES; probe++) {
+        if (slots[index] == SLOT_EMPTY) {
+            return -1;
+        }
+        if (slots[index] != SLOT_DELETED &&
+            memcmp(routes[slots[index]].destination, destination, 8) == 0) {
+            return (int)index;
+        }
+        index = (index + 1) & ROUTE_MASK;
+    }
+    return -1;
+}
+
+// First free or deleted slot on the destination's probe path
+static void route_index_add(uint16_t entry)
+{
+    size_t index = route_hash(routes[entry].destination) & ROUTE_MASK;
+    while (slots[index] != SLOT_EMPTY && slots[index] != SLOT_DELETED) {
+        index = (index + 1) & ROUTE_MASK;
+    }
+    if (slots[index] == SLOT_DELETED) {
+        deleted_count--;
+    }
+    slots[index] = entry;
+}
+
+// Under churn at the load limit every insert lands on a tombstone, none ever
+// become empty again, and misses walk the whole table; start the index over
+static void route_index_rebuild(void)
+{
+    memset(slots, 0xFF, sizeof(slots));
+    deleted_count = 0;
+    for (uint16_t entry = 0; entry < ROUTE_MAX_LOAD; entry++) {
+        if (routes[entry].active) {
+            route_index_add(entry);
+        }
+    }
+}
+
+// Caller holds table_mutex
+static void route_delete_slot(size_t index)
+{
+    uint16_t entry = slots[index];
+    timer_wheel_cancel(&expiry_timers[entry]);
+    routes[entry].active = false;
+    free_entries[free_count++] = entry;
+    used_count--;
+    digest ^= route_hash(routes[entry].destination);
+
+    slots[index] = SLOT_DELETED;
+    deleted_count++;
+
+    // A tombstone followed by an empty slot ends no probe chain; reclaim the run
+    if (slots[(index + 1) & ROUTE_MASK] == SLOT_EMPTY) {
+        while (slots[index] == SLOT_DELETED) {
+            slots[index] = SLOT_EMPTY;
+            deleted_count--;
+            index = (index - 1) & ROUTE_MASK;
+        }
+    }
+
+    if (deleted_count > ROUTE_MAX_DELETED) {
+        route_index_rebuild();
+    }
+}
+
+// Evict the least recently used route among a rotating sample of entries;
+// caller holds table_mutex
+static void route_evict(uint32_t now_ms)
+{
+    int victim = -1;
+    size_t sampled = 0;
+
+    for (size_t probe = 0; probe < ROUTE_MAX_LOAD && sampled < ROUTE_EVICT_SAMPLES; probe++) {
+        size_t entry = evict_cursor;
+        evict_cursor = (evict_cursor + 1) % ROUTE_MAX_LOAD;
+        if (!routes[entry].active) {
+            continue;
+        }
+        sampled++;
+        if (victim < 0 || now_ms - last_used_ms[entry] > now_ms - last_used_ms[victim] ||
+            (last_used_ms[entry] == last_used_ms[victim] && routes[entry].hop_count > routes[victim].hop_count)) {
+            victim = (int)entry;
+        }
+    }
+
+    if (victim >= 0) {
+        ESP_LOGD(TAG, "Evicting least recently used route");
+        route_delete_slot(route_lookup(routes[victim].destination));
+    }
+}
+
+static void route_expired(void *arg)
+{
+    ESP_LOGD(TAG, "Route expired");
+    xSemaphoreTake(table_mutex, portMAX_DELAY);
+    route_delete_slot(route_lookup(routes[(uintptr_t)arg].destination));
+    xSemaphoreGive(table_mutex);
+}
+
+esp_err_t route_table_init(void)
+{
+    if (table_mutex == NULL) {
+        table_mutex = xSemaphoreCreateMutex();
+        if (table_mutex == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    memset(routes, 0, sizeof(routes));
+    memset(last_used_ms, 0, sizeof(last_used_ms));
+    memset(slots, 0xFF, sizeof(slots));
+    used_count = 0;
+    deleted_count = 0;
+    digest = 0;
+    evict_cursor = 0;
+    free_count = 0;
+    for (size_t i = ROUTE_MAX_LOAD; i-- > 0;) {
+        free_entries[free_count++] = i;
+        timer_wheel_setup(&expiry_timers[i], route_expired, (void *)(uintptr_t)i);
+    }
+    return ESP_OK;
+}
+
+route_entry_t *route_table_find(const uint8_t *destination, uint32_t now_ms)
+{
+    int index = route_lookup(destination);
+    if (index < 0) {
+        return NULL;
+    }
+    last_used_ms[slots[index]] = now_ms;
+    return &routes[slots[index]];
+}
+
+// Adds the route or updates the one already there; a full table evicts
+// the least recently used route rather than refusing
+route_entry_t *route_table_insert(const uint8_t *destination, const uint8_t *next_hop, uint8_t hop_count,
+                                  uint32_t now_ms)
+{
+    xSemaphoreTake(table_mutex, portMAX_DELAY);
+
+    int index = route_lookup(destination);
+    uint16_t entry;
+    if (index >= 0) {
+        entry = slots[index];
+    } else {
+        if (used_count >= ROUTE_MAX_LOAD) {
+            route_evict(now_ms);
+        }
+
+        entry = free_entries[--free_count];
+        memset(&routes[entry], 0, sizeof(routes[entry]));
+        memcpy(routes[entry].destination, destination, 8);
+        routes[entry].active = true;
+        route_index_add(entry);
+        used_count++;
+        digest ^= route_hash(destination);
+    }
+
+    memcpy(routes[entry].next_hop, next_hop, 8);
+    routes[entry].hop_count = hop_count;
+    routes[entry].timestamp = now_ms;
+    last_used_ms[entry] = now_ms;
+
+    xSemaphoreGive(table_mutex);
+    return &routes[entry];
+}
+
+esp_err_t route_table_remove(const uint8_t *destination)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(table_mutex, portMAX_DELAY);
+    int index = route_lookup(destination);
+    if (index >= 0) {
+        route_delete_slot(index);
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(table_mutex);
+    return ret;
+}
+
+// A copy for tasks other than mesh_task; does not count as a use for eviction
+bool route_table_get(const uint8_t *destination, route_entry_t *route)
+{
+    xSemaphoreTake(table_mutex, portMAX_DELAY);
+    int index = route_lookup(destination);
+    if (index >= 0) {
+        *route = routes[slots[index]];
+    }
+    xSemaphoreGive(table_mutex);
+    return index >= 0;
+}
+
+size_t route_table_count(void)
+{
+    return used_count;
+}
+
+uint32_t route_table_digest(const uint8_t *self_id)
+{
+    return digest ^ route_hash(self_id);
+}
+
+route_entry_t *route_table_next(size_t *cursor)
+{
+    while (*cursor < ROUTE_MAX_LOAD) {
+        size_t entry = (*cursor)++;
+        if (routes[entry].active) {
+            return &routes[entry];
+        }
+    }
+    return NULL;
+}
+
+void route_table_refresh(route_entry_t *route, uint32_t lifetime_ms)
+{
+    timer_wheel_start(&expiry_timers[route - routes], lifetime_ms);
+}
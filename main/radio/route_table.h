@@ -0,0 +1,32 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include "esp_err.h"
+#include "device_config.h"
+
+// Routes keyed by destination ID, found through an open-addressing hash
+// index. Entries never move once inserted, so returned pointers stay valid
+// until the route is removed or evicted.
+//
+// mesh_task owns the table: it alone changes it and may use the pointers.
+// Other tasks read with route_table_get(), which copies under the table
+// mutex that mesh_task holds while it changes a slot.
+esp_err_t route_table_init(void);
+route_entry_t *route_table_find(const uint8_t *destination, uint32_t now_ms);
+route_entry_t *route_table_insert(const uint8_t *destination, const uint8_t *next_hop, uint8_t hop_count,
+                                  uint32_t now_ms);
+esp_err_t route_table_remove(const uint8_t *destination);
+size_t route_table_count(void);
+bool route_table_get(const uint8_t *destination, route_entry_t *route);
+
+// Order-independent digest of the destinations in the table plus self_id,
+// equal on all nodes that know the same set of nodes
+uint32_t route_table_digest(const uint8_t *self_id);
+
+// Iterate routes: start with *cursor = 0; returns NULL after a full pass
+route_entry_t *route_table_next(size_t *cursor);
+
+// (Re)start the route's expiry timer; it is removed after lifetime_ms
+void route_table_refresh(route_entry_t *route, uint32_t lifetime_ms);
+
+#endif // ROUTE_TABLE_H
@@ -0,0 +1,168 @@
+#include "text_codec.h"
+#include <string.h>
+
+// Output bytes below TEXT_CODE_VERBATIM index the dictionary; the two
+// escape codes carry bytes the dictionary has no entry for
+#define TEXT_CODE_VERBATIM      254     // Next byte is literal
+#define TEXT_CODE_VERBATIM_RUN  255     // Next byte is run length - 1, then the literals
+#define TEXT_VERBATIM_RUN_MAX   32
+
+// Fragments of short English chat messages, compile-time constant. The
+// codes are the table positions, so entries may only ever be appended.
+static const char *const dictionary[] = {
+    " ", "e", "t", "a", "o", "i", "n", "s", "r", "h", "l", "d", "u", "c", "m", "w", "y", "f", "g",
+    "p", "b", "v", "k", ".", ",", "?", "!", "'", ":", "-", "\n", "0", "1", "2", "3", "4", "5", "6",
+    "7", "8", "9", "I", "A", "T", "O", "W", "S", "H", "N", "Y", "M", "th", "he", "in", "er", "an",
+    "re", "on", "at", "en", "nd", "ou", "ea", "ha", "es", "st", "to", "it", "or", "is", "ng", "ll",
+    "le", "me", "ve", "hi", "se", "ed", "al", "ar", "te", "co", "de", "ne", "ro", "ri", "li", "ra",
+    "ti", "wa", "ow", "ok", "om", "ch", "sh", "ck", "ee", "oo", "ly", "ay", "be", "ma", "no", "so",
+    "go", "do", "we", "up", "ut", "us", "ic", "ur", "as", "et", "e ", " t", "s ", "d ", "t ", " a",
+    "y ", " s", " w", " i", " o", " b", " c", " m", " h", " f", " g", " p", " n", "n ", "r ", "o ",
+    "k ", ". ", ", ", "? ", "! ", "..", "...", "the", "the ", " the ", "ing", "ing ", "and",
+    " and ", "you", " you", "you ", "are", " are ", "for", " for ", " to ", " I ", "I'm ", "I'll ",
+    "it's ", "that", " that ", "this", " this ", "what", "What ", "where", "Where ", "when",
+    "When ", "here", " here", "there", " there", "have", " have ", "will", " will ", "can", " can ",
+    "not", " not ", "with", " with ", "just", "just ", "get", " get ", "going", " going ", "come",
+    " come ", "back", " back", "now", " now", "soon", "meet", " meet ", "help", "Help", "need",
+    " need ", "OK", "Ok", "yes", "Yes", "no ", "No", "thanks", "Thanks", "lol", "see", " see ",
+    "good", " good", "at ", " at ", "on ", " on ", " in ", " of ", " is ", " be ", " we ", "We ",
+    " my ", " me", "camp", "trail", "water", "home", "north", "south", "east", "west", " min",
+    " km", "hour", "tion", "ight", "ould", "ame", "ter", "all", "our",
+};
+
+#define DICTIONARY_SIZE (sizeof(dictionary) / sizeof(dictionary[0]))
+_Static_assert(DICTIONARY_SIZE <= TEXT_CODE_VERBATIM, "dictionary codes collide with escapes");
+
+static uint8_t entry_length[DICTIONARY_SIZE];
+static int16_t first_entry[256];                // First entry starting with a given byte
+static int16_t next_entry[DICTIONARY_SIZE];     // Next entry with the same first byte
+
+// Chain entries by first byte so a lookup only scans plausible candidates.
+// Must run before any task compresses or decompresses text.
+void text_codec_init(void)
+{
+    for (int i = 0; i < 256; i++) {
+        first_entry[i] = -1;
+    }
+    for (int i = DICTIONARY_SIZE - 1; i >= 0; i--) {
+        uint8_t first = (uint8_t)dictionary[i][0];
+        entry_length[i] = strlen(dictionary[i]);
+        next_entry[i] = first_entry[first];
+        first_entry[first] = i;
+    }
+}
+
+static uint8_t *text_flush_verbatim(const uint8_t *literal, size_t count, uint8_t *out, const uint8_t *out_end)
+{
+    while (count > 0) {
+        size_t run = count > TEXT_VERBATIM_RUN_MAX ? TEXT_VERBATIM_RUN_MAX : count;
+        size_t needed = (run == 1) ? 2 : run + 2;
+        if (out == NULL || (size_t)(out_end - out) < needed) {
+            return NULL;
+        }
+        if (run == 1) {
+            *out++ = TEXT_CODE_VERBATIM;
+        } else {
+            *out++ = TEXT_CODE_VERBATIM_RUN;
+            *out++ = (uint8_t)(run - 1);
+        }
+        memcpy(out, literal, run);
+        out += run;
+        literal += run;
+        count -= run;
+    }
+    return out;
+}
+
+// Returns the compressed length, or 0 if the result would not be smaller
+size_t text_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size)
+{
+    const uint8_t *out_end = out + (out_size < in_len ? out_size : in_len);
+    uint8_t *p = out;
+    const uint8_t *literal = NULL;
+    size_t literal_len = 0;
+    size_t pos = 0;
+
+    while (pos < in_len) {
+        // Greedy longest match
+        int best = -1;
+        size_t best_len = 0;
+        for (int i = first_entry[in[pos]]; i >= 0; i = next_entry[i]) {
+            size_t len = entry_length[i];
+            if (len > best_len && len <= in_len - pos && memcmp(dictionary[i], &in[pos], len) == 0) {
+                best = i;
+                best_len = len;
+            }
+        }
+
+        if (best < 0) {
+            if (literal_len == 0) {
+                literal = &in[pos];
+            }
+            literal_len++;
+            pos++;
+            continue;
+        }
+
+        if (literal_len > 0) {
+            p = text_flush_verbatim(literal, literal_len, p, out_end);
+            literal_len = 0;
+        }
+        if (p == NULL || p >= out_end) {
+            return 0;
+        }
+        *p++ = (uint8_t)best;
+        pos += best_len;
+    }
+
+    if (literal_len > 0) {
+        p = text_flush_verbatim(literal, literal_len, p, out_end);
+    }
+    if (p == NULL || (size_t)(p - out) >= in_len) {
+        return 0;
+    }
+    return p - out;
+}
+
+esp_err_t text_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size, size_t *out_len)
+{
+    const uint8_t *end = in + in_len;
+    size_t len = 0;
+
+    while (in < end) {
+        uint8_t code = *in++;
+        const uint8_t *src;
+        size_t n;
+
+        if (code == TEXT_CODE_VERBATIM) {
+            n = 1;
+            src = in;
+        } else if (code == TEXT_CODE_VERBATIM_RUN) {
+            if (in >= end) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            n = (size_t)*in++ + 1;
+            src = in;
+        } else if (code < DICTIONARY_SIZE) {
+            src = (const uint8_t *)dictionary[code];
+            n = entry_length[code];
+        } else {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (src == in) {
+            if ((size_t)(end - in) < n) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            in += n;
+        }
+        if (out_size - len < n) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(out + len, src, n);
+        len += n;
+    }
+
+    *out_len = len;
+    return ESP_OK;
+}
@@ -0,0 +1,13 @@
+#ifndef TEXT_CODEC_H
+#define TEXT_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Static-dictionary (SMAZ-style) compression for short chat text
+void text_codec_init(void);
+size_t text_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size);
+esp_err_t text_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size, size_t *out_len);
+
+#endif // TEXT_CODEC_H
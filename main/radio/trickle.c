@@ -0,0 +1,64 @@
+#include "trickle.h"
+#include "esp_random.h"
+
+static void trickle_start_interval(trickle_t *trickle, uint32_t now_ms)
+{
+    uint32_t half = trickle->interval_ms / 2;
+    trickle->start_ms = now_ms;
+    trickle->fire_ms = now_ms + half + esp_random() % (trickle->interval_ms - half);
+    trickle->counter = 0;
+    trickle->fired = false;
+}
+
+void trickle_init(trickle_t *trickle, uint32_t imin_ms, uint8_t max_doublings, uint8_t k, uint32_t now_ms)
+{
+    trickle->imin_ms = imin_ms;
+    trickle->imax_ms = imin_ms << max_doublings;
+    trickle->k = k;
+    trickle->interval_ms = imin_ms;
+    trickle->suppressed = false;
+    trickle_start_interval(trickle, now_ms);
+}
+
+void trickle_consistent(trickle_t *trickle)
+{
+    if (trickle->counter < UINT8_MAX) {
+        trickle->counter++;
+    }
+}
+
+void trickle_inconsistent(trickle_t *trickle, uint32_t now_ms)
+{
+    // Already at the fastest rate: the running interval serves as well
+    if (trickle->interval_ms == trickle->imin_ms) {
+        return;
+    }
+    trickle->interval_ms = trickle->imin_ms;
+    trickle_start_interval(trickle, now_ms);
+}
+
+bool trickle_poll(trickle_t *trickle, uint32_t now_ms)
+{
+    bool transmit = false;
+
+    if (!trickle->fired && (int32_t)(now_ms - trickle->fire_ms) >= 0) {
+        trickle->fired = true;
+        transmit = trickle->counter < trickle->k || trickle->suppressed;
+        trickle->suppressed = !transmit;
+    }
+
+    if (now_ms - trickle->start_ms >= trickle->interval_ms) {
+        if (trickle->interval_ms < trickle->imax_ms) {
+            trickle->interval_ms *= 2;
+        }
+        trickle_start_interval(trickle, now_ms);
+    }
+    return transmit;
+}
+
+uint32_t trickle_wait_ms(const trickle_t *trickle, uint32_t now_ms)
+{
+    uint32_t next_ms = trickle->fired ? trickle->start_ms + trickle->interval_ms : trickle->fire_ms;
+    int32_t remaining = (int32_t)(next_ms - now_ms);
+    return remaining > 0 ? (uint32_t)remaining : 0;
+}
@@ -0,0 +1,35 @@
+#ifndef TRICKLE_H
+#define TRICKLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Trickle timer (RFC 6206): transmit once per interval unless k consistent
+// transmissions were heard, double the interval while things stay
+// consistent and drop back to Imin on any inconsistency.
+//
+// Unlike the RFC, a transmission is never suppressed twice in a row, so
+// neighbors hear from every node at least once per two intervals.
+typedef struct {
+    uint32_t imin_ms;
+    uint32_t imax_ms;
+    uint8_t k;
+    uint32_t interval_ms;           // Current interval I
+    uint32_t start_ms;              // Start of the current interval
+    uint32_t fire_ms;               // Transmission point t within it
+    uint8_t counter;                // Consistent transmissions heard (c)
+    bool fired;
+    bool suppressed;                // Previous interval stayed silent
+} trickle_t;
+
+void trickle_init(trickle_t *trickle, uint32_t imin_ms, uint8_t max_doublings, uint8_t k, uint32_t now_ms);
+void trickle_consistent(trickle_t *trickle);
+void trickle_inconsistent(trickle_t *trickle, uint32_t now_ms);
+
+// True when it is time to transmit
+bool trickle_poll(trickle_t *trickle, uint32_t now_ms);
+
+// Time until trickle_poll next has something to do
+uint32_t trickle_wait_ms(const trickle_t *trickle, uint32_t now_ms);
+
+#endif // TRICKLE_H
@@ -0,0 +1,277 @@
+#include "tx_sched.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+
+static const char *TAG = "TX_SCHED";
+
+#define TX_SCHED_TOTAL_DEPTH (TX_DEPTH_CONTROL + TX_DEPTH_EMERGENCY + TX_DEPTH_LOCAL + \
+                              TX_DEPTH_RELAY + TX_DEPTH_BEACON)
+
+typedef struct {
+    msg_handle_t handle;
+    uint32_t enqueued_ms;
+    uint32_t seq;
+    lora_lbt_t lbt;                 // Busy CADs and backoff window of this frame alone
+} tx_slot_t;
+
+// One ring per class, carved out of a shared slot array
+typedef struct {
+    uint16_t offset;
+    uint16_t depth;
+    uint16_t head;
+    uint16_t count;
+    uint32_t deferred_until_ms;     // Head blocked (e.g. by the duty cycle) until then
+    bool deferred;
+} tx_ring_t;
+
+static const uint16_t class_depth[TX_CLASS_COUNT] = {
+    TX_DEPTH_CONTROL, TX_DEPTH_EMERGENCY, TX_DEPTH_LOCAL, TX_DEPTH_RELAY, TX_DEPTH_BEACON,
+};
+
+static tx_slot_t slots[TX_SCHED_TOTAL_DEPTH];
+static tx_ring_t rings[TX_CLASS_COUNT];
+static tx_sched_stats_t stats;
+static uint32_t next_seq = 0;
+static SemaphoreHandle_t sched_mutex;
+
+esp_err_t tx_sched_init(void)
+{
+    sched_mutex = xSemaphoreCreateMutex();
+    if (sched_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint16_t offset = 0;
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        memset(&rings[c], 0, sizeof(rings[c]));
+        rings[c].offset = offset;
+        rings[c].depth = class_depth[c];
+        offset += class_depth[c];
+    }
+    memset(&stats, 0, sizeof(stats));
+    return ESP_OK;
+}
+
+tx_class_t tx_sched_classify(const mesh_message_t *message, const uint8_t *self_id)
+{
+    switch (message->message_type) {
+        case MSG_TYPE_ACK:
+        case MSG_TYPE_ROUTE_REQUEST:
+        case MSG_TYPE_ROUTE_REPLY:
+        case MSG_TYPE_ROUTE_ERROR:
+        case MSG_TYPE_FRAGMENT_NACK:
+            return TX_CLASS_CONTROL;
+        case MSG_TYPE_EMERGENCY:
+            return TX_CLASS_EMERGENCY;
+        case MSG_TYPE_BEACON:
+            return TX_CLASS_BEACON;
+        default:
+            return memcmp(message->sender_id, self_id, 8) == 0 ? TX_CLASS_LOCAL : TX_CLASS_RELAY;
+    }
+}
+
+static tx_slot_t *tx_ring_slot(const tx_ring_t *ring, uint16_t index)
+{
+    return &slots[ring->offset + (ring->head + index) % ring->depth];
+}
+
+// Takes over the caller's reference to the message
+esp_err_t tx_sched_enqueue(msg_handle_t handle, tx_class_t tx_class, uint32_t now_ms)
+{
+    tx_ring_t *ring = &rings[tx_class];
+
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+
+    if (ring->count == ring->depth) {
+        stats.dropped[tx_class]++;
+        if (tx_class != TX_CLASS_BEACON) {
+            xSemaphoreGive(sched_mutex);
+            ESP_LOGW(TAG, "Class %d full, message %lu dropped", tx_class, msg_pool_get(handle)->id);
+            msg_pool_release(handle);
+            return ESP_ERR_NO_MEM;
+        }
+        // Only the newest beacon is worth sending
+        msg_pool_release(tx_ring_slot(ring, 0)->handle);
+        ring->head = (ring->head + 1) % ring->depth;
+        ring->count--;
+    }
+
+    tx_slot_t *slot = tx_ring_slot(ring, ring->count);
+    slot->handle = handle;
+    slot->enqueued_ms = now_ms;
+    slot->seq = next_seq++;
+    slot->lbt = (lora_lbt_t) {0};
+    ring->count++;
+    stats.enqueued[tx_class]++;
+
+    xSemaphoreGive(sched_mutex);
+    return ESP_OK;
+}
+
+// Strict priority, except that every TX_AGING_MS a head frame has waited
+// lifts its class one level so low classes are never starved.
+// The returned handle carries its own reference for the caller to release.
+msg_handle_t tx_sched_peek(tx_sched_ticket_t *ticket, uint32_t now_ms)
+{
+    msg_handle_t handle = MSG_HANDLE_NONE;
+    int best = -1;
+    int32_t best_rank = 0;
+
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        tx_ring_t *ring = &rings[c];
+        if (ring->count == 0) {
+            continue;
+        }
+        if (ring->deferred) {
+            if ((int32_t)(now_ms - ring->deferred_until_ms) < 0) {
+                continue;  // Head-of-line blocked; let other classes through
+            }
+            ring->deferred = false;
+        }
+
+        uint32_t waited = now_ms - tx_ring_slot(ring, 0)->enqueued_ms;
+        int32_t rank = c - (int32_t)(waited / TX_AGING_MS);
+        if (best < 0 || rank < best_rank) {
+            best = c;
+            best_rank = rank;
+        }
+    }
+
+    if (best >= 0) {
+        tx_slot_t *slot = tx_ring_slot(&rings[best], 0);
+        handle = slot->handle;
+        msg_pool_ref(handle);
+        ticket->tx_class = best;
+        ticket->seq = slot->seq;
+        ticket->enqueued_ms = slot->enqueued_ms;
+        ticket->lbt = slot->lbt;
+    }
+
+    xSemaphoreGive(sched_mutex);
+    return handle;
+}
+
+// Find queued messages that can ride along with the one being sent, in
+// priority order. Each returned handle carries a reference for the caller.
+size_t tx_sched_collect(const tx_sched_ticket_t *exclude, tx_sched_match_t match, void *ctx,
+                        msg_handle_t *handles, tx_sched_ticket_t *tickets, size_t max)
+{
+    size_t found = 0;
+
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+
+    for (int c = 0; c < TX_CLASS_COUNT && found < max; c++) {
+        tx_ring_t *ring = &rings[c];
+        for (uint16_t i = 0; i < ring->count && found < max; i++) {
+            tx_slot_t *slot = tx_ring_slot(ring, i);
+            if (slot->seq == exclude->seq || !match(msg_pool_get(slot->handle), ctx)) {
+                continue;
+            }
+            msg_pool_ref(slot->handle);
+            handles[found] = slot->handle;
+            tickets[found].tx_class = c;
+            tickets[found].seq = slot->seq;
+            tickets[found].enqueued_ms = slot->enqueued_ms;
+            tickets[found].lbt = slot->lbt;
+            found++;
+        }
+    }
+
+    xSemaphoreGive(sched_mutex);
+    return found;
+}
+
+// Remove a frame that has been sent (or consumed otherwise). Frames sent
+// inside an aggregate may come from anywhere in their ring.
+void tx_sched_complete(const tx_sched_ticket_t *ticket, uint32_t now_ms)
+{
+    tx_ring_t *ring = &rings[ticket->tx_class];
+
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+
+    // A replaced beacon is already gone, so the ticket may match nothing
+    for (uint16_t i = 0; i < ring->count; i++) {
+        tx_slot_t *slot = tx_ring_slot(ring, i);
+        if (slot->seq != ticket->seq) {
+            continue;
+        }
+
+        uint32_t delay = now_ms - slot->enqueued_ms;
+        stats.sent[ticket->tx_class]++;
+        stats.delay_ms_total[ticket->tx_class] += delay;
+        if (delay > stats.delay_ms_max[ticket->tx_class]) {
+            stats.delay_ms_max[ticket->tx_class] = delay;
+        }
+        msg_pool_release(slot->handle);
+
+        // Close the gap so the ring stays in arrival order
+        for (uint16_t j = i; j + 1 < ring->count; j++) {
+            *tx_ring_slot(ring, j) = *tx_ring_slot(ring, j + 1);
+        }
+        ring->count--;
+        break;
+    }
+
+    xSemaphoreGive(sched_mutex);
+}
+
+size_t tx_sched_free(tx_class_t tx_class)
+{
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    size_t free_slots = rings[tx_class].depth - rings[tx_class].count;
+    xSemaphoreGive(sched_mutex);
+    return free_slots;
+}
+
+// Hold a class back until until_ms; the frame keeps the ticket's channel
+// access state for its next attempt
+void tx_sched_defer(const tx_sched_ticket_t *ticket, uint32_t until_ms)
+{
+    tx_ring_t *ring = &rings[ticket->tx_class];
+
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    ring->deferred = true;
+    ring->deferred_until_ms = until_ms;
+    stats.deferred[ticket->tx_class]++;
+    for (uint16_t i = 0; i < ring->count; i++) {
+        tx_slot_t *slot = tx_ring_slot(ring, i);
+        if (slot->seq == ticket->seq) {
+            slot->lbt = ticket->lbt;
+            break;
+        }
+    }
+    xSemaphoreGive(sched_mutex);
+}
+
+// Time until tx_sched_peek can hand out a frame: 0 if one is ready now,
+// UINT32_MAX if nothing is queued
+uint32_t tx_sched_wait_ms(uint32_t now_ms)
+{
+    uint32_t wait_ms = UINT32_MAX;
+
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        const tx_ring_t *ring = &rings[c];
+        if (ring->count == 0) {
+            continue;
+        }
+        int32_t remaining = ring->deferred ? (int32_t)(ring->deferred_until_ms - now_ms) : 0;
+        uint32_t ring_wait = remaining > 0 ? (uint32_t)remaining : 0;
+        if (ring_wait < wait_ms) {
+            wait_ms = ring_wait;
+        }
+    }
+    xSemaphoreGive(sched_mutex);
+    return wait_ms;
+}
+
+void tx_sched_get_stats(tx_sched_stats_t *stats_out)
+{
+    xSemaphoreTake(sched_mutex, portMAX_DELAY);
+    *stats_out = stats;
+    xSemaphoreGive(sched_mutex);
+}
@@ -0,0 +1,51 @@
+#ifndef TX_SCHED_H
+#define TX_SCHED_H
+
+#include "esp_err.h"
+#include "device_config.h"
+#include "msg_pool.h"
+#include "lora.h"
+
+// Priority classes, most urgent first
+typedef enum {
+    TX_CLASS_CONTROL = 0,       // ACKs and route control
+    TX_CLASS_EMERGENCY,
+    TX_CLASS_LOCAL,             // Text originated on this node
+    TX_CLASS_RELAY,             // Traffic forwarded for others
+    TX_CLASS_BEACON,
+    TX_CLASS_COUNT
+} tx_class_t;
+
+// Identifies the frame handed out by tx_sched_peek
+typedef struct {
+    tx_class_t tx_class;
+    uint32_t seq;
+    uint32_t enqueued_ms;
+    lora_lbt_t lbt;                 // Channel access progress, kept by tx_sched_defer
+} tx_sched_ticket_t;
+
+// Decides whether a queued message may share a frame; ctx is caller state
+typedef bool (*tx_sched_match_t)(const mesh_message_t *message, void *ctx);
+
+typedef struct {
+    uint32_t enqueued[TX_CLASS_COUNT];
+    uint32_t sent[TX_CLASS_COUNT];
+    uint32_t dropped[TX_CLASS_COUNT];       // Class full (or replaced, for beacons)
+    uint32_t deferred[TX_CLASS_COUNT];      // Head held back, other classes served instead
+    uint64_t delay_ms_total[TX_CLASS_COUNT];    // Queueing delay of sent frames
+    uint32_t delay_ms_max[TX_CLASS_COUNT];
+} tx_sched_stats_t;
+
+esp_err_t tx_sched_init(void);
+tx_class_t tx_sched_classify(const mesh_message_t *message, const uint8_t *self_id);
+esp_err_t tx_sched_enqueue(msg_handle_t handle, tx_class_t tx_class, uint32_t now_ms);
+msg_handle_t tx_sched_peek(tx_sched_ticket_t *ticket, uint32_t now_ms);
+size_t tx_sched_collect(const tx_sched_ticket_t *exclude, tx_sched_match_t match, void *ctx,
+                        msg_handle_t *handles, tx_sched_ticket_t *tickets, size_t max);
+void tx_sched_complete(const tx_sched_ticket_t *ticket, uint32_t now_ms);
+size_t tx_sched_free(tx_class_t tx_class);
+void tx_sched_defer(const tx_sched_ticket_t *ticket, uint32_t until_ms);
+uint32_t tx_sched_wait_ms(uint32_t now_ms);
+void tx_sched_get_stats(tx_sched_stats_t *stats);
+
+#endif // TX_SCHED_H
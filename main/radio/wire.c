@@ -0,0 +1,326 @@
+#include "wire.h"
+#include "text_codec.h"
+#include <string.h>
+
+static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static size_t varint_size(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static uint8_t *varint_put(uint8_t *p, uint64_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+// Returns NULL on truncated or overlong input
+static const uint8_t *varint_get(const uint8_t *p, const uint8_t *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static uint8_t wire_flags(const mesh_message_t *message, const wire_link_t *link)
+{
+    uint8_t flags = 0;
+    if (memcmp(message->recipient_id, broadcast_id, 8) == 0) {
+        flags |= WIRE_FLAG_BROADCAST;
+    }
+    if (memcmp(link->transmitter_id, message->sender_id, 8) != 0) {
+        flags |= WIRE_FLAG_RELAYED;
+    }
+    if (link->has_next_hop) {
+        flags |= WIRE_FLAG_NEXT_HOP;
+    }
+    return flags;
+}
+
+// Text goes on air compressed whenever that makes it shorter
+static size_t wire_payload(const mesh_message_t *message, uint8_t *scratch, const uint8_t **payload, uint8_t *flags)
+{
+    *payload = message->payload;
+    if (WIRE_COMPRESS_TEXT && message->payload_length > 0 &&
+        (message->message_type == MSG_TYPE_TEXT || message->message_type == MSG_TYPE_EMERGENCY)) {
+        size_t len = text_compress(message->payload, message->payload_length, scratch, message->payload_length);
+        if (len > 0) {
+            *payload = scratch;
+            *flags |= WIRE_FLAG_COMPRESSED;
+            return len;
+        }
+    }
+    return message->payload_length;
+}
+
+size_t wire_encoded_size(const mesh_message_t *message, const wire_link_t *link)
+{
+    uint8_t flags = wire_flags(message, link);
+    uint8_t scratch[UINT8_MAX];
+    const uint8_t *payload;
+    size_t payload_len = wire_payload(message, scratch, &payload, &flags);
+    return 4 + varint_size(message->id) + varint_size(message->timestamp) + 8 +
+           ((flags & WIRE_FLAG_RELAYED) ? 8 : 0) + ((flags & WIRE_FLAG_BROADCAST) ? 0 : 8) +
+           ((flags & WIRE_FLAG_NEXT_HOP) ? 8 : 0) + 1 + payload_len + 2;
+}
+
+esp_err_t wire_encode(const mesh_message_t *message, const wire_link_t *link,
+                      uint8_t *buf, size_t buf_size, size_t *out_len)
+{
+    if (wire_encoded_size(message, link) > buf_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t flags = wire_flags(message, link);
+    uint8_t scratch[UINT8_MAX];
+    const uint8_t *payload;
+    size_t payload_len = wire_payload(message, scratch, &payload, &flags);
+    uint8_t *p = buf;
+
+    *p++ = WIRE_VERSION;
+    *p++ = flags;
+    *p++ = (uint8_t)message->message_type;
+    *p++ = message->hop_count;
+    p = varint_put(p, message->id);
+    p = varint_put(p, message->timestamp);
+    memcpy(p, message->sender_id, 8);
+    p += 8;
+    if (flags & WIRE_FLAG_RELAYED) {
+        memcpy(p, link->transmitter_id, 8);
+        p += 8;
+    }
+    if (!(flags & WIRE_FLAG_BROADCAST)) {
+        memcpy(p, message->recipient_id, 8);
+        p += 8;
+    }
+    if (flags & WIRE_FLAG_NEXT_HOP) {
+        memcpy(p, link->next_hop_id, 8);
+        p += 8;
+    }
+    *p++ = (uint8_t)payload_len;
+    memcpy(p, payload, payload_len);
+    p += payload_len;
+    *p++ = (uint8_t)(message->checksum & 0xFF);
+    *p++ = (uint8_t)(message->checksum >> 8);
+
+    *out_len = p - buf;
+    return ESP_OK;
+}
+
+esp_err_t wire_decode(const uint8_t *buf, size_t len, mesh_message_t *message, wire_link_t *link)
+{
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+    uint64_t value;
+
+    if (len < 4) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (p[0] != WIRE_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    uint8_t flags = p[1];
+    if (flags & ~(WIRE_FLAG_BROADCAST | WIRE_FLAG_RELAYED | WIRE_FLAG_NEXT_HOP | WIRE_FLAG_COMPRESSED)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // Start from a clean struct; fields absent on air stay zero
+    memset(message, 0, sizeof(*message));
+    message->message_type = (message_type_t)p[2];
+    message->hop_count = p[3];
+    p += 4;
+
+    if ((p = varint_get(p, end, &value)) == NULL || value > UINT32_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    message->id = (uint32_t)value;
+    if ((p = varint_get(p, end, &value)) == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    message->timestamp = value;
+
+    size_t ids_len = 8 + ((flags & WIRE_FLAG_RELAYED) ? 8 : 0) + ((flags & WIRE_FLAG_BROADCAST) ? 0 : 8) +
+                     ((flags & WIRE_FLAG_NEXT_HOP) ? 8 : 0);
+    if ((size_t)(end - p) < ids_len + 1) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(message->sender_id, p, 8);
+    p += 8;
+    if (flags & WIRE_FLAG_RELAYED) {
+        memcpy(link->transmitter_id, p, 8);
+        p += 8;
+    } else {
+        memcpy(link->transmitter_id, message->sender_id, 8);
+    }
+    if (flags & WIRE_FLAG_BROADCAST) {
+        memcpy(message->recipient_id, broadcast_id, 8);
+    } else {
+        memcpy(message->recipient_id, p, 8);
+        p += 8;
+    }
+    link->has_next_hop = (flags & WIRE_FLAG_NEXT_HOP) != 0;
+    if (link->has_next_hop) {
+        memcpy(link->next_hop_id, p, 8);
+        p += 8;
+    }
+
+    size_t payload_len = *p++;
+    if ((size_t)(end - p) != payload_len + 2u) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (flags & WIRE_FLAG_COMPRESSED) {
+        size_t text_len;
+        esp_err_t ret = text_decompress(p, payload_len, message->payload, UINT8_MAX, &text_len);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        message->payload_length = (uint8_t)text_len;
+    } else {
+        memcpy(message->payload, p, payload_len);
+        message->payload_length = (uint8_t)payload_len;
+    }
+    p += payload_len;
+    message->checksum = (uint16_t)(p[0] | (p[1] << 8));
+
+    return ESP_OK;
+}
+
+size_t wire_aggregate_header_size(const wire_link_t *link)
+{
+    return 2 + 8 + (link->has_next_hop ? 8 : 0);
+}
+
+// Records carry no link fields of their own; the container supplies them
+static void wire_record_link(const mesh_message_t *message, wire_link_t *record_link)
+{
+    memcpy(record_link->transmitter_id, message->sender_id, 8);
+    record_link->has_next_hop = false;
+}
+
+size_t wire_aggregate_record_size(const mesh_message_t *message)
+{
+    wire_link_t record_link;
+    wire_record_link(message, &record_link);
+    return 1 + wire_encoded_size(message, &record_link);
+}
+
+esp_err_t wire_encode_aggregate(const mesh_message_t *const *messages, size_t count, const wire_link_t *link,
+                                uint8_t *buf, size_t buf_size, size_t *out_len)
+{
+    size_t total = wire_aggregate_header_size(link);
+    for (size_t i = 0; i < count; i++) {
+        total += wire_aggregate_record_size(messages[i]);
+    }
+    if (total > buf_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t *p = buf;
+    *p++ = WIRE_VERSION;
+    *p++ = WIRE_FLAG_AGGREGATE | (link->has_next_hop ? WIRE_FLAG_NEXT_HOP : 0);
+    memcpy(p, link->transmitter_id, 8);
+    p += 8;
+    if (link->has_next_hop) {
+        memcpy(p, link->next_hop_id, 8);
+        p += 8;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        wire_link_t record_link;
+        size_t record_len;
+        wire_record_link(messages[i], &record_link);
+        wire_encode(messages[i], &record_link, p + 1, buf + buf_size - (p + 1), &record_len);
+        *p = (uint8_t)record_len;
+        p += 1 + record_len;
+    }
+
+    *out_len = p - buf;
+    return ESP_OK;
+}
+
+// Parse the container header; returns its size, or 0 if malformed
+static size_t wire_aggregate_link(const uint8_t *buf, size_t len, wire_link_t *link)
+{
+    if (len < 10) {
+        return 0;
+    }
+    uint8_t flags = buf[1];
+    if (flags & ~(WIRE_FLAG_AGGREGATE | WIRE_FLAG_NEXT_HOP)) {
+        return 0;
+    }
+
+    memcpy(link->transmitter_id, buf + 2, 8);
+    link->has_next_hop = (flags & WIRE_FLAG_NEXT_HOP) != 0;
+    if (link->has_next_hop) {
+        if (len < 18) {
+            return 0;
+        }
+        memcpy(link->next_hop_id, buf + 10, 8);
+    }
+    return wire_aggregate_header_size(link);
+}
+
+esp_err_t wire_decode_next(const uint8_t *buf, size_t len, size_t *offset,
+                           mesh_message_t *message, wire_link_t *link)
+{
+    if (*offset >= len) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (len < 2 || buf[0] != WIRE_VERSION) {
+        *offset = len;
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    // Plain frame: the whole buffer is one message
+    if (!(buf[1] & WIRE_FLAG_AGGREGATE)) {
+        *offset = len;
+        return wire_decode(buf, len, message, link);
+    }
+
+    wire_link_t container;
+    size_t header_len = wire_aggregate_link(buf, len, &container);
+    if (header_len == 0) {
+        *offset = len;
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (*offset < header_len) {
+        *offset = header_len;
+    }
+    if (*offset >= len) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t record_len = buf[*offset];
+    const uint8_t *record = buf + *offset + 1;
+    if (record_len < 4 || record_len > len - *offset - 1) {
+        *offset = len;  // Nothing after a bad length can be trusted
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *offset += 1 + record_len;
+
+    if (record[1] & (WIRE_FLAG_RELAYED | WIRE_FLAG_NEXT_HOP | WIRE_FLAG_AGGREGATE)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    esp_err_t ret = wire_decode(record, record_len, message, link);
+    if (ret == ESP_OK) {
+        *link = container;
+    }
+    return ret;
+}
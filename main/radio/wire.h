@@ -0,0 +1,69 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include "esp_err.h"
+#include "device_config.h"
+
+// On-air frame format, independent of the in-memory mesh_message_t
+//
+//   version       1 byte
+//   flags         1 byte   (WIRE_FLAG_*)
+//   message_type  1 byte
+//   hop_count     1 byte
+//   id            varint
+//   timestamp     varint
+//   sender_id     8 bytes
+//   transmitter   8 bytes  (only when WIRE_FLAG_RELAYED)
+//   recipient_id  8 bytes  (omitted when WIRE_FLAG_BROADCAST)
+//   next_hop      8 bytes  (only when WIRE_FLAG_NEXT_HOP)
+//   payload_len   1 byte   (on-air length, compressed if WIRE_FLAG_COMPRESSED)
+//   payload       payload_len bytes
+//   checksum      2 bytes, little endian
+//
+// An aggregate frame carries several messages for the same next hop (or
+// several broadcasts) behind one preamble:
+//
+//   version       1 byte
+//   flags         1 byte   (WIRE_FLAG_AGGREGATE, optionally WIRE_FLAG_NEXT_HOP)
+//   transmitter   8 bytes
+//   next_hop      8 bytes  (only when WIRE_FLAG_NEXT_HOP)
+//   records       repeated: length byte, then a single-message frame
+//                 without transmitter or next hop
+//
+// Version 2 added relay links, aggregates, compressed text and the beacon's
+// base-listen phase. A receiver refuses any other version, so a node still on
+// version 1 drops these frames rather than misreading them.
+#define WIRE_VERSION            2
+
+#define WIRE_FLAG_BROADCAST     0x01    // Recipient is all 0xFF and not sent
+#define WIRE_FLAG_RELAYED       0x02    // Transmitter differs from the sender
+#define WIRE_FLAG_NEXT_HOP      0x04    // Only the named neighbor may forward
+#define WIRE_FLAG_AGGREGATE     0x08    // Container of several message records
+#define WIRE_FLAG_COMPRESSED    0x10    // Text payload is text_codec compressed
+
+#define WIRE_MAX_HEADER         (4 + 5 + 10 + 8 + 8 + 8 + 8 + 1 + 2)
+#define WIRE_MAX_PAYLOAD        (255 - WIRE_MAX_HEADER)
+
+// Link-layer fields carried alongside a message but not part of mesh_message_t
+typedef struct {
+    uint8_t transmitter_id[8];      // Node that put this frame on air
+    uint8_t next_hop_id[8];         // Neighbor asked to handle a unicast frame
+    bool has_next_hop;
+} wire_link_t;
+
+size_t wire_encoded_size(const mesh_message_t *message, const wire_link_t *link);
+esp_err_t wire_encode(const mesh_message_t *message, const wire_link_t *link,
+                      uint8_t *buf, size_t buf_size, size_t *out_len);
+esp_err_t wire_decode(const uint8_t *buf, size_t len, mesh_message_t *message, wire_link_t *link);
+
+size_t wire_aggregate_header_size(const wire_link_t *link);
+size_t wire_aggregate_record_size(const mesh_message_t *message);
+esp_err_t wire_encode_aggregate(const mesh_message_t *const *messages, size_t count, const wire_link_t *link,
+                                uint8_t *buf, size_t buf_size, size_t *out_len);
+
+// Decode plain and aggregate frames alike, one message per call. Start
+// with *offset = 0; ESP_ERR_NOT_FOUND means the frame is exhausted.
+esp_err_t wire_decode_next(const uint8_t *buf, size_t len, size_t *offset,
+                           mesh_message_t *message, wire_link_t *link);
+
+#endif // WIRE_H
@@ -0,0 +1,1132 @@
+#include "msg_log.h"
+#include "record_codec.h"
+#include "crc.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "MSG_LOG";
+
+#define MSG_LOG_SECTOR_SIZE     4096
+#define MSG_LOG_MAGIC           0x474F4C4D  // "MLOG"
+#define MSG_LOG_MAX_DATA        RECORD_MAX_SIZE
+#define MSG_LOG_IO_BUFFER       2048        // Largest run of records written at once
+#define MSG_LOG_MOVED           UINT32_MAX  // prev_addr of a pinned record copied forward
+
+_Static_assert(MSG_LOG_RETAIN_PER_PEER < UINT16_MAX, "Conversation positions are 16-bit");
+
+// Written when the head moves into a sector
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;            // One more than the sector opened before
+    uint32_t first_seq;             // Sequence number of its first record
+    uint32_t base_id;               // Delta bases for its records: the
+    uint64_t base_timestamp;        // newest message before it was opened
+    uint32_t opened_s;              // Log clock when it was opened
+    uint16_t crc;
+} __attribute__((packed)) msg_log_sector_t;
+
+// Newest record of a conversation. The sector header is followed by a
+// snapshot of all of them, so recovery only has to replay the head sector.
+// The snapshot's peers are also the dictionary its records are coded with.
+typedef struct {
+    uint8_t peer[8];                // Other device, or the broadcast ID
+    uint32_t seq;                   // 0 for an unused entry
+    uint32_t addr;
+    uint16_t ordinal;               // Of the newest record
+} __attribute__((packed)) msg_log_conversation_t;
+
+// Pinned record, wherever it has been moved to since
+typedef struct {
+    uint32_t seq;                   // 0 for an unused entry
+    uint32_t addr;
+} __attribute__((packed)) msg_log_pin_t;
+
+// Follows each sector header
+typedef struct {
+    msg_log_conversation_t conversations[MSG_LOG_CONVERSATIONS];
+    msg_log_pin_t pins[MSG_LOG_PINNED_MAX];     // Oldest first
+    uint16_t crc;
+} __attribute__((packed)) msg_log_index_t;
+
+#define MSG_LOG_DATA_START      (sizeof(msg_log_sector_t) + sizeof(msg_log_index_t))
+
+// Precedes each record; all 0xFF where nothing has been written yet.
+// Records of one conversation are chained newest to oldest.
+typedef struct {
+    uint16_t crc;                   // Over the rest of the header and the data
+    uint16_t length;                // Data bytes that follow
+    uint32_t seq;
+    uint32_t prev_seq;              // Previous record of the conversation, 0 if none
+    uint32_t prev_addr;             // MSG_LOG_MOVED: a copy, and prev_seq the original
+    uint16_t ordinal;               // Position in the conversation, counting up
+} __attribute__((packed)) msg_log_record_t;
+
+static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static const esp_partition_t *partition;
+static SemaphoreHandle_t log_mutex;
+static uint32_t sector_count;
+static uint32_t *sector_first_seq;  // Meaningful for the live sectors only
+static uint32_t oldest_sector;
+static uint32_t quota_sectors;      // Most sectors the log may hold
+static uint32_t erased_ahead;       // Erased sectors following the head, at least 1
+static uint32_t head_sector;
+static uint32_t head_generation;
+static uint32_t write_offset;       // Within the head sector
+static bool head_sealed;            // Holds a torn record; appends move on
+static uint32_t next_seq;
+static msg_log_stats_t stats;
+static uint8_t self_id[8];
+static msg_log_conversation_t conversations[MSG_LOG_CONVERSATIONS];
+static msg_log_pin_t pins[MSG_LOG_PINNED_MAX];
+static uint32_t pin_count;
+static uint32_t last_id;            // Newest message appended
+static uint64_t last_timestamp;
+
+// Powered-on seconds, carried across reboots through the sector headers;
+// these devices keep no wall time
+static uint32_t clock_base_s;
+static int64_t clock_base_us;
+
+// Progress through the oldest sector, kept between compaction steps
+static struct {
+    uint32_t sector;                // UINT32_MAX before the oldest is examined
+    uint32_t offset;                // Next record to examine
+    uint32_t seq;
+    uint32_t closed_s;              // Log clock when the sector after it was opened
+    bool reclaim;                   // Decided to give it up
+} compact = { .sector = UINT32_MAX };
+
+// Records are coded against their sector's dictionary: the head sector's
+// is kept for appends, and one other is cached for reads
+static record_dict_t head_dict;
+static record_dict_t read_dict;
+static uint32_t read_dict_sector = UINT32_MAX;
+static mesh_message_t decoded;
+static uint8_t encoded[RECORD_MAX_SIZE];
+static msg_log_index_t snapshot;
+
+// Addresses of the newest records, oldest first, so recent history is read
+// without walking sectors
+static uint32_t tail_addr[MSG_LOG_TAIL_INDEX];
+static uint32_t tail_start;
+static uint32_t tail_count;
+
+// Staging for reads and for runs of records written together
+static uint8_t io_buf[MSG_LOG_IO_BUFFER];
+_Static_assert(MSG_LOG_IO_BUFFER >= sizeof(msg_log_record_t) + MSG_LOG_MAX_DATA, "I/O buffer holds no record");
+
+static uint32_t sector_base(uint32_t sector)
+{
+    return sector * MSG_LOG_SECTOR_SIZE;
+}
+
+static uint32_t sector_prev(uint32_t sector)
+{
+    return (sector + sector_count - 1) % sector_count;
+}
+
+static uint32_t sector_next(uint32_t sector)
+{
+    return (sector + 1) % sector_count;
+}
+
+static uint32_t msg_log_clock(void)
+{
+    return clock_base_s + (uint32_t)((esp_timer_get_time() - clock_base_us) / 1000000);
+}
+
+static uint16_t record_crc(const msg_log_record_t *record, const uint8_t *data)
+{
+    uint16_t crc = crc16_ccitt(CRC16_CCITT_INIT, &record->length,
+                               sizeof(*record) - offsetof(msg_log_record_t, length));
+    return crc16_ccitt(crc, data, record->length);
+}
+
+static bool msg_log_read_sector(uint32_t sector, msg_log_sector_t *header)
+{
+    if (esp_partition_read(partition, sector_base(sector), header, sizeof(*header)) != ESP_OK) {
+        return false;
+    }
+    return header->magic == MSG_LOG_MAGIC &&
+           header->crc == crc16_ccitt(CRC16_CCITT_INIT, header, offsetof(msg_log_sector_t, crc));
+}
+
+// ESP_ERR_NOT_FOUND at the end of the written part of a sector,
+// ESP_ERR_INVALID_CRC for a torn or corrupted record
+static esp_err_t msg_log_read_record(uint32_t addr, msg_log_record_t *record, uint8_t *data)
+{
+    uint32_t end = (addr / MSG_LOG_SECTOR_SIZE + 1) * MSG_LOG_SECTOR_SIZE;
+    if (end - addr < sizeof(*record)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t ret = esp_partition_read(partition, addr, record, sizeof(*record));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (record->length == UINT16_MAX && record->crc == UINT16_MAX && record->seq == UINT32_MAX) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (record->length > MSG_LOG_MAX_DATA || record->length > end - addr - sizeof(*record)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    ret = esp_partition_read(partition, addr + sizeof(*record), data, record->length);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return record_crc(record, data) == record->crc ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+static esp_err_t msg_log_erase(uint32_t sector)
+{
+    stats.erases++;
+    return esp_partition_erase_range(partition, sector_base(sector), MSG_LOG_SECTOR_SIZE);
+}
+
+static bool msg_log_sector_blank(uint32_t sector)
+{
+    for (uint32_t offset = 0; offset < MSG_LOG_SECTOR_SIZE; offset += sizeof(io_buf)) {
+        size_t len = MSG_LOG_SECTOR_SIZE - offset < sizeof(io_buf) ? MSG_LOG_SECTOR_SIZE - offset : sizeof(io_buf);
+        if (esp_partition_read(partition, sector_base(sector) + offset, io_buf, len) != ESP_OK) {
+            return false;
+        }
+        for (size_t i = 0; i < len; i++) {
+            if (io_buf[i] != 0xFF) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void msg_log_tail_reset(void)
+{
+    tail_start = 0;
+    tail_count = 0;
+}
+
+static void msg_log_tail_push(uint32_t addr)
+{
+    if (tail_count < MSG_LOG_TAIL_INDEX) {
+        tail_addr[(tail_start + tail_count++) % MSG_LOG_TAIL_INDEX] = addr;
+    } else {
+        tail_addr[tail_start] = addr;
+        tail_start = (tail_start + 1) % MSG_LOG_TAIL_INDEX;
+    }
+}
+
+// History is kept per conversation: the broadcast channel, or the device
+// at the other end of a unicast message
+static const uint8_t *msg_log_peer(const uint8_t *sender_id, const uint8_t *recipient_id)
+{
+    if (memcmp(recipient_id, broadcast_id, 8) == 0) {
+        return broadcast_id;
+    }
+    return memcmp(sender_id, self_id, 8) == 0 ? recipient_id : sender_id;
+}
+
+static void msg_log_dict_build(const msg_log_sector_t *header, const msg_log_conversation_t *index,
+                               record_dict_t *dict)
+{
+    memcpy(dict->self_id, self_id, 8);
+    dict->peer_count = 0;
+    for (int i = 0; i < MSG_LOG_CONVERSATIONS; i++) {
+        if (index[i].seq != 0) {
+            memcpy(dict->peers[dict->peer_count++], index[i].peer, 8);
+        }
+    }
+    dict->base_id = header->base_id;
+    dict->base_timestamp = header->base_timestamp;
+}
+
+// Into the snapshot buffer
+static bool msg_log_read_index(uint32_t sector)
+{
+    return esp_partition_read(partition, sector_base(sector) + sizeof(msg_log_sector_t),
+                              &snapshot, sizeof(snapshot)) == ESP_OK &&
+           snapshot.crc == crc16_ccitt(CRC16_CCITT_INIT, &snapshot, offsetof(msg_log_index_t, crc));
+}
+
+// Dictionary for decoding records of a sector, loaded on first use
+static const record_dict_t *msg_log_dict(uint32_t sector)
+{
+    if (sector == head_sector) {
+        return &head_dict;
+    }
+    if (sector != read_dict_sector) {
+        msg_log_sector_t header;
+        if (!msg_log_read_sector(sector, &header) || !msg_log_read_index(sector)) {
+            return NULL;
+        }
+        msg_log_dict_build(&header, snapshot.conversations, &read_dict);
+        read_dict_sector = sector;
+    }
+    return &read_dict;
+}
+
+// Decode the record just read into io_buf
+static esp_err_t msg_log_decode(uint32_t addr, const msg_log_record_t *record, mesh_message_t *message)
+{
+    const record_dict_t *dict = msg_log_dict(addr / MSG_LOG_SECTOR_SIZE);
+    if (dict == NULL) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    return record_decode(io_buf, record->length, dict, message);
+}
+
+// Which conversation the record just read into io_buf belongs to, without
+// decoding its payload
+static esp_err_t msg_log_decode_peer(uint32_t addr, const msg_log_record_t *record, uint8_t *peer)
+{
+    const record_dict_t *dict = msg_log_dict(addr / MSG_LOG_SECTOR_SIZE);
+    if (dict == NULL) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    uint8_t sender_id[8];
+    uint8_t recipient_id[8];
+    esp_err_t ret = record_decode_ids(io_buf, record->length, dict, sender_id, recipient_id);
+    if (ret == ESP_OK) {
+        memcpy(peer, msg_log_peer(sender_id, recipient_id), 8);
+    }
+    return ret;
+}
+
+static msg_log_conversation_t *msg_log_conversation(const uint8_t *peer)
+{
+    for (int i = 0; i < MSG_LOG_CONVERSATIONS; i++) {
+        if (conversations[i].seq != 0 && memcmp(conversations[i].peer, peer, 8) == 0) {
+            return &conversations[i];
+        }
+    }
+    return NULL;
+}
+
+// Appending to a conversation not yet indexed takes over the entry that
+// has been quiet longest; that one's history can then only be read by seq
+static void msg_log_conversation_update(const uint8_t *peer, uint32_t seq, uint32_t addr, msg_log_record_t *record)
+{
+    msg_log_conversation_t *conversation = msg_log_conversation(peer);
+    if (conversation) {
+        record->prev_seq = conversation->seq;
+        record->prev_addr = conversation->addr;
+        record->ordinal = conversation->ordinal + 1;
+    } else {
+        conversation = &conversations[0];
+        for (int i = 1; i < MSG_LOG_CONVERSATIONS && conversation->seq != 0; i++) {
+            if (conversations[i].seq == 0 || (int32_t)(conversations[i].seq - conversation->seq) < 0) {
+                conversation = &conversations[i];
+            }
+        }
+        memcpy(conversation->peer, peer, 8);
+        record->prev_seq = 0;
+        record->prev_addr = 0;
+        record->ordinal = 0;
+    }
+    conversation->seq = seq;
+    conversation->addr = addr;
+    conversation->ordinal = record->ordinal;
+}
+
+static int msg_log_pin_find(uint32_t seq)
+{
+    for (uint32_t i = 0; i < pin_count; i++) {
+        if (pins[i].seq == seq) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void msg_log_pin_remove(uint32_t pin)
+{
+    memmove(&pins[pin], &pins[pin + 1], (pin_count - pin - 1) * sizeof(pins[0]));
+    memset(&pins[--pin_count], 0, sizeof(pins[0]));
+}
+
+// Emergency messages are pinned. Past MSG_LOG_PINNED_MAX the oldest pin is
+// released to the normal limits.
+static void msg_log_pin_add(uint32_t seq, uint32_t addr)
+{
+    if (pin_count == MSG_LOG_PINNED_MAX) {
+        msg_log_pin_remove(0);
+    }
+    pins[pin_count].seq = seq;
+    pins[pin_count].addr = addr;
+    pin_count++;
+}
+
+// Drop pins whose record went with a sector given up unexamined
+static void msg_log_pins_prune(void)
+{
+    for (uint32_t i = 0; i < pin_count; ) {
+        if ((int32_t)(pins[i].seq - sector_first_seq[oldest_sector]) < 0) {
+            ESP_LOGW(TAG, "Pinned record %lu lost with a full log", pins[i].seq);
+            msg_log_pin_remove(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+// Move the head into the pre-erased next sector. The compactor normally
+// keeps more erased ahead; when it has not, the one after is erased here,
+// giving up the oldest sector if the ring is full.
+static esp_err_t msg_log_advance(void)
+{
+    uint32_t sector = sector_next(head_sector);
+    msg_log_sector_t header = {
+        .magic = MSG_LOG_MAGIC,
+        .generation = head_generation + 1,
+        .first_seq = next_seq,
+        .base_id = last_id,
+        .base_timestamp = last_timestamp,
+        .opened_s = msg_log_clock(),
+    };
+    header.crc = crc16_ccitt(CRC16_CCITT_INIT, &header, offsetof(msg_log_sector_t, crc));
+
+    memcpy(snapshot.conversations, conversations, sizeof(conversations));
+    memcpy(snapshot.pins, pins, sizeof(pins));
+    snapshot.crc = crc16_ccitt(CRC16_CCITT_INIT, &snapshot, offsetof(msg_log_index_t, crc));
+
+    // Only called with nothing staged, so io_buf is free
+    memcpy(io_buf, &header, sizeof(header));
+    memcpy(io_buf + sizeof(header), &snapshot, sizeof(snapshot));
+
+    esp_err_t ret = esp_partition_write(partition, sector_base(sector), io_buf, MSG_LOG_DATA_START);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    stats.bytes_written += MSG_LOG_DATA_START;
+    head_sector = sector;
+    head_generation = header.generation;
+    sector_first_seq[sector] = next_seq;
+    write_offset = MSG_LOG_DATA_START;
+    head_sealed = false;
+    msg_log_dict_build(&header, conversations, &head_dict);
+
+    uint32_t ahead = sector_next(sector);
+    if (ahead == oldest_sector) {
+        oldest_sector = sector_next(ahead);
+        compact.sector = UINT32_MAX;
+        stats.overruns++;
+        msg_log_pins_prune();
+    }
+    if (read_dict_sector == sector || read_dict_sector == ahead) {
+        read_dict_sector = UINT32_MAX;
+    }
+    if (--erased_ahead > 0) {
+        return ESP_OK;
+    }
+    erased_ahead = 1;
+    return msg_log_erase(ahead);
+}
+
+// Start an empty log in sector 0
+static esp_err_t msg_log_format(void)
+{
+    ESP_LOGI(TAG, "No log found, formatting");
+    esp_err_t ret = msg_log_erase(0);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    head_sector = sector_count - 1;
+    head_generation = 0;
+    oldest_sector = 0;
+    erased_ahead = 1;
+    next_seq = 1;
+    last_id = 0;
+    last_timestamp = 0;
+    clock_base_s = 0;
+    clock_base_us = esp_timer_get_time();
+    memset(conversations, 0, sizeof(conversations));
+    memset(pins, 0, sizeof(pins));
+    pin_count = 0;
+    msg_log_tail_reset();
+    return msg_log_advance();
+}
+
+// Index the newest records, starting far enough back to fill the tail
+static void msg_log_fill_tail(void)
+{
+    msg_log_record_t record;
+    uint32_t sector = head_sector;
+
+    while (sector != oldest_sector && next_seq - sector_first_seq[sector] < MSG_LOG_TAIL_INDEX) {
+        sector = sector_prev(sector);
+    }
+
+    msg_log_tail_reset();
+    for (;;) {
+        uint32_t end_seq = sector == head_sector ? next_seq : sector_first_seq[sector_next(sector)];
+        uint32_t addr = sector_base(sector) + MSG_LOG_DATA_START;
+        for (uint32_t seq = sector_first_seq[sector]; seq != end_seq; seq++) {
+            if (msg_log_read_record(addr, &record, io_buf + sizeof(record)) != ESP_OK || record.seq != seq) {
+                // The tail must stay contiguous up to the newest record
+                msg_log_tail_reset();
+                break;
+            }
+            msg_log_tail_push(addr);
+            addr += sizeof(record) + record.length;
+        }
+        if (sector == head_sector) {
+            break;
+        }
+        sector = sector_next(sector);
+    }
+}
+
+// Find the newest sector, walk back over those opened before it, and scan
+// the head sector for the write position
+static esp_err_t msg_log_recover(void)
+{
+    msg_log_sector_t header;
+    msg_log_record_t record;
+    bool found = false;
+
+    for (uint32_t sector = 0; sector < sector_count; sector++) {
+        if (msg_log_read_sector(sector, &header) &&
+            (!found || (int32_t)(header.generation - head_generation) > 0)) {
+            found = true;
+            head_sector = sector;
+            head_generation = header.generation;
+            sector_first_seq[sector] = header.first_seq;
+        }
+    }
+    if (!found) {
+        return msg_log_format();
+    }
+
+    // The sector after the head is never part of the log
+    oldest_sector = head_sector;
+    for (uint32_t back = 1; back + 1 < sector_count; back++) {
+        uint32_t sector = (head_sector + sector_count - back) % sector_count;
+        if (!msg_log_read_sector(sector, &header) || header.generation != head_generation - back) {
+            break;
+        }
+        sector_first_seq[sector] = header.first_seq;
+        oldest_sector = sector;
+    }
+
+    head_sealed = false;
+
+    // Indexes as of opening the head sector, brought up to date below.
+    // Without them the head sector's records cannot be decoded.
+    msg_log_read_sector(head_sector, &header);
+    if (msg_log_read_index(head_sector)) {
+        memcpy(conversations, snapshot.conversations, sizeof(conversations));
+        memcpy(pins, snapshot.pins, sizeof(pins));
+    } else {
+        ESP_LOGW(TAG, "Conversation index of sector %lu damaged", head_sector);
+        memset(conversations, 0, sizeof(conversations));
+        memset(pins, 0, sizeof(pins));
+        head_sealed = true;
+    }
+    pin_count = 0;
+    while (pin_count < MSG_LOG_PINNED_MAX && pins[pin_count].seq != 0) {
+        pin_count++;
+    }
+    msg_log_dict_build(&header, conversations, &head_dict);
+    last_id = header.base_id;
+    last_timestamp = header.base_timestamp;
+    // Time since the head sector was opened is lost
+    clock_base_s = header.opened_s;
+    clock_base_us = esp_timer_get_time();
+
+    next_seq = sector_first_seq[head_sector];
+    write_offset = MSG_LOG_DATA_START;
+    while (!head_sealed) {
+        uint32_t addr = sector_base(head_sector) + write_offset;
+        esp_err_t ret = msg_log_read_record(addr, &record, io_buf);
+        if (ret == ESP_ERR_NOT_FOUND) {
+            break;
+        }
+        if (ret == ESP_OK && record.seq == next_seq && record.prev_addr != MSG_LOG_MOVED) {
+            ret = record_decode(io_buf, record.length, &head_dict, &decoded);
+        }
+        if (ret != ESP_OK || record.seq != next_seq) {
+            ESP_LOGW(TAG, "Torn record %lu in sector %lu, sealing it", next_seq, head_sector);
+            head_sealed = true;
+            break;
+        }
+        if (record.prev_addr == MSG_LOG_MOVED) {
+            int pin = msg_log_pin_find(record.prev_seq);
+            if (pin >= 0) {
+                pins[pin].seq = record.seq;
+                pins[pin].addr = addr;
+            }
+        } else {
+            msg_log_conversation_update(msg_log_peer(decoded.sender_id, decoded.recipient_id),
+                                        record.seq, addr, &record);
+            if (decoded.message_type == MSG_TYPE_EMERGENCY) {
+                msg_log_pin_add(record.seq, addr);
+            }
+            last_id = decoded.id;
+            last_timestamp = decoded.timestamp;
+        }
+        write_offset += sizeof(record) + record.length;
+        next_seq++;
+    }
+
+    // A power cut may have interrupted the erase ahead of the head
+    uint32_t ahead = sector_next(head_sector);
+    if (!msg_log_sector_blank(ahead)) {
+        esp_err_t ret = msg_log_erase(ahead);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    erased_ahead = 1;
+    msg_log_pins_prune();
+
+    msg_log_fill_tail();
+    return ESP_OK;
+}
+
+esp_err_t msg_log_init(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                         MSG_LOG_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "Partition \"%s\" not found", MSG_LOG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    sector_count = partition->size / MSG_LOG_SECTOR_SIZE;
+    if (sector_count < 3) {
+        ESP_LOGE(TAG, "Partition too small (%lu sectors)", sector_count);
+        partition = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    quota_sectors = sector_count > MSG_LOG_FREE_SECTORS + 3 ? sector_count - 1 - MSG_LOG_FREE_SECTORS : 2;
+    if (MSG_LOG_QUOTA_KB != 0 && MSG_LOG_QUOTA_KB * 1024 / MSG_LOG_SECTOR_SIZE < quota_sectors) {
+        quota_sectors = MSG_LOG_QUOTA_KB * 1024 / MSG_LOG_SECTOR_SIZE < 2 ? 2 : MSG_LOG_QUOTA_KB * 1024 / MSG_LOG_SECTOR_SIZE;
+    }
+
+    esp_read_mac(self_id, ESP_MAC_WIFI_STA);  // The ID the mesh layer uses
+    log_mutex = xSemaphoreCreateMutex();
+    sector_first_seq = calloc(sector_count, sizeof(uint32_t));
+    if (log_mutex == NULL || sector_first_seq == NULL) {
+        partition = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t ret = msg_log_recover();
+    stats.recovery_us = (uint32_t)(esp_timer_get_time() - start_us);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Recovery failed: %s", esp_err_to_name(ret));
+        partition = NULL;
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "%lu records in %lu sectors, recovered in %lu us",
+             next_seq - sector_first_seq[oldest_sector], sector_count, stats.recovery_us);
+    return ESP_OK;
+}
+
+// Write the records staged in io_buf at the write position
+static esp_err_t msg_log_write_run(size_t len, uint32_t records)
+{
+    uint32_t addr = sector_base(head_sector) + write_offset;
+    esp_err_t ret = esp_partition_write(partition, addr, io_buf, len);
+    if (ret != ESP_OK) {
+        head_sealed = true;
+        return ret;
+    }
+
+    for (size_t offset = 0; offset < len; ) {
+        const msg_log_record_t *record = (const msg_log_record_t *)(io_buf + offset);
+        msg_log_tail_push(addr + offset);
+        offset += sizeof(*record) + record->length;
+    }
+    write_offset += len;
+    next_seq += records;
+    stats.writes++;
+    stats.bytes_written += len;
+    return ESP_OK;
+}
+
+// Group commit: consecutive records share one flash write as far as the
+// I/O buffer and the head sector allow. A power cut tears one write at
+// most; the records before the tear survive.
+esp_err_t msg_log_append_batch(const mesh_message_t *messages, size_t count, uint32_t *first_seq_out)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = ESP_OK;
+    size_t staged = 0;
+    uint32_t staged_records = 0;
+    msg_log_conversation_t committed[MSG_LOG_CONVERSATIONS];
+    msg_log_pin_t committed_pins[MSG_LOG_PINNED_MAX];
+    uint32_t committed_pin_count;
+    uint32_t committed_id;
+    uint64_t committed_timestamp;
+
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+
+    // Staged records already link into the indexes; undone if their write fails
+    memcpy(committed, conversations, sizeof(committed));
+    memcpy(committed_pins, pins, sizeof(committed_pins));
+    committed_pin_count = pin_count;
+    committed_id = last_id;
+    committed_timestamp = last_timestamp;
+    if (first_seq_out) {
+        *first_seq_out = next_seq;
+    }
+    for (size_t i = 0; i < count && ret == ESP_OK; ) {
+        if (staged == 0 && head_sealed) {
+            ret = msg_log_advance();
+            continue;
+        }
+        // Coded with the head sector's dictionary, so again after an advance
+        size_t data_len = record_encode(&messages[i], &head_dict, encoded);
+        size_t record_len = sizeof(msg_log_record_t) + data_len;
+
+        if (staged > 0 && (staged + record_len > sizeof(io_buf) ||
+                           write_offset + staged + record_len > MSG_LOG_SECTOR_SIZE)) {
+            ret = msg_log_write_run(staged, staged_records);
+            if (ret == ESP_OK) {
+                stats.appended += staged_records;
+                memcpy(committed, conversations, sizeof(committed));
+                memcpy(committed_pins, pins, sizeof(committed_pins));
+                committed_pin_count = pin_count;
+                committed_id = last_id;
+                committed_timestamp = last_timestamp;
+            }
+            staged = 0;
+            staged_records = 0;
+            continue;
+        }
+        if (staged == 0 && write_offset + record_len > MSG_LOG_SECTOR_SIZE) {
+            ret = msg_log_advance();
+            continue;
+        }
+
+        msg_log_record_t *record = (msg_log_record_t *)(io_buf + staged);
+        uint32_t addr = sector_base(head_sector) + write_offset + staged;
+        record->length = (uint16_t)data_len;
+        record->seq = next_seq + staged_records;
+        msg_log_conversation_update(msg_log_peer(messages[i].sender_id, messages[i].recipient_id),
+                                    record->seq, addr, record);
+        if (messages[i].message_type == MSG_TYPE_EMERGENCY) {
+            msg_log_pin_add(record->seq, addr);
+        }
+        memcpy(io_buf + staged + sizeof(*record), encoded, data_len);
+        record->crc = record_crc(record, encoded);
+        last_id = messages[i].id;
+        last_timestamp = messages[i].timestamp;
+        staged += record_len;
+        staged_records++;
+        i++;
+    }
+    if (ret == ESP_OK && staged > 0) {
+        ret = msg_log_write_run(staged, staged_records);
+        if (ret == ESP_OK) {
+            stats.appended += staged_records;
+        }
+    }
+    if (ret != ESP_OK) {
+        memcpy(conversations, committed, sizeof(conversations));
+        memcpy(pins, committed_pins, sizeof(pins));
+        pin_count = committed_pin_count;
+        last_id = committed_id;
+        last_timestamp = committed_timestamp;
+    }
+
+    xSemaphoreGive(log_mutex);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Append failed: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+esp_err_t msg_log_append(const mesh_message_t *message, uint32_t *seq_out)
+{
+    return msg_log_append_batch(message, 1, seq_out);
+}
+
+// Recent records come from the tail index; older ones from a walk through
+// the sector that holds them
+static esp_err_t msg_log_locate(uint32_t seq, uint32_t *addr)
+{
+    msg_log_record_t record;
+
+    if ((int32_t)(seq - sector_first_seq[oldest_sector]) < 0 || (int32_t)(seq - next_seq) >= 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint32_t back = next_seq - seq;
+    if (back <= tail_count) {
+        *addr = tail_addr[(tail_start + tail_count - back) % MSG_LOG_TAIL_INDEX];
+        return ESP_OK;
+    }
+
+    uint32_t sector = head_sector;
+    while ((int32_t)(seq - sector_first_seq[sector]) < 0) {
+        sector = sector_prev(sector);
+    }
+    uint32_t offset = MSG_LOG_DATA_START;
+    for (uint32_t current = sector_first_seq[sector]; current != seq; current++) {
+        if (offset + sizeof(record) > MSG_LOG_SECTOR_SIZE ||
+            esp_partition_read(partition, sector_base(sector) + offset, &record, sizeof(record)) != ESP_OK ||
+            record.seq != current || record.length > MSG_LOG_MAX_DATA) {
+            return ESP_ERR_INVALID_CRC;
+        }
+        offset += sizeof(record) + record.length;
+    }
+    *addr = sector_base(sector) + offset;
+    return ESP_OK;
+}
+
+esp_err_t msg_log_read(uint32_t seq, mesh_message_t *message)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    msg_log_record_t record;
+    uint32_t addr;
+
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+
+    esp_err_t ret = msg_log_locate(seq, &addr);
+    if (ret == ESP_OK) {
+        ret = msg_log_read_record(addr, &record, io_buf);
+    }
+    if (ret == ESP_OK && record.seq != seq) {
+        ret = ESP_ERR_INVALID_CRC;
+    }
+    // Moved pins are listed by msg_log_pinned() instead
+    if (ret == ESP_OK && record.prev_addr == MSG_LOG_MOVED) {
+        ret = ESP_ERR_NOT_FOUND;
+    }
+    if (ret == ESP_OK) {
+        ret = msg_log_decode(addr, &record, message);
+    }
+
+    xSemaphoreGive(log_mutex);
+    return ret;
+}
+
+// Follows the conversation's chain from the cursor, newest first, reading
+// only the records returned. Stops at the conversation's quota even where
+// older records have not been reclaimed yet.
+esp_err_t msg_log_query(const uint8_t *peer_id, msg_log_cursor_t *cursor,
+                        mesh_message_t *messages, size_t max_count, size_t *count)
+{
+    *count = 0;
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    msg_log_record_t record;
+    uint32_t seq = 0;
+    uint32_t addr = 0;
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+
+    const msg_log_conversation_t *conversation = msg_log_conversation(peer_id);
+    if (conversation == NULL) {
+        // No longer indexed, so past every quota
+    } else if (*cursor == MSG_LOG_CURSOR_NEWEST) {
+        seq = conversation->seq;
+        addr = conversation->addr;
+    } else if (*cursor != MSG_LOG_CURSOR_END) {
+        seq = (uint32_t)(*cursor >> 32);
+        addr = (uint32_t)*cursor;
+    }
+
+    while (seq != 0 && *count < max_count) {
+        // The rest of the conversation has been overwritten
+        if ((int32_t)(seq - sector_first_seq[oldest_sector]) < 0 || (int32_t)(seq - next_seq) >= 0) {
+            seq = 0;
+            break;
+        }
+        mesh_message_t *message = &messages[*count];
+        ret = msg_log_read_record(addr, &record, io_buf);
+        if (ret == ESP_OK && record.seq != seq) {
+            ret = ESP_ERR_INVALID_CRC;
+        }
+        if (ret == ESP_OK && (uint16_t)(conversation->ordinal - record.ordinal) >= MSG_LOG_RETAIN_PER_PEER) {
+            seq = 0;
+            break;
+        }
+        uint8_t peer[8];
+        if (ret == ESP_OK) {
+            ret = msg_log_decode_peer(addr, &record, peer);
+        }
+        if (ret == ESP_OK && memcmp(peer, peer_id, 8) != 0) {
+            ret = ESP_ERR_INVALID_CRC;
+        }
+        if (ret == ESP_OK) {
+            ret = msg_log_decode(addr, &record, message);
+        }
+        if (ret != ESP_OK) {
+            break;
+        }
+        (*count)++;
+        seq = record.prev_seq;
+        addr = record.prev_addr;
+    }
+    *cursor = seq != 0 ? ((uint64_t)seq << 32) | addr : MSG_LOG_CURSOR_END;
+
+    xSemaphoreGive(log_mutex);
+    return ret;
+}
+
+// Pinned messages, oldest first, whether or not their conversation's
+// history still shows them
+esp_err_t msg_log_pinned(mesh_message_t *messages, size_t max_count, size_t *count)
+{
+    *count = 0;
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    msg_log_record_t record;
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+
+    for (uint32_t i = 0; i < pin_count && *count < max_count && ret == ESP_OK; i++) {
+        ret = msg_log_read_record(pins[i].addr, &record, io_buf);
+        if (ret == ESP_OK && record.seq != pins[i].seq) {
+            ret = ESP_ERR_INVALID_CRC;
+        }
+        if (ret == ESP_OK) {
+            ret = msg_log_decode(pins[i].addr, &record, &messages[*count]);
+        }
+        if (ret == ESP_OK) {
+            (*count)++;
+        }
+    }
+
+    xSemaphoreGive(log_mutex);
+    return ret;
+}
+
+// Copy a pinned record to the head ahead of its sector being given up. The
+// copy joins no conversation chain; its prev_seq names the original.
+static esp_err_t msg_log_move_pin(uint32_t pin)
+{
+    msg_log_record_t record;
+    uint32_t origin = pins[pin].seq;
+
+    esp_err_t ret = msg_log_read_record(pins[pin].addr, &record, io_buf);
+    if (ret == ESP_OK && record.seq != origin) {
+        ret = ESP_ERR_INVALID_CRC;
+    }
+    if (ret == ESP_OK) {
+        ret = msg_log_decode(pins[pin].addr, &record, &decoded);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Pinned record %lu unreadable, unpinning it", origin);
+        msg_log_pin_remove(pin);
+        return ret;
+    }
+
+    size_t data_len = record_encode(&decoded, &head_dict, encoded);
+    if (head_sealed || write_offset + sizeof(record) + data_len > MSG_LOG_SECTOR_SIZE) {
+        ret = msg_log_advance();
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        data_len = record_encode(&decoded, &head_dict, encoded);
+    }
+
+    msg_log_record_t *copy = (msg_log_record_t *)io_buf;
+    uint32_t addr = sector_base(head_sector) + write_offset;
+    copy->length = (uint16_t)data_len;
+    copy->seq = next_seq;
+    copy->prev_seq = origin;
+    copy->prev_addr = MSG_LOG_MOVED;
+    copy->ordinal = 0;
+    memcpy(io_buf + sizeof(*copy), encoded, data_len);
+    copy->crc = record_crc(copy, encoded);
+    ret = msg_log_write_run(sizeof(*copy) + data_len, 1);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    // The advance may have given up the original already
+    int moved = msg_log_pin_find(origin);
+    if (moved >= 0) {
+        pins[moved].seq = next_seq - 1;
+        pins[moved].addr = addr;
+    }
+    stats.moved++;
+    return ESP_OK;
+}
+
+// Whether a record still counts as history and so keeps its sector. Pinned
+// records are moved rather than kept, and copies last as long as their pin.
+static bool msg_log_retained(uint32_t addr, const msg_log_record_t *record)
+{
+    if (record->prev_addr == MSG_LOG_MOVED || msg_log_pin_find(record->seq) >= 0) {
+        return false;
+    }
+    uint8_t peer[8];
+    if (msg_log_decode_peer(addr, record, peer) != ESP_OK) {
+        return false;
+    }
+    const msg_log_conversation_t *conversation = msg_log_conversation(peer);
+    return conversation != NULL &&
+           (uint16_t)(conversation->ordinal - record->ordinal) < MSG_LOG_RETAIN_PER_PEER;
+}
+
+// One unit of retention work: erase a sector ahead of the head, examine a
+// record of the oldest sector, move a pin out of it, or give it up. False
+// when nothing is due.
+static bool msg_log_compact_step(void)
+{
+    uint32_t used = (head_sector + sector_count - oldest_sector) % sector_count + 1;
+    uint32_t free = sector_count - used;
+
+    // Keeps erases out of the append path
+    if (erased_ahead < free && erased_ahead < MSG_LOG_FREE_SECTORS) {
+        uint32_t sector = (head_sector + 1 + erased_ahead) % sector_count;
+        if (!msg_log_sector_blank(sector) && msg_log_erase(sector) != ESP_OK) {
+            return false;
+        }
+        erased_ahead++;
+        return true;
+    }
+    if (oldest_sector == head_sector) {
+        return false;
+    }
+
+    uint32_t next = sector_next(oldest_sector);
+    if (compact.sector != oldest_sector) {
+        msg_log_sector_t header;
+        compact.sector = oldest_sector;
+        compact.offset = MSG_LOG_DATA_START;
+        compact.seq = sector_first_seq[oldest_sector];
+        compact.closed_s = msg_log_read_sector(next, &header) ? header.opened_s : msg_log_clock();
+        compact.reclaim = false;
+    }
+
+    if (!compact.reclaim) {
+        if (used > quota_sectors ||
+            (MSG_LOG_RETAIN_AGE_S != 0 &&
+             (int32_t)(msg_log_clock() - compact.closed_s) >= (int32_t)MSG_LOG_RETAIN_AGE_S)) {
+            compact.reclaim = true;
+        } else if (compact.seq != sector_first_seq[next]) {
+            msg_log_record_t record;
+            uint32_t addr = sector_base(oldest_sector) + compact.offset;
+            if (msg_log_read_record(addr, &record, io_buf) != ESP_OK || record.seq != compact.seq) {
+                // Nothing readable follows a torn record
+                compact.seq = sector_first_seq[next];
+                return true;
+            }
+            // Expiry only grows, so the scan resumes here next time
+            if (msg_log_retained(addr, &record)) {
+                return false;
+            }
+            compact.offset += sizeof(record) + record.length;
+            compact.seq++;
+            return true;
+        } else {
+            compact.reclaim = true;
+        }
+    }
+
+    for (uint32_t i = 0; i < pin_count; i++) {
+        if ((int32_t)(pins[i].seq - sector_first_seq[next]) < 0) {
+            msg_log_move_pin(i);
+            return true;
+        }
+    }
+
+    esp_err_t ret = msg_log_erase(oldest_sector);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Reclaiming sector %lu failed: %s", oldest_sector, esp_err_to_name(ret));
+        return false;
+    }
+    if (read_dict_sector == oldest_sector) {
+        read_dict_sector = UINT32_MAX;
+    }
+    oldest_sector = next;
+    if (erased_ahead == free) {
+        erased_ahead++;
+    }
+    compact.sector = UINT32_MAX;
+    stats.reclaimed++;
+    return true;
+}
+
+// Steps run until the budget is spent; the log is locked for one step at a
+// time, so appends and queries wait at most one step (a sector erase)
+bool msg_log_compact(uint32_t budget_us)
+{
+    if (partition == NULL) {
+        return false;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    bool more;
+    do {
+        xSemaphoreTake(log_mutex, portMAX_DELAY);
+        int64_t step_us = esp_timer_get_time();
+        more = msg_log_compact_step();
+        step_us = esp_timer_get_time() - step_us;
+        if (step_us > stats.compact_step_max_us) {
+            stats.compact_step_max_us = (uint32_t)step_us;
+        }
+        xSemaphoreGive(log_mutex);
+    } while (more && esp_timer_get_time() - start_us < budget_us);
+
+    return more;
+}
+
+// Start over in a fresh sector. Its generation skips ahead so recovery no
+// longer links it to the sectors written before.
+esp_err_t msg_log_clear(void)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+    head_generation += sector_count;
+    memset(conversations, 0, sizeof(conversations));
+    memset(pins, 0, sizeof(pins));
+    pin_count = 0;
+    esp_err_t ret = msg_log_advance();
+    if (ret == ESP_OK) {
+        oldest_sector = head_sector;
+        compact.sector = UINT32_MAX;
+        msg_log_tail_reset();
+    }
+    xSemaphoreGive(log_mutex);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Clear failed: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+void msg_log_get_stats(msg_log_stats_t *stats_out)
+{
+    if (partition == NULL) {
+        memset(stats_out, 0, sizeof(*stats_out));
+        return;
+    }
+
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+    *stats_out = stats;
+    stats_out->first_seq = sector_first_seq[oldest_sector];
+    stats_out->next_seq = next_seq;
+    stats_out->sectors = sector_count;
+    stats_out->used_sectors = (head_sector + sector_count - oldest_sector) % sector_count + 1;
+    stats_out->pinned = pin_count;
+    xSemaphoreGive(log_mutex);
+}
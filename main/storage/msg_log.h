@@ -0,0 +1,61 @@
+#ifndef MSG_LOG_H
+#define MSG_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "device_config.h"
+
+// Append-only message log on its own flash partition, used as a ring of
+// sectors. Records carry a sequence number and a CRC; the sector after the
+// write head is kept erased, so the oldest sector is given up as the log
+// wraps. A power cut costs at most the record being written.
+//
+// Records hold messages in the compact form of record_codec.h, coded
+// against a dictionary kept with each sector; the checksum field of a
+// message read back is zero.
+//
+// Each record links to the previous one of its conversation (a peer, or
+// the broadcast channel), so history pages are read without scanning.
+// The newest MSG_LOG_CONVERSATIONS conversations are indexed.
+//
+// Retention: a conversation's history shows its newest
+// MSG_LOG_RETAIN_PER_PEER messages. msg_log_compact() gives up the oldest
+// sector once none of its records is history any more, once it has aged
+// past MSG_LOG_RETAIN_AGE_S, or whenever the log holds more than
+// MSG_LOG_QUOTA_KB. Emergency messages are pinned: copied forward when
+// their sector goes, and listed by msg_log_pinned().
+typedef struct {
+    uint32_t first_seq;             // Oldest record still stored
+    uint32_t next_seq;              // Assigned to the next append
+    uint32_t sectors;
+    uint32_t appended;              // Since boot
+    uint32_t writes;                // Flash program operations for records
+    uint32_t bytes_written;
+    uint32_t erases;
+    uint32_t recovery_us;           // Boot-time scan
+    uint32_t used_sectors;
+    uint32_t pinned;
+    uint32_t reclaimed;             // Sectors given up by the compactor
+    uint32_t moved;                 // Pinned records copied forward
+    uint32_t overruns;              // Sectors given up unexamined, the compactor behind
+    uint32_t compact_step_max_us;   // Longest the compactor held the log
+} msg_log_stats_t;
+
+// Position in a conversation's history; opaque to callers
+typedef uint64_t msg_log_cursor_t;
+#define MSG_LOG_CURSOR_NEWEST   UINT64_MAX  // Start a query from the newest message
+#define MSG_LOG_CURSOR_END      0           // Returned when nothing older is left
+
+esp_err_t msg_log_init(void);
+esp_err_t msg_log_append(const mesh_message_t *message, uint32_t *seq_out);
+esp_err_t msg_log_append_batch(const mesh_message_t *messages, size_t count, uint32_t *first_seq_out);
+esp_err_t msg_log_read(uint32_t seq, mesh_message_t *message);
+esp_err_t msg_log_query(const uint8_t *peer_id, msg_log_cursor_t *cursor,
+                        mesh_message_t *messages, size_t max_count, size_t *count);
+esp_err_t msg_log_pinned(mesh_message_t *messages, size_t max_count, size_t *count);
+bool msg_log_compact(uint32_t budget_us);
+esp_err_t msg_log_clear(void);
+void msg_log_get_stats(msg_log_stats_t *stats_out);
+
+#endif // MSG_LOG_H
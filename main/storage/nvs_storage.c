@@ -1,4 +1,5 @@
 #include "nvs_storage.h"
+#include "msg_log.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "nvs.h"
@@ -6,11 +7,9 @@
 
 static const char *TAG = "NVS_STORAGE";
 
-// NVS namespaces
-#define NVS_NAMESPACE_MESSAGES "messages"
+// NVS namespace; messages live in the flash message log instead
 #define NVS_NAMESPACE_CONFIG   "config"
 
-static nvs_handle_t nvs_messages_handle;
 static nvs_handle_t nvs_config_handle;
 static bool nvs_initialized = false;
 
@@ -18,21 +17,19 @@ esp_err_t nvs_storage_init(void)
 {
     esp_err_t ret;
     
-    // Open NVS namespace for messages
-    ret = nvs_open(NVS_NAMESPACE_MESSAGES, NVS_READWRITE, &nvs_messages_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Error opening NVS handle for messages: %s", esp_err_to_name(ret));
-        return ret;
-    }
-    
     // Open NVS namespace for configuration
     ret = nvs_open(NVS_NAMESPACE_CONFIG, NVS_READWRITE, &nvs_config_handle);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Error opening NVS handle for config: %s", esp_err_to_name(ret));
-        nvs_close(nvs_messages_handle);
         return ret;
     }
     
+    // Message history stays unavailable without its partition; config still works
+    ret = msg_log_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Message log unavailable: %s", esp_err_to_name(ret));
+    }
+    
     nvs_initialized = true;
     ESP_LOGI(TAG, "NVS storage initialized");
     
@@ -45,27 +42,17 @@ esp_err_t nvs_storage_save_message(const mesh_message_t *message)
         return ESP_ERR_INVALID_STATE;
     }
     
-    // Create a key based on message ID and timestamp
-    char key[32];
-    snprintf(key, sizeof(key), "msg_%lu_%llu", message->id, message->timestamp);
-    
-    esp_err_t ret = nvs_set_blob(nvs_messages_handle, key, message, sizeof(mesh_message_t));
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Error saving message: %s", esp_err_to_name(ret));
-        return ret;
-    }
-    
-    // Commit to ensure data is written to flash
-    ret = nvs_commit(nvs_messages_handle);
+    uint32_t seq;
+    esp_err_t ret = msg_log_append(message, &seq);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Error committing message: %s", esp_err_to_name(ret));
         return ret;
     }
     
-    ESP_LOGD(TAG, "Message saved with key: %s", key);
+    ESP_LOGD(TAG, "Message %lu saved as record %lu", message->id, seq);
     return ESP_OK;
 }
 
+// Loads the newest messages, oldest first
 esp_err_t nvs_storage_load_messages(mesh_message_t *messages, size_t max_count, size_t *loaded_count)
 {
     if (!nvs_initialized || !messages || !loaded_count) {
@@ -74,29 +61,21 @@ esp_err_t nvs_storage_load_messages(mesh_message_t *messages, size_t max_count,
     
     *loaded_count = 0;
     
-    // Iterate through all keys in the messages namespace
-    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, NVS_NAMESPACE_MESSAGES, NVS_TYPE_BLOB);
-    
-    while (it != NULL && *loaded_count < max_count) {
-        nvs_entry_info_t info;
-        nvs_entry_info(it, &info);
-        
-        size_t required_size = sizeof(mesh_message_t);
-        esp_err_t ret = nvs_get_blob(nvs_messages_handle, info.key, &messages[*loaded_count], &required_size);
-        
-        if (ret == ESP_OK && required_size == sizeof(mesh_message_t)) {
+    msg_log_stats_t log;
+    msg_log_get_stats(&log);
+    uint32_t stored = log.next_seq - log.first_seq;
+    uint32_t seq = log.next_seq - (stored < max_count ? stored : (uint32_t)max_count);
+    
+    for (; seq != log.next_seq; seq++) {
+        esp_err_t ret = msg_log_read(seq, &messages[*loaded_count]);
+        if (ret == ESP_OK) {
             (*loaded_count)++;
-            ESP_LOGD(TAG, "Loaded message with key: %s", info.key);
-        } else {
-            ESP_LOGW(TAG, "Failed to load message with key: %s", info.key);
+        } else if (ret != ESP_ERR_NOT_FOUND) {  // Not found: a pinned message moved forward
+            ESP_LOGW(TAG, "Failed to load record %lu", seq);
         }
-        
-        it = nvs_entry_next(it);
     }
     
-    nvs_release_iterator(it);
-    
-    ESP_LOGI(TAG, "Loaded %d messages from NVS", *loaded_count);
+    ESP_LOGI(TAG, "Loaded %d messages from the message log", *loaded_count);
     return ESP_OK;
 }
 
@@ -106,19 +85,12 @@ esp_err_t nvs_storage_clear_messages(void)
         return ESP_ERR_INVALID_STATE;
     }
     
-    esp_err_t ret = nvs_erase_all(nvs_messages_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Error clearing messages: %s", esp_err_to_name(ret));
-        return ret;
-    }
-    
-    ret = nvs_commit(nvs_messages_handle);
+    esp_err_t ret = msg_log_clear();
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Error committing message clear: %s", esp_err_to_name(ret));
         return ret;
     }
     
-    ESP_LOGI(TAG, "All messages cleared from NVS");
+    ESP_LOGI(TAG, "All messages cleared");
     return ESP_OK;
 }
 
@@ -4,7 +4,8 @@
 #include "esp_err.h"
 #include "device_config.h"
 
-// NVS storage functions
+// Persistent storage: configuration blobs in NVS, message history in the
+// append-only flash log (msg_log.h)
 esp_err_t nvs_storage_init(void);
 esp_err_t nvs_storage_save_message(const mesh_message_t *message);
 esp_err_t nvs_storage_load_messages(mesh_message_t *messages, size_t max_count, size_t *loaded_count);
@@ -0,0 +1,152 @@
+#include "persist.h"
+#include "msg_log.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "PERSIST";
+
+// Two batches: one fills while the other is written
+static mesh_message_t batches[2][PERSIST_BATCH_MAX];
+static mesh_message_t *filling = batches[0];
+static size_t fill_count = 0;
+static uint32_t fill_started_ms;        // Arrival of the oldest pending message
+static persist_stats_t stats;
+
+static SemaphoreHandle_t batch_mutex;   // Guards the filling batch, held only briefly
+static SemaphoreHandle_t flush_mutex;   // One flush at a time
+static TaskHandle_t persist_task_handle = NULL;
+
+static uint32_t persist_now_ms(void)
+{
+    return pdTICKS_TO_MS(xTaskGetTickCount());
+}
+
+// Time until the pending batch is due, UINT32_MAX if nothing is pending
+static uint32_t persist_wait_ms(uint32_t now_ms)
+{
+    uint32_t wait_ms = UINT32_MAX;
+
+    xSemaphoreTake(batch_mutex, portMAX_DELAY);
+    if (fill_count >= PERSIST_BATCH_MAX) {
+        wait_ms = 0;
+    } else if (fill_count > 0) {
+        uint32_t age = now_ms - fill_started_ms;
+        wait_ms = age >= PERSIST_FLUSH_MS ? 0 : PERSIST_FLUSH_MS - age;
+    }
+    xSemaphoreGive(batch_mutex);
+    return wait_ms;
+}
+
+// Between commits the task also runs the log's retention work, in slices
+// short enough that a pending batch is never held up by more than one
+static void persist_task(void *arg)
+{
+    while (1) {
+        uint32_t wait_ms = persist_wait_ms(persist_now_ms());
+        if (wait_ms == 0) {
+            persist_flush();
+            continue;
+        }
+        uint32_t compact_ms = msg_log_compact(MSG_LOG_COMPACT_SLICE_US) ? MSG_LOG_COMPACT_PAUSE_MS
+                                                                         : MSG_LOG_RETENTION_CHECK_MS;
+        if (compact_ms < wait_ms) {
+            wait_ms = compact_ms;
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms) + 1);
+    }
+}
+
+esp_err_t persist_init(void)
+{
+    batch_mutex = xSemaphoreCreateMutex();
+    flush_mutex = xSemaphoreCreateMutex();
+    if (batch_mutex == NULL || flush_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memset(&stats, 0, sizeof(stats));
+
+    // Below the radio and mesh tasks, so flash writes only use idle time
+    if (xTaskCreate(persist_task, "persist", 3072, NULL, 2, &persist_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create persist task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Write-behind persistence started");
+    return ESP_OK;
+}
+
+// Copies the message and returns; never waits for flash
+esp_err_t persist_message(const mesh_message_t *message)
+{
+    if (persist_task_handle == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(batch_mutex, portMAX_DELAY);
+    if (fill_count == PERSIST_BATCH_MAX) {
+        stats.dropped++;
+        xSemaphoreGive(batch_mutex);
+        ESP_LOGW(TAG, "Batch full, message %lu not persisted", message->id);
+        return ESP_ERR_NO_MEM;
+    }
+    if (fill_count == 0) {
+        fill_started_ms = persist_now_ms();
+    }
+    // The log stores nothing past the used payload
+    memcpy(&filling[fill_count++], message, offsetof(mesh_message_t, payload) + message->payload_length);
+    stats.queued++;
+    bool wake = fill_count == 1 || fill_count == PERSIST_BATCH_MAX;
+    xSemaphoreGive(batch_mutex);
+
+    // The task arms its deadline on the first message and flushes on a full batch
+    if (wake) {
+        xTaskNotifyGive(persist_task_handle);
+    }
+    return ESP_OK;
+}
+
+// Commit everything pending. Runs in the persist task, and in the caller's
+// context when power management is about to sleep.
+esp_err_t persist_flush(void)
+{
+    if (persist_task_handle == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(flush_mutex, portMAX_DELAY);
+
+    // Swap batches so new messages keep arriving while this one is written
+    xSemaphoreTake(batch_mutex, portMAX_DELAY);
+    mesh_message_t *batch = filling;
+    size_t count = fill_count;
+    filling = filling == batches[0] ? batches[1] : batches[0];
+    fill_count = 0;
+    xSemaphoreGive(batch_mutex);
+
+    esp_err_t ret = ESP_OK;
+    if (count > 0) {
+        ret = msg_log_append_batch(batch, count, NULL);
+        xSemaphoreTake(batch_mutex, portMAX_DELAY);
+        stats.flushes++;
+        if (ret == ESP_OK) {
+            stats.committed += count;
+        } else {
+            stats.failed += count;
+        }
+        xSemaphoreGive(batch_mutex);
+    }
+
+    xSemaphoreGive(flush_mutex);
+    return ret;
+}
+
+void persist_get_stats(persist_stats_t *stats_out)
+{
+    xSemaphoreTake(batch_mutex, portMAX_DELAY);
+    *stats_out = stats;
+    xSemaphoreGive(batch_mutex);
+}
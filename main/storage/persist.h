@@ -0,0 +1,26 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "device_config.h"
+
+// Write-behind persistence: callers hand messages over without touching
+// flash, and a low-priority task commits them to the message log in
+// groups. A message is on flash within PERSIST_FLUSH_MS of being handed
+// over, or earlier once PERSIST_BATCH_MAX are pending or persist_flush()
+// is called (before sleep, on low battery).
+typedef struct {
+    uint32_t queued;
+    uint32_t committed;
+    uint32_t dropped;               // Batch full while the previous one was being written
+    uint32_t failed;                // Lost to a flash error
+    uint32_t flushes;
+} persist_stats_t;
+
+esp_err_t persist_init(void);
+esp_err_t persist_message(const mesh_message_t *message);
+esp_err_t persist_flush(void);
+void persist_get_stats(persist_stats_t *stats_out);
+
+#endif // PERSIST_H
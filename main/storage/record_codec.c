@@ -0,0 +1,208 @@
+#include "record_codec.h"
+#include "text_codec.h"
+#include <string.h>
+
+// Flags byte: how each device ID is stored, and what follows
+#define RECORD_ID_SELF          0
+#define RECORD_ID_PEER          1       // One-byte dictionary index
+#define RECORD_ID_LITERAL       2       // All 8 bytes
+#define RECORD_ID_BROADCAST     3       // Recipient only
+#define RECORD_SENDER_SHIFT     0
+#define RECORD_RECIPIENT_SHIFT  2
+#define RECORD_FLAG_TEXT        0x10    // Type is MSG_TYPE_TEXT, no type byte
+#define RECORD_FLAG_COMPRESSED  0x20    // Payload in text_codec form
+
+static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static uint8_t *varint_put(uint8_t *p, uint64_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+// Returns NULL on truncated or overlong input
+static const uint8_t *varint_get(const uint8_t *p, const uint8_t *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Deltas of either sign stay short
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static uint8_t *record_put_id(uint8_t *p, const uint8_t *id, const record_dict_t *dict, uint8_t *mode)
+{
+    if (memcmp(id, dict->self_id, 8) == 0) {
+        *mode = RECORD_ID_SELF;
+        return p;
+    }
+    if (memcmp(id, broadcast_id, 8) == 0) {
+        *mode = RECORD_ID_BROADCAST;
+        return p;
+    }
+    for (uint8_t i = 0; i < dict->peer_count; i++) {
+        if (memcmp(id, dict->peers[i], 8) == 0) {
+            *mode = RECORD_ID_PEER;
+            *p++ = i;
+            return p;
+        }
+    }
+    *mode = RECORD_ID_LITERAL;
+    memcpy(p, id, 8);
+    return p + 8;
+}
+
+static const uint8_t *record_get_id(const uint8_t *p, const uint8_t *end, uint8_t mode,
+                                    const record_dict_t *dict, uint8_t *id)
+{
+    switch (mode) {
+        case RECORD_ID_SELF:
+            memcpy(id, dict->self_id, 8);
+            return p;
+        case RECORD_ID_BROADCAST:
+            memcpy(id, broadcast_id, 8);
+            return p;
+        case RECORD_ID_PEER:
+            if (p >= end || *p >= dict->peer_count) {
+                return NULL;
+            }
+            memcpy(id, dict->peers[*p], 8);
+            return p + 1;
+        default:
+            if (end - p < 8) {
+                return NULL;
+            }
+            memcpy(id, p, 8);
+            return p + 8;
+    }
+}
+
+// Writes at most RECORD_MAX_SIZE bytes
+size_t record_encode(const mesh_message_t *message, const record_dict_t *dict, uint8_t *out)
+{
+    uint8_t sender_mode, recipient_mode;
+    uint8_t *p = out + 1;
+
+    p = record_put_id(p, message->sender_id, dict, &sender_mode);
+    p = record_put_id(p, message->recipient_id, dict, &recipient_mode);
+    uint8_t flags = (uint8_t)(sender_mode << RECORD_SENDER_SHIFT | recipient_mode << RECORD_RECIPIENT_SHIFT);
+
+    if (message->message_type == MSG_TYPE_TEXT) {
+        flags |= RECORD_FLAG_TEXT;
+    } else {
+        *p++ = (uint8_t)message->message_type;
+    }
+    p = varint_put(p, zigzag((int64_t)message->id - (int64_t)dict->base_id));
+    p = varint_put(p, zigzag((int64_t)(message->timestamp - dict->base_timestamp)));
+    *p++ = message->hop_count;
+
+    size_t len = 0;
+    if ((message->message_type == MSG_TYPE_TEXT || message->message_type == MSG_TYPE_EMERGENCY) &&
+        message->payload_length > 0) {
+        len = text_compress(message->payload, message->payload_length, p, message->payload_length);
+    }
+    if (len > 0) {
+        flags |= RECORD_FLAG_COMPRESSED;
+    } else {
+        len = message->payload_length;
+        memcpy(p, message->payload, len);
+    }
+    p += len;
+
+    out[0] = flags;
+    return p - out;
+}
+
+// Leaves *p after the fixed part
+static esp_err_t record_decode_head(const uint8_t **p, const uint8_t *end, const record_dict_t *dict,
+                                    uint8_t *sender_id, uint8_t *recipient_id, uint8_t *flags)
+{
+    if (*p >= end) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *flags = *(*p)++;
+    if (
+        (*p = record_get_id(*p, end, *flags >> RECORD_SENDER_SHIFT & 3, dict, sender_id)) == NULL ||
+        (*p = record_get_id(*p, end, *flags >> RECORD_RECIPIENT_SHIFT & 3, dict, recipient_id)) == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t record_decode_ids(const uint8_t *data, size_t len, const record_dict_t *dict,
+                            uint8_t *sender_id, uint8_t *recipient_id)
+{
+    uint8_t flags;
+    return record_decode_head(&data, data + len, dict, sender_id, recipient_id, &flags);
+}
+
+esp_err_t record_decode(const uint8_t *data, size_t len, const record_dict_t *dict, mesh_message_t *message)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+    uint64_t value;
+    uint8_t flags;
+
+    memset(message, 0, sizeof(*message));
+    esp_err_t ret = record_decode_head(&p, end, dict, message->sender_id, message->recipient_id, &flags);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (flags & RECORD_FLAG_TEXT) {
+        message->message_type = MSG_TYPE_TEXT;
+    } else if (p < end) {
+        message->message_type = (message_type_t)*p++;
+    } else {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if ((p = varint_get(p, end, &value)) == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    message->id = (uint32_t)(dict->base_id + unzigzag(value));
+    if ((p = varint_get(p, end, &value)) == NULL) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    message->timestamp = dict->base_timestamp + (uint64_t)unzigzag(value);
+    if (p >= end) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    message->hop_count = *p++;
+
+    size_t payload_len = end - p;
+    if (flags & RECORD_FLAG_COMPRESSED) {
+        size_t text_len;
+        ret = text_decompress(p, payload_len, message->payload, UINT8_MAX, &text_len);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        message->payload_length = (uint8_t)text_len;
+    } else {
+        if (payload_len > UINT8_MAX) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(message->payload, p, payload_len);
+        message->payload_length = (uint8_t)payload_len;
+    }
+    return ESP_OK;
+}
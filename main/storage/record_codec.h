@@ -0,0 +1,31 @@
+#ifndef RECORD_CODEC_H
+#define RECORD_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "device_config.h"
+
+// Compact storage form of a message. Device IDs become one-byte
+// references into a dictionary of known peers, the ID and timestamp are
+// stored as varint deltas against per-dictionary bases, and only used
+// payload bytes are kept (text compressed when that is shorter).
+typedef struct {
+    uint8_t self_id[8];
+    uint8_t peers[MSG_LOG_CONVERSATIONS][8];
+    uint8_t peer_count;
+    uint32_t base_id;
+    uint64_t base_timestamp;
+} record_dict_t;
+
+// Flags, two device IDs, type, varint ID and timestamp, hop count, payload
+#define RECORD_MAX_SIZE (1 + 8 + 8 + 1 + 5 + 10 + 1 + UINT8_MAX)
+
+size_t record_encode(const mesh_message_t *message, const record_dict_t *dict, uint8_t *out);
+esp_err_t record_decode(const uint8_t *data, size_t len, const record_dict_t *dict, mesh_message_t *message);
+
+// Only the addressing, for callers that need nothing else
+esp_err_t record_decode_ids(const uint8_t *data, size_t len, const record_dict_t *dict,
+                            uint8_t *sender_id, uint8_t *recipient_id);
+
+#endif // RECORD_CODEC_H
@@ -0,0 +1,13 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF, no reflection.
+// Feed a running value back in to cover several regions.
+#define CRC16_CCITT_INIT 0xFFFF
+
+uint16_t crc16_ccitt(uint16_t crc, const void *data, size_t length);
+
+#endif // CRC_H
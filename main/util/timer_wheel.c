@@ -0,0 +1,210 @@
+#include "timer_wheel.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <string.h>
+
+#define WHEEL_BITS      6
+#define WHEEL_SLOTS     (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS    4
+#define WHEEL_SPAN      (1UL << (WHEEL_BITS * WHEEL_LEVELS))   // Longest delay in ticks
+
+static wheel_timer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+static wheel_timer_t *expired;          // Due timers waiting for their callback
+static uint32_t current_tick;           // Last tick the wheel has processed
+static uint32_t pending_count;
+static SemaphoreHandle_t wheel_mutex;
+
+static void wheel_link(wheel_timer_t **head, wheel_timer_t *timer)
+{
+    timer->next = *head;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void wheel_unlink(wheel_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Level n holds timers due within 64^(n+1) ticks, in slots of 64^n ticks
+static void wheel_insert(wheel_timer_t *timer)
+{
+    uint32_t delta = timer->expires - current_tick;
+    uint32_t expires = timer->expires;
+
+    if (delta >= WHEEL_SPAN) {
+        expires = current_tick + WHEEL_SPAN - 1;    // Cascades again when it gets there
+        delta = WHEEL_SPAN - 1;
+    }
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1UL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    wheel_link(&slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK], timer);
+}
+
+static void wheel_cascade(int level, uint32_t index)
+{
+    wheel_timer_t *timer = slots[level][index];
+    slots[level][index] = NULL;
+    while (timer) {
+        wheel_timer_t *next = timer->next;
+        if (timer->expires == current_tick) {
+            wheel_link(&expired, timer);
+        } else {
+            wheel_insert(timer);
+        }
+        timer = next;
+    }
+}
+
+// Move everything due up to now_tick onto the expired list
+static void wheel_advance(uint32_t now_tick)
+{
+    if (pending_count == 0) {
+        current_tick = now_tick;
+        return;
+    }
+
+    while ((int32_t)(now_tick - current_tick) > 0) {
+        current_tick++;
+        uint32_t index = current_tick & WHEEL_MASK;
+
+        // Entering a new level-n slot pulls its timers down first
+        for (int level = 1; index == 0 && level < WHEEL_LEVELS; level++) {
+            index = (current_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            wheel_cascade(level, index);
+        }
+
+        wheel_timer_t *timer;
+        while ((timer = slots[0][current_tick & WHEEL_MASK]) != NULL) {
+            wheel_unlink(timer);
+            wheel_link(&expired, timer);
+        }
+    }
+}
+
+static uint32_t wheel_next_ms(uint32_t now_tick)
+{
+    if (expired) {
+        return 0;
+    }
+    if (pending_count == 0) {
+        return UINT32_MAX;
+    }
+
+    // Within each level the first occupied slot after the current one holds
+    // that level's earliest timers; levels overlap, so check them all
+    uint32_t best = UINT32_MAX;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        uint32_t start = (current_tick >> (WHEEL_BITS * level)) + 1;
+        for (uint32_t i = 0; i < WHEEL_SLOTS; i++) {
+            wheel_timer_t *timer = slots[level][(start + i) & WHEEL_MASK];
+            if (timer == NULL) {
+                continue;
+            }
+            for (; timer; timer = timer->next) {
+                uint32_t delta = timer->expires - current_tick;
+                if (delta < best) {
+                    best = delta;
+                }
+            }
+            break;
+        }
+    }
+
+    int32_t wait_ticks = (int32_t)(current_tick + best - now_tick);
+    return wait_ticks > 0 ? pdTICKS_TO_MS(wait_ticks) : 0;
+}
+
+void timer_wheel_init(void)
+{
+    wheel_mutex = xSemaphoreCreateMutex();
+    memset(slots, 0, sizeof(slots));
+    expired = NULL;
+    current_tick = xTaskGetTickCount();
+    pending_count = 0;
+}
+
+void timer_wheel_setup(wheel_timer_t *timer, timer_wheel_callback_t callback, void *arg)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+void timer_wheel_start(wheel_timer_t *timer, uint32_t delay_ms)
+{
+    // Round up: a timer never fires before its delay has passed
+    uint32_t delay_ticks = pdMS_TO_TICKS(delay_ms + portTICK_PERIOD_MS - 1);
+
+    xSemaphoreTake(wheel_mutex, portMAX_DELAY);
+    if (timer->pprev) {
+        wheel_unlink(timer);
+        pending_count--;
+    }
+    timer->expires = xTaskGetTickCount() + (delay_ticks > 0 ? delay_ticks : 1);
+    wheel_insert(timer);
+    pending_count++;
+    xSemaphoreGive(wheel_mutex);
+}
+
+void timer_wheel_cancel(wheel_timer_t *timer)
+{
+    xSemaphoreTake(wheel_mutex, portMAX_DELAY);
+    if (timer->pprev) {
+        wheel_unlink(timer);
+        pending_count--;
+    }
+    xSemaphoreGive(wheel_mutex);
+}
+
+bool timer_wheel_pending(const wheel_timer_t *timer)
+{
+    return timer->pprev != NULL;
+}
+
+uint32_t timer_wheel_run(void)
+{
+    xSemaphoreTake(wheel_mutex, portMAX_DELAY);
+    wheel_advance(xTaskGetTickCount());
+
+    // One at a time, without the lock, so callbacks can start and cancel timers
+    wheel_timer_t *timer;
+    while ((timer = expired) != NULL) {
+        wheel_unlink(timer);
+        pending_count--;
+        timer_wheel_callback_t callback = timer->callback;
+        void *arg = timer->arg;
+        xSemaphoreGive(wheel_mutex);
+
+        if (callback) {
+            callback(arg);
+        }
+
+        xSemaphoreTake(wheel_mutex, portMAX_DELAY);
+    }
+
+    uint32_t wait_ms = wheel_next_ms(xTaskGetTickCount());
+    xSemaphoreGive(wheel_mutex);
+    return wait_ms;
+}
+
+uint32_t timer_wheel_next_ms(void)
+{
+    xSemaphoreTake(wheel_mutex, portMAX_DELAY);
+    uint32_t wait_ms = wheel_next_ms(xTaskGetTickCount());
+    xSemaphoreGive(wheel_mutex);
+    return wait_ms;
+}
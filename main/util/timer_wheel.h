@@ -0,0 +1,36 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hierarchical timer wheel on the FreeRTOS tick: O(1) start and cancel,
+// with far timers cascading down one level as their slot comes up.
+//
+// Timers are owned by the caller and must stay allocated while pending.
+// Callbacks run in the task that calls timer_wheel_run() (mesh_task) and
+// may restart their own timer. A timer without a callback only marks a
+// deadline, so that timer_wheel_next_ms() does not sleep through it.
+typedef void (*timer_wheel_callback_t)(void *arg);
+
+typedef struct wheel_timer {
+    struct wheel_timer *next;
+    struct wheel_timer **pprev;     // NULL when not pending
+    uint32_t expires;               // Absolute tick
+    timer_wheel_callback_t callback;
+    void *arg;
+} wheel_timer_t;
+
+void timer_wheel_init(void);
+void timer_wheel_setup(wheel_timer_t *timer, timer_wheel_callback_t callback, void *arg);
+void timer_wheel_start(wheel_timer_t *timer, uint32_t delay_ms);
+void timer_wheel_cancel(wheel_timer_t *timer);
+bool timer_wheel_pending(const wheel_timer_t *timer);
+
+// Fire every expired timer; returns the time until the next one is due
+uint32_t timer_wheel_run(void);
+
+// Time until the next pending timer is due, UINT32_MAX if none
+uint32_t timer_wheel_next_ms(void);
+
+#endif // TIMER_WHEEL_H
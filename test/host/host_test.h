@@ -0,0 +1,25 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// A failed check ends the test program; ctest reports it with this line
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+        long long actual_ = (long long)(actual); \
+        long long expected_ = (long long)(expected); \
+        if (actual_ != expected_) { \
+            fprintf(stderr, "%s:%d: check failed: %s == %lld, expected %lld\n", \
+                    __FILE__, __LINE__, #actual, actual_, expected_); \
+            exit(1); \
+        } \
+    } while (0)
+
+#endif // HOST_TEST_H
@@ -0,0 +1,10 @@
+#pragma once
+
+typedef enum { ADC_UNIT_1 = 1 } adc_unit_t;
+typedef enum { ADC1_CHANNEL_0 = 0 } adc1_channel_t;
+typedef enum { ADC_ATTEN_DB_11 = 3 } adc_atten_t;
+typedef enum { ADC_WIDTH_BIT_12 = 3 } adc_bits_width_t;
+
+int adc1_config_width(adc_bits_width_t width);
+int adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten);
+int adc1_get_raw(adc1_channel_t channel);
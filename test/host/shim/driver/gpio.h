@@ -0,0 +1,35 @@
+#pragma once
+#include "esp_err.h"
+
+// Pin levels and edge interrupts; host_gpio_set() in host_shim.h drives an input
+typedef int gpio_num_t;
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+    GPIO_INTR_LOW_LEVEL,
+    GPIO_INTR_HIGH_LEVEL,
+} gpio_int_type_t;
+typedef enum { GPIO_MODE_INPUT, GPIO_MODE_OUTPUT } gpio_mode_t;
+typedef struct {
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    int pull_up_en;
+    int pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+typedef void (*gpio_isr_t)(void *);
+
+#define ESP_INTR_FLAG_IRAM      (1 << 10)
+
+esp_err_t gpio_config(const gpio_config_t *config);
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level);
+int gpio_get_level(gpio_num_t pin);
+esp_err_t gpio_install_isr_service(int flags);
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void *arg);
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type);
+esp_err_t gpio_intr_enable(gpio_num_t pin);
+esp_err_t gpio_intr_disable(gpio_num_t pin);
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type);
+esp_err_t gpio_wakeup_disable(gpio_num_t pin);
@@ -0,0 +1,60 @@
+#pragma once
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// The SPI master driver API; radio_emu.c answers it as an SX127x would
+typedef int spi_host_device_t;
+#define SPI2_HOST               1
+#define SPI_DMA_CH_AUTO         3
+#define SPI_TRANS_USE_RXDATA    (1 << 2)
+#define SPI_TRANS_USE_TXDATA    (1 << 3)
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+} spi_bus_config_t;
+
+typedef struct {
+    uint8_t command_bits;
+    uint8_t address_bits;
+    uint8_t dummy_bits;
+    uint8_t mode;
+    int clock_speed_hz;
+    int spics_io_num;
+    uint32_t flags;
+    int queue_size;
+} spi_device_interface_config_t;
+
+typedef struct spi_transaction_t {
+    uint32_t flags;
+    uint16_t cmd;
+    uint64_t addr;
+    size_t length;                  // Data bits, not counting the address phase
+    size_t rxlength;
+    void *user;
+    union {
+        const void *tx_buffer;
+        uint8_t tx_data[4];
+    };
+    union {
+        void *rx_buffer;
+        uint8_t rx_data[4];
+    };
+} spi_transaction_t;
+
+typedef struct spi_device_t *spi_device_handle_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *config, int dma_channel);
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *config,
+                             spi_device_handle_t *handle);
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans);
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans);
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *trans, TickType_t ticks_to_wait);
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **trans,
+                                      TickType_t ticks_to_wait);
+esp_err_t spi_device_acquire_bus(spi_device_handle_t handle, TickType_t ticks_to_wait);
+void spi_device_release_bus(spi_device_handle_t handle);
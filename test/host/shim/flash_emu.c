@@ -0,0 +1,134 @@
+#include "flash_emu.h"
+#include "host_shim.h"
+#include "esp_partition.h"
+#include <stdlib.h>
+#include <string.h>
+
+static esp_partition_t partition;
+static uint8_t *flash;
+static flash_emu_stats_t stats;
+static bool cut_armed;
+static uint32_t cut_budget;
+static bool power_lost;
+
+void flash_emu_init(const char *label, uint32_t size)
+{
+    free(flash);
+    flash = malloc(size);
+    memset(flash, 0xFF, size);
+
+    memset(&partition, 0, sizeof(partition));
+    partition.type = ESP_PARTITION_TYPE_DATA;
+    partition.subtype = ESP_PARTITION_SUBTYPE_DATA_UNDEFINED;
+    partition.size = size;
+    partition.erase_size = FLASH_EMU_SECTOR_SIZE;
+    strncpy(partition.label, label, sizeof(partition.label) - 1);
+
+    flash_emu_reset_stats();
+    flash_emu_restore_power();
+}
+
+void flash_emu_free(void)
+{
+    free(flash);
+    flash = NULL;
+}
+
+void flash_emu_get_stats(flash_emu_stats_t *stats_out)
+{
+    *stats_out = stats;
+}
+
+void flash_emu_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void flash_emu_cut_after(uint32_t bytes)
+{
+    cut_armed = true;
+    cut_budget = bytes;
+}
+
+bool flash_emu_power_lost(void)
+{
+    return power_lost;
+}
+
+void flash_emu_restore_power(void)
+{
+    cut_armed = false;
+    power_lost = false;
+}
+
+static bool flash_emu_in_range(size_t offset, size_t size)
+{
+    return flash != NULL && offset <= partition.size && size <= partition.size - offset;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    (void)subtype;
+    if (flash == NULL || type != partition.type || (label != NULL && strcmp(label, partition.label) != 0)) {
+        return NULL;
+    }
+    return &partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t src_offset, void *dst, size_t size)
+{
+    (void)part;
+    if (!flash_emu_in_range(src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, flash + src_offset, size);
+    stats.reads++;
+    host_time_us += FLASH_EMU_READ_US(size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t dst_offset, const void *src, size_t size)
+{
+    (void)part;
+    if (!flash_emu_in_range(dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (power_lost) {
+        return ESP_FAIL;
+    }
+
+    size_t programmed = size;
+    if (cut_armed && size > cut_budget) {
+        programmed = cut_budget;
+        power_lost = true;
+    }
+    if (cut_armed) {
+        cut_budget -= programmed;
+    }
+
+    const uint8_t *bytes = src;
+    for (size_t i = 0; i < programmed; i++) {
+        flash[dst_offset + i] &= bytes[i];
+    }
+    stats.writes++;
+    stats.write_bytes += programmed;
+    host_time_us += FLASH_EMU_WRITE_US(programmed);
+    return power_lost ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t size)
+{
+    (void)part;
+    if (!flash_emu_in_range(offset, size) || offset % FLASH_EMU_SECTOR_SIZE != 0 ||
+        size % FLASH_EMU_SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (power_lost) {
+        return ESP_FAIL;
+    }
+    memset(flash + offset, 0xFF, size);
+    stats.erases += size / FLASH_EMU_SECTOR_SIZE;
+    host_time_us += (int64_t)FLASH_EMU_ERASE_US * (size / FLASH_EMU_SECTOR_SIZE);
+    return ESP_OK;
+}
@@ -0,0 +1,36 @@
+#ifndef FLASH_EMU_H
+#define FLASH_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// RAM-backed NOR flash behind esp_partition_*: erase sets a 4 KB sector to
+// 0xFF and programming only clears bits. Each operation advances the host
+// clock by a modelled flash time, and a power cut can be scheduled to
+// land part way through a write.
+#define FLASH_EMU_SECTOR_SIZE   4096
+#define FLASH_EMU_ERASE_US      45000
+#define FLASH_EMU_READ_US(len)  (10 + (len) / 40)
+#define FLASH_EMU_WRITE_US(len) (20 + (len) * 3)
+
+typedef struct {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+    uint64_t write_bytes;
+} flash_emu_stats_t;
+
+// Fresh, fully erased partition; the label is the one the message log looks for
+void flash_emu_init(const char *label, uint32_t size);
+void flash_emu_free(void);
+void flash_emu_get_stats(flash_emu_stats_t *stats);
+void flash_emu_reset_stats(void);
+
+// Power fails once this many more bytes have been programmed, tearing the
+// write in progress; every later write and erase fails until power returns
+void flash_emu_cut_after(uint32_t bytes);
+bool flash_emu_power_lost(void);
+void flash_emu_restore_power(void);
+
+#endif // FLASH_EMU_H
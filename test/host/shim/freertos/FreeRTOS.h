@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// One tick per millisecond, driven by the host clock
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+#define pdTICKS_TO_MS(ticks)    ((uint32_t)(ticks))
+#define portTICK_PERIOD_MS      1
+#define portMAX_DELAY           0xFFFFFFFFu
+#define pdPASS                  1
+#define pdFAIL                  0
+#define pdTRUE                  1
+#define pdFALSE                 0
+
+// Interrupts run inside the host scheduler, which switches to a woken task
+// on its own once the interrupt returns
+#define portYIELD_FROM_ISR(woken)   ((void)(woken))
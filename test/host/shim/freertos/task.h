@@ -0,0 +1,20 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef enum { eNoAction, eSetBits, eIncrement } eNotifyAction;
+
+// Tasks are registered but only run once a test calls host_tasks_start();
+// until then tests drive the modules directly
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task);
+TaskHandle_t xTaskGetHandle(const char *name);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value,
+                           TickType_t ticks_to_wait);
@@ -0,0 +1,477 @@
+// FreeRTOS tasks, notifications, queues and semaphores on one host thread.
+// Tasks are coroutines: one runs until it blocks, then the highest priority
+// ready task takes over. With none ready the clock jumps to the next
+// timeout or scheduled interrupt, so runs stay deterministic.
+#include "host_shim.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include <ucontext.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HOST_MAX_TASKS          8
+#define HOST_MAX_EVENTS         64
+#define HOST_STACK_SIZE         (256 * 1024)
+#define HOST_MAIN_PRIORITY      1           // app_main's priority
+
+typedef enum {
+    TASK_CREATED,                           // Waits for host_tasks_start()
+    TASK_READY,
+    TASK_BLOCKED,
+    TASK_DELETED,
+} host_task_state_t;
+
+typedef struct {
+    ucontext_t context;
+    void *stack;
+    const char *name;
+    TaskFunction_t function;
+    void *parameters;
+    UBaseType_t priority;
+    host_task_state_t state;
+    uint64_t ready_seq;                     // Equal priorities run in the order they became ready
+    const void *waiting_on;                 // What wakes the task early, NULL for a delay
+    int64_t wake_us;                        // Timeout, -1 for none
+    bool timed_out;
+    uint32_t notify_value;
+    bool notify_pending;
+    int64_t run_start_us;
+    host_task_stats_t stats;
+} host_task_t;
+
+typedef struct {
+    int64_t at_us;
+    uint64_t seq;
+    void (*fn)(void *);
+    void *arg;
+} host_event_t;
+
+// A semaphore is a queue of zero-sized items, as in FreeRTOS
+typedef struct {
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+} host_queue_t;
+
+// Slot 0 is the test's own main()
+static host_task_t tasks[HOST_MAX_TASKS] = {
+    [0] = { .name = "main", .priority = HOST_MAIN_PRIORITY, .state = TASK_READY, .wake_us = -1 },
+};
+static int task_count = 1;
+static host_task_t *current = &tasks[0];
+static bool tasks_started;
+static bool in_isr;
+static uint64_t ready_seq;
+static host_event_t events[HOST_MAX_EVENTS];
+static int event_count;
+static uint64_t event_seq;
+
+static void host_make_ready(host_task_t *task)
+{
+    task->state = TASK_READY;
+    task->ready_seq = ++ready_seq;
+    task->waiting_on = NULL;
+}
+
+// Interrupts whose time has come, earliest first
+static void host_run_due_events(void)
+{
+    for (;;) {
+        int due = -1;
+        for (int i = 0; i < event_count; i++) {
+            if (events[i].at_us <= host_time_us &&
+                (due < 0 || events[i].at_us < events[due].at_us ||
+                 (events[i].at_us == events[due].at_us && events[i].seq < events[due].seq))) {
+                due = i;
+            }
+        }
+        if (due < 0) {
+            return;
+        }
+        host_event_t event = events[due];
+        events[due] = events[--event_count];
+
+        in_isr = true;
+        event.fn(event.arg);
+        in_isr = false;
+    }
+}
+
+static void host_expire_timeouts(void)
+{
+    for (int i = 0; i < task_count; i++) {
+        if (tasks[i].state == TASK_BLOCKED && tasks[i].wake_us >= 0 && tasks[i].wake_us <= host_time_us) {
+            tasks[i].timed_out = true;
+            host_make_ready(&tasks[i]);
+        }
+    }
+}
+
+static host_task_t *host_pick(void)
+{
+    host_task_t *best = NULL;
+    for (int i = 0; i < task_count; i++) {
+        host_task_t *task = &tasks[i];
+        if (task->state == TASK_READY &&
+            (best == NULL || task->priority > best->priority ||
+             (task->priority == best->priority && task->ready_seq < best->ready_seq))) {
+            best = task;
+        }
+    }
+    return best;
+}
+
+// Nothing is ready: move the clock to whatever happens next
+static void host_idle(void)
+{
+    int64_t next_us = -1;
+    for (int i = 0; i < event_count; i++) {
+        if (next_us < 0 || events[i].at_us < next_us) {
+            next_us = events[i].at_us;
+        }
+    }
+    for (int i = 0; i < task_count; i++) {
+        if (tasks[i].state == TASK_BLOCKED && tasks[i].wake_us >= 0 &&
+            (next_us < 0 || tasks[i].wake_us < next_us)) {
+            next_us = tasks[i].wake_us;
+        }
+    }
+    if (next_us < 0) {
+        fprintf(stderr, "host scheduler: every task is blocked for good\n");
+        abort();
+    }
+    if (next_us > host_time_us) {
+        host_time_us = next_us;
+    }
+}
+
+// Hand the CPU to the highest priority ready task, which may be the caller
+static void host_switch(void)
+{
+    host_task_t *from = current;
+    bool from_blocked = from->state != TASK_READY;
+    from->stats.busy_us += host_time_us - from->run_start_us;
+
+    host_task_t *next;
+    for (;;) {
+        host_run_due_events();
+        host_expire_timeouts();
+        if ((next = host_pick()) != NULL) {
+            break;
+        }
+        host_idle();
+    }
+
+    // A task resuming after it blocked counts as a switch, as it would from idle
+    current = next;
+    next->run_start_us = host_time_us;
+    if (next != from || from_blocked) {
+        next->stats.switches++;
+    }
+    if (next != from) {
+        swapcontext(&from->context, &next->context);
+    }
+}
+
+// A task-level wake of something more important runs it straight away
+static void host_preempt(void)
+{
+    if (in_isr) {
+        return;
+    }
+    host_task_t *next = host_pick();
+    if (next != NULL && next->priority > current->priority) {
+        host_make_ready(current);
+        host_switch();
+    }
+}
+
+static void host_wake(const void *object)
+{
+    for (int i = 0; i < task_count; i++) {
+        if (tasks[i].state == TASK_BLOCKED && tasks[i].waiting_on == object) {
+            host_make_ready(&tasks[i]);
+        }
+    }
+}
+
+// Ticks count from the start of the current one, as on the target
+static int64_t host_deadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return -1;
+    }
+    return (host_time_us / 1000 + ticks) * 1000;
+}
+
+// Blocks the running task until object is signalled; false once the deadline has passed
+static bool host_block(const void *object, int64_t deadline_us)
+{
+    if (deadline_us >= 0 && deadline_us <= host_time_us) {
+        return false;
+    }
+    if (in_isr) {
+        fprintf(stderr, "host scheduler: blocking call from an interrupt\n");
+        abort();
+    }
+    current->state = TASK_BLOCKED;
+    current->waiting_on = object;
+    current->wake_us = deadline_us;
+    current->timed_out = false;
+    host_switch();
+    return !current->timed_out;
+}
+
+static void host_task_entry(void)
+{
+    current->function(current->parameters);
+
+    // A FreeRTOS task must not return; treat it as having deleted itself
+    current->state = TASK_DELETED;
+    host_switch();
+}
+
+void host_tasks_start(void)
+{
+    tasks_started = true;
+    for (int i = 1; i < task_count; i++) {
+        if (tasks[i].state == TASK_CREATED) {
+            host_make_ready(&tasks[i]);
+        }
+    }
+}
+
+void host_at_us(int64_t at_us, void (*fn)(void *), void *arg)
+{
+    if (event_count == HOST_MAX_EVENTS) {
+        fprintf(stderr, "host scheduler: too many pending events\n");
+        abort();
+    }
+    events[event_count++] = (host_event_t) { .at_us = at_us, .seq = ++event_seq, .fn = fn, .arg = arg };
+}
+
+void host_isr(void (*fn)(void *), void *arg)
+{
+    bool nested = in_isr;
+    in_isr = true;
+    fn(arg);
+    in_isr = nested;
+    host_preempt();
+}
+
+void host_task_stats(TaskHandle_t task, host_task_stats_t *stats)
+{
+    host_task_t *t = task != NULL ? task : &tasks[0];
+    *stats = t->stats;
+    if (t == current) {
+        stats->busy_us += host_time_us - t->run_start_us;
+    }
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+    if (task_count == HOST_MAX_TASKS) {
+        return pdFAIL;
+    }
+    host_task_t *task = &tasks[task_count++];
+    *task = (host_task_t) {
+        .name = name,
+        .function = function,
+        .parameters = parameters,
+        .priority = priority,
+        .state = TASK_CREATED,
+        .wake_us = -1,
+        .stack = malloc(HOST_STACK_SIZE),
+    };
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = HOST_STACK_SIZE;
+    task->context.uc_link = NULL;
+    makecontext(&task->context, host_task_entry, 0);
+
+    if (created_task != NULL) {
+        *created_task = task;
+    }
+    if (tasks_started) {
+        host_make_ready(task);
+        host_preempt();
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetHandle(const char *name)
+{
+    for (int i = 0; i < task_count; i++) {
+        if (strcmp(tasks[i].name, name) == 0) {
+            return &tasks[i];
+        }
+    }
+    return NULL;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(host_time_us / 1000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    host_block(NULL, host_deadline(ticks));
+}
+
+static void host_notify(host_task_t *task, uint32_t value, eNotifyAction action)
+{
+    if (action == eSetBits) {
+        task->notify_value |= value;
+    } else if (action == eIncrement) {
+        task->notify_value++;
+    }
+    task->notify_pending = true;
+    host_wake(&task->notify_value);
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    host_notify(task, value, action);
+    host_preempt();
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return xTaskNotify(task, 0, eIncrement);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_woken)
+{
+    host_task_t *t = task;
+    host_notify(t, 0, eIncrement);
+    if (higher_priority_woken != NULL && t->priority > current->priority) {
+        *higher_priority_woken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    int64_t deadline_us = host_deadline(ticks_to_wait);
+    while (current->notify_value == 0) {
+        if (!host_block(&current->notify_value, deadline_us)) {
+            return 0;
+        }
+    }
+    uint32_t value = current->notify_value;
+    current->notify_value = clear_on_exit ? 0 : value - 1;
+    current->notify_pending = false;
+    return value;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value,
+                           TickType_t ticks_to_wait)
+{
+    int64_t deadline_us = host_deadline(ticks_to_wait);
+    if (!current->notify_pending) {
+        current->notify_value &= ~clear_on_entry;
+    }
+    while (!current->notify_pending) {
+        if (!host_block(&current->notify_value, deadline_us)) {
+            if (value != NULL) {
+                *value = current->notify_value;
+            }
+            return pdFALSE;
+        }
+    }
+    if (value != NULL) {
+        *value = current->notify_value;
+    }
+    current->notify_value &= ~clear_on_exit;
+    current->notify_pending = false;
+    return pdTRUE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    host_queue_t *queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    if (item_size > 0 && (queue->items = calloc(length, item_size)) == NULL) {
+        free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t ticks_to_wait)
+{
+    host_queue_t *queue = handle;
+    int64_t deadline_us = host_deadline(ticks_to_wait);
+    while (queue->count == queue->length) {
+        if (!host_block(queue, deadline_us)) {
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size > 0) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    host_wake(queue);
+    host_preempt();
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t ticks_to_wait)
+{
+    host_queue_t *queue = handle;
+    int64_t deadline_us = host_deadline(ticks_to_wait);
+    while (queue->count == 0) {
+        if (!host_block(queue, deadline_us)) {
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size > 0) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    host_wake(queue);
+    host_preempt();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle)
+{
+    return ((host_queue_t *)handle)->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+    if (mutex != NULL) {
+        xQueueSend(mutex, NULL, 0);
+    }
+    return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    return xQueueReceive(semaphore, NULL, ticks_to_wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return xQueueSend(semaphore, NULL, 0);
+}
@@ -0,0 +1,247 @@
+#include "host_shim.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_mac.h"
+#include "esp_wifi.h"
+#include "esp_sleep.h"
+#include "esp_pm.h"
+#include "esp_adc_cal.h"
+#include "driver/gpio.h"
+#include <string.h>
+
+int64_t host_time_us;
+host_sleep_t host_sleep;
+static uint32_t random_state = 0x2545F491;
+static int64_t gpio_wake_us = -1;
+
+void host_advance_ms(uint32_t ms)
+{
+    host_time_us += (int64_t)ms * 1000;
+}
+
+void host_seed_random(uint32_t seed)
+{
+    random_state = seed != 0 ? seed : 1;
+}
+
+uint32_t esp_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_time_us;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK:                return "ESP_OK";
+        case ESP_FAIL:              return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_CRC:   return "ESP_ERR_INVALID_CRC";
+        default:                    return "ESP_ERR";
+    }
+}
+
+// Same station MAC on every run
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    static const uint8_t host_mac[6] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01};
+    (void)type;
+    memcpy(mac, host_mac, sizeof(host_mac));
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6])
+{
+    return esp_read_mac(mac, ESP_MAC_WIFI_STA);
+}
+
+// Input levels and edge interrupts, for the radio's DIO0
+#define HOST_GPIO_PINS 64
+
+typedef struct {
+    int level;
+    gpio_int_type_t intr_type;
+    bool intr_enabled;
+    gpio_isr_t handler;
+    void *arg;
+} host_gpio_t;
+
+static host_gpio_t gpios[HOST_GPIO_PINS];
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    for (int pin = 0; pin < HOST_GPIO_PINS; pin++) {
+        if (config->pin_bit_mask & (1ULL << pin)) {
+            gpios[pin].intr_type = config->intr_type;
+            gpios[pin].intr_enabled = config->intr_type != GPIO_INTR_DISABLE;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+    gpios[pin].level = level != 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin)
+{
+    return gpios[pin].level;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    (void)flags;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void *arg)
+{
+    gpios[pin].handler = handler;
+    gpios[pin].arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type)
+{
+    gpios[pin].intr_type = type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t pin)
+{
+    gpios[pin].intr_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t pin)
+{
+    gpios[pin].intr_enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type)
+{
+    (void)pin;
+    (void)type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t pin)
+{
+    (void)pin;
+    return ESP_OK;
+}
+
+void host_gpio_set(int pin, int level)
+{
+    host_gpio_t *gpio = &gpios[pin];
+    int old = gpio->level;
+    gpio->level = level != 0;
+
+    bool fire = false;
+    switch (gpio->intr_type) {
+        case GPIO_INTR_POSEDGE:     fire = !old && gpio->level; break;
+        case GPIO_INTR_NEGEDGE:     fire = old && !gpio->level; break;
+        case GPIO_INTR_ANYEDGE:     fire = old != gpio->level; break;
+        case GPIO_INTR_HIGH_LEVEL:  fire = gpio->level; break;
+        case GPIO_INTR_LOW_LEVEL:   fire = !gpio->level; break;
+        default:                    break;
+    }
+    if (fire && gpio->intr_enabled && gpio->handler != NULL) {
+        host_isr(gpio->handler, gpio->arg);
+    }
+}
+
+esp_err_t esp_pm_configure(const void *config)
+{
+    (void)config;
+    return ESP_OK;
+}
+
+int adc1_config_width(adc_bits_width_t width)
+{
+    (void)width;
+    return 0;
+}
+
+int adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten)
+{
+    (void)channel;
+    (void)atten;
+    return 0;
+}
+
+// A healthy battery
+int adc1_get_raw(adc1_channel_t channel)
+{
+    (void)channel;
+    return 2000;
+}
+
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t unit, adc_atten_t atten, adc_bits_width_t width,
+                                             uint32_t default_vref, esp_adc_cal_characteristics_t *chars)
+{
+    (void)unit;
+    (void)atten;
+    (void)width;
+    chars->vref = default_vref;
+    return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc_reading, const esp_adc_cal_characteristics_t *chars)
+{
+    (void)chars;
+    return adc_reading;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    host_sleep.timer_wakeup_us = time_in_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void)
+{
+    host_sleep.gpio_wakeup = true;
+    return ESP_OK;
+}
+
+void host_sleep_gpio_after(uint32_t wake_ms)
+{
+    gpio_wake_us = (int64_t)wake_ms * 1000;
+}
+
+// Sleeps by moving the clock to whichever armed wakeup comes first
+esp_err_t esp_light_sleep_start(void)
+{
+    int64_t slept_us = (int64_t)host_sleep.timer_wakeup_us;
+    host_sleep.gpio_woken = false;
+    if (host_sleep.gpio_wakeup && gpio_wake_us >= 0 && gpio_wake_us < slept_us) {
+        slept_us = gpio_wake_us;
+        host_sleep.gpio_woken = true;
+    }
+    gpio_wake_us = -1;
+    host_sleep.sleeps++;
+    host_time_us += slept_us;
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start(void)
+{
+    abort();
+}
@@ -0,0 +1,56 @@
+#ifndef HOST_SHIM_H
+#define HOST_SHIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Host clock behind xTaskGetTickCount() and esp_timer_get_time(). Time
+// only moves when a test advances it or the flash emulator charges for
+// an operation, so runs are deterministic.
+extern int64_t host_time_us;
+void host_advance_ms(uint32_t ms);
+
+// esp_random() is a seeded xorshift generator
+void host_seed_random(uint32_t seed);
+
+// What the last light sleep was armed with
+typedef struct {
+    uint32_t sleeps;
+    uint64_t timer_wakeup_us;       // Armed timer wakeup
+    bool gpio_wakeup;               // esp_sleep_enable_gpio_wakeup() called
+    bool gpio_woken;                // Last sleep ended on a GPIO level
+} host_sleep_t;
+extern host_sleep_t host_sleep;
+
+// Makes the next light sleep end early on a GPIO wakeup, after wake_ms,
+// provided one was armed
+void host_sleep_gpio_after(uint32_t wake_ms);
+
+// Tasks created with xTaskCreate() run from here on, one at a time: the
+// running one keeps the CPU until it blocks, then the highest priority ready
+// task takes over. The test's main() is a task too, at app_main's priority,
+// and lets the others run by blocking, e.g. in vTaskDelay(). When every task
+// is blocked the clock jumps to the next timeout or scheduled interrupt.
+void host_tasks_start(void);
+
+// Calls fn(arg) in interrupt context once the clock reaches at_us
+void host_at_us(int64_t at_us, void (*fn)(void *), void *arg);
+
+// Calls fn(arg) in interrupt context now
+void host_isr(void (*fn)(void *), void *arg);
+
+// Drives an input pin; an edge or level matching its interrupt type calls
+// the handler registered with gpio_isr_handler_add()
+void host_gpio_set(int pin, int level);
+
+// How often a task (NULL for main) was switched to, and the clock time it
+// held the CPU for; only time charged while running (SPI, flash) counts
+typedef struct {
+    uint32_t switches;
+    int64_t busy_us;
+} host_task_stats_t;
+void host_task_stats(TaskHandle_t task, host_task_stats_t *stats);
+
+#endif // HOST_SHIM_H
@@ -0,0 +1,370 @@
+#include "radio_emu.h"
+#include "host_shim.h"
+#include "airtime.h"
+#include "device_config.h"
+#include "driver/spi_master.h"
+#include <string.h>
+
+#define REG_FIFO                 0x00
+#define REG_OP_MODE              0x01
+#define REG_FIFO_ADDR_PTR        0x0D
+#define REG_FIFO_TX_BASE_ADDR    0x0E
+#define REG_FIFO_RX_BASE_ADDR    0x0F
+#define REG_FIFO_RX_CURRENT_ADDR 0x10
+#define REG_IRQ_FLAGS            0x12
+#define REG_RX_NB_BYTES          0x13
+#define REG_PKT_RSSI_VALUE       0x1A
+#define REG_PKT_SNR_VALUE        0x1B
+#define REG_MODEM_CONFIG_1       0x1D
+#define REG_MODEM_CONFIG_2       0x1E
+#define REG_PREAMBLE_MSB         0x20
+#define REG_PREAMBLE_LSB         0x21
+#define REG_PAYLOAD_LENGTH       0x22
+#define REG_DIO_MAPPING_1        0x40
+#define REG_VERSION              0x42
+
+#define MODE_MASK                0x07
+#define MODE_STDBY               0x01
+#define MODE_TX                  0x03
+#define MODE_RX_CONTINUOUS       0x05
+#define MODE_CAD                 0x07
+
+#define IRQ_CAD_DETECTED         0x01
+#define IRQ_CAD_DONE             0x04
+#define IRQ_TX_DONE              0x08
+#define IRQ_RX_DONE              0x40
+
+#define RX_SLOTS                 16
+
+// The one device on the bus
+struct spi_device_t {
+    int clock_speed_hz;
+    int queue_size;
+    bool acquired;
+    spi_transaction_t *done[16];    // Completed, waiting for spi_device_get_trans_result()
+    int done_count;
+};
+
+typedef struct {
+    bool used;
+    uint8_t data[256];
+    size_t length;
+    int rssi;
+    float snr;
+    bool any_params;
+    lora_modem_params_t params;
+} radio_emu_rx_t;
+
+static struct spi_device_t device;
+static uint8_t regs[128];
+static uint8_t fifo[256];
+static uint32_t mode_generation;        // Completions scheduled under an older mode are void
+static int64_t busy_until_us;
+static radio_emu_rx_t rx_slots[RX_SLOTS];
+static uint8_t last_tx[256];
+static size_t last_tx_length;
+static int64_t tx_start_us;
+static radio_emu_tx_hook_t tx_hook;
+static radio_emu_stats_t stats;
+static int64_t bus_ns;                  // Bus time not yet charged to the clock
+
+void radio_emu_init(void)
+{
+    memset(regs, 0, sizeof(regs));
+    memset(fifo, 0, sizeof(fifo));
+    regs[REG_OP_MODE] = MODE_STDBY;
+    regs[REG_VERSION] = 0x12;
+    mode_generation++;
+    busy_until_us = 0;
+    last_tx_length = 0;
+    tx_hook = NULL;
+    memset(&device, 0, sizeof(device));
+    radio_emu_reset_stats();
+    host_gpio_set(LORA_DIO0_PIN, 0);
+}
+
+void radio_emu_get_stats(radio_emu_stats_t *out)
+{
+    *out = stats;
+}
+
+void radio_emu_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void radio_emu_channel_busy_until(int64_t until_us)
+{
+    busy_until_us = until_us;
+}
+
+void radio_emu_set_tx_hook(radio_emu_tx_hook_t hook)
+{
+    tx_hook = hook;
+}
+
+size_t radio_emu_last_tx(uint8_t *data)
+{
+    memcpy(data, last_tx, last_tx_length);
+    return last_tx_length;
+}
+
+// DIO0 follows whichever IRQ flag REG_DIO_MAPPING_1 routes to it
+static void radio_emu_update_dio0(void)
+{
+    static const uint8_t dio0_flags[4] = {IRQ_RX_DONE, IRQ_TX_DONE, IRQ_CAD_DONE, 0};
+    uint8_t flag = dio0_flags[regs[REG_DIO_MAPPING_1] >> 6];
+    host_gpio_set(LORA_DIO0_PIN, (regs[REG_IRQ_FLAGS] & flag) != 0);
+}
+
+static void radio_emu_modem_params(lora_modem_params_t *params)
+{
+    static const uint32_t bandwidths[10] = {
+        7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000
+    };
+    uint8_t bw = regs[REG_MODEM_CONFIG_1] >> 4;
+    params->bandwidth_hz = bandwidths[bw < 10 ? bw : 9];
+    params->coding_rate = ((regs[REG_MODEM_CONFIG_1] >> 1) & 0x07) + 4;
+    params->spreading_factor = regs[REG_MODEM_CONFIG_2] >> 4;
+    params->preamble_length = (regs[REG_PREAMBLE_MSB] << 8) | regs[REG_PREAMBLE_LSB];
+}
+
+bool radio_emu_listening(lora_modem_params_t *params)
+{
+    radio_emu_modem_params(params);
+    return (regs[REG_OP_MODE] & MODE_MASK) == MODE_RX_CONTINUOUS;
+}
+
+static void radio_emu_complete(void *arg)
+{
+    uint32_t generation = (uint32_t)(uintptr_t)arg;
+    if (generation != mode_generation) {
+        return;
+    }
+
+    uint8_t mode = regs[REG_OP_MODE] & MODE_MASK;
+    if (mode == MODE_TX) {
+        regs[REG_IRQ_FLAGS] |= IRQ_TX_DONE;
+        if (tx_hook != NULL) {
+            lora_modem_params_t params;
+            radio_emu_modem_params(&params);
+            tx_hook(last_tx, last_tx_length, &params, tx_start_us);
+        }
+    } else if (mode == MODE_CAD) {
+        regs[REG_IRQ_FLAGS] |= IRQ_CAD_DONE | (host_time_us < busy_until_us ? IRQ_CAD_DETECTED : 0);
+    }
+    // Both return to standby on their own
+    regs[REG_OP_MODE] = (regs[REG_OP_MODE] & ~MODE_MASK) | MODE_STDBY;
+    mode_generation++;
+    radio_emu_update_dio0();
+}
+
+static void radio_emu_set_mode(uint8_t value)
+{
+    regs[REG_OP_MODE] = value;
+    mode_generation++;
+
+    lora_modem_params_t params;
+    radio_emu_modem_params(&params);
+    void *arg = (void *)(uintptr_t)mode_generation;
+    switch (value & MODE_MASK) {
+        case MODE_TX:
+            last_tx_length = regs[REG_PAYLOAD_LENGTH];
+            for (size_t i = 0; i < last_tx_length; i++) {
+                last_tx[i] = fifo[(uint8_t)(regs[REG_FIFO_TX_BASE_ADDR] + i)];
+            }
+            tx_start_us = host_time_us;
+            stats.tx_frames++;
+            host_at_us(host_time_us + airtime_us(&params, last_tx_length), radio_emu_complete, arg);
+            break;
+        case MODE_CAD:
+            stats.cad_runs++;
+            host_at_us(host_time_us + 2 * airtime_symbol_us(&params), radio_emu_complete, arg);
+            break;
+        default:
+            break;
+    }
+}
+
+static void radio_emu_arrive(void *arg)
+{
+    radio_emu_rx_t *slot = arg;
+    slot->used = false;
+    lora_modem_params_t params;
+    if (!radio_emu_listening(&params) ||
+        (!slot->any_params && (slot->params.spreading_factor != params.spreading_factor ||
+                               slot->params.bandwidth_hz != params.bandwidth_hz))) {
+        stats.rx_missed++;
+        return;
+    }
+
+    uint8_t base = regs[REG_FIFO_RX_BASE_ADDR];
+    for (size_t i = 0; i < slot->length; i++) {
+        fifo[(uint8_t)(base + i)] = slot->data[i];
+    }
+    regs[REG_FIFO_RX_CURRENT_ADDR] = base;
+    regs[REG_RX_NB_BYTES] = slot->length;
+    int rssi = slot->rssi + 164;
+    regs[REG_PKT_RSSI_VALUE] = rssi < 0 ? 0 : rssi > 255 ? 255 : rssi;
+    regs[REG_PKT_SNR_VALUE] = (uint8_t)(int8_t)(slot->snr * 4);
+    regs[REG_IRQ_FLAGS] |= IRQ_RX_DONE;
+    stats.rx_frames++;
+    radio_emu_update_dio0();
+}
+
+void radio_emu_receive_at(int64_t at_us, const uint8_t *data, size_t length, int rssi, float snr,
+                          const lora_modem_params_t *params)
+{
+    for (int i = 0; i < RX_SLOTS; i++) {
+        if (!rx_slots[i].used) {
+            rx_slots[i] = (radio_emu_rx_t) {
+                .used = true, .length = length, .rssi = rssi, .snr = snr, .any_params = params == NULL,
+            };
+            if (params != NULL) {
+                rx_slots[i].params = *params;
+            }
+            memcpy(rx_slots[i].data, data, length);
+            host_at_us(at_us, radio_emu_arrive, &rx_slots[i]);
+            return;
+        }
+    }
+    abort();
+}
+
+static uint8_t radio_emu_read(uint8_t reg)
+{
+    if (reg == REG_FIFO) {
+        return fifo[regs[REG_FIFO_ADDR_PTR]++];
+    }
+    return regs[reg];
+}
+
+static void radio_emu_write(uint8_t reg, uint8_t value)
+{
+    switch (reg) {
+        case REG_FIFO:
+            fifo[regs[REG_FIFO_ADDR_PTR]++] = value;
+            break;
+        case REG_OP_MODE:
+            radio_emu_set_mode(value);
+            break;
+        case REG_IRQ_FLAGS:
+            regs[REG_IRQ_FLAGS] &= ~value;      // Write one to clear
+            radio_emu_update_dio0();
+            break;
+        case REG_VERSION:
+            break;
+        case REG_DIO_MAPPING_1:
+            regs[reg] = value;
+            radio_emu_update_dio0();
+            break;
+        default:
+            regs[reg] = value;
+            break;
+    }
+}
+
+// Runs one transaction: an address byte, then a burst that walks the
+// registers or, at REG_FIFO, streams through the FIFO
+static void radio_emu_execute(struct spi_device_t *dev, spi_transaction_t *trans)
+{
+    bool write = (trans->addr & 0x80) != 0;
+    uint8_t reg = trans->addr & 0x7F;
+    size_t length = trans->length / 8;
+    const uint8_t *tx = (trans->flags & SPI_TRANS_USE_TXDATA) ? trans->tx_data : trans->tx_buffer;
+    uint8_t *rx = (trans->flags & SPI_TRANS_USE_RXDATA) ? trans->rx_data : trans->rx_buffer;
+
+    for (size_t i = 0; i < length; i++) {
+        if (write) {
+            radio_emu_write(reg, tx[i]);
+        } else {
+            uint8_t value = radio_emu_read(reg);
+            if (rx != NULL) {
+                rx[i] = value;
+            }
+        }
+        if (reg != REG_FIFO) {
+            reg = (reg + 1) & 0x7F;
+        }
+    }
+
+    stats.transactions++;
+    stats.bytes += length;
+    stats.fifo_transactions += (trans->addr & 0x7F) == REG_FIFO;
+    int64_t ns = (int64_t)(8 + trans->length) * 1000000000 / dev->clock_speed_hz +
+                 RADIO_EMU_TRANS_OVERHEAD_US * 1000;
+    if (!dev->acquired) {
+        stats.acquisitions++;
+        ns += RADIO_EMU_ACQUIRE_US * 1000;
+    }
+
+    // The caller waits out the transfer
+    bus_ns += ns;
+    stats.bus_us += bus_ns / 1000;
+    host_time_us += bus_ns / 1000;
+    bus_ns %= 1000;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *config, int dma_channel)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *config,
+                             spi_device_handle_t *handle)
+{
+    if (config->queue_size > (int)(sizeof(device.done) / sizeof(device.done[0]))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    device.clock_speed_hz = config->clock_speed_hz;
+    device.queue_size = config->queue_size;
+    *handle = &device;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans)
+{
+    radio_emu_execute(handle, trans);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans)
+{
+    radio_emu_execute(handle, trans);
+    return ESP_OK;
+}
+
+// Runs at once; the result waits in the queue until collected
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *trans, TickType_t ticks_to_wait)
+{
+    if (handle->done_count == handle->queue_size) {
+        return ESP_ERR_TIMEOUT;
+    }
+    radio_emu_execute(handle, trans);
+    handle->done[handle->done_count++] = trans;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **trans,
+                                      TickType_t ticks_to_wait)
+{
+    if (handle->done_count == 0) {
+        return ESP_ERR_TIMEOUT;
+    }
+    *trans = handle->done[0];
+    memmove(handle->done, handle->done + 1, --handle->done_count * sizeof(handle->done[0]));
+    return ESP_OK;
+}
+
+esp_err_t spi_device_acquire_bus(spi_device_handle_t handle, TickType_t ticks_to_wait)
+{
+    handle->acquired = true;
+    stats.acquisitions++;
+    bus_ns += RADIO_EMU_ACQUIRE_US * 1000;
+    return ESP_OK;
+}
+
+void spi_device_release_bus(spi_device_handle_t handle)
+{
+    handle->acquired = false;
+}
@@ -0,0 +1,55 @@
+#ifndef RADIO_EMU_H
+#define RADIO_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "airtime.h"
+
+// An SX127x behind the SPI master driver API: its registers, the 256-byte
+// FIFO and DIO0, raised on TxDone, RxDone or CadDone once the real airtime
+// has passed. Every transaction is counted and charged to the host clock
+// at the SPI clock the driver asked for, plus the costs below.
+#define RADIO_EMU_TRANS_OVERHEAD_US  2  // Chip select and driver bookkeeping per transaction
+#define RADIO_EMU_ACQUIRE_US         8  // Taking the bus, once per lone transaction or acquired batch
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t acquisitions;
+    uint32_t fifo_transactions;
+    uint32_t bytes;                 // Data phase only, the address byte is not counted
+    int64_t bus_us;
+    uint32_t tx_frames;
+    uint32_t cad_runs;
+    uint32_t rx_frames;             // Landed in the FIFO
+    uint32_t rx_missed;             // Arrived while the radio was not listening, or on other settings
+} radio_emu_stats_t;
+
+// Called in interrupt context as each transmission ends
+typedef void (*radio_emu_tx_hook_t)(const uint8_t *data, size_t length, const lora_modem_params_t *params,
+                                    int64_t start_us);
+
+// Powers up the chip: registers at their reset values, DIO0 low
+void radio_emu_init(void);
+
+void radio_emu_get_stats(radio_emu_stats_t *stats);
+void radio_emu_reset_stats(void);
+
+// A frame finishes arriving at at_us; it is received if the radio is in
+// continuous RX then, on the same spreading factor and bandwidth unless
+// params is NULL
+void radio_emu_receive_at(int64_t at_us, const uint8_t *data, size_t length, int rssi, float snr,
+                          const lora_modem_params_t *params);
+
+// Whether the radio is in continuous RX, and on which settings
+bool radio_emu_listening(lora_modem_params_t *params);
+
+void radio_emu_set_tx_hook(radio_emu_tx_hook_t hook);
+
+// CAD reports activity while the clock is before until_us
+void radio_emu_channel_busy_until(int64_t until_us);
+
+// The last frame transmitted; returns its length, 0 if none
+size_t radio_emu_last_tx(uint8_t *data);
+
+#endif // RADIO_EMU_H
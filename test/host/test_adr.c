@@ -0,0 +1,295 @@
+// ADR on the radio emulator, with the real mesh layer: a node listening
+// faster than the base profile drops back to it exactly when its beacons say,
+// and a sender follows a neighbor's announced schedule rather than assuming
+// the fast profile throughout
+#include "host_test.h"
+#include "host_shim.h"
+#include "radio_emu.h"
+#include "lora.h"
+#include "mesh.h"
+#include "wire.h"
+#include "adr.h"
+#include "beacon.h"
+#include "link_quality.h"
+#include "text_codec.h"
+#include "timer_wheel.h"
+#include <string.h>
+
+#define LISTEN_RUN_MS   300000
+#define SEND_RUN_MS     300000
+#define SAMPLE_MS       50
+#define EDGE_MS         10              // Toggles may land this late after the deadline
+#define NEIGHBOR_SNR    10.0f
+
+static const uint8_t node_a[8] = {0xA0, 1, 2, 3, 4, 5, 6, 7};
+static const uint8_t node_b[8] = {0xB0, 1, 2, 3, 4, 5, 6, 7};
+static uint8_t device_id[8];
+static uint32_t beacon_seq;
+static int64_t run_end_us;
+
+// Latest schedule the node under test announced
+static bool announced;
+static uint8_t announced_profile;
+static bool announced_base_listen;
+static int64_t announced_period_us;
+static uint32_t schedule_changes;   // Beacons placing the period somewhere new
+
+static bool same_params(const lora_modem_params_t *a, const lora_modem_params_t *b)
+{
+    return a->spreading_factor == b->spreading_factor && a->bandwidth_hz == b->bandwidth_hz;
+}
+
+// A neighbor's beacon, heard whatever the node is listening on
+static void neighbor_beacon(const uint8_t *id, uint8_t profile, uint16_t base_phase_ms)
+{
+    mesh_message_t beacon = {
+        .id = ++beacon_seq, .message_type = MSG_TYPE_BEACON, .hop_count = 1,
+        .payload_length = BEACON_HEADER_SIZE,
+        .payload = {profile, base_phase_ms & 0xFF, base_phase_ms >> 8},
+    };
+    memcpy(beacon.sender_id, id, 8);
+    memset(beacon.recipient_id, 0xFF, 8);
+    beacon.checksum = mesh_calculate_checksum(&beacon);
+
+    wire_link_t link = {0};
+    memcpy(link.transmitter_id, id, 8);
+    uint8_t frame[LORA_MAX_PAYLOAD];
+    size_t length;
+    CHECK_EQ(wire_encode(&beacon, &link, frame, sizeof(frame), &length), ESP_OK);
+    radio_emu_receive_at(host_time_us + airtime_us(adr_profile_params(adr_base_profile()), length),
+                         frame, length, -80, NEIGHBOR_SNR, NULL);
+}
+
+// Whether a neighbor that announced this schedule listens on base at t
+static bool in_base_window(bool base_listen, int64_t period_us, int64_t t_us)
+{
+    if (!base_listen) {
+        return true;
+    }
+    int64_t into_us = (t_us - period_us) % (ADR_BASE_LISTEN_PERIOD_MS * 1000LL);
+    if (into_us < 0) {
+        into_us += ADR_BASE_LISTEN_PERIOD_MS * 1000LL;
+    }
+    return into_us < ADR_BASE_LISTEN_MS * 1000LL;
+}
+
+// Distance from t to the nearest toggle of that schedule
+static int64_t edge_distance_us(int64_t period_us, int64_t t_us)
+{
+    const int64_t period = ADR_BASE_LISTEN_PERIOD_MS * 1000LL;
+    int64_t into_us = ((t_us - period_us) % period + period) % period;
+    int64_t to_close = into_us - ADR_BASE_LISTEN_MS * 1000LL;
+    to_close = to_close < 0 ? -to_close : to_close;
+    int64_t to_open = into_us < period - into_us ? into_us : period - into_us;
+    return to_close < to_open ? to_close : to_open;
+}
+
+// Part 1: the node's own listening against its beacons
+
+static void capture_beacon(const uint8_t *data, size_t length, const lora_modem_params_t *params,
+                           int64_t start_us)
+{
+    mesh_message_t message;
+    wire_link_t link;
+    size_t offset = 0;
+    while (wire_decode_next(data, length, &offset, &message, &link) == ESP_OK) {
+        if (message.message_type != MSG_TYPE_BEACON || memcmp(message.sender_id, device_id, 8) != 0) {
+            continue;
+        }
+        CHECK(message.payload_length >= BEACON_HEADER_SIZE);
+        uint16_t phase_ms = message.payload[1] | (message.payload[2] << 8);
+        bool base_listen = phase_ms != LINK_NO_BASE_LISTEN;
+        int64_t period_us = start_us / 1000 * 1000 - phase_ms * 1000LL;
+
+        // A later beacon must agree with the schedule the earlier one set up
+        if (base_listen && announced && announced_base_listen &&
+            message.payload[0] == announced_profile &&
+            (period_us - announced_period_us) % (ADR_BASE_LISTEN_PERIOD_MS * 1000LL) != 0) {
+            schedule_changes++;
+        }
+        announced = true;
+        announced_profile = message.payload[0];
+        announced_base_listen = base_listen;
+        announced_period_us = period_us;
+    }
+}
+
+typedef struct {
+    uint32_t samples;
+    uint32_t on_base;
+    uint32_t mismatches;
+} listen_result_t;
+
+static listen_result_t listened;
+
+static void sample_listening(void *arg)
+{
+    lora_modem_params_t params;
+    if (announced && radio_emu_listening(&params)) {
+        uint8_t expected = announced_profile;
+        if (announced_profile != adr_base_profile() &&
+            in_base_window(announced_base_listen, announced_period_us, host_time_us)) {
+            expected = adr_base_profile();
+        }
+        bool near_edge = announced_base_listen && edge_distance_us(announced_period_us, host_time_us) < EDGE_MS * 1000;
+        if (!near_edge) {
+            listened.samples++;
+            listened.on_base += same_params(&params, adr_profile_params(adr_base_profile()));
+            listened.mismatches += !same_params(&params, adr_profile_params(expected));
+        }
+    }
+    if (host_time_us + SAMPLE_MS * 1000LL < run_end_us) {
+        host_at_us(host_time_us + SAMPLE_MS * 1000LL, sample_listening, NULL);
+    }
+}
+
+// A neighbor that listens on base throughout, heard with a strong link
+static void beacon_a(void *arg)
+{
+    neighbor_beacon(node_a, adr_base_profile(), LINK_NO_BASE_LISTEN);
+    if (host_time_us < run_end_us) {
+        host_at_us(host_time_us + 7000000, beacon_a, NULL);
+    }
+}
+
+static void test_listen_schedule(void)
+{
+    radio_emu_set_tx_hook(capture_beacon);
+    run_end_us = host_time_us + LISTEN_RUN_MS * 1000LL;
+    host_at_us(host_time_us + 1000000, beacon_a, NULL);
+    host_at_us(host_time_us + SAMPLE_MS * 1000LL, sample_listening, NULL);
+    vTaskDelay(pdMS_TO_TICKS(LISTEN_RUN_MS));
+
+    printf("listening: %lu samples, %.1f%% on base, %lu off the announced schedule, %lu schedule jumps\n",
+           (unsigned long)listened.samples, listened.on_base * 100.0 / listened.samples,
+           (unsigned long)listened.mismatches, (unsigned long)schedule_changes);
+
+    // The strong link moved the node to a faster profile, which it announced...
+    CHECK(announced && announced_profile < adr_base_profile());
+    CHECK(announced_base_listen);
+
+    // ...and it was on base for the announced window and only then
+    CHECK_EQ(listened.mismatches, 0);
+    CHECK_EQ(schedule_changes, 0);
+    CHECK(listened.on_base * 100 > listened.samples * (ADR_BASE_LISTEN_MS * 100 / ADR_BASE_LISTEN_PERIOD_MS - 2));
+    CHECK(listened.on_base * 100 < listened.samples * (ADR_BASE_LISTEN_MS * 100 / ADR_BASE_LISTEN_PERIOD_MS + 2));
+}
+
+// Part 2: frames for a neighbor that announced a fast profile and a schedule
+
+#define B_FAST_PROFILE  0
+
+static int64_t b_period_us;
+
+typedef struct {
+    uint32_t frames;
+    uint32_t delivered;
+    uint32_t naive_delivered;       // Had every frame gone out on the announced profile
+} send_result_t;
+
+static send_result_t sent;
+
+static uint8_t b_profile_at(int64_t t_us)
+{
+    return in_base_window(true, b_period_us, t_us) ? adr_base_profile() : B_FAST_PROFILE;
+}
+
+static void judge_frame(const uint8_t *data, size_t length, const lora_modem_params_t *params, int64_t start_us)
+{
+    mesh_message_t message;
+    wire_link_t link;
+    size_t offset = 0;
+    if (wire_decode_next(data, length, &offset, &message, &link) != ESP_OK ||
+        !link.has_next_hop || memcmp(link.next_hop_id, node_b, 8) != 0) {
+        return;
+    }
+
+    // Heard only if B stayed on the frame's profile from start to end
+    uint8_t at_start = b_profile_at(start_us);
+    uint8_t at_end = b_profile_at(host_time_us);
+    sent.frames++;
+    sent.delivered += at_start == at_end && same_params(params, adr_profile_params(at_start));
+    sent.naive_delivered += at_start == B_FAST_PROFILE && at_end == B_FAST_PROFILE;
+}
+
+static void beacon_b(void *arg)
+{
+    int64_t into_us = ((host_time_us - b_period_us) % (ADR_BASE_LISTEN_PERIOD_MS * 1000LL));
+    neighbor_beacon(node_b, B_FAST_PROFILE, into_us / 1000);
+    if (host_time_us < run_end_us) {
+        host_at_us(host_time_us + 9000000, beacon_b, NULL);
+    }
+}
+
+static void test_follow_schedule(void)
+{
+    radio_emu_set_tx_hook(judge_frame);
+    b_period_us = host_time_us - 3141000;
+    run_end_us = host_time_us + SEND_RUN_MS * 1000LL;
+    beacon_b(NULL);
+    vTaskDelay(pdMS_TO_TICKS(1000));
+
+    uint32_t rng = 0x2F6B;
+    while (host_time_us < run_end_us) {
+        CHECK_EQ(mesh_send_text_message(node_b, "ping"), ESP_OK);
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        vTaskDelay(pdMS_TO_TICKS(500 + rng % 2000));
+    }
+
+    printf("sending:   %lu frames to B, %lu heard following its schedule, %lu had B been assumed fast throughout\n",
+           (unsigned long)sent.frames, (unsigned long)sent.delivered, (unsigned long)sent.naive_delivered);
+
+    // Only a frame caught in flight by a toggle is lost...
+    CHECK(sent.frames > SEND_RUN_MS / 2500);
+    CHECK(sent.delivered * 100 >= sent.frames * 98);
+
+    // ...where assuming the fast profile loses the base window's share
+    CHECK(sent.naive_delivered * 100 < sent.frames * 85);
+}
+
+// Part 3: a profile announcement from a neighbor we have no entry for must
+// not push out one we have
+static void test_no_eviction(void)
+{
+    uint8_t id[8] = {0xC0};
+    link_quality_init();
+    for (int i = 0; i < MAX_NEIGHBORS; i++) {
+        id[1] = i;
+        link_quality_update(id, -80, NEIGHBOR_SNR, 1000 + i);
+    }
+
+    id[1] = MAX_NEIGHBORS;
+    link_quality_set_rx_profile(id, 0, LINK_NO_BASE_LISTEN, 5000);
+    CHECK(link_quality_find(id) == NULL);
+    for (int i = 0; i < MAX_NEIGHBORS; i++) {
+        id[1] = i;
+        CHECK(link_quality_find(id) != NULL);
+    }
+
+    // A known one takes the profile and schedule
+    id[1] = 3;
+    link_quality_set_rx_profile(id, 0, 1500, 5000);
+    const link_entry_t *entry = link_quality_find(id);
+    CHECK_EQ(entry->rx_profile, 0);
+    CHECK(entry->base_listens);
+    CHECK_EQ(entry->base_period_ms, 3500);
+}
+
+int main(void)
+{
+    host_tasks_start();
+    timer_wheel_init();
+    text_codec_init();
+    radio_emu_init();
+    CHECK_EQ(lora_init(), ESP_OK);
+    CHECK_EQ(mesh_init(), ESP_OK);
+    mesh_get_device_id(device_id);
+
+    test_listen_schedule();
+    test_follow_schedule();
+    radio_emu_set_tx_hook(NULL);
+    test_no_eviction();
+    return 0;
+}
@@ -0,0 +1,353 @@
+// Frame aggregation on a busy node, replayed on the radio emulator with the
+// real mesh layer: texts to and from two neighbors with their ACKs, our own
+// broadcasts and broadcasts relayed for others. Every frame on air must only
+// combine messages bound for the same next hop (or all broadcast), nothing
+// may be lost or sent twice, a lone message waits no longer than the
+// aggregation window, and the counters mesh_get_tx_stats reports must agree
+// with what was actually transmitted.
+#include "host_test.h"
+#include "host_shim.h"
+#include "radio_emu.h"
+#include "lora.h"
+#include "mesh.h"
+#include "wire.h"
+#include "adr.h"
+#include "beacon.h"
+#include "link_quality.h"
+#include "text_codec.h"
+#include "timer_wheel.h"
+#include <string.h>
+
+#define RUN_MS              (1800 * 1000)
+#define INCOMING_GAP_MS     1500        // Mean gap between texts the neighbors send us
+#define LOCAL_GAP_MS        2000        // Mean gap between texts we send them
+#define BROADCAST_GAP_MS    4000        // Mean gap between our broadcasts
+#define RELAY_GAP_MS        2000        // Mean gap between broadcasts heard for relaying
+#define TURNAROUND_MS       200         // From the end of our text to the start of its ACK
+#define BEACON_GAP_MS       30000       // Keeps the neighbors' link entries fresh
+#define MAX_IDS             4096
+#define SLACK_MS            400         // Channel access and a frame ahead on air
+
+static const uint8_t neighbors[2][8] = {
+    {0xA1, 1, 2, 3, 4, 5, 6, 7},
+    {0xA2, 1, 2, 3, 4, 5, 6, 7},
+};
+static const uint8_t node_s[8] = {0x50, 1, 2, 3, 4, 5, 6, 7};
+static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static const char *const chat[] = {
+    "ok", "on my way", "where are you now?", "yes", "see you at the trailhead in ten minutes",
+};
+static uint8_t device_id[8];
+static uint32_t neighbor_seq;
+static uint32_t rng_state = 0xA66;
+static int64_t run_end_us;
+
+// What went on air, as the hook saw it
+static struct {
+    uint32_t frames;
+    uint32_t messages;
+    uint32_t aggregates;
+    uint64_t airtime_us;
+    uint64_t airtime_saved_us;
+    uint32_t acks;
+} air;
+
+// Message ids we expect to see sent, and how often they were
+typedef struct {
+    uint32_t id;
+    int64_t due_us;                 // Heard or queued, so ready to go out
+    uint8_t sent;
+} expected_t;
+
+static expected_t acks_due[MAX_IDS];
+static uint32_t acks_due_count;
+static expected_t relays_due[MAX_IDS];
+static uint32_t relays_due_count;
+static uint32_t broadcasts_sent;
+static uint32_t broadcasts_on_air;
+static uint32_t texts_sent;
+static uint32_t texts_acked;
+static uint32_t texts_failed;
+static uint32_t late_acks;
+static uint32_t max_ack_wait_ms;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Exponential gaps, so arrivals are as bursty as independent senders make them
+static int64_t gap_us(uint32_t mean_ms)
+{
+    double u = (rng() % 1000000 + 1) / 1000001.0;
+    return (int64_t)(-__builtin_log(u) * mean_ms * 1000);
+}
+
+static expected_t *find(expected_t *list, uint32_t count, uint32_t id)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (list[i].id == id) {
+            return &list[i];
+        }
+    }
+    return NULL;
+}
+
+static void from_neighbor(mesh_message_t *message, const wire_link_t *link, int64_t at_us)
+{
+    // Neighbors take turns on air, so their frames never land on each other
+    static int64_t channel_free_us;
+    if (at_us < channel_free_us) {
+        at_us = channel_free_us;
+    }
+    message->checksum = mesh_calculate_checksum(message);
+    uint8_t frame[LORA_MAX_PAYLOAD];
+    size_t length;
+    CHECK_EQ(wire_encode(message, link, frame, sizeof(frame), &length), ESP_OK);
+    channel_free_us = at_us + airtime_us(adr_profile_params(adr_base_profile()), length);
+    radio_emu_receive_at(channel_free_us, frame, length, -80, 5.0f, NULL);
+    channel_free_us += 1000;
+}
+
+static void neighbor_message(mesh_message_t *message, const uint8_t *sender, uint8_t type,
+                             const uint8_t *recipient)
+{
+    memset(message, 0, sizeof(*message));
+    message->id = ++neighbor_seq;
+    memcpy(message->sender_id, sender, 8);
+    memcpy(message->recipient_id, recipient, 8);
+    message->message_type = type;
+    message->hop_count = MAX_HOP_COUNT;
+}
+
+static void beacon(void *arg)
+{
+    const uint8_t *neighbor = arg;
+    mesh_message_t message;
+    neighbor_message(&message, neighbor, MSG_TYPE_BEACON, broadcast_id);
+    message.hop_count = 1;
+    message.payload_length = BEACON_HEADER_SIZE;
+    message.payload[0] = adr_base_profile();
+    message.payload[1] = LINK_NO_BASE_LISTEN & 0xFF;
+    message.payload[2] = LINK_NO_BASE_LISTEN >> 8;
+    wire_link_t link = {0};
+    memcpy(link.transmitter_id, neighbor, 8);
+    from_neighbor(&message, &link, host_time_us);
+    if (host_time_us < run_end_us) {
+        host_at_us(host_time_us + BEACON_GAP_MS * 1000LL, beacon, arg);
+    }
+}
+
+// The neighbors' own texts for us, each owed an ACK
+static void incoming_text(void *arg)
+{
+    const uint8_t *neighbor = neighbors[rng() % 2];
+    mesh_message_t message;
+    neighbor_message(&message, neighbor, MSG_TYPE_TEXT, device_id);
+    const char *text = chat[rng() % 5];
+    message.payload_length = strlen(text);
+    memcpy(message.payload, text, message.payload_length);
+    wire_link_t link = { .has_next_hop = true };
+    memcpy(link.transmitter_id, neighbor, 8);
+    memcpy(link.next_hop_id, device_id, 8);
+    from_neighbor(&message, &link, host_time_us);
+    if (host_time_us < run_end_us) {
+        host_at_us(host_time_us + gap_us(INCOMING_GAP_MS), incoming_text, NULL);
+    }
+}
+
+// Broadcasts from further away that a neighbor passes on, for us to flood
+static void relayed_broadcast(void *arg)
+{
+    mesh_message_t message;
+    neighbor_message(&message, node_s, MSG_TYPE_TEXT, broadcast_id);
+    message.hop_count = MAX_HOP_COUNT - 1;
+    const char *text = chat[rng() % 5];
+    message.payload_length = strlen(text);
+    memcpy(message.payload, text, message.payload_length);
+    wire_link_t link = {0};
+    memcpy(link.transmitter_id, neighbors[rng() % 2], 8);
+    from_neighbor(&message, &link, host_time_us);
+    if (host_time_us < run_end_us) {
+        host_at_us(host_time_us + gap_us(RELAY_GAP_MS), relayed_broadcast, NULL);
+    }
+}
+
+static void on_message(const mesh_message_t *message)
+{
+    if (message->message_type != MSG_TYPE_TEXT) {
+        return;
+    }
+    expected_t *list = memcmp(message->sender_id, node_s, 8) == 0 ? relays_due : acks_due;
+    uint32_t *count = list == relays_due ? &relays_due_count : &acks_due_count;
+    if (find(list, *count, message->id) == NULL) {
+        CHECK(*count < MAX_IDS);
+        list[(*count)++] = (expected_t) { .id = message->id, .due_us = host_time_us };
+    }
+}
+
+static void on_delivery(uint32_t message_id, mesh_delivery_state_t state, uint8_t attempts, uint32_t latency_ms)
+{
+    if (state == MESH_DELIVERY_ACKED) {
+        texts_acked++;
+    } else {
+        texts_failed++;
+    }
+}
+
+static void ack_from_neighbor(const uint8_t *neighbor, uint32_t id)
+{
+    mesh_message_t ack;
+    neighbor_message(&ack, neighbor, MSG_TYPE_ACK, device_id);
+    ack.payload_length = sizeof(uint32_t);
+    memcpy(ack.payload, &id, sizeof(uint32_t));
+    wire_link_t link = { .has_next_hop = true };
+    memcpy(link.transmitter_id, neighbor, 8);
+    memcpy(link.next_hop_id, device_id, 8);
+    from_neighbor(&ack, &link, host_time_us + TURNAROUND_MS * 1000LL);
+}
+
+static void on_air(const uint8_t *data, size_t length, const lora_modem_params_t *params, int64_t start_us)
+{
+    mesh_message_t records[AGG_MAX_RECORDS];
+    wire_link_t links[AGG_MAX_RECORDS];
+    size_t count = 0;
+    size_t offset = 0;
+    mesh_message_t message;
+    wire_link_t link;
+    while (wire_decode_next(data, length, &offset, &message, &link) == ESP_OK) {
+        CHECK(count < AGG_MAX_RECORDS);
+        records[count] = message;
+        links[count++] = link;
+    }
+    CHECK(count > 0);
+    CHECK_EQ(offset, length);
+
+    air.frames++;
+    air.messages += count;
+    air.airtime_us += airtime_us(params, length);
+    uint32_t separate_us = 0;
+    for (size_t i = 0; i < count; i++) {
+        const mesh_message_t *record = &records[i];
+        separate_us += airtime_us(params, wire_encoded_size(record, &links[i]));
+
+        // Only what is bound the same way shares a frame: unicast for the
+        // neighbor the frame names, or broadcasts. Every unicast here is for
+        // a neighbor, so its next hop is its recipient.
+        bool broadcast = memcmp(record->recipient_id, broadcast_id, 8) == 0;
+        CHECK_EQ(links[i].has_next_hop, !broadcast);
+        if (!broadcast) {
+            CHECK(memcmp(links[i].next_hop_id, record->recipient_id, 8) == 0);
+        }
+
+        if (record->message_type == MSG_TYPE_ACK) {
+            uint32_t id;
+            memcpy(&id, record->payload, sizeof(id));
+            expected_t *due = find(acks_due, acks_due_count, id);
+            CHECK(due != NULL);
+            uint32_t wait_ms = (uint32_t)((start_us - due->due_us) / 1000);
+            if (due->sent++ == 0 && wait_ms > max_ack_wait_ms) {
+                max_ack_wait_ms = wait_ms;
+            }
+            late_acks += wait_ms > AGG_WINDOW_MS + SLACK_MS;
+            air.acks++;
+        } else if (record->message_type == MSG_TYPE_TEXT && memcmp(record->sender_id, node_s, 8) == 0) {
+            expected_t *due = find(relays_due, relays_due_count, record->id);
+            CHECK(due != NULL);
+            CHECK_EQ(due->sent++, 0);
+        } else if (record->message_type == MSG_TYPE_TEXT && !broadcast) {
+            ack_from_neighbor(record->recipient_id, record->id);
+        } else if (record->message_type == MSG_TYPE_TEXT) {
+            broadcasts_on_air++;
+        }
+    }
+    if (count > 1) {
+        air.aggregates++;
+        air.airtime_saved_us += separate_us - airtime_us(params, length);
+    }
+}
+
+int main(void)
+{
+    host_tasks_start();
+    timer_wheel_init();
+    text_codec_init();
+    radio_emu_init();
+    CHECK_EQ(lora_init(), ESP_OK);
+    CHECK_EQ(mesh_init(), ESP_OK);
+    mesh_get_device_id(device_id);
+    mesh_set_message_callback(on_message);
+    mesh_set_delivery_callback(on_delivery);
+    radio_emu_set_tx_hook(on_air);
+
+    run_end_us = host_time_us + RUN_MS * 1000LL;
+    beacon((void *)neighbors[0]);
+    beacon((void *)neighbors[1]);
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    host_at_us(host_time_us + gap_us(INCOMING_GAP_MS), incoming_text, NULL);
+    host_at_us(host_time_us + gap_us(RELAY_GAP_MS), relayed_broadcast, NULL);
+
+    // Our own traffic, from the task a phone's messages arrive on
+    int64_t next_text_us = host_time_us + gap_us(LOCAL_GAP_MS);
+    int64_t next_broadcast_us = host_time_us + gap_us(BROADCAST_GAP_MS);
+    while (host_time_us < run_end_us) {
+        int64_t next_us = next_text_us < next_broadcast_us ? next_text_us : next_broadcast_us;
+        vTaskDelay(pdMS_TO_TICKS((next_us - host_time_us) / 1000 + 1));
+        if (host_time_us >= next_text_us) {
+            if (mesh_send_text_message(neighbors[rng() % 2], chat[rng() % 5]) == ESP_OK) {
+                texts_sent++;
+            }
+            next_text_us = host_time_us + gap_us(LOCAL_GAP_MS);
+        }
+        if (host_time_us >= next_broadcast_us) {
+            if (mesh_send_broadcast(chat[rng() % 5]) == ESP_OK) {
+                broadcasts_sent++;
+            }
+            next_broadcast_us = host_time_us + gap_us(BROADCAST_GAP_MS);
+        }
+    }
+    vTaskDelay(pdMS_TO_TICKS(200000));
+
+    mesh_tx_stats_t stats;
+    mesh_get_tx_stats(&stats);
+    printf("replay: %lu messages in %lu frames (%.2f per frame), %lu aggregates, "
+           "%.1f s on air, %.1f s (%.1f%%) saved\n",
+           (unsigned long)air.messages, (unsigned long)air.frames, (double)air.messages / air.frames,
+           (unsigned long)air.aggregates, air.airtime_us / 1e6, air.airtime_saved_us / 1e6,
+           air.airtime_saved_us * 100.0 / (air.airtime_us + air.airtime_saved_us));
+    printf("replay: %lu ACKs for %lu texts heard, longest wait %lu ms; %lu of %lu texts acknowledged, "
+           "%lu relays, %lu of %lu broadcasts\n",
+           (unsigned long)air.acks, (unsigned long)acks_due_count, (unsigned long)max_ack_wait_ms,
+           (unsigned long)texts_acked, (unsigned long)texts_sent, (unsigned long)relays_due_count,
+           (unsigned long)broadcasts_on_air, (unsigned long)broadcasts_sent);
+
+    // The node's own accounting matches the air
+    CHECK_EQ(stats.frames, air.frames);
+    CHECK_EQ(stats.messages, air.messages);
+    CHECK_EQ(stats.aggregates, air.aggregates);
+    CHECK_EQ(stats.airtime_saved_us, air.airtime_saved_us);
+
+    // Nothing lost or duplicated on the way out: every text heard is ACKed,
+    // every broadcast heard relayed once, every one of ours sent once
+    for (uint32_t i = 0; i < acks_due_count; i++) {
+        CHECK(acks_due[i].sent >= 1);
+    }
+    for (uint32_t i = 0; i < relays_due_count; i++) {
+        CHECK_EQ(relays_due[i].sent, 1);
+    }
+    CHECK_EQ(broadcasts_on_air, broadcasts_sent);
+    CHECK_EQ(texts_acked + texts_failed, texts_sent);
+    CHECK_EQ(texts_failed, 0);
+
+    // Waiting for companions is bounded by the window
+    CHECK_EQ(late_acks, 0);
+
+    // And it pays, if modestly: short chat and ACKs seldom queue together
+    // within the window unless the node is this busy
+    CHECK(air.aggregates * 20 > air.frames);
+    CHECK(air.airtime_saved_us * 60 > air.airtime_us);
+    return 0;
+}
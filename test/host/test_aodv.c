@@ -0,0 +1,423 @@
+// On-demand routing on the radio emulator, with the real mesh layer. The node
+// under test sits in a line of neighbors the test plays, and takes each role
+// in turn: source discovering a route and buffering while it does, relay
+// passing requests, replies and data along the paths they set up, relay with
+// no route answering with a route error, and bystander staying silent where
+// flooding would have relayed everything
+#include "host_test.h"
+#include "host_shim.h"
+#include "radio_emu.h"
+#include "lora.h"
+#include "mesh.h"
+#include "wire.h"
+#include "adr.h"
+#include "text_codec.h"
+#include "timer_wheel.h"
+#include <string.h>
+
+#define MESSAGES        10
+#define SETTLE_MS       3000            // Longer than the longest flood backoff
+
+// Control payloads as aodv.c puts them on air
+typedef struct {
+    uint8_t destination[8];
+    uint32_t dest_seq;
+    uint32_t orig_seq;
+    uint8_t hops;
+} __attribute__((packed)) rreq_t;
+
+typedef struct {
+    uint8_t destination[8];
+    uint32_t dest_seq;
+    uint8_t hops;
+} __attribute__((packed)) rrep_t;
+
+typedef struct {
+    uint8_t destination[8];
+    uint32_t dest_seq;
+} __attribute__((packed)) rerr_entry_t;
+
+// Neighbors N1 and N2 on either side; S and D beyond them
+static const uint8_t node_n1[8] = {0xA1, 1, 2, 3, 4, 5, 6, 7};
+static const uint8_t node_n2[8] = {0xA2, 1, 2, 3, 4, 5, 6, 7};
+static const uint8_t node_s[8] = {0x50, 1, 2, 3, 4, 5, 6, 7};
+static const uint8_t node_d[8] = {0xD0, 1, 2, 3, 4, 5, 6, 7};
+static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static uint8_t device_id[8];
+static uint32_t inject_seq = 1000;
+
+// Everything but beacons the node put on air
+#define MAX_SENT        64
+
+typedef struct {
+    mesh_message_t message;
+    wire_link_t link;
+    int64_t start_us;
+} sent_t;
+
+static sent_t sent[MAX_SENT];
+static uint32_t sent_count;
+
+static uint32_t acked;
+static uint32_t failed;
+
+static void capture(const uint8_t *data, size_t length, const lora_modem_params_t *params, int64_t start_us)
+{
+    size_t offset = 0;
+    mesh_message_t message;
+    wire_link_t link;
+    while (wire_decode_next(data, length, &offset, &message, &link) == ESP_OK) {
+        if (message.message_type != MSG_TYPE_BEACON && sent_count < MAX_SENT) {
+            sent[sent_count++] = (sent_t) { .message = message, .link = link, .start_us = start_us };
+        }
+    }
+}
+
+static uint32_t count_sent(uint8_t type)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < sent_count; i++) {
+        count += sent[i].message.message_type == type;
+    }
+    return count;
+}
+
+static const sent_t *last_sent(uint8_t type)
+{
+    for (uint32_t i = sent_count; i-- > 0;) {
+        if (sent[i].message.message_type == type) {
+            return &sent[i];
+        }
+    }
+    return NULL;
+}
+
+static void on_delivery(uint32_t message_id, mesh_delivery_state_t state, uint8_t attempts, uint32_t latency_ms)
+{
+    acked += state == MESH_DELIVERY_ACKED;
+    failed += state == MESH_DELIVERY_FAILED;
+}
+
+// A message from sender, put on air by a neighbor one hop away, then time
+// for the node to act on it
+static mesh_message_t *message_from(mesh_message_t *message, const uint8_t *sender, const uint8_t *recipient,
+                                    uint8_t type)
+{
+    memset(message, 0, sizeof(*message));
+    message->id = ++inject_seq;
+    memcpy(message->sender_id, sender, 8);
+    memcpy(message->recipient_id, recipient, 8);
+    message->message_type = type;
+    message->hop_count = MAX_HOP_COUNT - 1;
+    return message;
+}
+
+static void inject(mesh_message_t *message, const uint8_t *transmitter, const uint8_t *next_hop)
+{
+    message->checksum = mesh_calculate_checksum(message);
+
+    wire_link_t link = {0};
+    memcpy(link.transmitter_id, transmitter, 8);
+    if (next_hop != NULL) {
+        memcpy(link.next_hop_id, next_hop, 8);
+        link.has_next_hop = true;
+    }
+    uint8_t frame[LORA_MAX_PAYLOAD];
+    size_t length;
+    CHECK_EQ(wire_encode(message, &link, frame, sizeof(frame), &length), ESP_OK);
+    radio_emu_receive_at(host_time_us + airtime_us(adr_profile_params(adr_base_profile()), length),
+                         frame, length, -80, 5.0f, NULL);
+    vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+}
+
+static void inject_text(const uint8_t *sender, const uint8_t *recipient, const uint8_t *transmitter,
+                        const uint8_t *next_hop)
+{
+    mesh_message_t message;
+    message_from(&message, sender, recipient, MSG_TYPE_TEXT);
+    message.payload_length = 2;
+    memcpy(message.payload, "hi", 2);
+    inject(&message, transmitter, next_hop);
+}
+
+static void inject_rrep(const uint8_t *replier, const uint8_t *originator, const uint8_t *transmitter,
+                        uint32_t dest_seq, uint8_t hops)
+{
+    mesh_message_t message;
+    rrep_t rep = { .dest_seq = dest_seq, .hops = hops };
+    memcpy(rep.destination, replier, 8);
+    message_from(&message, replier, originator, MSG_TYPE_ROUTE_REPLY);
+    memcpy(message.payload, &rep, sizeof(rep));
+    message.payload_length = sizeof(rep);
+    inject(&message, transmitter, device_id);
+}
+
+static void inject_ack(const uint8_t *sender, uint32_t message_id, const uint8_t *transmitter)
+{
+    mesh_message_t message;
+    message_from(&message, sender, device_id, MSG_TYPE_ACK);
+    memcpy(message.payload, &message_id, sizeof(message_id));
+    message.payload_length = sizeof(message_id);
+    inject(&message, transmitter, device_id);
+}
+
+static bool same_id(const uint8_t *a, const uint8_t *b)
+{
+    return memcmp(a, b, 8) == 0;
+}
+
+// Source: one request for D, answered through N1, then every message goes
+// straight to N1
+static void test_source(void)
+{
+    sent_count = 0;
+    CHECK_EQ(mesh_send_text_message(node_d, "first"), ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(1000));
+
+    // Nothing for D goes out before the route is known
+    CHECK_EQ(count_sent(MSG_TYPE_ROUTE_REQUEST), 1);
+    CHECK_EQ(count_sent(MSG_TYPE_TEXT), 0);
+    const sent_t *request = last_sent(MSG_TYPE_ROUTE_REQUEST);
+    rreq_t req;
+    memcpy(&req, request->message.payload, sizeof(req));
+    CHECK(same_id(request->message.recipient_id, broadcast_id));
+    CHECK(same_id(req.destination, node_d));
+    CHECK_EQ(req.hops, 0);
+
+    // D replied; N1 passes the reply on, its hop included
+    inject_rrep(node_d, device_id, node_n1, 5, 1);
+    route_entry_t route;
+    CHECK(mesh_get_route(node_d, &route));
+    CHECK(same_id(route.next_hop, node_n1));
+    CHECK_EQ(route.hop_count, 2);
+    CHECK_EQ(route.seq_num, 5);
+
+    // The buffered message left as soon as the reply came in
+    CHECK_EQ(count_sent(MSG_TYPE_TEXT), 1);
+    const sent_t *text = last_sent(MSG_TYPE_TEXT);
+    CHECK(text->link.has_next_hop && same_id(text->link.next_hop_id, node_n1));
+    inject_ack(node_d, text->message.id, node_n1);
+
+    for (int i = 1; i < MESSAGES; i++) {
+        CHECK_EQ(mesh_send_text_message(node_d, "more"), ESP_OK);
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        text = last_sent(MSG_TYPE_TEXT);
+        CHECK(text->link.has_next_hop && same_id(text->link.next_hop_id, node_n1));
+        inject_ack(node_d, text->message.id, node_n1);
+    }
+
+    CHECK_EQ(acked, MESSAGES);
+    CHECK_EQ(count_sent(MSG_TYPE_ROUTE_REQUEST), 1);
+    printf("source:    %lu of %d acknowledged, %lu frames sent (%lu route request), %.2f per delivered message\n",
+           (unsigned long)acked, MESSAGES, (unsigned long)sent_count,
+           (unsigned long)count_sent(MSG_TYPE_ROUTE_REQUEST), (double)sent_count / acked);
+    CHECK_EQ(sent_count, MESSAGES + 1);
+}
+
+// Relay between S (through N1) and D (N2): the request is passed on and sets
+// up the way back, the reply follows it and sets up the way forward, and data
+// then takes that path
+static void test_relay(void)
+{
+    mesh_message_t message;
+
+    sent_count = 0;
+    rreq_t req = { .dest_seq = 0, .orig_seq = 7, .hops = 1 };
+    memcpy(req.destination, node_n2, 8);
+    message_from(&message, node_s, broadcast_id, MSG_TYPE_ROUTE_REQUEST);
+    memcpy(message.payload, &req, sizeof(req));
+    message.payload_length = sizeof(req);
+    inject(&message, node_n1, NULL);
+
+    const sent_t *forwarded = last_sent(MSG_TYPE_ROUTE_REQUEST);
+    CHECK(forwarded != NULL);
+    memcpy(&req, forwarded->message.payload, sizeof(req));
+    CHECK(same_id(forwarded->message.sender_id, node_s));
+    CHECK_EQ(forwarded->message.hop_count, MAX_HOP_COUNT - 2);
+    CHECK_EQ(req.hops, 2);
+    route_entry_t route;
+    CHECK(mesh_get_route(node_s, &route));
+    CHECK(same_id(route.next_hop, node_n1));
+    CHECK_EQ(route.hop_count, 2);
+
+    inject_rrep(node_n2, node_s, node_n2, 3, 0);
+    const sent_t *reply = last_sent(MSG_TYPE_ROUTE_REPLY);
+    CHECK(reply != NULL);
+    CHECK(reply->link.has_next_hop && same_id(reply->link.next_hop_id, node_n1));
+    CHECK(mesh_get_route(node_n2, &route));
+    CHECK(same_id(route.next_hop, node_n2));
+    CHECK_EQ(route.hop_count, 1);
+
+    for (int i = 0; i < MESSAGES; i++) {
+        inject_text(node_s, node_n2, node_n1, device_id);
+        const sent_t *text = last_sent(MSG_TYPE_TEXT);
+        CHECK(text->link.has_next_hop && same_id(text->link.next_hop_id, node_n2));
+    }
+    CHECK_EQ(count_sent(MSG_TYPE_TEXT), MESSAGES);
+    printf("relay:     %d of %d messages forwarded, %lu frames sent with the request and reply\n",
+           MESSAGES, MESSAGES, (unsigned long)sent_count);
+    CHECK_EQ(sent_count, MESSAGES + 2);
+}
+
+// A relay asked to forward towards a node it has no route to cannot buffer
+// for the source: it reports the destination unreachable and drops the message
+static void test_relay_without_route(void)
+{
+    static const uint8_t unknown[8] = {0xE0, 1, 2, 3, 4, 5, 6, 7};
+    sent_count = 0;
+    inject_text(node_s, unknown, node_n1, device_id);
+
+    CHECK_EQ(count_sent(MSG_TYPE_TEXT), 0);
+    CHECK_EQ(count_sent(MSG_TYPE_ROUTE_REQUEST), 0);
+    const sent_t *error = last_sent(MSG_TYPE_ROUTE_ERROR);
+    CHECK(error != NULL);
+    rerr_entry_t entry;
+    CHECK_EQ(error->message.payload[0], 1);
+    memcpy(&entry, &error->message.payload[1], sizeof(entry));
+    CHECK(same_id(entry.destination, unknown));
+    CHECK(same_id(error->message.recipient_id, broadcast_id));
+}
+
+// A route error counts only from the next hop the route goes through; the
+// node then drops the route and passes the error upstream
+static void test_route_error(void)
+{
+    mesh_message_t message;
+    rerr_entry_t entry = { .dest_seq = 4 };
+    memcpy(entry.destination, node_n2, 8);
+
+    sent_count = 0;
+    message_from(&message, node_n1, broadcast_id, MSG_TYPE_ROUTE_ERROR);
+    message.payload[0] = 1;
+    memcpy(&message.payload[1], &entry, sizeof(entry));
+    message.payload_length = 1 + sizeof(entry);
+    inject(&message, node_n1, NULL);
+
+    route_entry_t route;
+    CHECK(mesh_get_route(node_n2, &route));
+    CHECK_EQ(sent_count, 0);
+
+    message_from(&message, node_n2, broadcast_id, MSG_TYPE_ROUTE_ERROR);
+    message.payload[0] = 1;
+    memcpy(&message.payload[1], &entry, sizeof(entry));
+    message.payload_length = 1 + sizeof(entry);
+    inject(&message, node_n2, NULL);
+
+    CHECK(!mesh_get_route(node_n2, &route));
+    CHECK_EQ(count_sent(MSG_TYPE_ROUTE_ERROR), 1);
+}
+
+// Overhearing unicast for someone else costs a routed network nothing; a
+// flooded network relays every message from every node
+static void test_bystander(void)
+{
+    sent_count = 0;
+    for (int i = 0; i < MESSAGES; i++) {
+        inject_text(node_s, node_d, node_n1, node_n2);
+    }
+    uint32_t unicast_relayed = sent_count;
+
+    sent_count = 0;
+    for (int i = 0; i < MESSAGES; i++) {
+        inject_text(node_s, broadcast_id, node_n1, NULL);
+    }
+    uint32_t flood_relayed = count_sent(MSG_TYPE_TEXT);
+
+    printf("bystander: %lu of %d unicasts relayed, %lu of %d flooded broadcasts\n",
+           (unsigned long)unicast_relayed, MESSAGES, (unsigned long)flood_relayed, MESSAGES);
+    CHECK_EQ(unicast_relayed, 0);
+    CHECK_EQ(flood_relayed, MESSAGES);
+}
+
+// Messages for destinations nobody answers for: AODV_PENDING_MAX are
+// buffered, each discovery retried with a doubling timeout and then given
+// up, and one more is dropped at once
+static void test_pending_overflow(void)
+{
+    uint8_t destinations[AODV_PENDING_MAX + 1][8];
+    int64_t started_us = host_time_us;
+
+    sent_count = 0;
+    for (int i = 0; i <= AODV_PENDING_MAX; i++) {
+        memcpy(destinations[i], node_d, 8);
+        destinations[i][1] = 0x80 + i;
+        CHECK_EQ(mesh_send_text_message(destinations[i], "anyone?"), ESP_OK);
+        vTaskDelay(pdMS_TO_TICKS(200));
+    }
+
+    // Past the last retry's deadline
+    uint32_t give_up_ms = 0;
+    for (int retry = 0; retry <= AODV_RREQ_RETRIES; retry++) {
+        give_up_ms += AODV_DISCOVERY_TIMEOUT_MS << retry;
+    }
+    vTaskDelay(pdMS_TO_TICKS(give_up_ms + 1000));
+
+    uint32_t requests[AODV_PENDING_MAX + 1] = {0};
+    uint32_t total = 0;
+    int64_t first_us[AODV_PENDING_MAX + 1];
+    int64_t previous_us[AODV_PENDING_MAX + 1];
+    bool doubling = true;
+    for (uint32_t i = 0; i < sent_count; i++) {
+        rreq_t req;
+        CHECK_EQ(sent[i].message.message_type, MSG_TYPE_ROUTE_REQUEST);
+        memcpy(&req, sent[i].message.payload, sizeof(req));
+        int d = req.destination[1] - 0x80;
+        CHECK(d >= 0 && d <= AODV_PENDING_MAX);
+        if (requests[d] == 0) {
+            first_us[d] = sent[i].start_us;
+        } else if (sent[i].start_us - first_us[d] >= give_up_ms * 1000LL) {
+            continue;   // Delivery retransmitted the dropped message, which starts over
+        } else {
+            // Each retry waits twice as long as the one before
+            int64_t expected_us = (AODV_DISCOVERY_TIMEOUT_MS << (requests[d] - 1)) * 1000LL;
+            int64_t gap_us = sent[i].start_us - previous_us[d];
+            doubling &= gap_us > expected_us - 50000 && gap_us < expected_us + 50000;
+        }
+        previous_us[d] = sent[i].start_us;
+        requests[d]++;
+        total++;
+    }
+
+    printf("overflow:  %d messages for unreachable nodes, %lu route requests for the first %d, %lu for the last\n",
+           AODV_PENDING_MAX + 1, (unsigned long)(total - requests[AODV_PENDING_MAX]), AODV_PENDING_MAX,
+           (unsigned long)requests[AODV_PENDING_MAX]);
+    for (int d = 0; d < AODV_PENDING_MAX; d++) {
+        CHECK_EQ(requests[d], 1 + AODV_RREQ_RETRIES);
+        CHECK(first_us[d] - started_us < 2000000);
+    }
+    CHECK_EQ(requests[AODV_PENDING_MAX], 0);
+    CHECK(doubling);
+
+    // Giving up freed the buffer for the next message
+    sent_count = 0;
+    CHECK_EQ(mesh_send_text_message(destinations[AODV_PENDING_MAX], "anyone?"), ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    bool requested = false;
+    for (uint32_t i = 0; i < sent_count; i++) {
+        requested |= sent[i].message.message_type == MSG_TYPE_ROUTE_REQUEST &&
+                     same_id(sent[i].message.payload, destinations[AODV_PENDING_MAX]);
+    }
+    CHECK(requested);
+}
+
+int main(void)
+{
+    host_tasks_start();
+    timer_wheel_init();
+    text_codec_init();
+    radio_emu_init();
+    CHECK_EQ(lora_init(), ESP_OK);
+    CHECK_EQ(mesh_init(), ESP_OK);
+    mesh_get_device_id(device_id);
+    mesh_set_delivery_callback(on_delivery);
+    radio_emu_set_tx_hook(capture);
+
+    test_source();
+    test_relay();
+    test_relay_without_route();
+    test_route_error();
+    test_bystander();
+    test_pending_overflow();
+    CHECK_EQ(failed, 0);
+    return 0;
+}
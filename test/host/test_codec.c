@@ -0,0 +1,472 @@
+// Wire format, text compression, CRC and airtime
+#include "host_test.h"
+#include "wire.h"
+#include "text_codec.h"
+#include "airtime.h"
+#include "crc.h"
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+static const char *const chat[] = {
+    "ok see you at the trailhead in ten minutes",
+    "where are you now?",
+    "battery at 40 percent, heading back to camp",
+    "yes",
+    "can you bring water and the first aid kit",
+    "Thanks! I'll meet you there",
+};
+
+// A longer sample for the compression benchmark: what hikers, event crews
+// and family groups send each other
+static const char *const corpus[] = {
+    "ok", "yes", "no", "on my way", "thanks!", "where are you?", "I'm at the car",
+    "be there in 5", "see you soon", "battery low, turning off the phone",
+    "we are at the second lake, going to have lunch here",
+    "the trail is closed after the bridge, take the left path",
+    "can someone bring extra water to the north gate",
+    "stage two needs two more people for setup",
+    "doors open at 7, sound check at 6:30",
+    "found the tent, next to the big oak tree",
+    "anyone seen a blue backpack? left it near the fire",
+    "weather is turning, we are heading back down now",
+    "all good here, camp is set up",
+    "Meet at the trailhead at 8 tomorrow morning",
+    "dinner is ready",
+    "running late, start without me",
+    "the signal here is terrible, will try again from the ridge",
+    "how many people are in your group?",
+    "we have 4, two of them are kids",
+    "need a medic at the east entrance",
+    "copy that",
+    "the road is blocked by a fallen tree about 2 km past the village",
+    "I can pick you up at the station at 10",
+    "does anyone have a spare charger?",
+};
+
+static uint32_t rng_state = 0xC2C;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void make_message(mesh_message_t *message, uint8_t type, const char *text, bool broadcast)
+{
+    memset(message, 0, sizeof(*message));
+    message->id = 123456;
+    message->timestamp = 1760000000;
+    memset(message->sender_id, 0x24, 8);
+    memset(message->recipient_id, broadcast ? 0xFF : 0x31, 8);
+    message->message_type = type;
+    message->hop_count = 7;
+    message->payload_length = strlen(text);
+    memcpy(message->payload, text, message->payload_length);
+    message->checksum = 0xBEEF;
+}
+
+static void check_same_message(const mesh_message_t *a, const mesh_message_t *b)
+{
+    CHECK_EQ(a->id, b->id);
+    CHECK_EQ(a->timestamp, b->timestamp);
+    CHECK(memcmp(a->sender_id, b->sender_id, 8) == 0);
+    CHECK(memcmp(a->recipient_id, b->recipient_id, 8) == 0);
+    CHECK_EQ(a->message_type, b->message_type);
+    CHECK_EQ(a->hop_count, b->hop_count);
+    CHECK_EQ(a->payload_length, b->payload_length);
+    CHECK(memcmp(a->payload, b->payload, a->payload_length) == 0);
+    CHECK_EQ(a->checksum, b->checksum);
+}
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// One bit at a time, straight from the polynomial: the reference the
+// slice-by-4 tables must agree with
+static uint16_t crc16_bitwise(uint16_t crc, const uint8_t *data, size_t length)
+{
+    while (length--) {
+        crc ^= (uint16_t)(*data++ << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void test_crc(void)
+{
+    // CRC-16/CCITT-FALSE check value
+    CHECK_EQ(crc16_ccitt(CRC16_CCITT_INIT, "123456789", 9), 0x29B1);
+    CHECK_EQ(crc16_bitwise(CRC16_CCITT_INIT, (const uint8_t *)"123456789", 9), 0x29B1);
+
+    // Random data, lengths, running values and alignments, so every tail
+    // length and every table gets exercised
+    static uint8_t random_data[300 + 4];
+    for (int i = 0; i < 5000; i++) {
+        size_t length = rng() % 300;
+        size_t align = rng() % 4;
+        uint16_t start = i % 2 ? CRC16_CCITT_INIT : (uint16_t)rng();
+        for (size_t j = 0; j < length; j++) {
+            random_data[align + j] = (uint8_t)rng();
+        }
+        CHECK_EQ(crc16_ccitt(start, random_data + align, length), crc16_bitwise(start, random_data + align, length));
+    }
+
+    // Running values chain across regions, whatever the split
+    uint8_t data[200];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 37 + 11);
+    }
+    uint16_t whole = crc16_ccitt(CRC16_CCITT_INIT, data, sizeof(data));
+    for (size_t split = 0; split <= sizeof(data); split++) {
+        uint16_t crc = crc16_ccitt(CRC16_CCITT_INIT, data, split);
+        CHECK_EQ(crc16_ccitt(crc, data + split, sizeof(data) - split), whole);
+    }
+}
+
+static void test_text_codec(void)
+{
+    uint8_t packed[256];
+    uint8_t unpacked[256];
+    size_t packed_total = 0;
+    size_t plain_total = 0;
+
+    for (size_t i = 0; i < sizeof(chat) / sizeof(chat[0]); i++) {
+        size_t length = strlen(chat[i]);
+        size_t packed_len = text_compress((const uint8_t *)chat[i], length, packed, sizeof(packed));
+        if (packed_len == 0) {
+            packed_len = length;    // Sent as is
+        } else {
+            size_t unpacked_len;
+            CHECK_EQ(text_decompress(packed, packed_len, unpacked, sizeof(unpacked), &unpacked_len), ESP_OK);
+            CHECK_EQ(unpacked_len, length);
+            CHECK(memcmp(unpacked, chat[i], length) == 0);
+        }
+        packed_total += packed_len;
+        plain_total += length;
+    }
+    CHECK(packed_total * 10 < plain_total * 8);
+
+    // Bytes outside the dictionary never come out larger
+    const uint8_t binary[] = {0xF0, 0x9F, 0x98, 0x80, 0x01, 0x02, 0xFE, 0xFF};
+    CHECK_EQ(text_compress(binary, sizeof(binary), packed, sizeof(packed)), 0);
+
+    // A verbatim escape cut short is refused
+    const uint8_t truncated[] = {254};
+    size_t unpacked_len;
+    CHECK(text_decompress(truncated, sizeof(truncated), unpacked, sizeof(unpacked), &unpacked_len) != ESP_OK);
+}
+
+static void test_wire_round_trip(void)
+{
+    uint8_t frame[255];
+    size_t frame_len;
+    mesh_message_t message;
+    mesh_message_t decoded;
+    wire_link_t decoded_link;
+
+    // Unicast handed to one neighbor by a relay
+    make_message(&message, MSG_TYPE_TEXT, chat[0], false);
+    wire_link_t link = {0};
+    memset(link.transmitter_id, 0x42, 8);
+    memset(link.next_hop_id, 0x43, 8);
+    link.has_next_hop = true;
+    CHECK_EQ(wire_encode(&message, &link, frame, sizeof(frame), &frame_len), ESP_OK);
+    CHECK_EQ(frame_len, wire_encoded_size(&message, &link));
+    CHECK_EQ(wire_decode(frame, frame_len, &decoded, &decoded_link), ESP_OK);
+    check_same_message(&message, &decoded);
+    CHECK(memcmp(decoded_link.transmitter_id, link.transmitter_id, 8) == 0);
+    CHECK(decoded_link.has_next_hop);
+    CHECK(memcmp(decoded_link.next_hop_id, link.next_hop_id, 8) == 0);
+
+    // Broadcast from its sender leaves both ids off the air
+    make_message(&message, MSG_TYPE_EMERGENCY, chat[2], true);
+    memset(&link, 0, sizeof(link));
+    memcpy(link.transmitter_id, message.sender_id, 8);
+    CHECK_EQ(wire_encode(&message, &link, frame, sizeof(frame), &frame_len), ESP_OK);
+    CHECK(frame_len < 4 + 8 + 8 + (size_t)message.payload_length);
+    CHECK_EQ(wire_decode(frame, frame_len, &decoded, &decoded_link), ESP_OK);
+    check_same_message(&message, &decoded);
+    CHECK(!decoded_link.has_next_hop);
+
+    // Every truncation is rejected rather than read past
+    for (size_t len = 0; len < frame_len; len++) {
+        CHECK(wire_decode(frame, len, &decoded, &decoded_link) != ESP_OK);
+    }
+
+    // A full-size payload still fits the largest header
+    char longest[WIRE_MAX_PAYLOAD + 1];
+    for (size_t i = 0; i < WIRE_MAX_PAYLOAD; i++) {
+        longest[i] = (char)(0x80 + i % 64);    // Incompressible
+    }
+    longest[WIRE_MAX_PAYLOAD] = '\0';
+    make_message(&message, MSG_TYPE_TEXT, longest, false);
+    memset(link.transmitter_id, 0x42, 8);
+    link.has_next_hop = true;
+    CHECK_EQ(wire_encode(&message, &link, frame, sizeof(frame), &frame_len), ESP_OK);
+    CHECK(frame_len <= 255);
+}
+
+static void test_wire_aggregate(void)
+{
+    mesh_message_t messages[3];
+    const mesh_message_t *records[3];
+    for (int i = 0; i < 3; i++) {
+        make_message(&messages[i], MSG_TYPE_TEXT, chat[i + 1], true);
+        messages[i].id += i;
+        records[i] = &messages[i];
+    }
+
+    wire_link_t link = {0};
+    memset(link.transmitter_id, 0x42, 8);
+    uint8_t frame[255];
+    size_t frame_len;
+    CHECK_EQ(wire_encode_aggregate(records, 3, &link, frame, sizeof(frame), &frame_len), ESP_OK);
+
+    size_t expected = wire_aggregate_header_size(&link);
+    for (int i = 0; i < 3; i++) {
+        expected += wire_aggregate_record_size(&messages[i]);
+    }
+    CHECK_EQ(frame_len, expected);
+
+    size_t offset = 0;
+    mesh_message_t decoded;
+    wire_link_t decoded_link;
+    for (int i = 0; i < 3; i++) {
+        CHECK_EQ(wire_decode_next(frame, frame_len, &offset, &decoded, &decoded_link), ESP_OK);
+        check_same_message(&messages[i], &decoded);
+        CHECK(memcmp(decoded_link.transmitter_id, link.transmitter_id, 8) == 0);
+    }
+    CHECK_EQ(wire_decode_next(frame, frame_len, &offset, &decoded, &decoded_link), ESP_ERR_NOT_FOUND);
+
+    // Unicast for one next hop: our ACK, our text and a relayed text, each
+    // record keeping its own sender while the container names the link
+    make_message(&messages[0], MSG_TYPE_ACK, "", false);
+    messages[0].payload_length = sizeof(uint32_t);
+    make_message(&messages[1], MSG_TYPE_TEXT, chat[0], false);
+    make_message(&messages[2], MSG_TYPE_TEXT, chat[4], false);
+    memset(messages[2].sender_id, 0x77, 8);
+    for (int i = 0; i < 3; i++) {
+        messages[i].id += i;
+    }
+    link.has_next_hop = true;
+    memset(link.next_hop_id, 0x31, 8);
+    CHECK_EQ(wire_encode_aggregate(records, 3, &link, frame, sizeof(frame), &frame_len), ESP_OK);
+    offset = 0;
+    for (int i = 0; i < 3; i++) {
+        CHECK_EQ(wire_decode_next(frame, frame_len, &offset, &decoded, &decoded_link), ESP_OK);
+        check_same_message(&messages[i], &decoded);
+        CHECK(memcmp(decoded_link.transmitter_id, link.transmitter_id, 8) == 0);
+        CHECK(decoded_link.has_next_hop);
+        CHECK(memcmp(decoded_link.next_hop_id, link.next_hop_id, 8) == 0);
+    }
+    CHECK_EQ(wire_decode_next(frame, frame_len, &offset, &decoded, &decoded_link), ESP_ERR_NOT_FOUND);
+
+    // One byte short of the whole is refused rather than cut off
+    CHECK_EQ(wire_encode_aggregate(records, 3, &link, frame, frame_len - 1, &offset), ESP_ERR_INVALID_SIZE);
+
+    // A frame cut short anywhere yields exactly the records wholly before
+    // the cut, never one made up of what is missing
+    for (size_t cut = 0; cut < frame_len; cut++) {
+        int whole = 0;
+        size_t end = wire_aggregate_header_size(&link);
+        for (int i = 0; i < 3; i++) {
+            end += wire_aggregate_record_size(&messages[i]);
+            whole += end <= cut;
+        }
+
+        int decoded_count = 0;
+        offset = 0;
+        while (wire_decode_next(frame, cut, &offset, &decoded, &decoded_link) == ESP_OK) {
+            CHECK(decoded_count < whole);
+            check_same_message(&messages[decoded_count++], &decoded);
+        }
+        CHECK_EQ(decoded_count, whole);
+        CHECK(offset <= cut);
+    }
+}
+
+// Frames say which format they are in: any other version is refused, and
+// only a payload that was compressed is marked so and decompressed
+static void test_wire_version(void)
+{
+    uint8_t frame[255];
+    size_t frame_len;
+    mesh_message_t message;
+    mesh_message_t decoded;
+    wire_link_t decoded_link;
+    wire_link_t link = {0};
+    memset(link.transmitter_id, 0x24, 8);
+
+    make_message(&message, MSG_TYPE_TEXT, chat[0], true);
+    CHECK_EQ(wire_encode(&message, &link, frame, sizeof(frame), &frame_len), ESP_OK);
+    CHECK_EQ(frame[0], WIRE_VERSION);
+    CHECK(frame[1] & WIRE_FLAG_COMPRESSED);
+
+    // A version 1 node's frame, which could be laid out the same, is still refused
+    frame[0] = 1;
+    size_t offset = 0;
+    CHECK_EQ(wire_decode(frame, frame_len, &decoded, &decoded_link), ESP_ERR_INVALID_VERSION);
+    CHECK_EQ(wire_decode_next(frame, frame_len, &offset, &decoded, &decoded_link), ESP_ERR_INVALID_VERSION);
+    CHECK_EQ(offset, frame_len);
+
+    // Without the flag the same bytes would be taken as they are: the
+    // receiver goes by the flag alone
+    frame[0] = WIRE_VERSION;
+    frame[1] &= ~WIRE_FLAG_COMPRESSED;
+    CHECK_EQ(wire_decode(frame, frame_len, &decoded, &decoded_link), ESP_OK);
+    CHECK(decoded.payload_length < message.payload_length);
+
+    // Text that does not shrink goes as it is, unflagged; other types never compress
+    const char *plain[] = {"\xF0\x9F\x98\x80\x01\x02", chat[4]};
+    const uint8_t types[] = {MSG_TYPE_TEXT, MSG_TYPE_ACK};
+    for (int i = 0; i < 2; i++) {
+        make_message(&message, types[i], plain[i], false);
+        CHECK_EQ(wire_encode(&message, &link, frame, sizeof(frame), &frame_len), ESP_OK);
+        CHECK(!(frame[1] & WIRE_FLAG_COMPRESSED));
+        CHECK_EQ(wire_decode(frame, frame_len, &decoded, &decoded_link), ESP_OK);
+        check_same_message(&message, &decoded);
+    }
+}
+
+// Compression ratio, codec speed and what it buys on air, over the corpus
+static void bench_text_codec(void)
+{
+    static const lora_modem_params_t sf12 = {
+        .spreading_factor = 12, .bandwidth_hz = 125000, .coding_rate = 5, .preamble_length = 8,
+    };
+    const size_t lines = sizeof(corpus) / sizeof(corpus[0]);
+    const int rounds = 2000;
+    uint8_t packed[lines][256];
+    size_t packed_len[lines];
+    uint8_t unpacked[256];
+    size_t plain_total = 0;
+    size_t packed_total = 0;
+    uint64_t plain_air_us = 0;
+    uint64_t packed_air_us = 0;
+
+    for (size_t i = 0; i < lines; i++) {
+        size_t length = strlen(corpus[i]);
+        packed_len[i] = text_compress((const uint8_t *)corpus[i], length, packed[i], sizeof(packed[i]));
+        size_t unpacked_len;
+        if (packed_len[i] > 0) {
+            CHECK_EQ(text_decompress(packed[i], packed_len[i], unpacked, sizeof(unpacked), &unpacked_len), ESP_OK);
+            CHECK_EQ(unpacked_len, length);
+            CHECK(memcmp(unpacked, corpus[i], length) == 0);
+        }
+        size_t sent = packed_len[i] > 0 ? packed_len[i] : length;
+        plain_total += length;
+        packed_total += sent;
+
+        // A unicast text from its sender, as it goes on air either way
+        mesh_message_t message;
+        make_message(&message, MSG_TYPE_TEXT, corpus[i], false);
+        wire_link_t link = {0};
+        memcpy(link.transmitter_id, message.sender_id, 8);
+        size_t frame_len = wire_encoded_size(&message, &link);
+        packed_air_us += airtime_us(&sf12, frame_len);
+        plain_air_us += airtime_us(&sf12, frame_len - sent + length);
+    }
+
+    int64_t start = now_ns();
+    size_t sink = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < lines; i++) {
+            sink += text_compress((const uint8_t *)corpus[i], strlen(corpus[i]), unpacked, sizeof(unpacked));
+        }
+    }
+    double encode_ns = (double)(now_ns() - start) / (rounds * lines);
+
+    start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < lines; i++) {
+            size_t unpacked_len = 0;
+            if (packed_len[i] > 0) {
+                text_decompress(packed[i], packed_len[i], unpacked, sizeof(unpacked), &unpacked_len);
+            }
+            sink += unpacked_len;
+        }
+    }
+    double decode_ns = (double)(now_ns() - start) / (rounds * lines);
+    CHECK(sink > 0);
+
+    printf("text codec: %zu lines, %zu -> %zu bytes (%.1f%%), encode %.0f ns, decode %.0f ns per line; "
+           "SF12 airtime %.1f s -> %.1f s (%.1f%% less)\n",
+           lines, plain_total, packed_total, packed_total * 100.0 / plain_total, encode_ns, decode_ns,
+           plain_air_us / 1e6, packed_air_us / 1e6, 100.0 - packed_air_us * 100.0 / plain_air_us);
+    CHECK(packed_total * 10 < plain_total * 8);
+    CHECK(packed_air_us < plain_air_us);
+}
+
+// Slice-by-4 against the bitwise loop, over what mesh_calculate_checksum
+// covers for a 20-character text and for a full payload
+static void bench_crc(void)
+{
+    const size_t header = offsetof(mesh_message_t, hop_count) + 1;
+    const size_t sizes[] = {header + 20, header + 255};
+    const int rounds = 200000;
+    uint8_t data[offsetof(mesh_message_t, hop_count) + 1 + 255];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)rng();
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint16_t sink = 0;
+        int64_t start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            data[0] = (uint8_t)r;
+            sink ^= crc16_ccitt(CRC16_CCITT_INIT, data, sizes[s]);
+        }
+        double slice_ns = (double)(now_ns() - start) / rounds;
+
+        start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            data[0] = (uint8_t)r;
+            sink ^= crc16_bitwise(CRC16_CCITT_INIT, data, sizes[s]);
+        }
+        double bitwise_ns = (double)(now_ns() - start) / rounds;
+        CHECK_EQ(sink, 0);
+
+        printf("crc16 over %3zu bytes: slice-by-4 %6.1f ns, bitwise %6.1f ns (%.1fx)\n",
+               sizes[s], slice_ns, bitwise_ns, bitwise_ns / slice_ns);
+        CHECK(slice_ns * 2 < bitwise_ns);
+    }
+}
+
+static void test_airtime(void)
+{
+    // Semtech LoRa calculator: 10 bytes, CR 4/5, 8 preamble symbols, CRC on
+    lora_modem_params_t sf7 = { .spreading_factor = 7, .bandwidth_hz = 125000, .coding_rate = 5, .preamble_length = 8 };
+    lora_modem_params_t sf12 = { .spreading_factor = 12, .bandwidth_hz = 125000, .coding_rate = 5, .preamble_length = 8 };
+    CHECK_EQ(airtime_symbol_us(&sf7), 1024);
+    CHECK_EQ(airtime_us(&sf7, 10), 41216);
+    CHECK_EQ(airtime_us(&sf12, 10), 991232);     // Low data rate optimization on
+
+    // Longer frames never take less time
+    for (size_t len = 1; len <= 255; len++) {
+        CHECK(airtime_us(&sf7, len) >= airtime_us(&sf7, len - 1));
+    }
+}
+
+int main(void)
+{
+    text_codec_init();
+
+    test_crc();
+    test_text_codec();
+    test_wire_round_trip();
+    test_wire_aggregate();
+    test_wire_version();
+    test_airtime();
+    bench_text_codec();
+    bench_crc();
+    return 0;
+}
@@ -0,0 +1,264 @@
+// Reliable delivery over a lossy link, on the radio emulator with the real
+// mesh layer: the neighbor the test plays loses frames both ways, and every
+// message must end in exactly one outcome, ACKED or FAILED, with
+// retransmissions spaced by the doubling, jittered ACK timeout
+#include "host_test.h"
+#include "host_shim.h"
+#include "radio_emu.h"
+#include "lora.h"
+#include "mesh.h"
+#include "wire.h"
+#include "adr.h"
+#include "beacon.h"
+#include "link_quality.h"
+#include "text_codec.h"
+#include "timer_wheel.h"
+#include "msg_pool.h"
+#include <string.h>
+
+#define MESSAGES        200
+#define SEND_GAP_MS     20000
+#define LOSS_PCT        30              // Each way, each transmission
+#define TURNAROUND_MS   200             // From the end of a text to the start of its ACK
+#define BEACON_GAP_MS   30000           // Keeps the neighbor's link entry fresh
+#define SLACK_MS        300             // Queueing and channel access on top of the timeout
+
+static const uint8_t node_n1[8] = {0xA1, 1, 2, 3, 4, 5, 6, 7};
+static uint8_t device_id[8];
+static uint32_t neighbor_seq;
+static uint32_t rng_state = 0xDE11;
+static uint32_t loss_pct;
+static int64_t run_end_us;
+
+typedef struct {
+    uint32_t id;
+    int64_t sent_us[DELIVERY_MAX_RETRIES + 2];
+    uint8_t transmissions;
+    uint8_t outcomes;
+    mesh_delivery_state_t state;
+    uint8_t attempts;
+    uint32_t latency_ms;
+    int64_t outcome_us;
+} tracked_t;
+
+static tracked_t tracked[MESSAGES];
+static uint32_t tracked_count;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static tracked_t *find(uint32_t id)
+{
+    for (uint32_t i = 0; i < tracked_count; i++) {
+        if (tracked[i].id == id) {
+            return &tracked[i];
+        }
+    }
+    return NULL;
+}
+
+static void from_neighbor(mesh_message_t *message, const wire_link_t *link, int64_t at_us)
+{
+    message->id = ++neighbor_seq;
+    memcpy(message->sender_id, node_n1, 8);
+    message->checksum = mesh_calculate_checksum(message);
+
+    uint8_t frame[LORA_MAX_PAYLOAD];
+    size_t length;
+    CHECK_EQ(wire_encode(message, link, frame, sizeof(frame), &length), ESP_OK);
+    radio_emu_receive_at(at_us + airtime_us(adr_profile_params(adr_base_profile()), length),
+                         frame, length, -80, 5.0f, NULL);
+}
+
+static void beacon(void *arg)
+{
+    mesh_message_t message = {
+        .message_type = MSG_TYPE_BEACON, .hop_count = 1, .payload_length = BEACON_HEADER_SIZE,
+        .payload = {adr_base_profile(), LINK_NO_BASE_LISTEN & 0xFF, LINK_NO_BASE_LISTEN >> 8},
+    };
+    memset(message.recipient_id, 0xFF, 8);
+    wire_link_t link = {0};
+    memcpy(link.transmitter_id, node_n1, 8);
+    from_neighbor(&message, &link, host_time_us);
+    if (host_time_us < run_end_us) {
+        host_at_us(host_time_us + BEACON_GAP_MS * 1000LL, beacon, NULL);
+    }
+}
+
+// The neighbor hears a text unless it is lost, and answers every copy it
+// hears, a retransmission included, with an ACK that may be lost too
+static void on_air(const uint8_t *data, size_t length, const lora_modem_params_t *params, int64_t start_us)
+{
+    size_t offset = 0;
+    mesh_message_t message;
+    wire_link_t link;
+    while (wire_decode_next(data, length, &offset, &message, &link) == ESP_OK) {
+        if (message.message_type != MSG_TYPE_TEXT) {
+            continue;
+        }
+        tracked_t *entry = find(message.id);
+        if (entry == NULL) {
+            CHECK(tracked_count < MESSAGES);
+            entry = &tracked[tracked_count++];
+            entry->id = message.id;
+        }
+        CHECK(link.has_next_hop && memcmp(link.next_hop_id, node_n1, 8) == 0);
+        CHECK(entry->transmissions <= DELIVERY_MAX_RETRIES);
+        entry->sent_us[entry->transmissions++] = start_us;
+        if (rng() % 100 < loss_pct || rng() % 100 < loss_pct) {
+            continue;
+        }
+
+        mesh_message_t ack = {
+            .message_type = MSG_TYPE_ACK, .hop_count = MAX_HOP_COUNT, .payload_length = sizeof(uint32_t),
+        };
+        memcpy(ack.recipient_id, device_id, 8);
+        memcpy(ack.payload, &message.id, sizeof(uint32_t));
+        wire_link_t ack_link = { .has_next_hop = true };
+        memcpy(ack_link.transmitter_id, node_n1, 8);
+        memcpy(ack_link.next_hop_id, device_id, 8);
+        from_neighbor(&ack, &ack_link, host_time_us + TURNAROUND_MS * 1000LL);
+    }
+}
+
+static void on_delivery(uint32_t message_id, mesh_delivery_state_t state, uint8_t attempts, uint32_t latency_ms)
+{
+    tracked_t *entry = find(message_id);
+    CHECK(entry != NULL);
+    entry->outcomes++;
+    entry->state = state;
+    entry->attempts = attempts;
+    entry->latency_ms = latency_ms;
+    entry->outcome_us = host_time_us;
+}
+
+// Base ACK wait before the given attempt's retransmission, one hop away
+static int64_t timeout_us(int attempt)
+{
+    int64_t timeout_ms = (int64_t)DELIVERY_HOP_TIMEOUT_MS << (attempt - 1);
+    return (timeout_ms < DELIVERY_BACKOFF_MAX_MS ? timeout_ms : DELIVERY_BACKOFF_MAX_MS) * 1000;
+}
+
+typedef struct {
+    uint32_t acked;
+    uint32_t failed;
+    uint32_t transmissions;
+    uint64_t latency_sum_ms;
+    uint32_t latency_max_ms;
+} delivery_result_t;
+
+static void run(const char *name, uint32_t loss, uint32_t count, delivery_result_t *result)
+{
+    loss_pct = loss;
+    tracked_count = 0;
+    memset(tracked, 0, sizeof(tracked));
+    run_end_us = host_time_us + (int64_t)count * SEND_GAP_MS * 1000 + 200000000LL;
+    beacon(NULL);
+    vTaskDelay(pdMS_TO_TICKS(1000));
+
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK_EQ(mesh_send_text_message(node_n1, "over a lossy link"), ESP_OK);
+        vTaskDelay(pdMS_TO_TICKS(SEND_GAP_MS));
+    }
+
+    // Long enough for the last one to run out of retries
+    vTaskDelay(pdMS_TO_TICKS(200000));
+    CHECK_EQ(tracked_count, count);
+
+    for (uint32_t i = 0; i < tracked_count; i++) {
+        const tracked_t *entry = &tracked[i];
+        CHECK_EQ(entry->outcomes, 1);
+        CHECK(entry->transmissions >= 1);
+        result->transmissions += entry->transmissions;
+
+        // Retransmitted once per expired, doubling timeout, jitter at most a quarter
+        for (int k = 1; k < entry->transmissions; k++) {
+            int64_t gap_us = entry->sent_us[k] - entry->sent_us[k - 1];
+            CHECK(gap_us >= timeout_us(k));
+            CHECK(gap_us <= timeout_us(k) * 5 / 4 + SLACK_MS * 1000);
+        }
+
+        if (entry->state == MESH_DELIVERY_ACKED) {
+            result->acked++;
+            result->latency_sum_ms += entry->latency_ms;
+            if (entry->latency_ms > result->latency_max_ms) {
+                result->latency_max_ms = entry->latency_ms;
+            }
+            CHECK_EQ(entry->attempts, entry->transmissions);
+        } else {
+            // Every attempt made, and given up only once the last one timed out
+            result->failed++;
+            CHECK_EQ(entry->attempts, DELIVERY_MAX_RETRIES + 1);
+            CHECK_EQ(entry->transmissions, DELIVERY_MAX_RETRIES + 1);
+            CHECK(entry->outcome_us - entry->sent_us[DELIVERY_MAX_RETRIES] >= timeout_us(DELIVERY_MAX_RETRIES + 1));
+        }
+    }
+
+    printf("%-10s %3lu messages: %5.1f%% acknowledged, %lu failed, %.2f transmissions each, "
+           "latency to ACK mean %6.0f ms max %6lu ms\n",
+           name, (unsigned long)count, result->acked * 100.0 / count, (unsigned long)result->failed,
+           (double)result->transmissions / count,
+           result->acked ? (double)result->latency_sum_ms / result->acked : 0.0,
+           (unsigned long)result->latency_max_ms);
+}
+
+// A message refused by a full queue is reported to the caller only: it is
+// neither retried later nor given an outcome, and its buffer goes back
+static void test_queue_full(void)
+{
+    msg_pool_stats_t before;
+    msg_pool_stats_t after;
+
+    loss_pct = 0;
+    tracked_count = 0;
+    memset(tracked, 0, sizeof(tracked));
+    msg_pool_get_stats(&before);
+    for (int i = 0; i < TX_DEPTH_LOCAL; i++) {
+        CHECK_EQ(mesh_send_text_message(node_n1, "burst"), ESP_OK);
+    }
+    CHECK_EQ(mesh_send_text_message(node_n1, "one too many"), ESP_ERR_NO_MEM);
+
+    vTaskDelay(pdMS_TO_TICKS(200000));
+    CHECK_EQ(tracked_count, TX_DEPTH_LOCAL);
+    for (uint32_t i = 0; i < tracked_count; i++) {
+        CHECK_EQ(tracked[i].outcomes, 1);
+        CHECK_EQ(tracked[i].state, MESH_DELIVERY_ACKED);
+    }
+    msg_pool_get_stats(&after);
+    CHECK_EQ(after.in_use, before.in_use);
+}
+
+int main(void)
+{
+    host_tasks_start();
+    timer_wheel_init();
+    text_codec_init();
+    radio_emu_init();
+    CHECK_EQ(lora_init(), ESP_OK);
+    CHECK_EQ(mesh_init(), ESP_OK);
+    mesh_get_device_id(device_id);
+    mesh_set_delivery_callback(on_delivery);
+    radio_emu_set_tx_hook(on_air);
+
+    // Lossy: about half the round trips fail, so several attempts are
+    // common and giving up after all of them rare
+    delivery_result_t lossy = {0};
+    run("lossy", LOSS_PCT, MESSAGES, &lossy);
+    CHECK(lossy.acked * 100 > MESSAGES * 90);
+    CHECK(lossy.failed > 0);
+    CHECK(lossy.transmissions > MESSAGES * 3 / 2);
+
+    // Dead: every message fails, each after its full set of attempts
+    delivery_result_t dead = {0};
+    run("dead link", 100, 10, &dead);
+    CHECK_EQ(dead.failed, 10);
+    CHECK_EQ(dead.transmissions, 10 * (DELIVERY_MAX_RETRIES + 1));
+
+    test_queue_full();
+    return 0;
+}
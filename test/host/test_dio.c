@@ -0,0 +1,223 @@
+// DIO0 interrupts against the old polling receive loop on the radio emulator:
+// frames heard, delivery latency, and the wakeups and SPI traffic it costs
+#include "host_test.h"
+#include "host_shim.h"
+#include "radio_emu.h"
+#include "lora.h"
+#include "driver/spi_master.h"
+#include "driver/gpio.h"
+#include <string.h>
+
+#define RUN_MS          600000
+#define MEAN_GAP_MS     2000            // Between arrivals
+#define FRAME_LENGTH    48
+#define MAX_FRAMES      (2 * RUN_MS / MEAN_GAP_MS)
+
+#define REG_FIFO                 0x00
+#define REG_OP_MODE              0x01
+#define REG_FIFO_ADDR_PTR        0x0D
+#define REG_FIFO_RX_CURRENT_ADDR 0x10
+#define REG_IRQ_FLAGS            0x12
+#define REG_RX_NB_BYTES          0x13
+#define MODE_STDBY               0x81
+#define MODE_RX_CONTINUOUS       0x85
+#define IRQ_RX_DONE_MASK         0x40
+
+typedef struct {
+    const char *name;
+    uint32_t sent;
+    uint32_t received;
+    int64_t latency_sum_us;
+    int64_t latency_max_us;
+    uint32_t wakeups;
+    uint32_t transactions;
+    int64_t bus_us;
+} dio_result_t;
+
+static int64_t arrival_us[MAX_FRAMES];
+static uint32_t arrivals;
+static int64_t run_end_us;
+static uint32_t rng_state = 0x9E3779B9;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Interrupt-context feeder: lands one frame, numbered by its first bytes,
+// and schedules the next
+static void arrive(void *arg)
+{
+    uint8_t frame[FRAME_LENGTH];
+    memset(frame, 0x5A, sizeof(frame));
+    memcpy(frame, &arrivals, sizeof(arrivals));
+    arrival_us[arrivals++] = host_time_us;
+    radio_emu_receive_at(host_time_us, frame, sizeof(frame), -90, 5.0f, NULL);
+
+    int64_t next_us = host_time_us + (1 + rng() % (2 * MEAN_GAP_MS - 1)) * 1000LL + rng() % 1000;
+    if (next_us < run_end_us && arrivals < MAX_FRAMES) {
+        host_at_us(next_us, arrive, NULL);
+    }
+}
+
+static void record(dio_result_t *result, const uint8_t *data)
+{
+    uint32_t seq;
+    memcpy(&seq, data, sizeof(seq));
+    CHECK(seq < arrivals);
+    int64_t latency_us = host_time_us - arrival_us[seq];
+    result->received++;
+    result->latency_sum_us += latency_us;
+    if (latency_us > result->latency_max_us) {
+        result->latency_max_us = latency_us;
+    }
+}
+
+static void start_run(TaskHandle_t task, host_task_stats_t *before)
+{
+    arrivals = 0;
+    run_end_us = host_time_us + RUN_MS * 1000LL;
+    host_at_us(host_time_us + MEAN_GAP_MS * 1000LL, arrive, NULL);
+    radio_emu_reset_stats();
+    host_task_stats(task, before);
+}
+
+static void end_run(dio_result_t *result, TaskHandle_t task, const host_task_stats_t *before)
+{
+    radio_emu_stats_t radio;
+    host_task_stats_t after;
+    radio_emu_get_stats(&radio);
+    host_task_stats(task, &after);
+    result->sent = arrivals;
+    result->wakeups = after.switches - before->switches;
+    result->transactions = radio.transactions;
+    result->bus_us = radio.bus_us;
+
+    printf("%-9s %3lu/%3lu frames, latency mean %6lld us max %6lld us, "
+           "%5.2f wakeups/s, %6.1f SPI transactions/s, %5.0f us/s on the bus\n",
+           result->name, (unsigned long)result->received, (unsigned long)result->sent,
+           result->received ? (long long)(result->latency_sum_us / result->received) : 0LL,
+           (long long)result->latency_max_us,
+           result->wakeups * 1000.0 / RUN_MS, result->transactions * 1000.0 / RUN_MS,
+           result->bus_us * 1000.0 / RUN_MS);
+}
+
+// The driver as it is: DIO0 wakes the radio task, which drains the FIFO
+static void run_interrupts(dio_result_t *result)
+{
+    TaskHandle_t task = xTaskGetHandle("lora_radio");
+    host_task_stats_t before;
+    CHECK(task != NULL);
+    start_run(task, &before);
+
+    lora_frame_t frame;
+    while (host_time_us < run_end_us + 1000000) {
+        if (lora_receive_frame(&frame, 1000) == ESP_OK) {
+            CHECK_EQ(frame.length, FRAME_LENGTH);
+            record(result, frame.data);
+        }
+    }
+    end_run(result, task, &before);
+}
+
+static spi_device_handle_t poll_spi;
+
+static uint8_t poll_read(uint8_t reg)
+{
+    spi_transaction_t trans = {
+        .flags = SPI_TRANS_USE_RXDATA, .addr = reg, .length = 8, .rxlength = 8,
+    };
+    spi_device_polling_transmit(poll_spi, &trans);
+    return trans.rx_data[0];
+}
+
+static void poll_write(uint8_t reg, uint8_t value)
+{
+    spi_transaction_t trans = {
+        .flags = SPI_TRANS_USE_TXDATA, .addr = reg | 0x80, .length = 8, .tx_data = {value},
+    };
+    spi_device_polling_transmit(poll_spi, &trans);
+}
+
+// The receive path before DIO0 interrupts (77acac3): mesh_task waited up to
+// 100 ms on its TX queue, then polled the IRQ flags every 10 ms for up to
+// 100 ms, putting the radio back in standby between windows
+static void polling_task(void *parameters)
+{
+    dio_result_t *result = parameters;
+    uint8_t data[256];
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+
+        poll_write(REG_OP_MODE, MODE_RX_CONTINUOUS);
+        uint8_t irq_flags;
+        TickType_t start = xTaskGetTickCount();
+        do {
+            irq_flags = poll_read(REG_IRQ_FLAGS);
+            vTaskDelay(pdMS_TO_TICKS(10));
+        } while (!(irq_flags & IRQ_RX_DONE_MASK) && xTaskGetTickCount() - start < pdMS_TO_TICKS(100));
+
+        if (irq_flags & IRQ_RX_DONE_MASK) {
+            uint8_t length = poll_read(REG_RX_NB_BYTES);
+            poll_write(REG_FIFO_ADDR_PTR, poll_read(REG_FIFO_RX_CURRENT_ADDR));
+            spi_transaction_t trans = {
+                .addr = REG_FIFO, .length = length * 8, .rxlength = length * 8, .rx_buffer = data,
+            };
+            spi_device_transmit(poll_spi, &trans);
+            poll_write(REG_IRQ_FLAGS, IRQ_RX_DONE_MASK);
+            record(result, data);
+        }
+        poll_write(REG_OP_MODE, MODE_STDBY);
+    }
+}
+
+static void run_polling(dio_result_t *result)
+{
+    const spi_device_interface_config_t devcfg = {
+        .clock_speed_hz = LORA_SPI_CLOCK_HZ, .queue_size = LORA_SPI_QUEUE_SIZE, .address_bits = 8,
+    };
+    CHECK_EQ(spi_bus_add_device(SPI2_HOST, &devcfg, &poll_spi), ESP_OK);
+
+    // The driver's radio task sits this one out
+    gpio_intr_disable(LORA_DIO0_PIN);
+
+    TaskHandle_t task;
+    CHECK_EQ(xTaskCreate(polling_task, "mesh_poll", 4096, result, 5, &task), pdPASS);
+    host_task_stats_t before;
+    start_run(task, &before);
+    vTaskDelay(pdMS_TO_TICKS(RUN_MS + 1000));
+    end_run(result, task, &before);
+}
+
+int main(void)
+{
+    host_tasks_start();
+    radio_emu_init();
+    CHECK_EQ(lora_init(), ESP_OK);
+
+    dio_result_t interrupts = { .name = "DIO0 IRQ" };
+    dio_result_t polling = { .name = "polling" };
+    run_interrupts(&interrupts);
+    run_polling(&polling);
+
+    // Every frame arrives, each within a couple of SPI transfers of RxDone...
+    CHECK(interrupts.sent > RUN_MS / MEAN_GAP_MS / 2);
+    CHECK_EQ(interrupts.received, interrupts.sent);
+    CHECK(interrupts.latency_max_us < 1000);
+
+    // ...where polling missed the frames that came during standby and took
+    // tens of milliseconds on the rest
+    CHECK(polling.received < polling.sent * 3 / 4);
+    CHECK(polling.latency_sum_us / polling.received > 5000);
+
+    // One wakeup per frame instead of one per poll, and no SPI traffic while idle
+    CHECK(interrupts.wakeups <= interrupts.received + 1);
+    CHECK(interrupts.wakeups * 10 < polling.wakeups);
+    CHECK(interrupts.transactions * 10 < polling.transactions);
+    CHECK(interrupts.bus_us * 10 < polling.bus_us);
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Duty-cycle token buckets on a fake clock: refill, band limits, the low
+// priority reserve, and frequencies outside every regulated band
+#include "host_test.h"
+#include "duty_cycle.h"
+#include "device_config.h"
+
+#define G1_HZ           868100000       // 1%
+#define G2_HZ           868900000       // 0.1%
+#define G3_HZ           869500000       // 10%
+#define US_915_HZ       915000000
+#define HOUR_MS         3600000u
+
+// Full budget per band: window times the allowed fraction
+#define G1_BUDGET_US    (DUTY_CYCLE_WINDOW_MS / 1000 * 10 * 1000)
+#define G2_BUDGET_US    (DUTY_CYCLE_WINDOW_MS / 1000 * 1 * 1000)
+#define G3_BUDGET_US    (DUTY_CYCLE_WINDOW_MS / 1000 * 100 * 1000)
+#define RESERVE_US(b)   ((uint64_t)(b) * DUTY_CYCLE_LOW_PRIO_RESERVE_PCT / 100)
+
+static uint32_t rng_state = 0xC0FFEE;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void test_band_limits(uint32_t now)
+{
+    duty_cycle_init(now);
+    CHECK_EQ(duty_cycle_remaining_us(G1_HZ, now), G1_BUDGET_US);
+    CHECK_EQ(duty_cycle_remaining_us(G2_HZ, now), G2_BUDGET_US);
+    CHECK_EQ(duty_cycle_remaining_us(G3_HZ, now), G3_BUDGET_US);
+
+    // Band edges: the low edge is inside, the high edge and the gaps between bands are not
+    CHECK_EQ(duty_cycle_remaining_us(863000000, now), G1_BUDGET_US);
+    CHECK_EQ(duty_cycle_remaining_us(868000000, now), G1_BUDGET_US);
+    CHECK_EQ(duty_cycle_remaining_us(868650000, now), UINT32_MAX);
+    CHECK_EQ(duty_cycle_remaining_us(869300000, now), UINT32_MAX);
+    CHECK_EQ(duty_cycle_remaining_us(870000000, now), UINT32_MAX);
+
+    // Spend the whole 0.1% band: the next frame waits exactly for its airtime to accrue
+    duty_cycle_consume(G2_HZ, G2_BUDGET_US, now);
+    CHECK_EQ(duty_cycle_remaining_us(G2_HZ, now), 0);
+    CHECK_EQ(duty_cycle_wait_ms(G2_HZ, 50000, DUTY_PRIORITY_HIGH, now), 50000);
+    CHECK_EQ(duty_cycle_wait_ms(G2_HZ, 50001, DUTY_PRIORITY_HIGH, now), 50001);   // Rounded up
+
+    // Other bands keep their own budget
+    CHECK_EQ(duty_cycle_remaining_us(G1_HZ, now), G1_BUDGET_US);
+    CHECK_EQ(duty_cycle_wait_ms(G3_HZ, 1000000, DUTY_PRIORITY_HIGH, now), 0);
+
+    // Overspending (a frame longer than the tokens left) floors at zero
+    duty_cycle_consume(G2_HZ, 1000, now);
+    CHECK_EQ(duty_cycle_remaining_us(G2_HZ, now), 0);
+}
+
+static void test_refill(uint32_t now)
+{
+    duty_cycle_init(now);
+    duty_cycle_consume(G1_HZ, G1_BUDGET_US, now);
+
+    // 10 us of airtime per ms at 1%
+    now += 1000;
+    CHECK_EQ(duty_cycle_remaining_us(G1_HZ, now), 10000);
+    now += 12345;
+    CHECK_EQ(duty_cycle_remaining_us(G1_HZ, now), 133450);
+
+    // Waiting the time returned is always enough, and never more than needed
+    uint32_t wait = duty_cycle_wait_ms(G1_HZ, 400000, DUTY_PRIORITY_HIGH, now);
+    CHECK(wait > 0);
+    CHECK(duty_cycle_wait_ms(G1_HZ, 400000, DUTY_PRIORITY_HIGH, now + wait - 1) > 0);
+    CHECK(duty_cycle_wait_ms(G1_HZ, 400000, DUTY_PRIORITY_HIGH, now + wait) == 0);
+
+    // The bucket fills up to one window's worth and no further
+    now += 2 * HOUR_MS;
+    CHECK_EQ(duty_cycle_remaining_us(G1_HZ, now), G1_BUDGET_US);
+}
+
+static void test_low_priority_reserve(uint32_t now)
+{
+    duty_cycle_init(now);
+
+    // Forwards and beacons stop while the reserve is all that is left...
+    uint32_t frame_us = 100000;
+    uint64_t spend = G3_BUDGET_US - RESERVE_US(G3_BUDGET_US) - frame_us;
+    duty_cycle_consume(G3_HZ, spend, now);
+    CHECK_EQ(duty_cycle_wait_ms(G3_HZ, frame_us, DUTY_PRIORITY_LOW, now), 0);
+    duty_cycle_consume(G3_HZ, 1, now);
+    CHECK_EQ(duty_cycle_wait_ms(G3_HZ, frame_us, DUTY_PRIORITY_LOW, now), 1);     // 100 us/ms at 10%
+
+    // ...which our own messages may still use
+    CHECK_EQ(duty_cycle_wait_ms(G3_HZ, frame_us, DUTY_PRIORITY_HIGH, now), 0);
+    duty_cycle_consume(G3_HZ, RESERVE_US(G3_BUDGET_US) - frame_us, now);
+    CHECK_EQ(duty_cycle_wait_ms(G3_HZ, frame_us, DUTY_PRIORITY_HIGH, now), 0);
+    CHECK_EQ(duty_cycle_wait_ms(G3_HZ, frame_us, DUTY_PRIORITY_LOW, now),
+             (RESERVE_US(G3_BUDGET_US) - frame_us + 1 + 99) / 100);
+}
+
+// 915 MHz is outside every EU band: nothing is ever held back or counted
+static void test_unrestricted(uint32_t now)
+{
+    duty_cycle_init(now);
+    for (int i = 0; i < 1000; i++) {
+        CHECK_EQ(duty_cycle_wait_ms(US_915_HZ, 5000000, DUTY_PRIORITY_LOW, now), 0);
+        duty_cycle_consume(US_915_HZ, 5000000, now);
+        now += 1;
+    }
+    CHECK_EQ(duty_cycle_remaining_us(US_915_HZ, now), UINT32_MAX);
+    CHECK_EQ(duty_cycle_remaining_us(G1_HZ, now), G1_BUDGET_US);
+}
+
+// A sender that transmits whenever allowed, for ten hours: after the
+// initial full bucket, it gets 1% of the time and no more
+static void test_greedy_sender(uint32_t now)
+{
+    const uint32_t hours = 10;
+    uint64_t sent_us = 0;
+    uint64_t first_hour_us = 0;
+    uint32_t start = now;
+
+    duty_cycle_init(now);
+    while (now - start < hours * HOUR_MS) {
+        uint32_t frame_us = 40000 + rng() % 1500000;
+        uint32_t wait = duty_cycle_wait_ms(G1_HZ, frame_us, DUTY_PRIORITY_HIGH, now);
+        if (wait > 0) {
+            now += wait;
+            continue;
+        }
+        duty_cycle_consume(G1_HZ, frame_us, now);
+        sent_us += frame_us;
+        if (now - start < HOUR_MS) {
+            first_hour_us += frame_us;
+        }
+        now += frame_us / 1000 + 1;
+    }
+
+    CHECK(first_hour_us <= 2 * G1_BUDGET_US);
+    CHECK(sent_us <= (uint64_t)G1_BUDGET_US * (hours + 1));
+    CHECK(sent_us >= (uint64_t)G1_BUDGET_US * hours * 95 / 100);
+}
+
+int main(void)
+{
+    test_band_limits(1000);
+    test_refill(5000);
+    test_low_priority_reserve(0);
+    test_unrestricted(77);
+
+    // The millisecond clock wraps after 49 days; the buckets must not notice
+    test_refill(UINT32_MAX - 5000);
+    test_greedy_sender(UINT32_MAX - HOUR_MS);
+    return 0;
+}
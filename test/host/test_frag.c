@@ -0,0 +1,320 @@
+// Fragmentation over a lossy link: delivery, goodput and the reassembly memory bound
+#include "host_test.h"
+#include "host_shim.h"
+#include "frag.h"
+#include "tx_sched.h"
+#include "wire.h"
+#include <malloc.h>
+#include <string.h>
+
+// Sender S transfers to receiver R; both ends live in the one frag module
+static const uint8_t node_s[8] = {0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53, 0x53};
+static const uint8_t node_r[8] = {0x52, 0x52, 0x52, 0x52, 0x52, 0x52, 0x52, 0x52};
+static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+#define FRAME_MS            400     // One frame on air, either direction
+#define CHANNEL_SLOTS       8       // Scheduler room for local traffic
+
+// Layout of a fragment payload as frag.c sends it
+typedef struct {
+    uint32_t transfer_id;
+    uint16_t total_length;
+    uint8_t index;
+    uint8_t count;
+    uint8_t type;
+} __attribute__((packed)) test_frag_header_t;
+
+#define TEST_DATA_SIZE      (WIRE_MAX_PAYLOAD - sizeof(test_frag_header_t))
+
+// ---- Heap accounting (malloc and free are wrapped at link time) ----
+
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+static size_t heap_live;
+static size_t heap_peak;
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+    if (ptr != NULL) {
+        heap_live += malloc_usable_size(ptr);
+        if (heap_live > heap_peak) {
+            heap_peak = heap_live;
+        }
+    }
+    return ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr != NULL) {
+        heap_live -= malloc_usable_size(ptr);
+    }
+    __real_free(ptr);
+}
+
+// ---- The parts of mesh and tx_sched that frag uses ----
+
+static msg_handle_t channel[CHANNEL_SLOTS];
+static size_t channel_head;
+static size_t channel_count;
+static uint32_t next_message_id = 1;
+
+uint32_t mesh_generate_message_id(void)
+{
+    return next_message_id++;
+}
+
+// Fragments come from S, bitmaps from R
+void mesh_prepare_message(mesh_message_t *message, uint8_t type, const uint8_t *recipient_id, uint8_t hop_count)
+{
+    memset(message, 0, sizeof(*message));
+    message->id = mesh_generate_message_id();
+    memcpy(message->sender_id, type == MSG_TYPE_FRAGMENT_NACK ? node_r : node_s, 8);
+    memcpy(message->recipient_id, recipient_id, 8);
+    message->message_type = type;
+    message->hop_count = hop_count;
+}
+
+uint16_t mesh_calculate_checksum(const mesh_message_t *message)
+{
+    (void)message;
+    return 0;
+}
+
+esp_err_t mesh_queue_handle(msg_handle_t handle)
+{
+    if (channel_count == CHANNEL_SLOTS) {
+        msg_pool_release(handle);
+        return ESP_ERR_NO_MEM;
+    }
+    channel[(channel_head + channel_count++) % CHANNEL_SLOTS] = handle;
+    return ESP_OK;
+}
+
+esp_err_t mesh_queue_message(const mesh_message_t *message)
+{
+    msg_handle_t handle = msg_pool_store(message);
+    if (handle == MSG_HANDLE_NONE) {
+        return ESP_ERR_NO_MEM;
+    }
+    return mesh_queue_handle(handle);
+}
+
+size_t tx_sched_free(tx_class_t tx_class)
+{
+    (void)tx_class;
+    return CHANNEL_SLOTS - channel_count;
+}
+
+// ---- Link model ----
+
+static uint32_t loss_state = 1;
+
+static bool link_loses(uint32_t loss_percent)
+{
+    loss_state ^= loss_state << 13;
+    loss_state ^= loss_state >> 17;
+    loss_state ^= loss_state << 5;
+    return loss_state % 100 < loss_percent;
+}
+
+static uint8_t delivered[FRAG_MAX_PAYLOAD];
+static size_t delivered_length;
+static uint32_t deliveries;
+
+static void on_payload(const uint8_t *sender_id, const uint8_t *recipient_id, uint32_t transfer_id,
+                       uint8_t type, const uint8_t *data, size_t length)
+{
+    (void)transfer_id;
+    CHECK(memcmp(sender_id, node_s, 8) == 0);
+    CHECK(memcmp(recipient_id, node_r, 8) == 0 || memcmp(recipient_id, broadcast_id, 8) == 0);
+    CHECK_EQ(type, MSG_TYPE_TEXT);
+    memcpy(delivered, data, length);
+    delivered_length = length;
+    deliveries++;
+}
+
+typedef struct {
+    uint32_t frames;                // Sent in either direction
+    size_t air_bytes;               // Payload bytes of those frames
+    uint32_t elapsed_ms;
+} transfer_result_t;
+
+static void reset(void)
+{
+    msg_pool_init();
+    frag_init();
+    frag_set_callback(on_payload);
+    channel_head = 0;
+    channel_count = 0;
+    deliveries = 0;
+    delivered_length = 0;
+    heap_live = 0;
+    heap_peak = 0;
+}
+
+// Runs one transfer until the receiver has it and the sender has let go
+static transfer_result_t run_transfer(const uint8_t *recipient_id, const uint8_t *data, size_t length,
+                                      uint32_t loss_percent)
+{
+    transfer_result_t result = {0};
+    uint32_t start_ms = (uint32_t)(host_time_us / 1000);
+
+    CHECK_EQ(frag_send(recipient_id, MSG_TYPE_TEXT, data, length), ESP_OK);
+    while (deliveries == 0 || heap_live != 0) {
+        uint32_t now_ms = (uint32_t)(host_time_us / 1000);
+        CHECK(now_ms - start_ms < 30 * 60 * 1000);
+        uint32_t wait_ms = frag_process(now_ms);
+
+        if (channel_count == 0) {
+            CHECK(wait_ms != UINT32_MAX);   // Nothing pending would mean the transfer failed
+            host_advance_ms(wait_ms > 0 ? wait_ms : 1);
+            continue;
+        }
+
+        msg_handle_t handle = channel[channel_head];
+        channel_head = (channel_head + 1) % CHANNEL_SLOTS;
+        channel_count--;
+        mesh_message_t message = *msg_pool_get(handle);
+        msg_pool_release(handle);
+
+        host_advance_ms(FRAME_MS);
+        result.frames++;
+        result.air_bytes += message.payload_length;
+        if (!link_loses(loss_percent)) {
+            frag_handle_message(&message);
+        }
+    }
+    result.elapsed_ms = (uint32_t)(host_time_us / 1000) - start_ms;
+
+    CHECK_EQ(deliveries, 1);
+    CHECK_EQ(delivered_length, length);
+    CHECK(memcmp(delivered, data, length) == 0);
+    return result;
+}
+
+static void fill(uint8_t *data, size_t length, uint32_t seed)
+{
+    for (size_t i = 0; i < length; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+static void test_lossy_unicast(void)
+{
+    static uint8_t data[FRAG_MAX_PAYLOAD];
+    static const size_t sizes[] = {300, 1024, 4096, FRAG_MAX_PAYLOAD};
+    static const uint32_t losses[] = {0, 10, 30, 50};
+
+    for (size_t l = 0; l < sizeof(losses) / sizeof(losses[0]); l++) {
+        size_t payload_total = 0;
+        size_t air_total = 0;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            reset();
+            loss_state = 0x9E3779B9 + l * 7919 + s;
+            fill(data, sizes[s], (uint32_t)(l * 31 + s));
+            transfer_result_t result = run_transfer(node_r, data, sizes[s], losses[l]);
+            payload_total += sizes[s];
+            air_total += result.air_bytes;
+
+            // One copy at each end, never more than the configured bound
+            CHECK(heap_peak <= 2 * (sizes[s] + 64));
+            CHECK(heap_peak <= (FRAG_TX_SLOTS + FRAG_RX_SLOTS) * (FRAG_MAX_PAYLOAD + 64));
+        }
+
+        // Goodput: delivered bytes over payload bytes put on air. Only
+        // headers and bitmaps are overhead without loss; with loss each
+        // lost fragment costs about one resend.
+        double goodput = (double)payload_total / air_total;
+        if (losses[l] == 0) {
+            CHECK(goodput > 0.9);
+        } else {
+            CHECK(goodput > (100.0 - losses[l]) / 100.0 * 0.85);
+        }
+    }
+}
+
+static void test_broadcast(void)
+{
+    static uint8_t data[3000];
+    reset();
+    fill(data, sizeof(data), 99);
+    transfer_result_t result = run_transfer(broadcast_id, data, sizeof(data), 0);
+
+    // Nobody answers a broadcast, so each fragment goes out exactly once
+    CHECK_EQ(result.frames, (sizeof(data) + TEST_DATA_SIZE - 1) / TEST_DATA_SIZE);
+}
+
+// Fragments built by hand, as a misbehaving or confused sender would
+static void deliver_fragment(uint32_t transfer_id, uint16_t total_length, uint8_t index, uint8_t count,
+                             const uint8_t *data, size_t chunk)
+{
+    mesh_message_t message;
+    mesh_prepare_message(&message, MSG_TYPE_FRAGMENT, node_r, MAX_HOP_COUNT);
+    test_frag_header_t header = {
+        .transfer_id = transfer_id,
+        .total_length = total_length,
+        .index = index,
+        .count = count,
+        .type = MSG_TYPE_TEXT,
+    };
+    memcpy(message.payload, &header, sizeof(header));
+    memcpy(message.payload + sizeof(header), data, chunk);
+    message.payload_length = sizeof(header) + chunk;
+    frag_handle_message(&message);
+}
+
+static void test_rejects_inconsistent_fragments(void)
+{
+    static uint8_t data[4 * TEST_DATA_SIZE];
+    static uint8_t other[4 * TEST_DATA_SIZE];
+    const uint16_t length = 3 * TEST_DATA_SIZE + 10;
+    const uint8_t count = 4;
+    fill(data, sizeof(data), 7);
+    memset(other, 0xAA, sizeof(other));
+
+    // A fragment whose header disagrees with the slot it matches must not
+    // be written into that slot's buffer
+    reset();
+    deliver_fragment(0x1234, length, 0, count, data, TEST_DATA_SIZE);
+    deliver_fragment(0x1234, 4 * TEST_DATA_SIZE, 1, count, other, TEST_DATA_SIZE);
+    deliver_fragment(0x1234, length, 2, count, data + 2 * TEST_DATA_SIZE, TEST_DATA_SIZE);
+    deliver_fragment(0x1234, length, 3, count, data + 3 * TEST_DATA_SIZE, 10);
+    CHECK_EQ(deliveries, 0);
+    deliver_fragment(0x1234, length, 1, count, data + TEST_DATA_SIZE, TEST_DATA_SIZE);
+    CHECK_EQ(deliveries, 1);
+    CHECK_EQ(delivered_length, length);
+    CHECK(memcmp(delivered, data, length) == 0);
+
+    // A short fragment that is not the last would leave a hole
+    reset();
+    deliver_fragment(0x5678, length, 0, count, data, TEST_DATA_SIZE - 1);
+    for (uint8_t index = 1; index < count; index++) {
+        size_t chunk = index + 1 < count ? TEST_DATA_SIZE : 10;
+        deliver_fragment(0x5678, length, index, count, data + index * TEST_DATA_SIZE, chunk);
+    }
+    CHECK_EQ(deliveries, 0);
+    deliver_fragment(0x5678, length, 0, count, data, TEST_DATA_SIZE);
+    CHECK_EQ(deliveries, 1);
+    CHECK(memcmp(delivered, data, length) == 0);
+
+    // Nor may the last fragment run past the total length
+    reset();
+    deliver_fragment(0x9ABC, length, 3, count, data + 3 * TEST_DATA_SIZE, 11);
+    for (uint8_t index = 0; index < 3; index++) {
+        deliver_fragment(0x9ABC, length, index, count, data + index * TEST_DATA_SIZE, TEST_DATA_SIZE);
+    }
+    CHECK_EQ(deliveries, 0);
+}
+
+int main(void)
+{
+    host_seed_random(16);
+
+    test_lossy_unicast();
+    test_broadcast();
+    test_rejects_inconsistent_fragments();
+    return 0;
+}
@@ -0,0 +1,230 @@
+// Listen before talk among nodes all in range of each other, on an
+// event-driven channel model. Every node backs off with lora_lbt_backoff_ms(),
+// its state kept per frame as tx_sched does, or shared by all frames of the
+// node as the driver's file-scope state used to be; plain ALOHA is the baseline.
+#include "host_test.h"
+#include "host_shim.h"
+#include "lora.h"
+#include "airtime.h"
+#include <string.h>
+
+#define NODES           12
+#define RUN_US          (3600 * 1000000LL)
+#define MEAN_GAP_MS     4000            // Between frames of one node, both classes
+#define CONTROL_PCT     40              // Short control frames, sent ahead of the rest
+#define CONTROL_LENGTH  24
+#define DATA_LENGTH     160
+#define MAX_FRAMES      (2 * RUN_US / (MEAN_GAP_MS * 1000LL) + 16)
+#define MAX_TX          (NODES * MAX_FRAMES)
+#define CLASSES         2
+
+typedef enum {
+    LBT_PER_FRAME,
+    LBT_PER_NODE,
+    LBT_NONE,
+} lbt_mode_t;
+
+typedef struct {
+    int64_t arrival_us;
+    lora_lbt_t lbt;
+    uint8_t busy_cads;              // Of this frame alone
+} frame_t;
+
+typedef struct {
+    frame_t frames[MAX_FRAMES];
+    uint32_t count;
+    uint32_t head;
+    int64_t deferred_until_us;
+} class_queue_t;
+
+typedef struct {
+    class_queue_t classes[CLASSES];
+    lora_lbt_t lbt;                 // LBT_PER_NODE only
+    int64_t free_at_us;             // End of its own CAD or transmission
+} node_t;
+
+typedef struct {
+    int64_t start_us;
+    int64_t end_us;
+    bool collided;
+} tx_t;
+
+typedef struct {
+    const char *name;
+    uint32_t offered;
+    uint32_t delivered;
+    uint32_t collided;
+    uint32_t dropped;               // Channel busy on every attempt
+    uint32_t dropped_early;         // ...before the frame had LORA_LBT_MAX_ATTEMPTS of its own
+    int64_t delay_sum_us;
+    int64_t delay_max_us;
+} lbt_result_t;
+
+static node_t nodes[NODES];
+static tx_t txs[MAX_TX];
+static uint32_t tx_count;
+static const lora_modem_params_t params = {
+    .spreading_factor = 7, .bandwidth_hz = 125000, .coding_rate = 5, .preamble_length = 8,
+};
+static const uint8_t lengths[CLASSES] = {CONTROL_LENGTH, DATA_LENGTH};
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Same arrivals for every mode
+static void generate(void)
+{
+    memset(nodes, 0, sizeof(nodes));
+    rng_state = 0x5EED1;
+    for (int n = 0; n < NODES; n++) {
+        int64_t t_us = rng() % (MEAN_GAP_MS * 1000);
+        while (t_us < RUN_US) {
+            class_queue_t *queue = &nodes[n].classes[rng() % 100 < CONTROL_PCT ? 0 : 1];
+            queue->frames[queue->count++].arrival_us = t_us;
+            t_us += (1 + rng() % (2 * MEAN_GAP_MS - 1)) * 1000LL;
+        }
+    }
+}
+
+// CAD sees a frame whose preamble was already on air when it started; one
+// that starts during the CAD goes unnoticed
+static bool channel_busy(int64_t t_us)
+{
+    for (uint32_t i = tx_count; i-- > 0 && txs[i].end_us > t_us - 2000000;) {
+        if (txs[i].start_us <= t_us && txs[i].end_us > t_us) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// When a node can next try, and which class; -1 if it has nothing left
+static int64_t node_next(const node_t *node, int *best)
+{
+    int64_t next_us = INT64_MAX;
+    *best = -1;
+    for (int c = 0; c < CLASSES; c++) {
+        const class_queue_t *queue = &node->classes[c];
+        if (queue->head == queue->count) {
+            continue;
+        }
+        int64_t t_us = queue->frames[queue->head].arrival_us;
+        t_us = t_us > queue->deferred_until_us ? t_us : queue->deferred_until_us;
+        t_us = t_us > node->free_at_us ? t_us : node->free_at_us;
+        if (t_us < next_us) {
+            next_us = t_us;
+            *best = c;
+        }
+    }
+    return next_us;
+}
+
+static void run(lbt_result_t *result, lbt_mode_t mode)
+{
+    const int64_t cad_us = 2 * airtime_symbol_us(&params);
+    generate();
+    host_seed_random(0xCAD);
+    tx_count = 0;
+
+    for (;;) {
+        int64_t t_us = INT64_MAX;
+        int n_best = -1;
+        int c_best = -1;
+        for (int n = 0; n < NODES; n++) {
+            int c;
+            int64_t next_us = node_next(&nodes[n], &c);
+            if (next_us < t_us) {
+                t_us = next_us;
+                n_best = n;
+                c_best = c;
+            }
+        }
+        if (n_best < 0 || t_us >= RUN_US) {
+            break;
+        }
+
+        node_t *node = &nodes[n_best];
+        class_queue_t *queue = &node->classes[c_best];
+        frame_t *frame = &queue->frames[queue->head];
+        lora_lbt_t *lbt = mode == LBT_PER_NODE ? &node->lbt : &frame->lbt;
+
+        if (mode != LBT_NONE && channel_busy(t_us)) {
+            frame->busy_cads++;
+            node->free_at_us = t_us + cad_us;
+            uint32_t backoff_ms = lora_lbt_backoff_ms(lbt, &params);
+            if (backoff_ms == 0) {
+                result->dropped++;
+                result->dropped_early += frame->busy_cads < LORA_LBT_MAX_ATTEMPTS;
+                queue->head++;
+            } else {
+                queue->deferred_until_us = t_us + cad_us + backoff_ms * 1000LL;
+            }
+            continue;
+        }
+
+        // Clear: on air right after the CAD
+        *lbt = (lora_lbt_t) {0};
+        tx_t *tx = &txs[tx_count++];
+        tx->start_us = t_us + (mode != LBT_NONE ? cad_us : 0);
+        tx->end_us = tx->start_us + airtime_us(&params, lengths[c_best]);
+        tx->collided = false;
+        node->free_at_us = tx->end_us;
+        queue->head++;
+
+        int64_t delay_us = tx->start_us - frame->arrival_us;
+        result->delay_sum_us += delay_us;
+        if (delay_us > result->delay_max_us) {
+            result->delay_max_us = delay_us;
+        }
+    }
+
+    // Overlapping transmissions are lost; starts are in order
+    for (uint32_t i = 0; i < tx_count; i++) {
+        for (uint32_t j = i + 1; j < tx_count && txs[j].start_us < txs[i].end_us; j++) {
+            txs[i].collided = txs[j].collided = true;
+        }
+    }
+    for (uint32_t i = 0; i < tx_count; i++) {
+        result->collided += txs[i].collided;
+    }
+    result->delivered = tx_count - result->collided;
+    for (int n = 0; n < NODES; n++) {
+        for (int c = 0; c < CLASSES; c++) {
+            result->offered += nodes[n].classes[c].count;
+        }
+    }
+
+    printf("%-9s %5lu offered, %5.1f%% delivered, %4lu collided, %3lu dropped busy (%3lu early), "
+           "access delay mean %5.1f ms max %6.1f ms\n",
+           result->name, (unsigned long)result->offered, result->delivered * 100.0 / result->offered,
+           (unsigned long)result->collided, (unsigned long)result->dropped, (unsigned long)result->dropped_early,
+           tx_count ? result->delay_sum_us / 1000.0 / tx_count : 0.0, result->delay_max_us / 1000.0);
+}
+
+int main(void)
+{
+    static lbt_result_t per_frame = { .name = "per frame" };
+    static lbt_result_t per_node = { .name = "per node" };
+    static lbt_result_t aloha = { .name = "no LBT" };
+    run(&per_frame, LBT_PER_FRAME);
+    run(&per_node, LBT_PER_NODE);
+    run(&aloha, LBT_NONE);
+
+    // Listening first avoids most of the collisions ALOHA suffers
+    CHECK(per_frame.collided * 2 < aloha.collided);
+
+    // A frame gives up only after its own attempts, never because another
+    // frame of the node used them up first
+    CHECK_EQ(per_frame.dropped_early, 0);
+    CHECK(per_node.dropped_early > 0);
+
+    // Resetting per frame costs nothing in delivery
+    CHECK(per_frame.delivered * 100 >= per_node.delivered * 99);
+    return 0;
+}
@@ -0,0 +1,150 @@
+// SX127x driver on the radio emulator: burst FIFO access and batched register writes
+#include "host_test.h"
+#include "host_shim.h"
+#include "radio_emu.h"
+#include "lora.h"
+#include <string.h>
+
+// What one FIFO byte would cost as its own register transaction
+#define PER_BYTE_US     (16 * 1000000 / LORA_SPI_CLOCK_HZ + RADIO_EMU_TRANS_OVERHEAD_US + RADIO_EMU_ACQUIRE_US)
+
+static void fill(uint8_t *data, size_t length, uint8_t seed)
+{
+    for (size_t i = 0; i < length; i++) {
+        data[i] = (uint8_t)(seed + i * 31);
+    }
+}
+
+// A full frame goes into the FIFO as one burst, not one transaction per byte
+static void test_fifo_write(void)
+{
+    uint8_t data[LORA_MAX_PAYLOAD];
+    uint8_t sent[256];
+    uint32_t backoff_ms;
+    radio_emu_stats_t stats;
+    fill(data, sizeof(data), 7);
+
+    radio_emu_reset_stats();
+    CHECK_EQ(lora_send_frame(data, sizeof(data), NULL, NULL, &backoff_ms), ESP_OK);
+    CHECK_EQ(radio_emu_last_tx(sent), sizeof(data));
+    CHECK(memcmp(sent, data, sizeof(data)) == 0);
+
+    radio_emu_get_stats(&stats);
+    CHECK_EQ(stats.tx_frames, 1);
+    CHECK_EQ(stats.cad_runs, 1);
+    CHECK_EQ(stats.fifo_transactions, 1);
+    CHECK(stats.transactions < 30);     // CAD, TX setup, burst, TX start, back to RX
+    CHECK(stats.bus_us < sizeof(data) * PER_BYTE_US / 5);
+
+    CHECK_EQ(lora_send_frame(data, 0, NULL, NULL, &backoff_ms), ESP_ERR_INVALID_SIZE);
+}
+
+// The radio task drains a received frame with one burst read
+static void test_fifo_read(void)
+{
+    uint8_t data[LORA_MAX_PAYLOAD];
+    lora_frame_t frame;
+    radio_emu_stats_t stats;
+    fill(data, sizeof(data), 99);
+
+    radio_emu_reset_stats();
+    radio_emu_receive_at(host_time_us + 5000, data, sizeof(data), -97, -6.25f, NULL);
+    CHECK_EQ(lora_receive_frame(&frame, 100), ESP_OK);
+    CHECK_EQ(frame.length, sizeof(data));
+    CHECK(memcmp(frame.data, data, sizeof(data)) == 0);
+    CHECK_EQ(frame.rssi, -97);
+    CHECK(frame.snr == -6.25f);
+
+    radio_emu_get_stats(&stats);
+    CHECK_EQ(stats.rx_frames, 1);
+    CHECK_EQ(stats.fifo_transactions, 1);
+    CHECK(stats.transactions < 10);     // IRQ flags, four packet registers, pointer, burst
+    CHECK(stats.bus_us < sizeof(data) * PER_BYTE_US / 5);
+
+    // Nothing else arrives
+    CHECK_EQ(lora_receive_frame(&frame, 100), ESP_ERR_TIMEOUT);
+}
+
+// A profile change programs its registers in batches, one bus acquisition each
+static void test_register_batches(void)
+{
+    const lora_modem_params_t slow = {
+        .spreading_factor = 10, .bandwidth_hz = 125000, .coding_rate = 5, .preamble_length = 8,
+    };
+    radio_emu_stats_t stats;
+
+    radio_emu_reset_stats();
+    CHECK_EQ(lora_set_rx_params(&slow), ESP_OK);
+    radio_emu_get_stats(&stats);
+
+    // Standby on its own, then the five modem registers and the two that start RX
+    CHECK_EQ(stats.transactions, 8);
+    CHECK_EQ(stats.acquisitions, 3);
+
+    // A frame sent on the new profile takes its airtime
+    uint8_t data[20];
+    uint32_t backoff_ms;
+    fill(data, sizeof(data), 1);
+    int64_t start_us = host_time_us;
+    CHECK_EQ(lora_send_frame(data, sizeof(data), &slow, NULL, &backoff_ms), ESP_OK);
+    CHECK(host_time_us - start_us >= airtime_us(&slow, sizeof(data)));
+
+    lora_mac_stats_t mac;
+    lora_get_mac_stats(&mac);
+    CHECK_EQ(mac.tx_frames, 2);
+    CHECK_EQ(mac.rx_frames, 1);
+    CHECK_EQ(mac.tx_timeouts, 0);
+}
+
+// Listen-before-talk state belongs to the frame: another frame backing off
+// in between neither widens its window nor uses up its attempts
+static void test_lbt_per_frame(void)
+{
+    const lora_modem_params_t *params = lora_get_modem_params();
+    uint32_t slot_ms = airtime_symbol_us(params) * (params->preamble_length + 12) / 1000 + 1;
+    uint8_t data[20];
+    uint32_t backoff_ms;
+    lora_lbt_t first = {0};
+    lora_lbt_t second = {0};
+    fill(data, sizeof(data), 3);
+
+    radio_emu_channel_busy_until(INT64_MAX);
+    for (int i = 1; i < LORA_LBT_MAX_ATTEMPTS; i++) {
+        CHECK_EQ(lora_send_frame(data, sizeof(data), NULL, &first, &backoff_ms), ESP_ERR_NOT_FINISHED);
+        CHECK(backoff_ms >= slot_ms);
+        CHECK(backoff_ms <= (LORA_LBT_CW_MIN << (i - 1)) * slot_ms);
+        CHECK_EQ(first.attempts, i);
+    }
+
+    // A new frame starts from the smallest window...
+    CHECK_EQ(lora_send_frame(data, sizeof(data), NULL, &second, &backoff_ms), ESP_ERR_NOT_FINISHED);
+    CHECK(backoff_ms <= LORA_LBT_CW_MIN * slot_ms);
+    CHECK_EQ(second.attempts, 1);
+
+    // ...and the first frame still gets its last attempt
+    CHECK_EQ(lora_send_frame(data, sizeof(data), NULL, &first, &backoff_ms), ESP_ERR_TIMEOUT);
+
+    // Once the channel clears the frame goes out and its state starts over
+    radio_emu_channel_busy_until(0);
+    CHECK_EQ(lora_send_frame(data, sizeof(data), NULL, &second, &backoff_ms), ESP_OK);
+    CHECK_EQ(second.attempts, 0);
+    CHECK_EQ(second.window, 0);
+
+    lora_mac_stats_t mac;
+    lora_get_mac_stats(&mac);
+    CHECK_EQ(mac.cad_busy, LORA_LBT_MAX_ATTEMPTS + 1);
+    CHECK_EQ(mac.tx_dropped_busy, 1);
+}
+
+int main(void)
+{
+    host_tasks_start();
+    radio_emu_init();
+    CHECK_EQ(lora_init(), ESP_OK);
+
+    test_fifo_write();
+    test_fifo_read();
+    test_register_batches();
+    test_lbt_per_frame();
+    return 0;
+}
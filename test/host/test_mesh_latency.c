@@ -0,0 +1,256 @@
+// Per-message latency of mesh_task, on the radio emulator with the real mesh
+// layer: from mesh_send_emergency_message to the start of the frame on air,
+// and from the end of a received frame to the message callback. The same
+// arrivals are then fed to the polling loop mesh_task used to run (wait up
+// to 100 ms for TX, poll RX for up to 100 ms, sleep 50 ms), modeled on the
+// same scheduler, for comparison.
+#include "host_test.h"
+#include "host_shim.h"
+#include "radio_emu.h"
+#include "lora.h"
+#include "mesh.h"
+#include "wire.h"
+#include "adr.h"
+#include "text_codec.h"
+#include "timer_wheel.h"
+#include "freertos/queue.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define EVENTS          400
+#define MEAN_GAP_MS     1500            // Light load: latency here is the loop's, not the queue's
+
+static const uint8_t node_n1[8] = {0xA1, 1, 2, 3, 4, 5, 6, 7};
+static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static uint32_t rng_state = 0x1A7E;
+
+typedef enum {
+    EVENT_SEND,                     // The phone queues a message
+    EVENT_RECEIVE,                  // A frame from the neighbor finishes arriving
+} event_kind_t;
+
+typedef struct {
+    int64_t at_us;                  // From the start of the run
+    event_kind_t kind;
+} event_t;
+
+static event_t events[EVENTS];
+
+// Latencies in us, in event order
+static int64_t tx_latency[EVENTS];
+static uint32_t tx_count;
+static int64_t rx_latency[EVENTS];
+static uint32_t rx_count;
+static int64_t sent_us[EVENTS];
+static uint32_t sent_count;
+static int64_t arrived_us[EVENTS];
+static uint32_t arrived_count;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static int compare_us(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int64_t percentile(int64_t *sorted, uint32_t count, int pct)
+{
+    return sorted[(count - 1) * pct / 100];
+}
+
+static void report(const char *loop, const char *what, int64_t *latency, uint32_t count,
+                   int64_t *p50, int64_t *p99, int64_t *max)
+{
+    qsort(latency, count, sizeof(latency[0]), compare_us);
+    *p50 = percentile(latency, count, 50);
+    *p99 = percentile(latency, count, 99);
+    *max = latency[count - 1];
+    printf("%-8s %-18s %3lu: p50 %7.1f ms, p90 %7.1f ms, p99 %7.1f ms, max %7.1f ms\n",
+           loop, what, (unsigned long)count, *p50 / 1000.0, percentile(latency, count, 90) / 1000.0,
+           *p99 / 1000.0, *max / 1000.0);
+}
+
+// Sends and receptions, interleaved at random
+static void make_events(void)
+{
+    int64_t at_us = 0;
+    for (int i = 0; i < EVENTS; i++) {
+        at_us += 100000 + rng() % (2 * MEAN_GAP_MS * 1000 - 200000);
+        events[i].at_us = at_us;
+        events[i].kind = rng() % 2 ? EVENT_SEND : EVENT_RECEIVE;
+    }
+}
+
+static void on_air(const uint8_t *data, size_t length, const lora_modem_params_t *params, int64_t start_us)
+{
+    size_t offset = 0;
+    mesh_message_t message;
+    wire_link_t link;
+    while (wire_decode_next(data, length, &offset, &message, &link) == ESP_OK) {
+        if (message.message_type == MSG_TYPE_EMERGENCY) {
+            CHECK(tx_count < sent_count);
+            tx_latency[tx_count] = start_us - sent_us[tx_count];
+            tx_count++;
+        }
+    }
+}
+
+static void on_message(const mesh_message_t *message)
+{
+    if (message->message_type == MSG_TYPE_TEXT) {
+        CHECK(rx_count < arrived_count);
+        rx_latency[rx_count] = host_time_us - arrived_us[rx_count];
+        rx_count++;
+    }
+}
+
+static void inject(int64_t at_us)
+{
+    static uint32_t seq;
+    mesh_message_t message;
+    memset(&message, 0, sizeof(message));
+    message.id = ++seq;
+    memcpy(message.sender_id, node_n1, 8);
+    memcpy(message.recipient_id, broadcast_id, 8);
+    message.message_type = MSG_TYPE_TEXT;
+    message.hop_count = 1;          // Delivered here, not relayed
+    message.payload_length = 5;
+    memcpy(message.payload, "hello", 5);
+    message.checksum = mesh_calculate_checksum(&message);
+
+    wire_link_t link = {0};
+    memcpy(link.transmitter_id, node_n1, 8);
+    uint8_t frame[LORA_MAX_PAYLOAD];
+    size_t length;
+    CHECK_EQ(wire_encode(&message, &link, frame, sizeof(frame), &length), ESP_OK);
+    radio_emu_receive_at(at_us, frame, length, -80, 5.0f, NULL);
+}
+
+static void run_event_loop(int64_t *tx, int64_t *rx)
+{
+    host_tasks_start();
+    timer_wheel_init();
+    text_codec_init();
+    radio_emu_init();
+    CHECK_EQ(lora_init(), ESP_OK);
+    CHECK_EQ(mesh_init(), ESP_OK);
+    mesh_set_message_callback(on_message);
+    radio_emu_set_tx_hook(on_air);
+
+    // Past the first beacons, so they are not in the way
+    vTaskDelay(pdMS_TO_TICKS(5000));
+    int64_t start_us = host_time_us;
+    for (int i = 0; i < EVENTS; i++) {
+        int64_t at_us = start_us + events[i].at_us;
+        if (events[i].kind == EVENT_RECEIVE) {
+            arrived_us[arrived_count++] = at_us;
+            inject(at_us);
+            continue;
+        }
+        vTaskDelay(pdMS_TO_TICKS((at_us - host_time_us) / 1000));
+        sent_us[sent_count++] = host_time_us;
+        CHECK_EQ(mesh_send_emergency_message(broadcast_id, "need help at the east gate"), ESP_OK);
+    }
+    vTaskDelay(pdMS_TO_TICKS(5000));
+    CHECK_EQ(tx_count, sent_count);
+    CHECK_EQ(rx_count, arrived_count);
+
+    report("events", "enqueue to air", tx_latency, tx_count, &tx[0], &tx[1], &tx[2]);
+    report("events", "air to callback", rx_latency, rx_count, &rx[0], &rx[1], &rx[2]);
+}
+
+// The loop it replaced, reduced to its timing: a 10-deep queue of structs
+// to the radio, which then blocks for the airtime, and received frames
+// picked up only in the receive slot
+static QueueHandle_t old_tx_queue;
+static QueueHandle_t old_rx_queue;
+
+static void old_mesh_task(void *parameters)
+{
+    int64_t queued_us;
+    int64_t arrived_at_us;
+    uint32_t air_us = airtime_us(adr_profile_params(adr_base_profile()), 40);
+
+    while (1) {
+        if (xQueueReceive(old_tx_queue, &queued_us, pdMS_TO_TICKS(100)) == pdPASS) {
+            tx_latency[tx_count++] = host_time_us - queued_us;
+            vTaskDelay(pdMS_TO_TICKS(air_us / 1000 + 1));
+        }
+        if (xQueueReceive(old_rx_queue, &arrived_at_us, pdMS_TO_TICKS(100)) == pdPASS) {
+            rx_latency[rx_count++] = host_time_us - arrived_at_us;
+        }
+        vTaskDelay(pdMS_TO_TICKS(50));
+    }
+}
+
+// The radio's receive interrupt, handing the frame to the old loop
+static void old_arrival(void *arg)
+{
+    int64_t at_us = host_time_us;
+    xQueueSend(old_rx_queue, &at_us, 0);
+}
+
+static void run_polling_loop(int64_t *tx, int64_t *rx)
+{
+    tx_count = 0;
+    rx_count = 0;
+    old_tx_queue = xQueueCreate(10, sizeof(int64_t));
+    old_rx_queue = xQueueCreate(10, sizeof(int64_t));
+    CHECK(xTaskCreate(old_mesh_task, "old_mesh_task", 4096, NULL, 5, NULL) == pdPASS);
+
+    int64_t start_us = host_time_us;
+    uint32_t sends = 0;
+    uint32_t receives = 0;
+    for (int i = 0; i < EVENTS; i++) {
+        int64_t at_us = start_us + events[i].at_us;
+        if (events[i].kind == EVENT_RECEIVE) {
+            host_at_us(at_us, old_arrival, NULL);
+            receives++;
+            continue;
+        }
+        vTaskDelay(pdMS_TO_TICKS((at_us - host_time_us) / 1000));
+        int64_t now_us = host_time_us;
+        CHECK(xQueueSend(old_tx_queue, &now_us, 0) == pdPASS);
+        sends++;
+    }
+    vTaskDelay(pdMS_TO_TICKS(5000));
+    CHECK_EQ(tx_count, sends);
+    CHECK_EQ(rx_count, receives);
+
+    report("polling", "enqueue to air", tx_latency, tx_count, &tx[0], &tx[1], &tx[2]);
+    report("polling", "air to callback", rx_latency, rx_count, &rx[0], &rx[1], &rx[2]);
+}
+
+int main(void)
+{
+    int64_t tx_new[3];
+    int64_t rx_new[3];
+    int64_t tx_old[3];
+    int64_t rx_old[3];
+
+    make_events();
+    run_event_loop(tx_new, rx_new);
+
+    // The mesh stack is idle from here on; its task sleeps until woken
+    radio_emu_set_tx_hook(NULL);
+    mesh_set_message_callback(NULL);
+    run_polling_loop(tx_old, rx_old);
+
+    // Sent after listen-before-talk alone, handled as soon as the frame is
+    // read out: a few ms, where the polling loop took up to a quarter second
+    CHECK(tx_new[2] < 30000);
+    CHECK(rx_new[2] < 10000);
+    CHECK(tx_new[0] * 5 < tx_old[0]);
+    CHECK(rx_new[0] * 5 < rx_old[0]);
+    CHECK(tx_old[2] > 100000);
+    CHECK(rx_old[2] > 100000);
+    return 0;
+}
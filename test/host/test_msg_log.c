@@ -0,0 +1,376 @@
+// Message log on the flash emulator: append and read back, recovery, power
+// cuts, and how lookups scale with the number of stored records
+#include "host_test.h"
+#include "host_shim.h"
+#include "flash_emu.h"
+#include "msg_log.h"
+#include "text_codec.h"
+#include "esp_random.h"
+#include <string.h>
+#include <time.h>
+
+#define LOG_SIZE        (24 * FLASH_EMU_SECTOR_SIZE)
+#define PEERS           12              // The last one is the broadcast channel
+#define MESSAGES        3000            // Enough to wrap the log
+#define BENCH_RECORDS   10000           // The larger of the two logs the lookups are timed on
+#define BENCH_LOG_SIZE  (512 * FLASH_EMU_SECTOR_SIZE)   // Holds it without wrapping
+#define MAX_SEQ         (BENCH_RECORDS + 2000)
+
+// The ID msg_log derives from the host shim's MAC
+static const uint8_t self_id[8] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01, 0x00, 0x00};
+
+static const char *const words[] = {"ok", "where", "are", "you", "camp", "water", "see", "the", "trail", "now"};
+
+// Which message of the mix each sequence number was appended with
+static uint32_t id_of_seq[MAX_SEQ];
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t peer_of(uint32_t i)
+{
+    return (i * 2654435761u >> 7) % PEERS;
+}
+
+static void make_message(uint32_t i, mesh_message_t *message)
+{
+    memset(message, 0, sizeof(*message));
+    message->id = 1000 + i;
+    message->timestamp = 1760000000 + i * 7;
+    message->message_type = i % 50 == 0 ? MSG_TYPE_EMERGENCY : MSG_TYPE_TEXT;
+    message->hop_count = i % 11;
+
+    uint32_t peer = peer_of(i);
+    if (peer == PEERS - 1) {
+        memset(message->recipient_id, 0xFF, 8);
+        memset(message->sender_id, 0x40 + i % 5, 8);
+    } else if (i % 3 == 0) {
+        memcpy(message->sender_id, self_id, 8);
+        memset(message->recipient_id, 0x10 + peer, 8);
+    } else {
+        memset(message->sender_id, 0x10 + peer, 8);
+        memcpy(message->recipient_id, self_id, 8);
+    }
+
+    // Mostly words, so the text codec has something to do
+    size_t length = 0;
+    for (uint32_t w = i; length < 10 + (i * 37) % 110; w = w * 7 + 3) {
+        const char *word = words[w % 10];
+        size_t word_len = strlen(word);
+        memcpy(message->payload + length, word, word_len);
+        message->payload[length + word_len] = ' ';
+        length += word_len + 1;
+    }
+    message->payload_length = length;
+}
+
+static void check_message(uint32_t i, const mesh_message_t *message)
+{
+    mesh_message_t expected;
+    make_message(i, &expected);
+    CHECK_EQ(message->id, expected.id);
+    CHECK_EQ(message->timestamp, expected.timestamp);
+    CHECK(memcmp(message->sender_id, expected.sender_id, 8) == 0);
+    CHECK(memcmp(message->recipient_id, expected.recipient_id, 8) == 0);
+    CHECK_EQ(message->message_type, expected.message_type);
+    CHECK_EQ(message->hop_count, expected.hop_count);
+    CHECK_EQ(message->payload_length, expected.payload_length);
+    CHECK(memcmp(message->payload, expected.payload, expected.payload_length) == 0);
+    CHECK_EQ(message->checksum, 0);
+}
+
+// Every stored record reads back as the message appended under its sequence number
+static void check_stored(void)
+{
+    msg_log_stats_t stats;
+    msg_log_get_stats(&stats);
+    CHECK(stats.next_seq - stats.first_seq > 0);
+
+    mesh_message_t message;
+    for (uint32_t seq = stats.first_seq; seq != stats.next_seq; seq++) {
+        esp_err_t ret = msg_log_read(seq, &message);
+        CHECK(ret == ESP_OK || ret == ESP_ERR_NOT_FOUND);   // Not found: a pin moved forward
+        if (ret == ESP_OK) {
+            check_message(id_of_seq[seq], &message);
+        }
+    }
+    CHECK(msg_log_read(stats.first_seq - 1, &message) != ESP_OK);
+    CHECK(msg_log_read(stats.next_seq, &message) != ESP_OK);
+}
+
+// A conversation pages back newest first through exactly its stored messages
+static void check_query(uint32_t peer, uint32_t next_index)
+{
+    msg_log_stats_t stats;
+    msg_log_get_stats(&stats);
+
+    uint8_t peer_id[8];
+    memset(peer_id, peer == PEERS - 1 ? 0xFF : 0x10 + peer, 8);
+    msg_log_cursor_t cursor = MSG_LOG_CURSOR_NEWEST;
+    uint32_t expected = next_index;
+    uint32_t returned = 0;
+    mesh_message_t page[20];
+    do {
+        size_t count;
+        CHECK_EQ(msg_log_query(peer_id, &cursor, page, 20, &count), ESP_OK);
+        for (size_t k = 0; k < count; k++) {
+            do {
+                expected--;
+            } while (peer_of(expected) != peer);
+            check_message(expected, &page[k]);
+            returned++;
+        }
+    } while (cursor != MSG_LOG_CURSOR_END);
+
+    // Nothing older than what was returned is still stored
+    uint32_t stored = 0;
+    for (uint32_t seq = stats.first_seq; seq != stats.next_seq; seq++) {
+        stored += peer_of(id_of_seq[seq]) == peer;
+    }
+    CHECK(returned > 0);
+    CHECK_EQ(returned, stored);
+}
+
+static uint32_t append(uint32_t i)
+{
+    mesh_message_t message;
+    uint32_t seq;
+    make_message(i, &message);
+    CHECK_EQ(msg_log_append(&message, &seq), ESP_OK);
+    CHECK(seq < MAX_SEQ);
+    id_of_seq[seq] = i;
+    return seq;
+}
+
+static void test_append_and_recover(void)
+{
+    flash_emu_init(MSG_LOG_PARTITION_LABEL, LOG_SIZE);
+    CHECK_EQ(msg_log_init(), ESP_OK);
+
+    uint32_t first = append(0);
+    for (uint32_t i = 1; i < MESSAGES; i++) {
+        CHECK_EQ(append(i), first + i);
+    }
+
+    msg_log_stats_t stats;
+    msg_log_get_stats(&stats);
+    CHECK_EQ(stats.appended, MESSAGES);
+    CHECK_EQ(stats.next_seq, first + MESSAGES);
+    CHECK(stats.first_seq > first);                 // Wrapped
+    CHECK(stats.writes <= stats.appended * 11 / 10);
+    check_stored();
+    check_query(5, MESSAGES);
+    check_query(PEERS - 1, MESSAGES);
+
+    // A reboot finds the same records, with only a few sectors read
+    msg_log_stats_t before = stats;
+    flash_emu_stats_t flash;
+    flash_emu_reset_stats();
+    CHECK_EQ(msg_log_init(), ESP_OK);
+    flash_emu_get_stats(&flash);
+    msg_log_get_stats(&stats);
+    CHECK_EQ(stats.first_seq, before.first_seq);
+    CHECK_EQ(stats.next_seq, before.next_seq);
+    CHECK(flash.reads < 1000);
+    check_stored();
+    check_query(5, MESSAGES);
+
+    // Appends carry on from where they were
+    CHECK_EQ(append(MESSAGES), before.next_seq);
+
+    // A batch goes out in far fewer writes than one per message
+    mesh_message_t batch[16];
+    for (uint32_t k = 0; k < 16; k++) {
+        make_message(MESSAGES + 1 + k, &batch[k]);
+    }
+    uint32_t batch_seq;
+    msg_log_get_stats(&before);
+    CHECK_EQ(msg_log_append_batch(batch, 16, &batch_seq), ESP_OK);
+    msg_log_get_stats(&stats);
+    CHECK(stats.writes - before.writes <= 2);
+    for (uint32_t k = 0; k < 16; k++) {
+        id_of_seq[batch_seq + k] = MESSAGES + 1 + k;
+    }
+    check_stored();
+
+    flash_emu_free();
+}
+
+// Cut power at a random point of a run of appends, reboot, and check that
+// every append that returned is there and the torn one is not
+static void test_power_cuts(void)
+{
+    flash_emu_init(MSG_LOG_PARTITION_LABEL, 16 * FLASH_EMU_SECTOR_SIZE);
+    CHECK_EQ(msg_log_init(), ESP_OK);
+    host_seed_random(21);
+
+    uint32_t i = 0;
+    for (int trial = 0; trial < 300; trial++) {
+        msg_log_stats_t stats;
+        msg_log_get_stats(&stats);
+        uint32_t committed = stats.next_seq;
+
+        flash_emu_cut_after(esp_random() % 3000);
+        for (;;) {
+            mesh_message_t message;
+            uint32_t seq;
+            make_message(i % MESSAGES, &message);
+            if (msg_log_append(&message, &seq) != ESP_OK) {
+                break;
+            }
+            CHECK_EQ(seq, committed);
+            id_of_seq[seq % MAX_SEQ] = i % MESSAGES;
+            committed++;
+            i++;
+        }
+        CHECK(flash_emu_power_lost());
+
+        flash_emu_restore_power();
+        CHECK_EQ(msg_log_init(), ESP_OK);
+        msg_log_get_stats(&stats);
+        CHECK_EQ(stats.next_seq, committed);
+
+        mesh_message_t message;
+        CHECK(msg_log_read(committed, &message) != ESP_OK);
+        for (uint32_t seq = stats.first_seq; seq != committed; seq++) {
+            esp_err_t ret = msg_log_read(seq, &message);
+            CHECK(ret == ESP_OK || ret == ESP_ERR_NOT_FOUND);
+            if (ret == ESP_OK) {
+                check_message(id_of_seq[seq % MAX_SEQ], &message);
+            }
+        }
+    }
+
+    flash_emu_free();
+}
+
+typedef struct {
+    double reads;                   // Flash reads per lookup
+    double flash_us;                // Modelled flash time per lookup
+    double cpu_ns;                  // Host time per lookup, flash model aside
+    uint32_t max_reads;
+} lookup_cost_t;
+
+static void cost_begin(flash_emu_stats_t *flash, int64_t *clock_us, int64_t *start_ns)
+{
+    flash_emu_get_stats(flash);
+    *clock_us = host_time_us;
+    *start_ns = now_ns();
+}
+
+static void cost_end(lookup_cost_t *cost, const flash_emu_stats_t *before, int64_t clock_us, int64_t start_ns)
+{
+    int64_t ns = now_ns() - start_ns;
+    flash_emu_stats_t flash;
+    flash_emu_get_stats(&flash);
+    uint32_t reads = flash.reads - before->reads;
+    cost->reads += reads;
+    cost->flash_us += host_time_us - clock_us;
+    cost->cpu_ns += ns;
+    if (reads > cost->max_reads) {
+        cost->max_reads = reads;
+    }
+}
+
+static void cost_average(lookup_cost_t *cost, uint32_t lookups)
+{
+    cost->reads /= lookups;
+    cost->flash_us /= lookups;
+    cost->cpu_ns /= lookups;
+}
+
+// A page of a conversation's history, and one record by sequence number,
+// on a log of the given size: the newest page of every conversation, every
+// page down to the oldest of one, and reads spread over the whole log,
+// most of them past the tail index and so found by walking their sector
+static void bench_lookup(uint32_t records, lookup_cost_t *newest, lookup_cost_t *deep, lookup_cost_t *read)
+{
+    flash_emu_init(MSG_LOG_PARTITION_LABEL, BENCH_LOG_SIZE);
+    CHECK_EQ(msg_log_init(), ESP_OK);
+    for (uint32_t i = 0; i < records; i++) {
+        append(i);
+    }
+    msg_log_stats_t stats;
+    msg_log_get_stats(&stats);
+    CHECK_EQ(stats.next_seq - stats.first_seq, records);
+
+    flash_emu_stats_t flash;
+    int64_t clock_us;
+    int64_t start_ns;
+    mesh_message_t page[20];
+    size_t count;
+    memset(newest, 0, sizeof(*newest));
+    memset(deep, 0, sizeof(*deep));
+    memset(read, 0, sizeof(*read));
+
+    for (uint32_t peer = 0; peer < PEERS; peer++) {
+        uint8_t peer_id[8];
+        memset(peer_id, peer == PEERS - 1 ? 0xFF : 0x10 + peer, 8);
+        msg_log_cursor_t cursor = MSG_LOG_CURSOR_NEWEST;
+        cost_begin(&flash, &clock_us, &start_ns);
+        CHECK_EQ(msg_log_query(peer_id, &cursor, page, 20, &count), ESP_OK);
+        cost_end(newest, &flash, clock_us, start_ns);
+        CHECK_EQ(count, 20);
+    }
+    cost_average(newest, PEERS);
+
+    uint8_t peer_id[8];
+    memset(peer_id, 0x15, 8);
+    msg_log_cursor_t cursor = MSG_LOG_CURSOR_NEWEST;
+    uint32_t pages = 0;
+    while (cursor != MSG_LOG_CURSOR_END) {
+        cost_begin(&flash, &clock_us, &start_ns);
+        CHECK_EQ(msg_log_query(peer_id, &cursor, page, 20, &count), ESP_OK);
+        cost_end(deep, &flash, clock_us, start_ns);
+        pages++;
+    }
+    cost_average(deep, pages);
+
+    const uint32_t lookups = 2000;
+    mesh_message_t message;
+    for (uint32_t k = 0; k < lookups; k++) {
+        uint32_t seq = stats.first_seq + esp_random() % records;
+        cost_begin(&flash, &clock_us, &start_ns);
+        CHECK_EQ(msg_log_read(seq, &message), ESP_OK);
+        cost_end(read, &flash, clock_us, start_ns);
+        CHECK_EQ(message.id, 1000 + id_of_seq[seq]);
+    }
+    cost_average(read, lookups);
+
+    printf("%5lu records in %lu sectors: newest page %.1f reads, %.0f us flash, %.1f us cpu; "
+           "older pages %.1f reads (max %lu); read by seq %.1f reads (max %lu), %.0f us flash, %.1f us cpu\n",
+           (unsigned long)records, (unsigned long)stats.used_sectors, newest->reads, newest->flash_us,
+           newest->cpu_ns / 1000, deep->reads, (unsigned long)deep->max_reads, read->reads,
+           (unsigned long)read->max_reads, read->flash_us, read->cpu_ns / 1000);
+    flash_emu_free();
+}
+
+// Ten times the records costs a history page nothing, and a read by
+// sequence number no more than one sector's walk
+static void bench_lookups(void)
+{
+    lookup_cost_t newest_small, deep_small, read_small;
+    lookup_cost_t newest_large, deep_large, read_large;
+    host_seed_random(0x3B1);
+    bench_lookup(BENCH_RECORDS / 10, &newest_small, &deep_small, &read_small);
+    bench_lookup(BENCH_RECORDS, &newest_large, &deep_large, &read_large);
+
+    CHECK(newest_large.max_reads == newest_small.max_reads);
+    CHECK(deep_large.max_reads <= deep_small.max_reads + 2);
+    CHECK(read_large.reads < read_small.reads * 1.5 + 2);
+    CHECK(read_large.max_reads <= read_small.max_reads + 4);
+}
+
+int main(void)
+{
+    text_codec_init();
+
+    test_append_and_recover();
+    test_power_cuts();
+    bench_lookups();
+    return 0;
+}
@@ -0,0 +1,137 @@
+// Write-behind persistence: group commits, the full-batch drop, flash failures
+#include "host_test.h"
+#include "host_shim.h"
+#include "flash_emu.h"
+#include "persist.h"
+#include "msg_log.h"
+#include "text_codec.h"
+#include <string.h>
+
+#define MESSAGES        1000
+
+static void make_message(uint32_t i, mesh_message_t *message)
+{
+    memset(message, 0, sizeof(*message));
+    message->id = 500 + i;
+    message->timestamp = 1760000000 + i;
+    memset(message->sender_id, 0x10 + i % 4, 8);
+    memset(message->recipient_id, 0xFF, 8);
+    message->message_type = MSG_TYPE_TEXT;
+    message->payload_length = snprintf((char *)message->payload, sizeof(message->payload),
+                                       "message %lu from the trail", (unsigned long)i);
+}
+
+static void check_logged(uint32_t seq, uint32_t i)
+{
+    mesh_message_t expected;
+    mesh_message_t message;
+    make_message(i, &expected);
+    CHECK_EQ(msg_log_read(seq, &message), ESP_OK);
+    CHECK_EQ(message.id, expected.id);
+    CHECK_EQ(message.payload_length, expected.payload_length);
+    CHECK(memcmp(message.payload, expected.payload, expected.payload_length) == 0);
+}
+
+// What persist_task does once a batch is full
+static void persist(uint32_t i)
+{
+    mesh_message_t message;
+    make_message(i, &message);
+    CHECK_EQ(persist_message(&message), ESP_OK);
+
+    persist_stats_t stats;
+    persist_get_stats(&stats);
+    if (stats.queued - stats.committed - stats.failed == PERSIST_BATCH_MAX) {
+        CHECK_EQ(persist_flush(), ESP_OK);
+    }
+}
+
+static uint32_t log_writes(void)
+{
+    msg_log_stats_t stats;
+    msg_log_get_stats(&stats);
+    return stats.writes;
+}
+
+int main(void)
+{
+    text_codec_init();
+    flash_emu_init(MSG_LOG_PARTITION_LABEL, 64 * FLASH_EMU_SECTOR_SIZE);
+    CHECK_EQ(msg_log_init(), ESP_OK);
+
+    mesh_message_t message;
+    make_message(0, &message);
+    CHECK_EQ(persist_message(&message), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(persist_init(), ESP_OK);
+
+    // Nothing pending: a flush (before sleep, say) writes nothing
+    CHECK_EQ(persist_flush(), ESP_OK);
+    persist_stats_t stats;
+    persist_get_stats(&stats);
+    CHECK_EQ(stats.flushes, 0);
+
+    // Handing a message over does not touch flash
+    msg_log_stats_t log;
+    msg_log_get_stats(&log);
+    uint32_t first_seq = log.next_seq;
+    uint32_t writes = log_writes();
+    for (uint32_t i = 0; i < PERSIST_BATCH_MAX - 1; i++) {
+        make_message(i, &message);
+        CHECK_EQ(persist_message(&message), ESP_OK);
+    }
+    CHECK_EQ(log_writes(), writes);
+
+    // The full batch goes out as one group
+    persist(PERSIST_BATCH_MAX - 1);
+    persist_get_stats(&stats);
+    CHECK_EQ(stats.queued, PERSIST_BATCH_MAX);
+    CHECK_EQ(stats.committed, PERSIST_BATCH_MAX);
+    CHECK_EQ(stats.flushes, 1);
+    CHECK(log_writes() - writes <= 2);
+    for (uint32_t i = 0; i < PERSIST_BATCH_MAX; i++) {
+        check_logged(first_seq + i, i);
+    }
+
+    // Far fewer flash writes than appending each message as it comes
+    writes = log_writes();
+    for (uint32_t i = PERSIST_BATCH_MAX; i < MESSAGES; i++) {
+        persist(i);
+    }
+    CHECK_EQ(persist_flush(), ESP_OK);
+    uint32_t batched_writes = log_writes() - writes;
+    writes = log_writes();
+    for (uint32_t i = 0; i < MESSAGES; i++) {
+        make_message(i, &message);
+        CHECK_EQ(msg_log_append(&message, NULL), ESP_OK);
+    }
+    uint32_t direct_writes = log_writes() - writes;
+    CHECK(batched_writes * 4 < direct_writes);
+    for (uint32_t i = 0; i < MESSAGES; i++) {
+        check_logged(first_seq + i, i);
+    }
+
+    // A full batch nobody has written yet drops the message rather than block
+    persist_get_stats(&stats);
+    uint32_t committed = stats.committed;
+    for (uint32_t i = 0; i < PERSIST_BATCH_MAX; i++) {
+        make_message(i, &message);
+        CHECK_EQ(persist_message(&message), ESP_OK);
+    }
+    CHECK_EQ(persist_message(&message), ESP_ERR_NO_MEM);
+    persist_get_stats(&stats);
+    CHECK_EQ(stats.dropped, 1);
+    CHECK_EQ(persist_flush(), ESP_OK);
+    persist_get_stats(&stats);
+    CHECK_EQ(stats.committed, committed + PERSIST_BATCH_MAX);
+
+    // A flash failure is counted against the batch it took
+    make_message(0, &message);
+    CHECK_EQ(persist_message(&message), ESP_OK);
+    flash_emu_cut_after(0);
+    CHECK(persist_flush() != ESP_OK);
+    persist_get_stats(&stats);
+    CHECK_EQ(stats.failed, 1);
+
+    flash_emu_free();
+    return 0;
+}
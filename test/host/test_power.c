@@ -0,0 +1,102 @@
+// Idle sleep: when it starts, how long it lasts, and what wakes it
+#include "host_test.h"
+#include "host_shim.h"
+#include "power_mgmt.h"
+#include "timer_wheel.h"
+#include "lora.h"
+#include "esp_sleep.h"
+#include "device_config.h"
+
+// Stand-ins for the radio's DIO0 wakeup
+static uint32_t arms;
+static uint32_t disarms;
+static uint32_t sleeps_at_arm;
+
+void lora_arm_wakeup(void)
+{
+    arms++;
+    sleeps_at_arm = host_sleep.sleeps;
+    esp_sleep_enable_gpio_wakeup();
+}
+
+void lora_disarm_wakeup(void)
+{
+    disarms++;
+    CHECK_EQ(host_sleep.sleeps, sleeps_at_arm + 1);    // Armed for exactly this sleep
+    host_sleep.gpio_wakeup = false;
+}
+
+static uint32_t hook_calls;
+
+static void on_sleep(void)
+{
+    hook_calls++;
+}
+
+// What mesh_task does on each pass
+static void run(void)
+{
+    timer_wheel_run();
+    CHECK_EQ(power_mgmt_update(), ESP_OK);
+}
+
+int main(void)
+{
+    timer_wheel_init();
+    CHECK_EQ(power_mgmt_init(), ESP_OK);
+    power_mgmt_set_sleep_hook(on_sleep);
+
+    // Awake until SLEEP_TIMEOUT has passed without activity
+    host_advance_ms(SLEEP_TIMEOUT - 1);
+    run();
+    CHECK_EQ(host_sleep.sleeps, 0);
+
+    // Idle with nothing scheduled: the longest sleep, DIO0 armed
+    host_advance_ms(1);
+    run();
+    CHECK_EQ(host_sleep.sleeps, 1);
+    CHECK_EQ(host_sleep.timer_wakeup_us, (uint64_t)POWER_MAX_SLEEP_MS * 1000);
+    CHECK(!host_sleep.gpio_woken);
+    CHECK_EQ(arms, 1);
+    CHECK_EQ(disarms, 1);
+    CHECK_EQ(hook_calls, 1);
+
+    // A registered timer cuts the sleep short to its deadline
+    wheel_timer_t deadline;
+    timer_wheel_setup(&deadline, NULL, NULL);
+    timer_wheel_start(&deadline, 7000);
+    run();
+    CHECK_EQ(host_sleep.sleeps, 2);
+    CHECK_EQ(host_sleep.timer_wakeup_us, 7000 * 1000);
+    timer_wheel_run();
+    CHECK(!timer_wheel_pending(&deadline));
+
+    // A deadline closer than POWER_MIN_SLEEP_MS is waited out awake
+    timer_wheel_start(&deadline, POWER_MIN_SLEEP_MS - 1);
+    uint32_t sleeps = host_sleep.sleeps;
+    run();
+    CHECK_EQ(host_sleep.sleeps, sleeps);
+    host_advance_ms(POWER_MIN_SLEEP_MS);
+    timer_wheel_run();
+
+    // A frame on DIO0 ends the sleep early...
+    int64_t before_us = host_time_us;
+    host_sleep_gpio_after(1234);
+    run();
+    CHECK_EQ(host_sleep.sleeps, sleeps + 1);
+    CHECK(host_sleep.gpio_woken);
+    CHECK_EQ(host_time_us - before_us, 1234 * 1000);
+    CHECK_EQ(arms, disarms);
+
+    // ...and, once the mesh has taken it, keeps the node awake for a full timeout
+    power_mgmt_activity_notify();
+    for (uint32_t elapsed = 0; elapsed < SLEEP_TIMEOUT; elapsed += 1000) {
+        run();
+        CHECK_EQ(host_sleep.sleeps, sleeps + 1);
+        host_advance_ms(1000);
+    }
+    run();
+    CHECK_EQ(host_sleep.sleeps, sleeps + 2);
+    CHECK_EQ(arms, disarms);
+    return 0;
+}
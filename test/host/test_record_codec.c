@@ -0,0 +1,281 @@
+// Compact record form of the message log: every way of storing an ID, a
+// type and a payload decodes back to the message, cut records are refused,
+// and the size per message over a chat-like history against the raw
+// header and payload the log used to store
+#include "host_test.h"
+#include "record_codec.h"
+#include "text_codec.h"
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#define HISTORY         20000
+#define PEERS           5               // Plus the broadcast channel
+#define RAW_HEADER      offsetof(mesh_message_t, payload)
+
+static const uint8_t self_id[8] = {0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01, 0x00, 0x00};
+static const uint8_t broadcast_id[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static const uint8_t stranger_id[8] = {0x77, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70};
+
+static const char *const lines[] = {
+    "ok", "yes", "on my way", "thanks!", "where are you?", "be there in 5",
+    "battery low, turning off the phone", "we are at the second lake, going to have lunch here",
+    "the trail is closed after the bridge, take the left path",
+    "can someone bring extra water to the north gate", "found the tent, next to the big oak tree",
+    "copy that", "does anyone have a spare charger?", "I can pick you up at the station at 10",
+};
+
+static uint32_t rng_state = 0x5EC0;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void make_dict(record_dict_t *dict, uint8_t peers)
+{
+    memset(dict, 0, sizeof(*dict));
+    memcpy(dict->self_id, self_id, 8);
+    for (uint8_t i = 0; i < peers; i++) {
+        memset(dict->peers[i], 0x10 + i, 8);
+    }
+    dict->peer_count = peers;
+    dict->base_id = 5000;
+    dict->base_timestamp = 1760000000;
+}
+
+static void make_message(mesh_message_t *message, const uint8_t *sender, const uint8_t *recipient,
+                         message_type_t type, const char *text)
+{
+    memset(message, 0, sizeof(*message));
+    message->id = 5012;
+    message->timestamp = 1760000300;
+    memcpy(message->sender_id, sender, 8);
+    memcpy(message->recipient_id, recipient, 8);
+    message->message_type = type;
+    message->hop_count = 3;
+    message->payload_length = strlen(text);
+    memcpy(message->payload, text, message->payload_length);
+}
+
+static void check_same(const mesh_message_t *a, const mesh_message_t *b)
+{
+    CHECK_EQ(a->id, b->id);
+    CHECK(a->timestamp == b->timestamp);
+    CHECK(memcmp(a->sender_id, b->sender_id, 8) == 0);
+    CHECK(memcmp(a->recipient_id, b->recipient_id, 8) == 0);
+    CHECK_EQ(a->message_type, b->message_type);
+    CHECK_EQ(a->hop_count, b->hop_count);
+    CHECK_EQ(a->payload_length, b->payload_length);
+    CHECK(memcmp(a->payload, b->payload, a->payload_length) == 0);
+    CHECK_EQ(b->checksum, 0);
+}
+
+static size_t round_trip(const mesh_message_t *message, const record_dict_t *dict)
+{
+    uint8_t record[RECORD_MAX_SIZE];
+    mesh_message_t decoded;
+    uint8_t sender[8];
+    uint8_t recipient[8];
+
+    size_t len = record_encode(message, dict, record);
+    CHECK(len <= RECORD_MAX_SIZE);
+    CHECK_EQ(record_decode(record, len, dict, &decoded), ESP_OK);
+    check_same(message, &decoded);
+    CHECK_EQ(record_decode_ids(record, len, dict, sender, recipient), ESP_OK);
+    CHECK(memcmp(sender, message->sender_id, 8) == 0);
+    CHECK(memcmp(recipient, message->recipient_id, 8) == 0);
+    return len;
+}
+
+static void test_round_trip(void)
+{
+    record_dict_t dict;
+    mesh_message_t message;
+    uint8_t peer[8];
+    make_dict(&dict, PEERS);
+    memset(peer, 0x12, 8);
+
+    // Each way of storing an ID: self and broadcast cost nothing, a known
+    // peer one byte, anyone else all eight
+    make_message(&message, self_id, broadcast_id, MSG_TYPE_TEXT, "ok");
+    size_t base = round_trip(&message, &dict);
+    make_message(&message, peer, self_id, MSG_TYPE_TEXT, "ok");
+    CHECK_EQ(round_trip(&message, &dict), base + 1);
+    make_message(&message, stranger_id, self_id, MSG_TYPE_TEXT, "ok");
+    CHECK_EQ(round_trip(&message, &dict), base + 8);
+    make_message(&message, stranger_id, peer, MSG_TYPE_TEXT, "ok");
+    CHECK_EQ(round_trip(&message, &dict), base + 9);
+
+    // Other types carry a type byte; emergency text is compressed as well
+    make_message(&message, self_id, broadcast_id, MSG_TYPE_EMERGENCY, "ok");
+    CHECK_EQ(round_trip(&message, &dict), base + 1);
+    const char *text = "we are at the second lake, going to have lunch here";
+    make_message(&message, self_id, peer, MSG_TYPE_EMERGENCY, text);
+    CHECK(round_trip(&message, &dict) < 1 + 1 + 1 + 2 + 3 + 1 + strlen(text));
+    make_message(&message, peer, self_id, MSG_TYPE_ACK, "");
+    round_trip(&message, &dict);
+
+    // Bytes the text codec cannot shorten are kept as they are
+    make_message(&message, peer, self_id, MSG_TYPE_TEXT, "");
+    for (int i = 0; i < 40; i++) {
+        message.payload[i] = (uint8_t)(0x80 + i * 3);
+    }
+    message.payload_length = 40;
+    CHECK(round_trip(&message, &dict) > 40);
+
+    // IDs and timestamps on either side of the bases, near and far
+    static const int64_t deltas[] = {0, 1, -1, 63, -64, 64, 100000, -100000, INT32_MAX / 2};
+    for (size_t i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++) {
+        make_message(&message, peer, self_id, MSG_TYPE_TEXT, "where are you?");
+        message.id = (uint32_t)(dict.base_id + deltas[i]);
+        message.timestamp = dict.base_timestamp + deltas[i];
+        round_trip(&message, &dict);
+    }
+
+    // The largest record fits RECORD_MAX_SIZE
+    make_message(&message, stranger_id, stranger_id, MSG_TYPE_BROADCAST, "");
+    message.id = dict.base_id ^ 0x80000000u;
+    message.timestamp = 0;
+    message.hop_count = 0xFF;
+    memset(message.payload, 0xFE, UINT8_MAX);
+    message.payload_length = UINT8_MAX;
+    round_trip(&message, &dict);
+
+    // An index past the dictionary is refused, not read out of bounds
+    record_dict_t smaller;
+    make_dict(&smaller, 2);
+    uint8_t record[RECORD_MAX_SIZE];
+    mesh_message_t decoded;
+    make_message(&message, peer, self_id, MSG_TYPE_TEXT, "ok");
+    size_t len = record_encode(&message, &dict, record);
+    CHECK(record_decode(record, len, &smaller, &decoded) != ESP_OK);
+}
+
+// The payload runs to the end of the record, so a cut there only shortens
+// it; a cut anywhere in front of the payload is refused
+static void test_truncated(void)
+{
+    record_dict_t dict;
+    mesh_message_t message;
+    mesh_message_t decoded;
+    uint8_t record[RECORD_MAX_SIZE];
+    uint8_t peer[8];
+    make_dict(&dict, PEERS);
+    memset(peer, 0x11, 8);
+
+    make_message(&message, stranger_id, peer, MSG_TYPE_EMERGENCY, "");
+    message.id = dict.base_id + 100000;
+    message.timestamp = dict.base_timestamp - 100000;
+    size_t len = record_encode(&message, &dict, record);
+    for (size_t cut = 0; cut < len; cut++) {
+        CHECK(record_decode(record, cut, &dict, &decoded) != ESP_OK);
+    }
+    CHECK_EQ(record_decode(record, len, &dict, &decoded), ESP_OK);
+    check_same(&message, &decoded);
+
+    uint8_t sender[8];
+    uint8_t recipient[8];
+    for (size_t cut = 0; cut < 1 + 8 + 1; cut++) {
+        CHECK(record_decode_ids(record, cut, &dict, sender, recipient) != ESP_OK);
+    }
+}
+
+// A history like the one the log holds: five peers and the broadcast
+// channel, per-sender message counters, minutes between messages, a
+// dictionary rebuilt every sector's worth. Reported against the raw header
+// and used payload, with and without the peer dictionary.
+static void bench_history(void)
+{
+    static mesh_message_t history[HISTORY];
+    uint32_t counters[PEERS + 1] = {0};
+    uint64_t timestamp = 1760000000;
+
+    for (uint32_t i = 0; i < HISTORY; i++) {
+        mesh_message_t *message = &history[i];
+        uint32_t conversation = rng() % (PEERS + 1);
+        uint8_t peer[8];
+        memset(peer, 0x10 + conversation, 8);
+        const char *text = lines[rng() % (sizeof(lines) / sizeof(lines[0]))];
+        bool outgoing = rng() % 3 == 0;
+        if (conversation == PEERS) {
+            memset(peer, 0x40 + rng() % 8, 8);
+            make_message(message, outgoing ? self_id : peer, broadcast_id, MSG_TYPE_TEXT, text);
+        } else {
+            make_message(message, outgoing ? self_id : peer, outgoing ? peer : self_id, MSG_TYPE_TEXT, text);
+        }
+        if (rng() % 100 == 0) {
+            message->message_type = MSG_TYPE_EMERGENCY;
+        }
+        timestamp += 5 + rng() % 600;
+        message->timestamp = timestamp;
+        message->id = ++counters[outgoing ? PEERS : conversation];
+        message->hop_count = outgoing ? 0 : 1 + rng() % 4;
+    }
+
+    size_t raw_total = 0;
+    size_t plain_total = 0;
+    size_t coded_total = 0;
+    size_t no_dict_total = 0;
+    uint8_t record[RECORD_MAX_SIZE];
+    record_dict_t dict;
+    record_dict_t no_dict;
+    make_dict(&dict, PEERS);
+    make_dict(&no_dict, 0);
+
+    int64_t encode_ns = 0;
+    int64_t decode_ns = 0;
+    for (uint32_t i = 0; i < HISTORY; i++) {
+        const mesh_message_t *message = &history[i];
+
+        // A new sector every 80 messages or so, its bases the newest before it
+        if (i % 80 == 0 && i > 0) {
+            dict.base_id = no_dict.base_id = history[i - 1].id;
+            dict.base_timestamp = no_dict.base_timestamp = history[i - 1].timestamp;
+        }
+        raw_total += RAW_HEADER + message->payload_length;
+        plain_total += message->payload_length;
+
+        int64_t start = now_ns();
+        size_t len = record_encode(message, &dict, record);
+        encode_ns += now_ns() - start;
+        coded_total += len;
+
+        mesh_message_t decoded;
+        start = now_ns();
+        CHECK_EQ(record_decode(record, len, &dict, &decoded), ESP_OK);
+        decode_ns += now_ns() - start;
+        check_same(message, &decoded);
+
+        no_dict_total += record_encode(message, &no_dict, record);
+    }
+
+    printf("record codec, %d messages: raw %.1f bytes/message (%zu header + %.1f text); "
+           "coded %.1f with the peer dictionary, %.1f without; encode %.0f ns, decode %.0f ns\n",
+           HISTORY, (double)raw_total / HISTORY, (size_t)RAW_HEADER, (double)plain_total / HISTORY,
+           (double)coded_total / HISTORY, (double)no_dict_total / HISTORY,
+           (double)encode_ns / HISTORY, (double)decode_ns / HISTORY);
+    CHECK(coded_total * 2 < raw_total);
+    CHECK(coded_total < plain_total);
+    CHECK(coded_total < no_dict_total);
+}
+
+int main(void)
+{
+    text_codec_init();
+
+    test_round_trip();
+    test_truncated();
+    bench_history();
+    return 0;
+}
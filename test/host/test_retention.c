@@ -0,0 +1,182 @@
+// Message log retention: steady-state usage, compaction slices, pins across reboots, aging and power cuts
+#include "host_test.h"
+#include "host_shim.h"
+#include "flash_emu.h"
+#include "msg_log.h"
+#include "text_codec.h"
+#include "esp_random.h"
+#include <string.h>
+
+#define LOG_SIZE        (256 * FLASH_EMU_SECTOR_SIZE)
+#define MESSAGES        40000
+#define BATCH           8
+#define COMMIT_MS       2000            // Between group commits
+#define BROADCAST       5               // Conversation that gets most of the traffic
+#define DAY_US          (24LL * 3600 * 1000000)
+
+static const char *const lines[] = {
+    "ok see you at the trailhead in ten minutes",
+    "where are you now?",
+    "battery at 40 percent, heading back to camp",
+    "yes",
+    "we are near the north ridge, signal is weak here",
+    "can you bring water and the first aid kit",
+    "on my way",
+    "thanks!",
+};
+
+static uint32_t ids[BROADCAST + 1];
+
+// Six in ten messages on the broadcast channel, the rest from five peers;
+// every 997th is an emergency, marked with a leading '!'
+static void make_message(int i, mesh_message_t *message)
+{
+    int peer = i % 10 < 6 ? BROADCAST : (i * 7) % 5;
+    memset(message, 0, sizeof(*message));
+    message->sender_id[0] = 0x24;
+    message->sender_id[5] = peer;
+    message->id = ++ids[peer];
+    message->timestamp = 1000 + i;
+    if (peer == BROADCAST) {
+        memset(message->recipient_id, 0xFF, 8);
+    }
+    message->message_type = i % 997 == 0 ? MSG_TYPE_EMERGENCY : MSG_TYPE_TEXT;
+    message->hop_count = 1;
+    const char *line = lines[i % 8];
+    message->payload_length = strlen(line);
+    memcpy(message->payload, line, message->payload_length);
+    if (message->message_type == MSG_TYPE_EMERGENCY) {
+        message->payload[0] = '!';
+    }
+}
+
+static void append_batch(int first)
+{
+    mesh_message_t batch[BATCH];
+    for (int k = 0; k < BATCH; k++) {
+        make_message(first + k, &batch[k]);
+    }
+    CHECK_EQ(msg_log_append_batch(batch, BATCH, NULL), ESP_OK);
+}
+
+// All pins present and all of them emergencies
+static void check_pins(void)
+{
+    mesh_message_t pinned[MSG_LOG_PINNED_MAX + 1];
+    size_t count;
+    CHECK_EQ(msg_log_pinned(pinned, MSG_LOG_PINNED_MAX + 1, &count), ESP_OK);
+    CHECK_EQ(count, MSG_LOG_PINNED_MAX);
+    for (size_t k = 0; k < count; k++) {
+        CHECK_EQ(pinned[k].message_type, MSG_TYPE_EMERGENCY);
+        CHECK_EQ(pinned[k].payload[0], '!');
+        CHECK(k == 0 || pinned[k].timestamp > pinned[k - 1].timestamp);
+    }
+}
+
+static void test_steady_state(void)
+{
+    int64_t max_slice_us = 0;
+    int64_t max_slice_no_erase_us = 0;
+    uint32_t max_used = 0;
+    msg_log_stats_t stats;
+
+    for (int i = 0; i < MESSAGES; i += BATCH) {
+        append_batch(i);
+        host_advance_ms(COMMIT_MS);
+
+        // One slice between commits, as persist_task runs it
+        flash_emu_stats_t before;
+        flash_emu_stats_t after;
+        flash_emu_get_stats(&before);
+        int64_t start_us = host_time_us;
+        msg_log_compact(MSG_LOG_COMPACT_SLICE_US);
+        int64_t slice_us = host_time_us - start_us;
+        flash_emu_get_stats(&after);
+
+        if (slice_us > max_slice_us) {
+            max_slice_us = slice_us;
+        }
+        if (after.erases == before.erases && slice_us > max_slice_no_erase_us) {
+            max_slice_no_erase_us = slice_us;
+        }
+        msg_log_get_stats(&stats);
+        if (i > MESSAGES / 2 && stats.used_sectors > max_used) {
+            max_used = stats.used_sectors;
+        }
+    }
+
+    // Per-conversation quotas, not the partition size, bound the log
+    msg_log_get_stats(&stats);
+    CHECK(max_used < stats.sectors - MSG_LOG_FREE_SECTORS - 1);
+    CHECK(stats.reclaimed > 0);
+    CHECK(stats.moved > 0);
+    CHECK_EQ(stats.overruns, 0);
+
+    // A slice overruns its budget by one step at most, and only an erase is that long
+    CHECK(max_slice_no_erase_us <= MSG_LOG_COMPACT_SLICE_US);
+    CHECK(max_slice_us <= MSG_LOG_COMPACT_SLICE_US + FLASH_EMU_ERASE_US);
+
+    // The busiest conversation shows exactly its quota
+    uint8_t broadcast_id[8];
+    memset(broadcast_id, 0xFF, 8);
+    msg_log_cursor_t cursor = MSG_LOG_CURSOR_NEWEST;
+    mesh_message_t page[50];
+    size_t total = 0;
+    do {
+        size_t count;
+        CHECK_EQ(msg_log_query(broadcast_id, &cursor, page, 50, &count), ESP_OK);
+        total += count;
+    } while (cursor != MSG_LOG_CURSOR_END);
+    CHECK_EQ(total, MSG_LOG_RETAIN_PER_PEER);
+
+    check_pins();
+}
+
+static void test_reboot_and_aging(void)
+{
+    CHECK_EQ(msg_log_init(), ESP_OK);
+    check_pins();
+
+    // A month powered on with nothing new: history ages out, pins stay
+    host_time_us += 31 * DAY_US;
+    int slices = 0;
+    while (msg_log_compact(MSG_LOG_COMPACT_SLICE_US)) {
+        CHECK(++slices < 100000);
+    }
+    msg_log_stats_t stats;
+    msg_log_get_stats(&stats);
+    CHECK(stats.used_sectors <= 2);
+    check_pins();
+}
+
+// Cut power part way through compaction; every pin must survive the reboot
+static void test_power_cuts(void)
+{
+    host_seed_random(25);
+    for (int trial = 0; trial < 100; trial++) {
+        append_batch(MESSAGES + trial * BATCH);
+        host_time_us += 31 * DAY_US / 50;
+
+        flash_emu_cut_after(esp_random() % 6000);
+        while (!flash_emu_power_lost() && msg_log_compact(MSG_LOG_COMPACT_SLICE_US)) {
+        }
+        flash_emu_restore_power();
+
+        CHECK_EQ(msg_log_init(), ESP_OK);
+        check_pins();
+    }
+}
+
+int main(void)
+{
+    text_codec_init();
+    flash_emu_init(MSG_LOG_PARTITION_LABEL, LOG_SIZE);
+    CHECK_EQ(msg_log_init(), ESP_OK);
+
+    test_steady_state();
+    test_reboot_and_aging();
+    test_power_cuts();
+
+    flash_emu_free();
+    return 0;
+}
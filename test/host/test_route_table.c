@@ -0,0 +1,175 @@
+// Route table lookup and insert cost as the table fills, on MAC-like node
+// IDs that differ in a few bytes: hits, misses, copies for other tasks, and
+// inserts that have to evict once the table is at its load limit
+#include "host_test.h"
+#include "host_shim.h"
+#include "route_table.h"
+#include "timer_wheel.h"
+#include <string.h>
+#include <time.h>
+
+#define MAX_LOAD        (MAX_ROUTES * 3 / 4)    // route_table.c evicts beyond this
+#define ROUNDS          200000
+
+static const uint8_t next_hop[8] = {0x24, 0x0A, 0xC4, 0xFF, 0xFF, 0xFF, 0, 0};
+
+static void node_id(uint8_t *id, uint32_t n)
+{
+    static const uint8_t oui[3] = {0x24, 0x0A, 0xC4};
+    memset(id, 0, 8);
+    memcpy(id, oui, 3);
+    id[3] = n >> 16;
+    id[4] = n >> 8;
+    id[5] = n;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double per_op_ns(int64_t start_ns, uint32_t ops)
+{
+    return (double)(now_ns() - start_ns) / ops;
+}
+
+static double bench_load(size_t load)
+{
+    uint8_t id[8];
+    route_entry_t copy;
+    uint32_t found = 0;
+
+    CHECK_EQ(route_table_init(), ESP_OK);
+    int64_t start = now_ns();
+    for (uint32_t n = 0; n < load; n++) {
+        node_id(id, n);
+        route_table_insert(id, next_hop, 1 + n % 8, n);
+    }
+    double insert_ns = load ? per_op_ns(start, load) : 0;
+    CHECK_EQ(route_table_count(), load);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        node_id(id, i % load);
+        found += route_table_find(id, i) != NULL;
+    }
+    double hit_ns = per_op_ns(start, ROUNDS);
+    CHECK_EQ(found, ROUNDS);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        node_id(id, 0x800000 + i);
+        found += route_table_find(id, i) != NULL;
+    }
+    double miss_ns = per_op_ns(start, ROUNDS);
+    CHECK_EQ(found, ROUNDS);
+
+    // What the sending task pays: the lookup under the mutex plus the copy
+    start = now_ns();
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        node_id(id, i % load);
+        found += route_table_get(id, &copy);
+    }
+    double get_ns = per_op_ns(start, ROUNDS);
+    CHECK_EQ(found, 2 * ROUNDS);
+    CHECK(memcmp(copy.next_hop, next_hop, 8) == 0);
+
+    printf("%3u%% load (%3u routes): insert %5.1f ns, hit %5.1f ns, miss %5.1f ns, copy %5.1f ns\n",
+           (unsigned)(load * 100 / MAX_ROUTES), (unsigned)load, insert_ns, hit_ns, miss_ns, get_ns);
+    return miss_ns;
+}
+
+// Past the load limit every new route evicts one, and churn leaves no
+// tombstones behind to slow lookups down
+static void bench_churn(double fresh_miss_ns)
+{
+    uint8_t id[8];
+
+    CHECK_EQ(route_table_init(), ESP_OK);
+    uint32_t empty = route_table_digest(next_hop);
+    for (uint32_t n = 0; n < MAX_LOAD; n++) {
+        node_id(id, n);
+        route_table_insert(id, next_hop, 2, n);
+    }
+
+    int64_t start = now_ns();
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        node_id(id, MAX_LOAD + i);
+        route_table_insert(id, next_hop, 2, MAX_LOAD + i);
+        CHECK(route_table_count() <= MAX_LOAD);
+    }
+    double evict_ns = per_op_ns(start, ROUNDS);
+    CHECK_EQ(route_table_count(), MAX_LOAD);
+
+    // The newest routes survived; recently used ones are what eviction keeps
+    node_id(id, MAX_LOAD + ROUNDS - 1);
+    CHECK(route_table_find(id, 0) != NULL);
+
+    start = now_ns();
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        node_id(id, 0x800000 + i);
+        found += route_table_find(id, i) != NULL;
+    }
+    double miss_ns = per_op_ns(start, ROUNDS);
+    CHECK_EQ(found, 0);
+
+    // Removing whatever is left brings the digest back to that of an empty table
+    size_t cursor = 0;
+    route_entry_t *route;
+    uint8_t left[MAX_LOAD][8];
+    size_t count = 0;
+    while ((route = route_table_next(&cursor)) != NULL) {
+        memcpy(left[count++], route->destination, 8);
+    }
+    CHECK_EQ(count, MAX_LOAD);
+    for (size_t i = 0; i < count; i++) {
+        CHECK_EQ(route_table_remove(left[i]), ESP_OK);
+    }
+    CHECK_EQ(route_table_count(), 0);
+    CHECK_EQ(route_table_digest(next_hop), empty);
+
+    printf("at limit (%3u routes): evicting insert %5.1f ns, miss after churn %5.1f ns\n",
+           (unsigned)MAX_LOAD, evict_ns, miss_ns);
+
+    // Tombstones left to pile up made this tens of times slower
+    CHECK(miss_ns < 5 * fresh_miss_ns);
+}
+
+// Rebuilding the index leaves the routes where they are
+static void test_stable_pointers(void)
+{
+    uint8_t id[8];
+    CHECK_EQ(route_table_init(), ESP_OK);
+    node_id(id, 0xABCDEF);
+    route_entry_t *kept = route_table_insert(id, next_hop, 3, 0);
+
+    for (uint32_t i = 0; i < 50 * MAX_ROUTES; i++) {
+        node_id(id, i);
+        route_table_insert(id, next_hop, 1, 0);
+        if (i >= MAX_LOAD / 2) {
+            node_id(id, i - MAX_LOAD / 2);
+            CHECK_EQ(route_table_remove(id), ESP_OK);
+        }
+    }
+
+    node_id(id, 0xABCDEF);
+    CHECK(route_table_find(id, 0) == kept);
+    CHECK_EQ(kept->hop_count, 3);
+    CHECK_EQ(route_table_count(), MAX_LOAD / 2 + 1);
+}
+
+int main(void)
+{
+    host_tasks_start();
+    timer_wheel_init();
+
+    bench_load(MAX_ROUTES / 4);
+    bench_load(MAX_ROUTES / 2);
+    double miss_ns = bench_load(MAX_LOAD);
+    bench_churn(miss_ns);
+    test_stable_pointers();
+    return 0;
+}
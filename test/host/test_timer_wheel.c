@@ -0,0 +1,170 @@
+// Timer wheel against a brute-force model: exact firing, cancels, tick wrap, far timers
+#include "host_test.h"
+#include "host_shim.h"
+#include "timer_wheel.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TIMERS          1000
+#define STEPS           20000
+#define SPAN_TICKS      (1UL << 24)     // Longest delay the wheel holds without re-cascading
+
+typedef struct {
+    wheel_timer_t timer;
+    uint32_t expires;               // Model: absolute tick it is due
+    bool pending;
+    bool restart;                   // Callback starts it again
+} model_timer_t;
+
+static model_timer_t timers[TIMERS];
+static uint32_t fired;
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t random_delay(void)
+{
+    uint32_t pick = rng() % 10;
+    if (pick < 6) {
+        return 1 + rng() % 200;
+    } else if (pick < 8) {
+        return 1 + rng() % 10000;
+    } else if (pick < 9) {
+        return 1 + rng() % (1 << 20);
+    }
+    return SPAN_TICKS - 100 + rng() % (1 << 22);    // Past the wheel's span
+}
+
+static void model_start(model_timer_t *model, uint32_t delay_ms)
+{
+    timer_wheel_start(&model->timer, delay_ms);
+    model->expires = xTaskGetTickCount() + delay_ms;
+    model->pending = true;
+}
+
+static void on_fire(void *arg)
+{
+    model_timer_t *model = arg;
+    CHECK(model->pending);
+    CHECK_EQ(xTaskGetTickCount(), model->expires);
+    CHECK(!timer_wheel_pending(&model->timer));
+    model->pending = false;
+    fired++;
+
+    if (model->restart) {
+        model_start(model, random_delay());
+    }
+}
+
+static uint32_t model_next_ms(void)
+{
+    uint32_t now = xTaskGetTickCount();
+    uint32_t best = UINT32_MAX;
+    for (int i = 0; i < TIMERS; i++) {
+        if (!timers[i].pending) {
+            continue;
+        }
+        int32_t remaining = (int32_t)(timers[i].expires - now);
+        uint32_t wait = remaining > 0 ? (uint32_t)remaining : 0;
+        if (wait < best) {
+            best = wait;
+        }
+    }
+    return best;
+}
+
+// Moves the clock at most to the next deadline, so every timer must fire on its own tick
+static void step(void)
+{
+    uint32_t next_ms = timer_wheel_next_ms();
+    CHECK_EQ(next_ms, model_next_ms());
+
+    uint32_t advance = next_ms == UINT32_MAX ? 1 + rng() % 5000 : next_ms;
+    if (advance > 0 && rng() % 4 == 0) {
+        advance = rng() % advance;
+    }
+    host_advance_ms(advance);
+    timer_wheel_run();
+
+    uint32_t now = xTaskGetTickCount();
+    for (int i = 0; i < TIMERS; i++) {
+        CHECK(!timers[i].pending || (int32_t)(timers[i].expires - now) > 0);
+        CHECK_EQ(timer_wheel_pending(&timers[i].timer), timers[i].pending);
+    }
+}
+
+static void test_against_model(void)
+{
+    // Start close enough to the tick wrap that the run crosses it
+    host_time_us = (int64_t)(UINT32_MAX - 5000) * 1000;
+    timer_wheel_init();
+    for (int i = 0; i < TIMERS; i++) {
+        timer_wheel_setup(&timers[i].timer, on_fire, &timers[i]);
+        timers[i].pending = false;
+        timers[i].restart = i % 3 == 0;
+    }
+
+    uint32_t start_tick = xTaskGetTickCount();
+    for (int s = 0; s < STEPS; s++) {
+        for (int op = rng() % 8; op > 0; op--) {
+            model_timer_t *model = &timers[rng() % TIMERS];
+            if (model->pending && rng() % 3 == 0) {
+                timer_wheel_cancel(&model->timer);
+                model->pending = false;
+            } else {
+                model_start(model, random_delay());     // Restarts a pending timer
+            }
+        }
+        step();
+    }
+    CHECK((int32_t)(xTaskGetTickCount() - start_tick) > 5000);     // Wrapped
+    CHECK(fired > STEPS);
+
+    // Let the far timers run out, cascading down from the top level
+    uint32_t far = 0;
+    for (int i = 0; i < TIMERS; i++) {
+        timers[i].restart = false;
+        if (timers[i].pending && timers[i].expires - xTaskGetTickCount() < (1 << 20)) {
+            timer_wheel_cancel(&timers[i].timer);
+            timers[i].pending = false;
+        } else if (timers[i].pending) {
+            far++;
+        }
+    }
+    CHECK(far > 0);
+    uint32_t fired_before = fired;
+    while (model_next_ms() != UINT32_MAX) {
+        step();
+    }
+    CHECK_EQ(fired - fired_before, far);
+    CHECK_EQ(timer_wheel_next_ms(), UINT32_MAX);
+}
+
+static void test_zero_delay(void)
+{
+    // A zero delay still waits for the next tick
+    model_timer_t model = {0};
+    timer_wheel_setup(&model.timer, on_fire, &model);
+    timer_wheel_start(&model.timer, 0);
+    model.expires = xTaskGetTickCount() + 1;
+    model.pending = true;
+    timer_wheel_run();
+    CHECK(model.pending);
+    CHECK_EQ(timer_wheel_next_ms(), 1);
+    host_advance_ms(1);
+    timer_wheel_run();
+    CHECK(!model.pending);
+}
+
+int main(void)
+{
+    test_against_model();
+    test_zero_delay();
+    return 0;
+}
@@ -0,0 +1,200 @@
+// Trickle timer (RFC 6206 with one change, see trickle.h): the interval
+// doubles up to Imax while nothing changes, drops back to Imin on an
+// inconsistency, and a node that has heard k consistent transmissions in an
+// interval stays silent, but never two intervals running. Then a single
+// broadcast domain of N nodes: that rule puts a floor of N/2 transmissions
+// per Imax under the k the RFC would settle at.
+#include "host_test.h"
+#include "host_shim.h"
+#include "trickle.h"
+#include "esp_random.h"
+#include <string.h>
+
+#define IMIN_MS         1000
+#define DOUBLINGS       4
+#define IMAX_MS         (IMIN_MS << DOUBLINGS)
+#define K               2
+#define MAX_NODES       32
+
+// Runs the timer to the end of its current interval, the way beacon.c
+// drives it: sleep for trickle_wait_ms, then poll. Returns transmissions.
+static int run_interval(trickle_t *trickle, uint32_t *now_ms, uint32_t heard_before_fire)
+{
+    uint32_t start_ms = trickle->start_ms;
+    uint32_t interval_ms = trickle->interval_ms;
+    int transmissions = 0;
+
+    for (uint32_t i = 0; i < heard_before_fire; i++) {
+        trickle_consistent(trickle);
+    }
+    while (trickle->start_ms == start_ms) {
+        *now_ms += trickle_wait_ms(trickle, *now_ms);
+        uint32_t fire_ms = trickle->fire_ms;
+        bool fired_before = trickle->fired;
+        if (trickle_poll(trickle, *now_ms)) {
+            transmissions++;
+        }
+
+        // The transmission point lies in the second half of the interval
+        if (!fired_before && trickle->fired) {
+            CHECK_EQ(*now_ms, fire_ms);
+            CHECK(fire_ms - start_ms >= interval_ms / 2);
+            CHECK(fire_ms - start_ms < interval_ms);
+        }
+    }
+    CHECK_EQ(*now_ms - start_ms, interval_ms);
+    return transmissions;
+}
+
+// With nothing heard, one transmission per interval, each interval twice
+// the last until Imax
+static void test_doubling(void)
+{
+    trickle_t trickle;
+    uint32_t now_ms = 5000;
+    trickle_init(&trickle, IMIN_MS, DOUBLINGS, K, now_ms);
+
+    uint32_t expected_ms = IMIN_MS;
+    for (int i = 0; i < DOUBLINGS + 4; i++) {
+        CHECK_EQ(trickle.interval_ms, expected_ms);
+        CHECK_EQ(run_interval(&trickle, &now_ms, 0), 1);
+        if (expected_ms < IMAX_MS) {
+            expected_ms *= 2;
+        }
+    }
+    CHECK_EQ(trickle.interval_ms, IMAX_MS);
+}
+
+// k consistent transmissions heard before the transmission point silence
+// it, every other interval; one fewer does not
+static void test_suppression(void)
+{
+    trickle_t trickle;
+    uint32_t now_ms = 0;
+    trickle_init(&trickle, IMIN_MS, DOUBLINGS, K, now_ms);
+
+    for (int i = 0; i < 6; i++) {
+        CHECK_EQ(run_interval(&trickle, &now_ms, K - 1), 1);
+    }
+    for (int i = 0; i < 6; i++) {
+        CHECK_EQ(run_interval(&trickle, &now_ms, K), i % 2);
+    }
+
+    // Heard after the transmission point, they count for nothing: the
+    // counter starts afresh with every interval
+    for (int i = 0; i < 4; i++) {
+        now_ms += trickle_wait_ms(&trickle, now_ms);
+        CHECK(trickle_poll(&trickle, now_ms));
+        for (int j = 0; j < K; j++) {
+            trickle_consistent(&trickle);
+        }
+        now_ms += trickle_wait_ms(&trickle, now_ms);
+        CHECK(!trickle_poll(&trickle, now_ms));
+        CHECK_EQ(trickle.counter, 0);
+    }
+
+    // Suppression does not stop the doubling
+    CHECK_EQ(trickle.interval_ms, IMAX_MS);
+}
+
+// An inconsistency at Imax restarts at Imin from that moment; at Imin it
+// leaves the running interval alone
+static void test_reset(void)
+{
+    trickle_t trickle;
+    uint32_t now_ms = 0;
+    trickle_init(&trickle, IMIN_MS, DOUBLINGS, K, now_ms);
+    while (trickle.interval_ms < IMAX_MS) {
+        run_interval(&trickle, &now_ms, 0);
+    }
+
+    // Part way into an Imax interval, before its transmission point
+    now_ms += IMAX_MS / 4;
+    CHECK(!trickle_poll(&trickle, now_ms));
+    trickle_consistent(&trickle);
+    trickle_inconsistent(&trickle, now_ms);
+    CHECK_EQ(trickle.interval_ms, IMIN_MS);
+    CHECK_EQ(trickle.start_ms, now_ms);
+    CHECK_EQ(trickle.counter, 0);
+    CHECK(trickle_wait_ms(&trickle, now_ms) >= IMIN_MS / 2);
+    CHECK(trickle_wait_ms(&trickle, now_ms) < IMIN_MS);
+
+    // Again at Imin: nothing moves
+    trickle_t before = trickle;
+    trickle_inconsistent(&trickle, now_ms + 10);
+    CHECK(memcmp(&before, &trickle, sizeof(trickle)) == 0);
+
+    // And it climbs back from there
+    CHECK_EQ(run_interval(&trickle, &now_ms, 0), 1);
+    CHECK_EQ(trickle.interval_ms, 2 * IMIN_MS);
+}
+
+// N nodes that all hear each other, started at random times: once every
+// interval has reached Imax, count transmissions per Imax
+static double run_network(int nodes, uint8_t k)
+{
+    trickle_t trickles[MAX_NODES];
+    uint32_t now_ms = 0;
+    uint32_t sent = 0;
+    for (int n = 0; n < nodes; n++) {
+        trickle_init(&trickles[n], IMIN_MS, DOUBLINGS, k, esp_random() % IMIN_MS);
+    }
+
+    const uint32_t settle_ms = 4 * IMAX_MS;
+    const uint32_t end_ms = settle_ms + 200 * IMAX_MS;
+    while (now_ms < end_ms) {
+        uint32_t wait_ms = UINT32_MAX;
+        for (int n = 0; n < nodes; n++) {
+            // A node that has not started yet waits for its start
+            uint32_t node_wait = (int32_t)(trickles[n].start_ms - now_ms) > 0
+                               ? trickles[n].start_ms - now_ms + trickle_wait_ms(&trickles[n], trickles[n].start_ms)
+                               : trickle_wait_ms(&trickles[n], now_ms);
+            if (node_wait < wait_ms) {
+                wait_ms = node_wait;
+            }
+        }
+        now_ms += wait_ms;
+
+        for (int n = 0; n < nodes; n++) {
+            if ((int32_t)(now_ms - trickles[n].start_ms) < 0 || !trickle_poll(&trickles[n], now_ms)) {
+                continue;
+            }
+            sent += now_ms >= settle_ms;
+            for (int other = 0; other < nodes; other++) {
+                if (other != n) {
+                    trickle_consistent(&trickles[other]);
+                }
+            }
+        }
+    }
+    return (double)sent / ((end_ms - settle_ms) / IMAX_MS);
+}
+
+static void test_network(void)
+{
+    static const int sizes[] = {1, 2, 5, 10, 20, 32};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int nodes = sizes[i];
+        double trickle_rate = run_network(nodes, K);
+        double k1_rate = run_network(nodes, 1);
+        printf("%2d nodes: %5.2f transmissions per Imax with k=%d, %5.2f with k=1, %2d without suppression\n",
+               nodes, trickle_rate, K, k1_rate, nodes);
+
+        // Every node is heard at least every other interval, so never below
+        // N/2; above about k plus that floor would mean suppression failed
+        CHECK(trickle_rate >= nodes / 2.0 - 0.01);
+        CHECK(trickle_rate <= nodes / 2.0 + K + 0.5);
+        CHECK(trickle_rate <= nodes * 1.01);
+        CHECK(k1_rate <= trickle_rate);
+    }
+}
+
+int main(void)
+{
+    host_seed_random(0x791C);
+    test_doubling();
+    test_suppression();
+    test_reset();
+    test_network();
+    return 0;
+}
@@ -0,0 +1,306 @@
+// TX scheduler under overload: one frame at a time leaves on a channel
+// offered more than it can carry, and each class's queueing delay and drops
+// are compared with the single FIFO every frame used to share. Aging must
+// keep the lowest classes moving however busy the higher ones are.
+#include "host_test.h"
+#include "host_shim.h"
+#include "tx_sched.h"
+#include <string.h>
+
+#define RUN_MS          (3600 * 1000)
+#define FRAME_MS        100             // On air per frame: 10 frames a second at most
+#define FIFO_DEPTH      10              // The queue all frames once shared
+
+static const char *const class_names[TX_CLASS_COUNT] = {
+    "control", "emergency", "local", "relay", "beacon",
+};
+
+// Offered frames per 1000 s, per class
+typedef struct {
+    const char *name;
+    uint32_t offered_per_ks[TX_CLASS_COUNT];
+} load_t;
+
+// 123% of what the channel carries, most of the excess relayed traffic
+static const load_t load_mixed = {
+    "mixed", {
+        [TX_CLASS_CONTROL] = 3000, [TX_CLASS_EMERGENCY] = 200, [TX_CLASS_LOCAL] = 3000,
+        [TX_CLASS_RELAY] = 6000, [TX_CLASS_BEACON] = 100,
+    },
+};
+
+// Control and local traffic alone fill the channel: strict priority would
+// never send a relayed frame or a beacon again
+static const load_t load_saturating = {
+    "saturating", {
+        [TX_CLASS_CONTROL] = 5000, [TX_CLASS_EMERGENCY] = 200, [TX_CLASS_LOCAL] = 5000,
+        [TX_CLASS_RELAY] = 1000, [TX_CLASS_BEACON] = 100,
+    },
+};
+
+typedef struct {
+    uint32_t offered[TX_CLASS_COUNT];
+    uint32_t sent[TX_CLASS_COUNT];
+    uint32_t dropped[TX_CLASS_COUNT];
+    uint64_t delay_ms_total[TX_CLASS_COUNT];
+    uint32_t delay_ms_max[TX_CLASS_COUNT];
+} overload_result_t;
+
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Which classes have a frame arriving this millisecond; the same for both queues
+static uint32_t arrivals(const load_t *load)
+{
+    uint32_t arriving = 0;
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        if (rng() % 1000000 < load->offered_per_ks[c]) {
+            arriving |= 1u << c;
+        }
+    }
+    return arriving;
+}
+
+static void print_result(const load_t *load, const char *name, const overload_result_t *result)
+{
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        printf("%-10s %-8s %-9s %5lu offered, %5.1f%% sent, %5.1f%% dropped, delay mean %7.0f ms max %6lu ms\n",
+               load->name, name, class_names[c], (unsigned long)result->offered[c],
+               result->sent[c] * 100.0 / result->offered[c], result->dropped[c] * 100.0 / result->offered[c],
+               result->sent[c] ? (double)result->delay_ms_total[c] / result->sent[c] : 0.0,
+               (unsigned long)result->delay_ms_max[c]);
+    }
+}
+
+static void run_sched(const load_t *load, overload_result_t *result)
+{
+    CHECK_EQ(msg_pool_init(), ESP_OK);
+    CHECK_EQ(tx_sched_init(), ESP_OK);
+    rng_state = 0x0BE1;
+    uint32_t busy_until_ms = 0;
+
+    for (uint32_t now_ms = 0; now_ms < RUN_MS; now_ms++) {
+        uint32_t arriving = arrivals(load);
+        for (int c = 0; c < TX_CLASS_COUNT; c++) {
+            if (arriving & (1u << c)) {
+                msg_handle_t handle = msg_pool_alloc();
+                CHECK(handle != MSG_HANDLE_NONE);
+                result->offered[c]++;
+                tx_sched_enqueue(handle, c, now_ms);
+            }
+        }
+
+        // What mesh_task does each time the radio is free
+        tx_sched_ticket_t ticket;
+        msg_handle_t handle;
+        if (now_ms >= busy_until_ms && (handle = tx_sched_peek(&ticket, now_ms)) != MSG_HANDLE_NONE) {
+            tx_sched_complete(&ticket, now_ms);
+            msg_pool_release(handle);
+            busy_until_ms = now_ms + FRAME_MS;
+        }
+    }
+
+    tx_sched_stats_t stats;
+    tx_sched_get_stats(&stats);
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        // A replaced beacon was queued first; any other drop never was
+        CHECK_EQ(stats.enqueued[c] + (c == TX_CLASS_BEACON ? 0 : stats.dropped[c]), result->offered[c]);
+        result->sent[c] = stats.sent[c];
+        result->dropped[c] = stats.dropped[c];
+        result->delay_ms_total[c] = stats.delay_ms_total[c];
+        result->delay_ms_max[c] = stats.delay_ms_max[c];
+    }
+}
+
+// The old shared queue: first come first served, anything arriving at a
+// full queue dropped
+static void run_fifo(const load_t *load, overload_result_t *result)
+{
+    struct {
+        tx_class_t tx_class;
+        uint32_t enqueued_ms;
+    } fifo[FIFO_DEPTH];
+    uint32_t head = 0;
+    uint32_t count = 0;
+    rng_state = 0x0BE1;
+    uint32_t busy_until_ms = 0;
+
+    for (uint32_t now_ms = 0; now_ms < RUN_MS; now_ms++) {
+        uint32_t arriving = arrivals(load);
+        for (int c = 0; c < TX_CLASS_COUNT; c++) {
+            if (arriving & (1u << c)) {
+                result->offered[c]++;
+                if (count == FIFO_DEPTH) {
+                    result->dropped[c]++;
+                } else {
+                    fifo[(head + count++) % FIFO_DEPTH].tx_class = c;
+                    fifo[(head + count - 1) % FIFO_DEPTH].enqueued_ms = now_ms;
+                }
+            }
+        }
+
+        if (now_ms >= busy_until_ms && count > 0) {
+            tx_class_t c = fifo[head].tx_class;
+            uint32_t delay = now_ms - fifo[head].enqueued_ms;
+            result->sent[c]++;
+            result->delay_ms_total[c] += delay;
+            if (delay > result->delay_ms_max[c]) {
+                result->delay_ms_max[c] = delay;
+            }
+            head = (head + 1) % FIFO_DEPTH;
+            count--;
+            busy_until_ms = now_ms + FRAME_MS;
+        }
+    }
+}
+
+static bool match_any(const mesh_message_t *message, void *ctx)
+{
+    return true;
+}
+
+// A frame held back keeps its own channel access progress, and only its own
+static void test_defer_keeps_lbt(void)
+{
+    CHECK_EQ(msg_pool_init(), ESP_OK);
+    CHECK_EQ(tx_sched_init(), ESP_OK);
+    for (int i = 0; i < 3; i++) {
+        CHECK_EQ(tx_sched_enqueue(msg_pool_alloc(), TX_CLASS_LOCAL, 0), ESP_OK);
+    }
+
+    tx_sched_ticket_t first;
+    msg_handle_t handle = tx_sched_peek(&first, 0);
+    CHECK_EQ(first.lbt.attempts, 0);
+    first.lbt = (lora_lbt_t) { .attempts = 2, .window = 5 };
+    tx_sched_defer(&first, 100);
+    msg_pool_release(handle);
+
+    // Still held back, then handed out again where it left off
+    tx_sched_ticket_t ticket;
+    CHECK_EQ(tx_sched_peek(&ticket, 50), MSG_HANDLE_NONE);
+    CHECK_EQ(tx_sched_wait_ms(50), 50);
+    handle = tx_sched_peek(&ticket, 100);
+    CHECK_EQ(ticket.seq, first.seq);
+    CHECK_EQ(ticket.lbt.attempts, 2);
+    CHECK_EQ(ticket.lbt.window, 5);
+    msg_pool_release(handle);
+
+    // Collected into another frame's aggregate, it still carries its own
+    // state, and the frames queued behind it none
+    msg_handle_t handles[3];
+    tx_sched_ticket_t tickets[3];
+    tx_sched_ticket_t other = { .tx_class = TX_CLASS_LOCAL, .seq = UINT32_MAX };
+    CHECK_EQ(tx_sched_collect(&other, match_any, NULL, handles, tickets, 3), 3);
+    CHECK_EQ(tickets[0].seq, first.seq);
+    CHECK_EQ(tickets[0].lbt.attempts, 2);
+    for (int i = 0; i < 3; i++) {
+        CHECK(i == 0 || (tickets[i].lbt.attempts == 0 && tickets[i].lbt.window == 0));
+        msg_pool_release(handles[i]);
+    }
+
+    // Deferring the second frame's ticket must not touch the head's state
+    tx_sched_ticket_t second = tickets[1];
+    second.lbt = (lora_lbt_t) { .attempts = 1, .window = 9 };
+    tx_sched_defer(&second, 100);
+    handle = tx_sched_peek(&ticket, 100);
+    CHECK_EQ(ticket.seq, first.seq);
+    CHECK_EQ(ticket.lbt.window, 5);
+    msg_pool_release(handle);
+
+    // Sent: the next head is the one deferred with it
+    tx_sched_complete(&ticket, 100);
+    handle = tx_sched_peek(&ticket, 100);
+    CHECK_EQ(ticket.seq, second.seq);
+    CHECK_EQ(ticket.lbt.window, 9);
+    msg_pool_release(handle);
+
+    // A new frame starts afresh in whichever slot it lands
+    tx_sched_ticket_t third = tickets[2];
+    third.lbt = (lora_lbt_t) { .attempts = 3, .window = 4 };
+    tx_sched_defer(&third, 100);
+    tx_sched_complete(&ticket, 100);
+    CHECK_EQ(tx_sched_enqueue(msg_pool_alloc(), TX_CLASS_LOCAL, 100), ESP_OK);
+    CHECK_EQ(tx_sched_collect(&other, match_any, NULL, handles, tickets, 3), 2);
+    CHECK_EQ(tickets[0].lbt.attempts, 3);
+    CHECK_EQ(tickets[1].lbt.attempts, 0);
+    CHECK_EQ(tickets[1].lbt.window, 0);
+    for (int i = 0; i < 2; i++) {
+        tx_sched_complete(&tickets[i], 100);
+        msg_pool_release(handles[i]);
+    }
+}
+
+// A class climbs one level per TX_AGING_MS its head has waited; level with a
+// higher class, it still goes after it
+static void test_aging_order(void)
+{
+    CHECK_EQ(msg_pool_init(), ESP_OK);
+    CHECK_EQ(tx_sched_init(), ESP_OK);
+    CHECK_EQ(tx_sched_enqueue(msg_pool_alloc(), TX_CLASS_LOCAL, 0), ESP_OK);
+
+    // A fresh control frame against the waiting local one each time
+    static const struct {
+        uint32_t now_ms;
+        tx_class_t expected;
+    } steps[] = {
+        {2 * TX_AGING_MS - 1, TX_CLASS_CONTROL},
+        {2 * TX_AGING_MS, TX_CLASS_CONTROL},
+        {3 * TX_AGING_MS, TX_CLASS_LOCAL},
+    };
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        tx_sched_ticket_t ticket;
+        CHECK_EQ(tx_sched_enqueue(msg_pool_alloc(), TX_CLASS_CONTROL, steps[i].now_ms), ESP_OK);
+        msg_handle_t handle = tx_sched_peek(&ticket, steps[i].now_ms);
+        CHECK_EQ(ticket.tx_class, steps[i].expected);
+        tx_sched_complete(&ticket, steps[i].now_ms);
+        msg_pool_release(handle);
+    }
+}
+
+static void run(const load_t *load, overload_result_t *sched, overload_result_t *fifo)
+{
+    memset(sched, 0, sizeof(*sched));
+    memset(fifo, 0, sizeof(*fifo));
+    run_sched(load, sched);
+    run_fifo(load, fifo);
+    print_result(load, "tx_sched", sched);
+    print_result(load, "fifo", fifo);
+
+    // Control and emergency frames go ahead of the backlog, and are never dropped
+    for (int c = TX_CLASS_CONTROL; c <= TX_CLASS_EMERGENCY; c++) {
+        CHECK_EQ(sched->dropped[c], 0);
+        CHECK(sched->delay_ms_total[c] * 3 * fifo->sent[c] < fifo->delay_ms_total[c] * sched->sent[c]);
+    }
+
+    // Aging keeps every class moving: nothing waits much beyond the time it
+    // takes its class to climb to the top
+    for (int c = 0; c < TX_CLASS_COUNT; c++) {
+        CHECK(sched->sent[c] > 0);
+        CHECK(sched->delay_ms_max[c] <= (uint32_t)(c + 1) * TX_AGING_MS);
+    }
+}
+
+int main(void)
+{
+    test_defer_keeps_lbt();
+    test_aging_order();
+
+    static overload_result_t sched;
+    static overload_result_t fifo;
+
+    // The overload falls on relayed traffic, not on what this node originates
+    run(&load_mixed, &sched, &fifo);
+    CHECK(sched.dropped[TX_CLASS_RELAY] > 10 * sched.dropped[TX_CLASS_LOCAL]);
+
+    // Relayed frames and beacons still leave, only late
+    run(&load_saturating, &sched, &fifo);
+    CHECK(sched.sent[TX_CLASS_RELAY] * 2 > sched.dropped[TX_CLASS_RELAY]);
+    return 0;
+}
@@ -275,6 +275,10 @@ function handleIncomingMessage(data) {
             updateMessageStatus(data.message_id, 'delivered');
             break;
             
+        case 'delivery_failed':
+            updateMessageStatus(data.message_id, 'failed');
+            break;
+            
         default:
             console.log('Unknown message type:', data.type);
     }